@@ -6,7 +6,9 @@
  * @brief   Implementation of the ble_adv library
  * @file
  */
+#define _GNU_SOURCE /* recvmmsg() */
 #include "ble_adv.h"
+#include "ble_adv_internal.h"
 
 #include <endian.h>
 #include <bluetooth/bluetooth.h>
@@ -14,27 +16,8 @@
 #include <bluetooth/hci_lib.h>
 #include <errno.h>
 #include <string.h>
-#include <unistd.h>
-
-/**
- * @name    EIR entry types
- * @{
- */
-#define EIR_FLAGS                                   0x01  /**< flags */
-#define EIR_UUID16_SOME                             0x02  /**< 16-bit UUID, more available */
-#define EIR_UUID16_ALL                              0x03  /**< 16-bit UUID, all listed */
-#define EIR_UUID32_SOME                             0x04  /**< 32-bit UUID, more available */
-#define EIR_UUID32_ALL                              0x05  /**< 32-bit UUID, all listed */
-#define EIR_UUID128_SOME                            0x06  /**< 128-bit UUID, more available */
-#define EIR_UUID128_ALL                             0x07  /**< 128-bit UUID, all listed */
-#define EIR_NAME_SHORT                              0x08  /**< shortened local name */
-#define EIR_NAME_COMPLETE                           0x09  /**< complete local name */
-#define EIR_TX_POWER                                0x0A  /**< transmit power level */
-#define EIR_DEVICE_ID                               0x10  /**< device ID */
-#define EIR_SERVICE_DATA                            0x16  /**< service data*/
-#define EIR_URI                                     0x24  /**< URI */
-#define EIR_MANUFACTURER_SPECIFIC_DATA              0xFF  /**< manufacturer specific data */
-/** @} */
+#include <sys/socket.h>
+#include <time.h>
 
 /**
  * @name    BLE event types
@@ -47,16 +30,33 @@
 /** @} */
 
 /**
- * @brief   Parse the EIR data of the BLE advertisements
- * @param[out]      dest        Write decoded fields here
- * @param[in]       eir         Data to decode
- * @param[in]       eir_len     Length of @p eir
- * @retval  0                   Success
- * @retval -EPROTO              Invalid encoding detected
- * @retval -EOVERFLOW           EIR field larger than space in @p dest
+ * @brief   Get the number of bytes of a field of length @p len to copy into a buffer of
+ *          @p size bytes
+ * @param[in,out]   dest        Advertisement to mark as truncated if needed
+ * @param[in]       len         Length of the field
+ * @param[in]       size        Number of bytes available
+ * @param[in]       flags       Parse flags
+ * @return  Number of bytes to copy
+ * @retval -EOVERFLOW           @p len exceeds @p size and lenient parsing is disabled
  */
-static int parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len)
+static int fit(struct ble_adv *dest, size_t len, size_t size, unsigned flags)
+{
+    if (len <= size) {
+        return (int)len;
+    }
+
+    if (!(flags & BLE_ADV_PARSE_FLAG_LENIENT)) {
+        return -EOVERFLOW;
+    }
+
+    dest->has |= BLE_ADV_HAS_TRUNCATED;
+    return (int)size;
+}
+
+int ble_adv_parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len, unsigned flags)
 {
+    int len;
+
     dest->name_len = 0;
     dest->uri_len = 0;
     dest->tx_power = INT8_MAX;
@@ -74,6 +74,11 @@ static int parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len)
 
         if (field_len > eir_len) {
             /* format error */
+            if (flags & BLE_ADV_PARSE_FLAG_LENIENT) {
+                /* keep what was decoded so far, but drop the truncated field */
+                dest->has |= BLE_ADV_HAS_TRUNCATED;
+                return 0;
+            }
             return -EPROTO;
         }
 
@@ -94,12 +99,12 @@ static int parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len)
         case EIR_NAME_SHORT:
         case EIR_NAME_COMPLETE:
             if (field_len) {
-                if (sizeof(dest->name) < field_len + 1U) {
-                    return -EOVERFLOW;
+                if (0 > (len = fit(dest, field_len, sizeof(dest->name) - 1, flags))) {
+                    return len;
                 }
-                memcpy(dest->name, eir, field_len);
-                dest->name[field_len] = '\0';
-                dest->name_len = field_len;
+                memcpy(dest->name, eir, (size_t)len);
+                dest->name[len] = '\0';
+                dest->name_len = (uint8_t)len;
             }
             break;
         case EIR_TX_POWER:
@@ -109,38 +114,39 @@ static int parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len)
             break;
         case EIR_SERVICE_DATA:
             if (field_len >= 2) {
-                if (field_len - 2U > sizeof(dest->service_data)) {
-                    return -EOVERFLOW;
+                len = fit(dest, field_len - 2U, sizeof(dest->service_data), flags);
+                if (len < 0) {
+                    return len;
                 }
                 /* UUID16 may be unaligned */
                 memcpy(&dest->service_uuid16, eir, sizeof(uint16_t));
                 dest->service_uuid16 = le16toh(dest->service_uuid16);
-                memcpy(dest->service_data, eir + 2, field_len - 2U);
-                dest->service_data_len = field_len - 2U;
+                memcpy(dest->service_data, eir + 2, (size_t)len);
+                dest->service_data_len = (uint8_t)len;
                 dest->has |= BLE_ADV_HAS_SERVICE_DATA;
             }
             break;
         case EIR_MANUFACTURER_SPECIFIC_DATA:
             if (field_len >= 2) {
-                if (field_len - 2U > sizeof(dest->ms_data)) {
-                    return -EOVERFLOW;
+                if (0 > (len = fit(dest, field_len - 2U, sizeof(dest->ms_data), flags))) {
+                    return len;
                 }
                 /* UUID16 may be unaligned */
                 memcpy(&dest->ms_uuid16, eir, sizeof(uint16_t));
                 dest->ms_uuid16 = le16toh(dest->ms_uuid16);
-                memcpy(dest->ms_data, eir + 2, field_len - 2U);
-                dest->ms_data_len = field_len - 2U;
+                memcpy(dest->ms_data, eir + 2, (size_t)len);
+                dest->ms_data_len = (uint8_t)len;
                 dest->has |= BLE_ADV_HAS_MS_DATA;
             }
             break;
         case EIR_URI:
             if (field_len) {
-                if (field_len + 1U > sizeof(dest->uri)) {
-                    return -EOVERFLOW;
+                if (0 > (len = fit(dest, field_len, sizeof(dest->uri) - 1, flags))) {
+                    return len;
                 }
-                memcpy(dest->uri, eir, field_len);
-                dest->uri_len = field_len;
-                dest->uri[field_len] = '\0';
+                memcpy(dest->uri, eir, (size_t)len);
+                dest->uri_len = (uint8_t)len;
+                dest->uri[len] = '\0';
             }
             break;
         case EIR_UUID16_SOME:
@@ -176,61 +182,544 @@ static int parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len)
     return 0;
 }
 
-int ble_adv_read(int dev, struct ble_adv *dest)
+int ble_adv_split_event(struct ble_adv_view *dest, size_t max, const void *event, size_t len,
+                        unsigned *cut)
+{
+    const uint8_t *buf = event;
+    const evt_le_meta_event *meta;
+    *cut = 0;
+    if (len < sizeof(*meta) + 1 + HCI_EVENT_HDR_SIZE + 1) {
+        return -EPROTO;
+    }
+    meta = (const evt_le_meta_event *)(buf + 1 + HCI_EVENT_HDR_SIZE);
+
+    if (meta->subevent != EVT_LE_ADVERTISING_REPORT) {
+        return -ENOENT;
+    }
+
+    unsigned num_reports = meta->data[0];
+    const uint8_t *pos = meta->data + 1;
+    const uint8_t *end = buf + len;
+    if (num_reports > max) {
+        num_reports = (unsigned)max;
+    }
+
+    for (unsigned i = 0; i < num_reports; i++) {
+        const le_advertising_info *info = (const le_advertising_info *)pos;
+        /* each report is followed by a one byte RSSI, which is not part of the struct */
+        if (((size_t)(end - pos) < sizeof(*info) + 1)
+            || ((size_t)(end - pos) < sizeof(*info) + info->length + 1U))
+        {
+            /* keep the complete reports in front of the cut */
+            *cut = num_reports - i;
+            return (int)i;
+        }
+
+        dest[i].bdaddr = info->bdaddr.b;
+        dest[i].eir = info->data;
+        dest[i].eir_len = info->length;
+        dest[i].evt_type = info->evt_type;
+        dest[i].addr_type = info->bdaddr_type;
+        dest[i].rssi = (int8_t)info->data[info->length];
+        pos += sizeof(*info) + info->length + 1U;
+    }
+
+    return (int)num_reports;
+}
+
+/**
+ * @brief   Decode the advertisement pointed to by @p view
+ * @param[out]      dest        Write the decoded advertisement here
+ * @param[in]       view        View of the advertisement to decode
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT
+ * @retval  0                   Success
+ * @retval -EPROTO              Invalid encoding detected
+ * @retval -EOVERFLOW           EIR field larger than space in @p dest
+ */
+static int parse_view(struct ble_adv *dest, const struct ble_adv_view *view, unsigned flags)
+{
+    ble_adv_view_addr(view, dest->addr);
+    dest->addr_type = view->addr_type;
+    dest->adapter = 0;
+    dest->timestamp_us = 0;
+    int err = ble_adv_parse_eir(dest, view->eir, view->eir_len, flags);
+    if (err) {
+        return err;
+    }
+
+    if (dest->name_len == 0) {
+        const char fallback[] = "<unknown>";
+        memcpy(dest->name, fallback, sizeof(fallback));
+    }
+
+    if (dest->uri_len == 0) {
+        const char fallback[] = "";
+        memcpy(dest->uri, fallback, sizeof(fallback));
+    }
+
+    dest->rssi = (uint8_t)view->rssi;
+    return 0;
+}
+
+/**
+ * @brief   Advertising reports of an HCI event dropped by @ref parse_event
+ */
+struct bad_reports {
+    unsigned proto;             /**< Reports with invalid encoding or cut off (`EPROTO`) */
+    unsigned overflow;          /**< Reports with an EIR field exceeding its buffer
+                                     (`EOVERFLOW`) */
+};
+
+/**
+ * @brief   Decode the advertising reports contained in an HCI event
+ * @param[out]      dest        Write decoded advertisements here
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       buf         HCI event as read from the HCI socket (including packet type)
+ * @param[in]       len         Length of @p buf in bytes
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT
+ * @param[out]      bad         Reports that failed to decode and were dropped
+ * @return  Number of advertisements written to @p dest
+ * @retval -ENOENT              @p buf is not an LE Advertising Report event
+ * @retval -EPROTO              The event header is invalid
+ *
+ * A malformed report only drops itself: the reports decoded fine are written to @p dest
+ * back to back, and the others are counted in @p bad.
+ *
+ * @note    If the event contains more than @p max reports, the surplus reports are ignored
+ */
+static int parse_event(struct ble_adv *dest, size_t max, const uint8_t *buf, size_t len,
+                       unsigned flags, struct bad_reports *bad)
 {
-    uint8_t buf[HCI_MAX_EVENT_SIZE];
-    ssize_t len;
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+    if (max > BLE_ADV_REPORTS_MAX) {
+        max = BLE_ADV_REPORTS_MAX;
+    }
+
+    bad->overflow = 0;
+    int num_reports = ble_adv_split_event(views, max, buf, len, &bad->proto);
+    int used = 0;
+    for (int i = 0; i < num_reports; i++) {
+        int err = parse_view(&dest[used], &views[i], flags);
+        if (err == -EOVERFLOW) {
+            bad->overflow++;
+        }
+        else if (err) {
+            bad->proto++;
+        }
+        else {
+            used++;
+        }
+    }
+
+    return (num_reports < 0) ? num_reports : used;
+}
 
-    if ((dev == -1) || !dest) {
+int ble_adv_event_views(struct ble_adv_view *dest, size_t max, const void *buf, size_t len)
+{
+    if (!dest || !buf) {
         errno = EINVAL;
         return -1;
     }
 
-    while (0 > (len = read(dev, buf, sizeof(buf)))) {
+    unsigned cut;
+    int retval = ble_adv_split_event(dest, max, buf, len, &cut);
+    if (retval < 0) {
+        errno = -retval;
+        return -1;
+    }
+
+    if (!retval && cut) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return retval;
+}
+
+int ble_adv_parse_event(struct ble_adv *dest, size_t max, const void *buf, size_t len,
+                        unsigned flags)
+{
+    if (!dest || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct bad_reports bad;
+    int retval = parse_event(dest, max, buf, len, flags, &bad);
+    if (retval < 0) {
+        errno = -retval;
+        return -1;
+    }
+
+    if (!retval && (bad.proto || bad.overflow)) {
+        errno = bad.proto ? EPROTO : EOVERFLOW;
+        return -1;
+    }
+
+    return retval;
+}
+
+void ble_adv_view_addr(const struct ble_adv_view *view, uint8_t addr[6])
+{
+    for (unsigned i = 0; i < 6; i++) {
+        addr[i] = view->bdaddr[5 - i];
+    }
+}
+
+int ble_adv_view_find(const struct ble_adv_view *view, uint8_t type,
+                      const uint8_t **data, size_t *len)
+{
+    const uint8_t *eir = view->eir;
+    size_t eir_len = view->eir_len;
+
+    while (eir_len >= 2) {
+        uint8_t field_len = eir[0];
+        if ((field_len == 0) || (field_len > eir_len - 1)) {
+            /* reached end of EIR or format error */
+            return 0;
+        }
+
+        if (eir[1] == type) {
+            *data = eir + 2;
+            *len = field_len - 1U;
+            return 1;
+        }
+
+        eir += field_len + 1U;
+        eir_len -= field_len + 1U;
+    }
+
+    return 0;
+}
+
+int ble_adv_view_service_data(const struct ble_adv_view *view, uint16_t uuid16,
+                              const uint8_t **data, size_t *len)
+{
+    const uint8_t *eir = view->eir;
+    size_t eir_len = view->eir_len;
+
+    while (eir_len >= 2) {
+        uint8_t field_len = eir[0];
+        if ((field_len == 0) || (field_len > eir_len - 1)) {
+            return 0;
+        }
+
+        if ((eir[1] == EIR_SERVICE_DATA) && (field_len >= 3)
+            && (eir[2] == (uuid16 & 0xff)) && (eir[3] == (uuid16 >> 8)))
+        {
+            *data = eir + 4;
+            *len = field_len - 3U;
+            return 1;
+        }
+
+        eir += field_len + 1U;
+        eir_len -= field_len + 1U;
+    }
+
+    return 0;
+}
+
+int ble_adv_view_parse(struct ble_adv *dest, const struct ble_adv_view *view, unsigned flags)
+{
+    if (!dest || !view) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int err = parse_view(dest, view, flags);
+    if (err) {
+        errno = -err;
+        return -1;
+    }
+
+    return 0;
+}
+
+ssize_t ble_adv_read_event(int dev, void *buf, size_t size, uint64_t *timestamp_us)
+{
+    struct ble_adv_events evs;
+
+    if ((dev == -1) || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* same receive path as the decoding reads, so that the timestamps match */
+    if (ble_adv_recv_events(dev, &evs, 1, 0) < 0) {
+        return -1;
+    }
+
+    size_t len = (evs.len[0] < size) ? evs.len[0] : size;
+    memcpy(buf, evs.buf[0], len);
+    if (timestamp_us) {
+        *timestamp_us = evs.timestamp_us[0];
+    }
+
+    return (ssize_t)len;
+}
+
+int ble_adv_recv_events(int dev, struct ble_adv_events *evs, unsigned vlen, uint8_t adapter)
+{
+    uint8_t cbufs[BLE_ADV_READ_MANY_EVENTS][BLE_ADV_CMSG_SIZE];
+    struct iovec iovs[BLE_ADV_READ_MANY_EVENTS];
+    struct mmsghdr msgs[BLE_ADV_READ_MANY_EVENTS];
+    int received;
+
+    if (vlen > BLE_ADV_READ_MANY_EVENTS) {
+        vlen = BLE_ADV_READ_MANY_EVENTS;
+    }
+
+    memset(msgs, 0, sizeof(msgs[0]) * vlen);
+    for (unsigned i = 0; i < vlen; i++) {
+        iovs[i].iov_base = evs->buf[i];
+        iovs[i].iov_len = sizeof(evs->buf[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = cbufs[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(cbufs[i]);
+    }
+
+    while (0 > (received = recvmmsg(dev, msgs, vlen, MSG_WAITFORONE, NULL))) {
         if (errno == EINTR) {
             continue;
         }
         return -1;
     }
 
-    evt_le_meta_event *meta;
-    if ((size_t)len < sizeof(*meta) + 1 + HCI_EVENT_HDR_SIZE) {
-        errno = EPROTO;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now_us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+
+    for (int i = 0; i < received; i++) {
+        evs->len[i] = msgs[i].msg_len;
+        evs->timestamp_us[i] = ble_adv_msg_timestamp(&msgs[i].msg_hdr);
+        if (evs->timestamp_us[i] && (now_us >= evs->timestamp_us[i])) {
+            ble_adv_stats_record(adapter, BLE_ADV_STATS_HIST_LATENCY,
+                                 now_us - evs->timestamp_us[i]);
+        }
+    }
+
+    return received;
+}
+
+/**
+ * @brief   Receive up to @p vlen HCI events and decode the contained advertisements
+ * @param[in]       dev         Descriptor of the HCI interfaces
+ * @param[out]      dest        Array to write the received BLE advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       vlen        Maximum number of HCI events to consume
+ * @param[out]      info        Statistics about the consumed events
+ * @param[out]      last_err    Negative errno of the last event failing to decode, or 0
+ * @param[in]       adapter     Tag the advertisements with this adapter and account the
+ *                              library statistics to it
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT
+ * @return  Number of advertisements written to @p dest
+ * @retval  -1                  Failed to receive any event, errno set to indicate the cause
+ *
+ * Blocks (unless @p dev is in non-blocking mode) until at least one event is available, but
+ * will not wait for further events.
+ */
+static int read_events(int dev, struct ble_adv *dest, size_t max, unsigned vlen,
+                       struct ble_adv_read_info *info, int *last_err, uint8_t adapter,
+                       unsigned flags)
+{
+    struct ble_adv_events evs;
+    int received = ble_adv_recv_events(dev, &evs, vlen, adapter);
+    if (received < 0) {
         return -1;
     }
-    meta = (evt_le_meta_event *)(buf + 1 + HCI_EVENT_HDR_SIZE);
 
-    if (meta->subevent != EVT_LE_ADVERTISING_REPORT) {
+    memset(info, 0, sizeof(*info));
+    *last_err = 0;
+    size_t used = 0;
+    size_t proto = 0;
+    size_t overflows = 0;
+    for (int i = 0; i < received; i++) {
+        struct bad_reports bad;
+        int retval = parse_event(dest + used, max - used, evs.buf[i], evs.len[i], flags, &bad);
+        info->events++;
+        if (retval < 0) {
+            *last_err = retval;
+            if (retval == -ENOENT) {
+                info->skipped++;
+            }
+            else {
+                info->invalid++;
+                proto++;
+            }
+            continue;
+        }
+
+        if (bad.proto || bad.overflow) {
+            *last_err = bad.proto ? -EPROTO : -EOVERFLOW;
+            info->malformed += bad.proto + bad.overflow;
+            proto += bad.proto;
+            overflows += bad.overflow;
+        }
+
+        for (int j = 0; j < retval; j++) {
+            dest[used + (size_t)j].timestamp_us = evs.timestamp_us[i];
+            dest[used + (size_t)j].adapter = adapter;
+            info->truncated += !!(dest[used + (size_t)j].has & BLE_ADV_HAS_TRUNCATED);
+        }
+
+        used += (size_t)retval;
+        /* parse_event() truncates to the space left, the num_reports byte tells what was lost */
+        info->dropped += (size_t)evs.buf[i][1 + HCI_EVENT_HDR_SIZE + 1] - (size_t)retval
+                         - bad.proto - bad.overflow;
+    }
+
+    struct ble_adv_read_tally tally = {
+        .events = info->events,
+        .reports = used,
+        .skipped = info->skipped,
+        .proto = proto,
+        .overflow = overflows,
+        .space = info->dropped,
+        .truncated = info->truncated,
+    };
+    ble_adv_stats_account(adapter, &tally);
+
+    return (int)used;
+}
+
+int ble_adv_read_many_adapter(int dev, struct ble_adv *dest, size_t max,
+                              struct ble_adv_read_info *info, uint8_t adapter, unsigned flags)
+{
+    struct ble_adv_read_info dummy;
+    int last_err;
+
+    if ((dev == -1) || !dest || !max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!info) {
+        info = &dummy;
+    }
+
+    return read_events(dev, dest, max, ble_adv_events_fitting(max), info, &last_err, adapter,
+                       flags);
+}
+
+int ble_adv_read_many(int dev, struct ble_adv *dest, size_t max, struct ble_adv_read_info *info,
+                      unsigned flags)
+{
+    return ble_adv_read_many_adapter(dev, dest, max, info, 0, flags);
+}
+
+int ble_adv_read_batch(int dev, struct ble_adv *dest, size_t max)
+{
+    struct ble_adv_read_info info;
+    int last_err;
+
+    if ((dev == -1) || !dest || !max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* strict, as the API predates the parse flags */
+    int retval = read_events(dev, dest, max, 1, &info, &last_err, 0, 0);
+    if (retval < 0) {
+        return -1;
+    }
+
+    if (!retval && last_err) {
+        errno = -last_err;
+        return -1;
+    }
+
+    return retval;
+}
+
+int ble_adv_read(int dev, struct ble_adv *dest)
+{
+    int retval = ble_adv_read_batch(dev, dest, 1);
+    if (retval < 0) {
+        return -1;
+    }
+
+    if (retval == 0) {
+        /* LE Advertising Report event without any report */
         errno = ENOENT;
         return -1;
     }
 
-    le_advertising_info *info;
-    info = (le_advertising_info *)(meta->data + 1);
+    return 0;
+}
 
-    dest->addr[0] = info->bdaddr.b[5];
-    dest->addr[1] = info->bdaddr.b[4];
-    dest->addr[2] = info->bdaddr.b[3];
-    dest->addr[3] = info->bdaddr.b[2];
-    dest->addr[4] = info->bdaddr.b[1];
-    dest->addr[5] = info->bdaddr.b[0];
-    int err = parse_eir(dest, info->data, info->length);
-    if (err) {
-        errno = -err;
+static void to_bdaddr(bdaddr_t *dest, const uint8_t addr[6])
+{
+    for (unsigned i = 0; i < 6; i++) {
+        dest->b[i] = addr[5 - i];
+    }
+}
+
+int ble_adv_accept_list_add(int dev, const uint8_t addr[6], uint8_t addr_type)
+{
+    bdaddr_t bdaddr;
+
+    if ((dev == -1) || !addr) {
+        errno = EINVAL;
         return -1;
     }
 
-    if (dest->name_len == 0) {
-        const char fallback[] = "<unknown>";
-        memcpy(dest->name, fallback, sizeof(fallback));
+    to_bdaddr(&bdaddr, addr);
+    return hci_le_add_white_list(dev, &bdaddr, addr_type, HCI_TIMEOUT_MS);
+}
+
+int ble_adv_accept_list_remove(int dev, const uint8_t addr[6], uint8_t addr_type)
+{
+    bdaddr_t bdaddr;
+
+    if ((dev == -1) || !addr) {
+        errno = EINVAL;
+        return -1;
     }
 
-    if (dest->uri_len == 0) {
-        const char fallback[] = "";
-        memcpy(dest->uri, fallback, sizeof(fallback));
+    to_bdaddr(&bdaddr, addr);
+    return hci_le_rm_white_list(dev, &bdaddr, addr_type, HCI_TIMEOUT_MS);
+}
+
+int ble_adv_accept_list_clear(int dev)
+{
+    if (dev == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return hci_le_clear_white_list(dev, HCI_TIMEOUT_MS);
+}
+
+int ble_adv_accept_list_load(int dev, const uint8_t (*addrs)[6], const uint8_t *addr_types,
+                             size_t len)
+{
+    uint8_t size;
+
+    if ((dev == -1) || (len && !addrs)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (hci_le_read_white_list_size(dev, &size, HCI_TIMEOUT_MS)) {
+        return -1;
+    }
+
+    if (len > size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (ble_adv_accept_list_clear(dev)) {
+        return -1;
     }
 
-    dest->rssi = buf[len - 1];
+    for (size_t i = 0; i < len; i++) {
+        uint8_t type = addr_types ? addr_types[i] : LE_PUBLIC_ADDRESS;
+        if (ble_adv_accept_list_add(dev, addrs[i], type)) {
+            return -1;
+        }
+    }
 
     return 0;
 }
@@ -242,37 +731,104 @@ static inline int use_public_address(unsigned flags)
     return (flags & (BLE_ADV_SCAN_FLAG_PASSIVE | BLE_ADV_SCAN_FLAG_PUBLIC_ADDR));
 }
 
-int ble_adv_scan(int dev, unsigned flags)
+int ble_adv_set_hci_filter(int dev)
 {
-    const uint8_t filter_policy = 0; /* don't use whitelist for filtering */
-    const uint16_t interval = htobs(0x0010);
-    const uint16_t window = htobs(0x0010);
-    uint8_t scan_type = (flags & BLE_ADV_SCAN_FLAG_PASSIVE) ? 0 : 1;
-    uint8_t own_type = use_public_address(flags) ? LE_PUBLIC_ADDRESS : LE_RANDOM_ADDRESS;
+    struct hci_filter hci_filter;
+    hci_filter_clear(&hci_filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &hci_filter);
+    hci_filter_set_event(EVT_LE_META_EVENT, &hci_filter);
 
-    if (dev == -1) {
-        errno = EINVAL;
+    if (setsockopt(dev, SOL_HCI, HCI_FILTER, &hci_filter, sizeof(hci_filter))) {
         return -1;
     }
 
-    if (!(flags & BLE_ADV_SCAN_FLAG_ENABLED)) {
-        if (hci_le_set_scan_enable(dev, 0, 0, 10000)) {
-            return -1;
+    /* raw HCI sockets only support their own timestamp option, not SO_TIMESTAMPNS */
+    int one = 1;
+    return setsockopt(dev, SOL_HCI, HCI_TIME_STAMP, &one, sizeof(one));
+}
+
+uint64_t ble_adv_msg_timestamp(const struct msghdr *msg)
+{
+    for (const struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr *)msg, (struct cmsghdr *)cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_HCI) && (cmsg->cmsg_type == HCI_CMSG_TSTAMP)
+            && (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timeval))))
+        {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
         }
-        return 0;
     }
 
-    if (hci_le_set_scan_parameters(dev, scan_type, interval, window,
-                                   own_type, filter_policy, 10000))
+    return 0;
+}
+
+int ble_adv_scan_params_init(struct ble_adv_scan_params *params, unsigned profile,
+                             unsigned flags)
+{
+    if (!params) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (profile) {
+    case BLE_ADV_SCAN_PROFILE_LOW_LATENCY:
+        /* 10 ms every 10 ms: 100 % duty cycle */
+        params->interval = 0x0010;
+        params->window = 0x0010;
+        break;
+    case BLE_ADV_SCAN_PROFILE_BALANCED:
+        /* 50 ms every 200 ms: 25 % duty cycle */
+        params->interval = 0x0140;
+        params->window = 0x0050;
+        break;
+    case BLE_ADV_SCAN_PROFILE_LOW_POWER:
+        /* 80 ms every 1280 ms: 6.25 % duty cycle */
+        params->interval = 0x0800;
+        params->window = 0x0080;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    params->scan_type = (flags & BLE_ADV_SCAN_FLAG_PASSIVE) ? 0 : 1;
+    params->own_addr_type = use_public_address(flags) ? LE_PUBLIC_ADDRESS : LE_RANDOM_ADDRESS;
+    /* only use the accept list (a.k.a. whitelist) for filtering if requested */
+    params->filter_policy = (flags & BLE_ADV_SCAN_FLAG_ACCEPT_LIST) ? 1 : 0;
+    params->filter_duplicates = (flags & BLE_ADV_SCAN_FLAG_NO_DUPLICATES) ? 1 : 0;
+    params->hci_timeout_ms = HCI_TIMEOUT_MS;
+    return 0;
+}
+
+int ble_adv_scan_ex(int dev, const struct ble_adv_scan_params *params)
+{
+    if ((dev == -1) || !params
+        || (params->interval < BLE_ADV_SCAN_INTERVAL_MIN)
+        || (params->interval > BLE_ADV_SCAN_INTERVAL_MAX)
+        || (params->window < BLE_ADV_SCAN_INTERVAL_MIN)
+        || (params->window > params->interval))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const uint16_t interval = htobs(params->interval);
+    const uint16_t window = htobs(params->window);
+    int to = (params->hci_timeout_ms > 0) ? params->hci_timeout_ms : HCI_TIMEOUT_MS;
+
+    if (hci_le_set_scan_parameters(dev, params->scan_type, interval, window,
+                                   params->own_addr_type, params->filter_policy, to))
     {
         if (errno == EIO) {
             /* maybe already scanning, trying to disable scanning first to be able to
              * apply the config */
-            if (hci_le_set_scan_enable(dev, 0, 0, 10000)) {
+            if (hci_le_set_scan_enable(dev, 0, 0, to)) {
                 return -1;
             }
-            if (hci_le_set_scan_parameters(dev, scan_type, interval, window,
-                                           own_type, filter_policy, 10000))
+            if (hci_le_set_scan_parameters(dev, params->scan_type, interval, window,
+                                           params->own_addr_type, params->filter_policy, to))
             {
                 return -1;
             }
@@ -282,20 +838,30 @@ int ble_adv_scan(int dev, unsigned flags)
         }
     }
 
-    uint8_t filter_duplicates = (flags & BLE_ADV_SCAN_FLAG_NO_DUPLICATES) ? 1 : 0;
-    if (hci_le_set_scan_enable(dev, 1, filter_duplicates, 10000)) {
+    if (hci_le_set_scan_enable(dev, 1, params->filter_duplicates, to)) {
         return -1;
     }
 
-    struct hci_filter hci_filter;
-    hci_filter_clear(&hci_filter);
-    hci_filter_set_ptype(HCI_EVENT_PKT, &hci_filter);
-    hci_filter_set_event(EVT_LE_META_EVENT, &hci_filter);
+    return ble_adv_set_hci_filter(dev);
+}
 
-    if (setsockopt(dev, SOL_HCI, HCI_FILTER, &hci_filter, sizeof(hci_filter))) {
+int ble_adv_scan(int dev, unsigned flags)
+{
+    struct ble_adv_scan_params params;
+
+    if (dev == -1) {
+        errno = EINVAL;
         return -1;
     }
 
-    return 0;
+    if (!(flags & BLE_ADV_SCAN_FLAG_ENABLED)) {
+        if (hci_le_set_scan_enable(dev, 0, 0, HCI_TIMEOUT_MS)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    ble_adv_scan_params_init(&params, BLE_ADV_SCAN_PROFILE_LOW_LATENCY, flags);
+    return ble_adv_scan_ex(dev, &params);
 }
 /** @} */
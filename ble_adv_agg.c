@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_agg
+ *
+ * @{
+ * @brief   Implementation of the per-sensor aggregation
+ * @file
+ */
+#include "ble_adv_agg.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct ble_adv_agg_window *window_at(const struct ble_adv_agg *agg, size_t slot,
+                                            size_t window)
+{
+    return &agg->windows[slot * agg->num_windows + window];
+}
+
+static void reset_window(struct ble_adv_agg_window *w, uint64_t start_ms)
+{
+    w->start_ms = start_ms;
+    for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+        w->channels[c].sum = 0;
+        w->channels[c].min = INT32_MAX;
+        w->channels[c].max = INT32_MIN;
+        w->channels[c].count = 0;
+    }
+}
+
+static int window_empty(const struct ble_adv_agg_window *w)
+{
+    for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+        if (w->channels[c].count) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief   Emit the window if it holds any values
+ * @return  Number of records emitted
+ */
+static size_t emit(struct ble_adv_agg *agg, size_t slot, size_t window, int partial)
+{
+    const struct ble_adv_agg_window *w = window_at(agg, slot, window);
+    if (window_empty(w)) {
+        return 0;
+    }
+
+    struct ble_adv_agg_record record;
+    record.start_ms = w->start_ms;
+    record.len_ms = agg->windows_ms[window];
+    memcpy(record.channels, w->channels, sizeof(record.channels));
+    memcpy(record.addr, agg->slots[slot].addr, sizeof(record.addr));
+    record.window = (uint8_t)window;
+    record.partial = (uint8_t)partial;
+    agg->emitted++;
+    agg->cb(&record, agg->ctx);
+    return 1;
+}
+
+int ble_adv_agg_init(struct ble_adv_agg *agg, const struct ble_adv_devtab *tab,
+                     const uint32_t *windows_ms, size_t num_windows, ble_adv_agg_cb_t cb,
+                     void *ctx)
+{
+    if (!agg || !tab || !windows_ms || !num_windows || (num_windows > BLE_ADV_AGG_WINDOWS_MAX)
+        || !cb)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_windows; i++) {
+        if (!windows_ms[i]) {
+            errno = EINVAL;
+            return -1;
+        }
+        agg->windows_ms[i] = windows_ms[i];
+    }
+
+    agg->slots = calloc(tab->capacity, sizeof(agg->slots[0]));
+    agg->windows = calloc((size_t)tab->capacity * num_windows, sizeof(agg->windows[0]));
+    if (!agg->slots || !agg->windows) {
+        free(agg->slots);
+        free(agg->windows);
+        return -1;
+    }
+
+    agg->tab = tab;
+    agg->cb = cb;
+    agg->ctx = ctx;
+    agg->num_windows = num_windows;
+    agg->emitted = 0;
+    return 0;
+}
+
+void ble_adv_agg_destroy(struct ble_adv_agg *agg)
+{
+    free(agg->slots);
+    free(agg->windows);
+    agg->slots = NULL;
+    agg->windows = NULL;
+}
+
+void ble_adv_agg_add(struct ble_adv_agg *agg, const struct ble_adv_devtab_entry *entry,
+                     const struct ble_adv_agg_sample *sample, uint64_t now_ms)
+{
+    size_t idx = (size_t)(entry - agg->tab->entries);
+    struct ble_adv_agg_slot *slot = &agg->slots[idx];
+
+    if (slot->used && ((slot->first_seen_ms != entry->first_seen_ms)
+                       || memcmp(slot->addr, entry->addr, sizeof(slot->addr))))
+    {
+        /* the device table evicted the sensor and reused its entry */
+        for (size_t i = 0; i < agg->num_windows; i++) {
+            emit(agg, idx, i, 1);
+        }
+        slot->used = 0;
+    }
+
+    if (!slot->used) {
+        slot->used = 1;
+        slot->first_seen_ms = entry->first_seen_ms;
+        memcpy(slot->addr, entry->addr, sizeof(slot->addr));
+        for (size_t i = 0; i < agg->num_windows; i++) {
+            reset_window(window_at(agg, idx, i), now_ms - now_ms % agg->windows_ms[i]);
+        }
+    }
+
+    for (size_t i = 0; i < agg->num_windows; i++) {
+        struct ble_adv_agg_window *w = window_at(agg, idx, i);
+        uint32_t len_ms = agg->windows_ms[i];
+        if (now_ms >= w->start_ms + len_ms) {
+            emit(agg, idx, i, 0);
+            reset_window(w, now_ms - now_ms % len_ms);
+        }
+
+        for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+            if (!(sample->has & (1U << c))) {
+                continue;
+            }
+            struct ble_adv_agg_stat *stat = &w->channels[c];
+            int32_t value = sample->values[c];
+            stat->sum += value;
+            stat->count++;
+            if (value < stat->min) {
+                stat->min = value;
+            }
+            if (value > stat->max) {
+                stat->max = value;
+            }
+        }
+    }
+}
+
+size_t ble_adv_agg_tick(struct ble_adv_agg *agg, uint64_t now_ms)
+{
+    size_t num = 0;
+
+    for (size_t idx = 0; idx < agg->tab->capacity; idx++) {
+        if (!agg->slots[idx].used) {
+            continue;
+        }
+
+        for (size_t i = 0; i < agg->num_windows; i++) {
+            struct ble_adv_agg_window *w = window_at(agg, idx, i);
+            uint32_t len_ms = agg->windows_ms[i];
+            if (now_ms >= w->start_ms + len_ms) {
+                num += emit(agg, idx, i, 0);
+                reset_window(w, now_ms - now_ms % len_ms);
+            }
+        }
+    }
+
+    return num;
+}
+
+size_t ble_adv_agg_flush(struct ble_adv_agg *agg)
+{
+    size_t num = 0;
+
+    for (size_t idx = 0; idx < agg->tab->capacity; idx++) {
+        if (!agg->slots[idx].used) {
+            continue;
+        }
+
+        for (size_t i = 0; i < agg->num_windows; i++) {
+            struct ble_adv_agg_window *w = window_at(agg, idx, i);
+            num += emit(agg, idx, i, 1);
+            reset_window(w, w->start_ms);
+        }
+    }
+
+    return num;
+}
+
+/** @} */
@@ -0,0 +1,463 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_autoscan
+ *
+ * @{
+ * @brief   Implementation of the non-blocking scan state machine
+ * @file
+ */
+#include "ble_adv_autoscan.h"
+#include "ble_adv_internal.h"
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @name    Commands of the start sequence, in the order the responses arrive
+ * @{
+ */
+#define STEP_DISABLE            0
+#define STEP_PARAMS             1
+#define STEP_ENABLE             2
+#define STEPS                   3
+/** @} */
+
+static const uint16_t step_opcodes[STEPS] = {
+    [STEP_DISABLE] = cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE),
+    [STEP_PARAMS] = cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS),
+    [STEP_ENABLE] = cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE),
+};
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int valid_params(const struct ble_adv_scan_params *params)
+{
+    return params && (params->interval >= BLE_ADV_SCAN_INTERVAL_MIN)
+        && (params->interval <= BLE_ADV_SCAN_INTERVAL_MAX)
+        && (params->window >= BLE_ADV_SCAN_INTERVAL_MIN)
+        && (params->window <= params->interval);
+}
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags == -1) || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @return  @ref BLE_ADV_AUTOSCAN_EV_CLOSED if the descriptor to read advertisements from was
+ *          open, 0 otherwise
+ */
+static unsigned close_dev(struct ble_adv_autoscan *as)
+{
+    unsigned events = 0;
+    if (as->dev >= 0) {
+        hci_close_dev(as->dev);
+        as->dev = -1;
+        events = BLE_ADV_AUTOSCAN_EV_CLOSED;
+    }
+    if (as->ctl >= 0) {
+        hci_close_dev(as->ctl);
+        as->ctl = -1;
+    }
+    return events;
+}
+
+static int open_dev(struct ble_adv_autoscan *as)
+{
+    int err;
+
+    as->dev = hci_open_dev(as->dev_id);
+    as->ctl = hci_open_dev(as->dev_id);
+    if ((as->dev < 0) || (as->ctl < 0) || set_nonblock(as->dev) || set_nonblock(as->ctl)
+        || ble_adv_set_hci_filter(as->dev))
+    {
+        goto fail;
+    }
+
+    /* the command descriptor only needs the responses to its commands */
+    struct hci_filter filter;
+    hci_filter_clear(&filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+    hci_filter_set_event(EVT_CMD_COMPLETE, &filter);
+    hci_filter_set_event(EVT_CMD_STATUS, &filter);
+    if (setsockopt(as->ctl, SOL_HCI, HCI_FILTER, &filter, sizeof(filter))) {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    err = errno;
+    close_dev(as);
+    errno = err;
+    return -1;
+}
+
+static int open_mon(void)
+{
+    int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* only sockets not bound to an adapter receive the HCI_DEV_* events */
+    struct sockaddr_hci addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.hci_family = AF_BLUETOOTH;
+    addr.hci_dev = HCI_DEV_NONE;
+    addr.hci_channel = HCI_CHANNEL_RAW;
+
+    struct hci_filter filter;
+    hci_filter_clear(&filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+    hci_filter_set_event(EVT_STACK_INTERNAL, &filter);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+        || setsockopt(fd, SOL_HCI, HCI_FILTER, &filter, sizeof(filter)))
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+static void retry_later(struct ble_adv_autoscan *as, unsigned state, uint64_t now)
+{
+    as->state = state;
+    as->deadline_ms = now + BLE_ADV_AUTOSCAN_RETRY_MS;
+}
+
+static void start(struct ble_adv_autoscan *as, uint64_t now)
+{
+    le_set_scan_enable_cp disable = { .enable = 0, .filter_dup = 0 };
+    le_set_scan_parameters_cp params = {
+        .type = as->params.scan_type,
+        .interval = htobs(as->params.interval),
+        .window = htobs(as->params.window),
+        .own_bdaddr_type = as->params.own_addr_type,
+        .filter = as->params.filter_policy,
+    };
+    le_set_scan_enable_cp enable = { .enable = 1, .filter_dup = as->params.filter_duplicates };
+
+    /* The kernel queues the commands and sends the next one once the controller has room.
+     * Disabling first is harmless if the controller is not scanning, its status is ignored. */
+    if (hci_send_cmd(as->ctl, OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE, LE_SET_SCAN_ENABLE_CP_SIZE,
+                     &disable)
+        || hci_send_cmd(as->ctl, OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS,
+                        LE_SET_SCAN_PARAMETERS_CP_SIZE, &params)
+        || hci_send_cmd(as->ctl, OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE, LE_SET_SCAN_ENABLE_CP_SIZE,
+                        &enable))
+    {
+        retry_later(as, (errno == ENETDOWN) ? BLE_ADV_AUTOSCAN_DOWN : BLE_ADV_AUTOSCAN_FAILED,
+                    now);
+        return;
+    }
+
+    int to = (as->params.hci_timeout_ms > 0) ? as->params.hci_timeout_ms : HCI_TIMEOUT_MS;
+    as->state = BLE_ADV_AUTOSCAN_STARTING;
+    as->step = STEP_DISABLE;
+    as->deadline_ms = now + (uint64_t)to;
+}
+
+static void send_disable(struct ble_adv_autoscan *as)
+{
+    le_set_scan_enable_cp disable = { .enable = 0, .filter_dup = 0 };
+    /* nothing to do about a failure, the adapter is most likely gone or down */
+    hci_send_cmd(as->ctl, OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE, LE_SET_SCAN_ENABLE_CP_SIZE,
+                 &disable);
+}
+
+static unsigned lost(struct ble_adv_autoscan *as)
+{
+    if ((as->state == BLE_ADV_AUTOSCAN_SCANNING) || (as->state == BLE_ADV_AUTOSCAN_STARTING)) {
+        return BLE_ADV_AUTOSCAN_EV_STOPPED;
+    }
+    return 0;
+}
+
+static unsigned reopen(struct ble_adv_autoscan *as, uint64_t now)
+{
+    if (open_dev(as)) {
+        retry_later(as, BLE_ADV_AUTOSCAN_CLOSED, now);
+        return 0;
+    }
+
+    as->state = BLE_ADV_AUTOSCAN_IDLE;
+    if (as->enabled) {
+        start(as, now);
+    }
+    return BLE_ADV_AUTOSCAN_EV_REOPENED;
+}
+
+static unsigned handle_dev_event(struct ble_adv_autoscan *as, uint16_t event, uint64_t now)
+{
+    unsigned events = 0;
+
+    switch (event) {
+    case HCI_DEV_UP:
+        if (as->dev < 0) {
+            return reopen(as, now);
+        }
+        as->state = BLE_ADV_AUTOSCAN_IDLE;
+        if (as->enabled) {
+            start(as, now);
+        }
+        break;
+    case HCI_DEV_DOWN:
+        if (as->dev >= 0) {
+            events = lost(as);
+            retry_later(as, BLE_ADV_AUTOSCAN_DOWN, now);
+        }
+        break;
+    case HCI_DEV_UNREG:
+        events = lost(as);
+        events |= close_dev(as);
+        retry_later(as, BLE_ADV_AUTOSCAN_CLOSED, now);
+        break;
+    default:
+        /* a newly registered adapter is useless until it is up */
+        break;
+    }
+
+    return events;
+}
+
+static unsigned read_mon(struct ble_adv_autoscan *as, uint64_t now)
+{
+    uint8_t buf[HCI_MAX_EVENT_SIZE];
+    unsigned events = 0;
+    ssize_t len;
+
+    while ((len = read(as->mon, buf, sizeof(buf))) > 0) {
+        const size_t hdr = 1 + HCI_EVENT_HDR_SIZE;
+        evt_stack_internal si;
+        evt_si_device sd;
+        if (((size_t)len < hdr + sizeof(si) + sizeof(sd)) || (buf[0] != HCI_EVENT_PKT)
+            || (buf[1] != EVT_STACK_INTERNAL))
+        {
+            continue;
+        }
+
+        /* the kernel fills these in host byte order */
+        memcpy(&si, buf + hdr, sizeof(si));
+        memcpy(&sd, buf + hdr + sizeof(si), sizeof(sd));
+        if ((si.type == EVT_SI_DEVICE) && (sd.dev_id == as->dev_id)) {
+            events |= handle_dev_event(as, sd.event, now);
+        }
+    }
+
+    return events;
+}
+
+static void handle_response(struct ble_adv_autoscan *as, uint16_t opcode, uint8_t status,
+                            uint64_t now)
+{
+    if ((as->state != BLE_ADV_AUTOSCAN_STARTING) || (opcode != step_opcodes[as->step])) {
+        /* e.g. the response to a command of another process */
+        return;
+    }
+
+    if (status && (as->step != STEP_DISABLE)) {
+        as->status = status;
+        retry_later(as, BLE_ADV_AUTOSCAN_FAILED, now);
+        return;
+    }
+
+    as->step++;
+}
+
+static unsigned read_ctl(struct ble_adv_autoscan *as, uint64_t now)
+{
+    uint8_t buf[HCI_MAX_EVENT_SIZE];
+    unsigned events = 0;
+    ssize_t len;
+
+    while ((as->ctl >= 0) && ((len = read(as->ctl, buf, sizeof(buf))) > 0)) {
+        const size_t hdr = 1 + HCI_EVENT_HDR_SIZE;
+        if (((size_t)len < hdr) || (buf[0] != HCI_EVENT_PKT)) {
+            continue;
+        }
+
+        if ((buf[1] == EVT_CMD_COMPLETE) && ((size_t)len > hdr + EVT_CMD_COMPLETE_SIZE)) {
+            evt_cmd_complete cc;
+            memcpy(&cc, buf + hdr, sizeof(cc));
+            /* the status is the first return parameter */
+            handle_response(as, btohs(cc.opcode), buf[hdr + EVT_CMD_COMPLETE_SIZE], now);
+        }
+        else if ((buf[1] == EVT_CMD_STATUS) && ((size_t)len >= hdr + EVT_CMD_STATUS_SIZE)) {
+            evt_cmd_status cs;
+            memcpy(&cs, buf + hdr, sizeof(cs));
+            handle_response(as, btohs(cs.opcode), cs.status, now);
+        }
+
+        if ((as->state == BLE_ADV_AUTOSCAN_STARTING) && (as->step == STEPS)) {
+            as->state = BLE_ADV_AUTOSCAN_SCANNING;
+            as->status = 0;
+            events |= BLE_ADV_AUTOSCAN_EV_SCANNING;
+        }
+    }
+
+    if ((as->ctl >= 0) && (len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        /* e.g. EPIPE after the adapter was removed */
+        events |= lost(as);
+        events |= close_dev(as);
+        retry_later(as, BLE_ADV_AUTOSCAN_CLOSED, now);
+    }
+
+    return events;
+}
+
+int ble_adv_autoscan_init(struct ble_adv_autoscan *as, int dev_id,
+                          const struct ble_adv_scan_params *params)
+{
+    if (!as || (dev_id < 0) || !valid_params(params)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    as->params = *params;
+    as->dev = -1;
+    as->ctl = -1;
+    as->dev_id = dev_id;
+    as->enabled = 1;
+    as->status = 0;
+    as->step = 0;
+    as->mon = open_mon();
+    if (as->mon < 0) {
+        return -1;
+    }
+
+    uint64_t now = now_ms();
+    if (open_dev(as)) {
+        retry_later(as, BLE_ADV_AUTOSCAN_CLOSED, now);
+        return 0;
+    }
+
+    start(as, now);
+    if (as->state == BLE_ADV_AUTOSCAN_FAILED) {
+        /* e.g. EPERM, retrying will not help */
+        int err = errno;
+        close_dev(as);
+        close(as->mon);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void ble_adv_autoscan_destroy(struct ble_adv_autoscan *as)
+{
+    ble_adv_autoscan_stop(as);
+    close_dev(as);
+    close(as->mon);
+    as->mon = -1;
+}
+
+int ble_adv_autoscan_set_params(struct ble_adv_autoscan *as,
+                                const struct ble_adv_scan_params *params)
+{
+    if (!as || !valid_params(params)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    as->params = *params;
+    as->enabled = 1;
+
+    /* A sequence still in flight is simply followed by the new one. As the controller
+     * processes them in order, it ends up scanning with the new parameters. */
+    switch (as->state) {
+    case BLE_ADV_AUTOSCAN_IDLE:
+    case BLE_ADV_AUTOSCAN_STARTING:
+    case BLE_ADV_AUTOSCAN_SCANNING:
+    case BLE_ADV_AUTOSCAN_FAILED:
+        start(as, now_ms());
+        break;
+    default:
+        /* applied once the adapter is back */
+        break;
+    }
+
+    return 0;
+}
+
+void ble_adv_autoscan_stop(struct ble_adv_autoscan *as)
+{
+    as->enabled = 0;
+
+    switch (as->state) {
+    case BLE_ADV_AUTOSCAN_STARTING:
+    case BLE_ADV_AUTOSCAN_SCANNING:
+    case BLE_ADV_AUTOSCAN_FAILED:
+        send_disable(as);
+        as->state = BLE_ADV_AUTOSCAN_IDLE;
+        break;
+    default:
+        break;
+    }
+}
+
+unsigned ble_adv_autoscan_run(struct ble_adv_autoscan *as)
+{
+    uint64_t now = now_ms();
+    unsigned events = read_mon(as, now);
+    events |= read_ctl(as, now);
+
+    if (now < as->deadline_ms) {
+        return events;
+    }
+
+    switch (as->state) {
+    case BLE_ADV_AUTOSCAN_STARTING:
+        /* the controller did not respond in time */
+        retry_later(as, BLE_ADV_AUTOSCAN_FAILED, now);
+        break;
+    case BLE_ADV_AUTOSCAN_DOWN:
+    case BLE_ADV_AUTOSCAN_FAILED:
+        /* also covers an HCI_DEV_UP event that was missed */
+        if (as->enabled) {
+            start(as, now);
+        }
+        break;
+    case BLE_ADV_AUTOSCAN_CLOSED:
+        events |= reopen(as, now);
+        break;
+    default:
+        break;
+    }
+
+    return events;
+}
+
+void ble_adv_autoscan_pollfds(const struct ble_adv_autoscan *as,
+                              struct pollfd pfds[BLE_ADV_AUTOSCAN_POLLFDS])
+{
+    pfds[0].fd = as->mon;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd = as->ctl;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+}
+
+/** @} */
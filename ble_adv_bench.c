@@ -0,0 +1,1034 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @defgroup    ble_adv_bench   Benchmark of the advertisement decoding
+ *
+ * @{
+ * @brief   Measure the decoding hot path over synthetic and recorded corpora
+ * @file
+ *
+ * Usage: `ble_adv_bench [-t SECONDS] [-j WORKERS] [-c] [-o FILE] [-b FILE [-r PERCENT]]
+ * [RECORDING...]`. Each corpus is decoded repeatedly for about @p SECONDS (default 0.5) in each
+ * of the following stages:
+ *
+ * - `eir`: Only the EIR decoding (@ref ble_adv_parse_eir) of pre-split advertisements
+ * - `views`: Only splitting the HCI events into views (@ref ble_adv_event_views)
+ * - `event`: Full decoding of the HCI events (@ref ble_adv_parse_event), as done by
+ *   @ref ble_adv_read without the syscall
+ * - `select`: Selecting the advertisements with LYWSD03MMC service data (UUID16 0x181A) via
+ *   @ref ble_adv_bulk_select
+ * - `pipe`: Full decoding of the HCI events and of the sensor data (@ref ble_adv_decode) on
+ *   @p WORKERS threads via @ref ble_adv_pipeline, only run if `-j` is given. Compare the
+ *   throughput for different values of @p WORKERS to see how it scales. CPU cycles and branch
+ *   misses are only counted for the ingest thread in this stage.
+ *
+ * Synthetic corpora are generated from a fixed seed, recordings are created with
+ * @ref ble_adv_recorder. If the kernel permits `perf_event_open()`, CPU cycles and branch
+ * misses are reported as well.
+ *
+ * With `-o FILE` the ns per packet of each corpus and stage are written to @p FILE. With
+ * `-b FILE` they are compared to those in @p FILE instead, and the exit code is non-zero if
+ * any of them got slower by more than @p PERCENT (default 20). This allows gating changes in
+ * CI, e.g. via `make bench BENCH_ARGS="-t 2 -b bench.baseline"` on the same machine that
+ * produced the baseline.
+ *
+ * With `-c` no benchmark is run. Instead, every event of the corpora and
+ * @ref CHECK_MUTATIONS randomly mutated copies of it are decoded with the fast paths
+ * (@ref ble_adv_view_find, @ref ble_adv_bulk_select, @ref ble_adv_fields_index and
+ * @ref ble_adv_decode_view) and the results are compared to those of a straightforward walk
+ * over the EIR data, of @ref ble_adv_parse_eir and of @ref lywsd03mmc_parse, once strict and
+ * once with @ref BLE_ADV_PARSE_FLAG_LENIENT. `make check` runs this.
+ *
+ * Compiled with `-DBLE_ADV_BENCH_FUZZ`, the file provides the same comparison as a
+ * libFuzzer / AFL++ entry point instead, see `make CC=clang ble_adv_fuzz`. Bit 0 of the first
+ * input byte selects @ref BLE_ADV_PARSE_FLAG_LENIENT. If bit 1 is set, the rest of the input
+ * is used as EIR data of a single advertising report, otherwise as an HCI event.
+ */
+#include "ble_adv.h"
+#include "ble_adv_bulk.h"
+#include "ble_adv_decode.h"
+#include "ble_adv_fields.h"
+#include "ble_adv_internal.h"
+#include "ble_adv_pipeline.h"
+#include "ble_adv_rec.h"
+#include "lywsd03mmc.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief   Number of HCI events in each synthetic corpus
+ */
+#define SYNTHETIC_EVENTS        4096
+
+/**
+ * @brief   Offset of the EIR data in an HCI event with a single report
+ */
+#define EIR_OFFSET              14
+
+/**
+ * @brief   Number of mutated copies of each event checked with `-c`
+ */
+#define CHECK_MUTATIONS         8
+
+/**
+ * @brief   Upper bound of the number of fields in the EIR data of a legacy advertising report
+ */
+#define REF_FIELDS_MAX          128
+
+/**
+ * @brief   EIR field found by @ref ref_walk
+ */
+struct ref_field {
+    uint16_t offset;            /**< Offset of the data (after the type) */
+    uint8_t len;                /**< Length of the data in bytes */
+    uint8_t type;               /**< EIR data type, e.g. @ref EIR_FLAGS */
+};
+
+/**
+ * @brief   Service data UUIDs and company IDs that @ref ble_adv_bulk_select is checked with
+ */
+static const struct {
+    uint8_t type;               /**< @ref EIR_SERVICE_DATA or
+                                     @ref EIR_MANUFACTURER_SPECIFIC_DATA */
+    uint16_t id;                /**< UUID16 or company ID */
+} check_selections[] = {
+    { EIR_SERVICE_DATA, 0x181A },
+    { EIR_SERVICE_DATA, 0xFCD2 },
+    { EIR_SERVICE_DATA, 0xFE95 },
+    { EIR_SERVICE_DATA, 0xFEAA },
+    { EIR_MANUFACTURER_SPECIFIC_DATA, 0x004C },
+    { EIR_MANUFACTURER_SPECIFIC_DATA, 0x0499 },
+};
+
+/**
+ * @brief   Walk over the EIR data as specified, without any shortcuts
+ *
+ * @param[out]      dest        Write the fields here
+ * @param[in]       eir         EIR data to walk over
+ * @param[in]       eir_len     Length of @p eir in bytes
+ * @param[out]      malformed   Set to 1 if the last field exceeds the data, else to 0
+ *
+ * @return  Number of fields written to @p dest
+ */
+static size_t ref_walk(struct ref_field *dest, const uint8_t *eir, size_t eir_len, int *malformed)
+{
+    size_t num = 0, pos = 0;
+    *malformed = 0;
+    while ((pos < eir_len) && (num < REF_FIELDS_MAX)) {
+        size_t field_len = eir[pos];
+        if (!field_len) {
+            /* early termination, the rest is padding */
+            break;
+        }
+        if (pos + 1 + field_len > eir_len) {
+            *malformed = 1;
+            break;
+        }
+        dest[num].offset = (uint16_t)(pos + 2);
+        dest[num].len = (uint8_t)(field_len - 1);
+        dest[num].type = eir[pos + 1];
+        num++;
+        pos += 1 + field_len;
+    }
+    return num;
+}
+
+/**
+ * @brief   Check if a field is too long to fit into @ref ble_adv without truncation
+ */
+static int ref_oversized(const struct ref_field *f)
+{
+    switch (f->type) {
+    case EIR_NAME_SHORT:
+    case EIR_NAME_COMPLETE:
+        return f->len > sizeof(((struct ble_adv *)NULL)->name) - 1;
+    case EIR_URI:
+        return f->len > sizeof(((struct ble_adv *)NULL)->uri) - 1;
+    case EIR_SERVICE_DATA:
+        return f->len > sizeof(((struct ble_adv *)NULL)->service_data) + 2;
+    case EIR_MANUFACTURER_SPECIFIC_DATA:
+        return f->len > sizeof(((struct ble_adv *)NULL)->ms_data) + 2;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief   Compare the fast paths on a single view to the reference decoders
+ *
+ * @param[in]       view        Advertisement to check
+ * @param[in]       flags       Parse flags to decode with
+ *
+ * @return  Description of the first mismatch, or NULL if all agree
+ */
+static const char *check_view(const struct ble_adv_view *view, unsigned flags)
+{
+    struct ref_field ref[REF_FIELDS_MAX];
+    int malformed;
+    size_t num = ref_walk(ref, view->eir, view->eir_len, &malformed);
+    int lenient = !!(flags & BLE_ADV_PARSE_FLAG_LENIENT);
+
+    for (unsigned type = 0; type <= UINT8_MAX; type++) {
+        const uint8_t *data = NULL;
+        size_t len = 0, i = 0;
+        while ((i < num) && (ref[i].type != type)) {
+            i++;
+        }
+        int found = ble_adv_view_find(view, (uint8_t)type, &data, &len);
+        if (found != (i < num)) {
+            return "ble_adv_view_find() disagrees on the presence of a field";
+        }
+        if (found && ((data != view->eir + ref[i].offset) || (len != ref[i].len))) {
+            return "ble_adv_view_find() returned the wrong field";
+        }
+    }
+
+    for (size_t j = 0; j < sizeof(check_selections) / sizeof(check_selections[0]); j++) {
+        uint8_t type = check_selections[j].type;
+        uint16_t id = check_selections[j].id;
+        int expected = 0;
+        for (size_t i = 0; i < num; i++) {
+            const uint8_t *data = view->eir + ref[i].offset;
+            if ((ref[i].type == type) && (ref[i].len >= 2)
+                && (data[0] == (id & 0xff)) && (data[1] == (id >> 8)))
+            {
+                expected = 1;
+            }
+        }
+        uint32_t selected;
+        if (ble_adv_bulk_select(&selected, view, 1, type, id) != (size_t)expected) {
+            return "ble_adv_bulk_select() disagrees";
+        }
+    }
+
+    struct ble_adv_fields fields;
+    int retval = ble_adv_fields_index(&fields, view, flags);
+    if (malformed && !lenient && (num <= BLE_ADV_FIELDS_MAX)) {
+        if ((retval != -1) || (errno != EPROTO)) {
+            return "ble_adv_fields_index() accepted a malformed field";
+        }
+    }
+    else {
+        size_t expected = (num < BLE_ADV_FIELDS_MAX) ? num : BLE_ADV_FIELDS_MAX;
+        if ((retval < 0) || ((size_t)retval != expected) || (fields.len != expected)) {
+            return "ble_adv_fields_index() returned the wrong number of fields";
+        }
+        if (fields.truncated != ((num > BLE_ADV_FIELDS_MAX) || malformed)) {
+            return "ble_adv_fields_index() got the truncation wrong";
+        }
+        for (size_t i = 0; i < expected; i++) {
+            if ((fields.fields[i].type != ref[i].type) || (fields.fields[i].len != ref[i].len)
+                || (fields.fields[i].offset != ref[i].offset))
+            {
+                return "ble_adv_fields_index() returned the wrong field";
+            }
+        }
+    }
+
+    size_t oversized = 0, payloads = 0, last_sd = num;
+    for (size_t i = 0; i < num; i++) {
+        oversized += (size_t)ref_oversized(&ref[i]);
+        if (((ref[i].type == EIR_SERVICE_DATA) || (ref[i].type == EIR_MANUFACTURER_SPECIFIC_DATA))
+            && (ref[i].len >= 2))
+        {
+            payloads++;
+            if (ref[i].type == EIR_SERVICE_DATA) {
+                last_sd = i;
+            }
+        }
+    }
+
+    struct ble_adv adv;
+    memset(&adv, 0, sizeof(adv));
+    if (ble_adv_view_parse(&adv, view, flags)) {
+        if (lenient || (!malformed && !oversized)) {
+            return "ble_adv_view_parse() rejected a valid advertisement";
+        }
+        return NULL;
+    }
+    if (malformed && !lenient) {
+        return "ble_adv_view_parse() accepted a malformed field";
+    }
+    if (!!(adv.has & BLE_ADV_HAS_TRUNCATED) != (malformed || oversized)) {
+        return "ble_adv_view_parse() got the truncation wrong";
+    }
+    if (!(adv.has & BLE_ADV_HAS_SERVICE_DATA) != (last_sd == num)) {
+        return "ble_adv_view_parse() disagrees on the presence of service data";
+    }
+    if (last_sd < num) {
+        const uint8_t *data = view->eir + ref[last_sd].offset;
+        size_t len = ref[last_sd].len - 2U;
+        if (len > sizeof(adv.service_data)) {
+            len = sizeof(adv.service_data);
+        }
+        if ((adv.service_uuid16 != (data[0] | (data[1] << 8))) || (adv.service_data_len != len)
+            || memcmp(adv.service_data, data + 2, len))
+        {
+            return "ble_adv_view_parse() returned the wrong service data";
+        }
+    }
+
+    struct ble_adv_sensor from_adv, from_view;
+    memset(&from_adv, 0, sizeof(from_adv));
+    memset(&from_view, 0, sizeof(from_view));
+    int adv_retval = ble_adv_decode(&from_adv, &adv);
+    if ((payloads == 1) && !(adv.has & BLE_ADV_HAS_TRUNCATED)) {
+        /* with more than one payload the two pick different ones by design */
+        int view_retval = ble_adv_decode_view(&from_view, view);
+        if ((adv_retval != view_retval)
+            || (!adv_retval && memcmp(&from_adv, &from_view, sizeof(from_adv))))
+        {
+            return "ble_adv_decode_view() disagrees with ble_adv_decode()";
+        }
+    }
+
+    if (lywsd03mmc_is_match(&adv)) {
+        struct lywsd03mmc_data data;
+        lywsd03mmc_parse(&data, &adv);
+        if (adv_retval || (from_adv.decoder != BLE_ADV_DECODER_ATC1441)
+            || (from_adv.temperature != data.temperature * 10)
+            || (from_adv.humidity != data.humidity * 100) || (from_adv.bat != data.bat)
+            || (from_adv.bat_mv != data.bat_mv))
+        {
+            return "ble_adv_decode() disagrees with lywsd03mmc_parse()";
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief   Compare the fast paths on all advertisements of an HCI event to the reference
+ *          decoders
+ *
+ * @param[in]       buf         HCI event to check
+ * @param[in]       len         Length of @p buf in bytes
+ * @param[in]       flags       Parse flags to decode with
+ *
+ * @return  Description of the first mismatch, or NULL if all agree
+ */
+static const char *check_event(const uint8_t *buf, size_t len, unsigned flags)
+{
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+    struct ble_adv advs[BLE_ADV_REPORTS_MAX];
+    int num = ble_adv_event_views(views, BLE_ADV_REPORTS_MAX, buf, len);
+    int valid = 0;
+    for (int i = 0; i < num; i++) {
+        const char *err = check_view(&views[i], flags);
+        if (err) {
+            return err;
+        }
+        valid += !ble_adv_view_parse(&advs[0], &views[i], flags);
+    }
+
+    /* malformed reports are dropped one by one, the others still have to come out */
+    int parsed = ble_adv_parse_event(advs, BLE_ADV_REPORTS_MAX, buf, len, flags);
+    if ((parsed >= 0) ? (parsed != valid) : (valid != 0)) {
+        return "ble_adv_parse_event() disagrees with ble_adv_view_parse()";
+    }
+
+    return NULL;
+}
+
+#ifndef BLE_ADV_BENCH_FUZZ
+/**
+ * @brief   Corpus of HCI events stored back to back
+ */
+struct corpus {
+    char name[64];              /**< Name printed in the results */
+    uint8_t *data;              /**< Events */
+    size_t len;                 /**< Bytes in @ref corpus::data */
+    size_t cap;                 /**< Size of @ref corpus::data */
+    size_t *offs;               /**< Offset of each event */
+    size_t num;                 /**< Number of events */
+    struct ble_adv_view *views; /**< Advertisements in the events */
+    size_t num_views;           /**< Number of entries in @ref corpus::views */
+    uint32_t *selected;         /**< Room for the indices of the selected views */
+};
+
+/**
+ * @brief   Counters read via perf_event_open()
+ */
+struct perf {
+    int cycles;                 /**< Group leader counting CPU cycles, or -1 */
+    int branch_misses;          /**< Counting branch misses, or -1 */
+};
+
+/**
+ * @brief   Sink of a pipeline worker, padded to avoid false sharing
+ */
+struct worker_sink {
+    _Alignas(BLE_ADV_CACHE_LINE) unsigned value;   /**< Accumulated results */
+};
+
+/**
+ * @brief   Time per packet measured for a stage, to compare against a baseline
+ */
+struct result {
+    char corpus[64];            /**< Name of the corpus, as in @ref corpus::name */
+    char stage[8];              /**< Name of the stage, e.g. `eir` */
+    double ns;                  /**< ns per packet */
+};
+
+static uint32_t rng_state = 0x12345678;
+static struct ble_adv_pipeline pipeline;
+static struct worker_sink worker_sinks[BLE_ADV_PIPELINE_WORKERS_MAX];
+static struct result *results;
+static size_t num_results;
+
+static uint32_t rng(void)
+{
+    /* xorshift32 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        perror("realloc()");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void corpus_add(struct corpus *c, const uint8_t *event, size_t len)
+{
+    if (c->len + len > c->cap) {
+        c->cap = (c->cap + len) * 2;
+        c->data = xrealloc(c->data, c->cap);
+    }
+    if (!(c->num & (c->num + 1))) {
+        /* grow whenever num + 1 is a power of two */
+        c->offs = xrealloc(c->offs, 2 * (c->num + 1) * sizeof(c->offs[0]));
+    }
+
+    memcpy(c->data + c->len, event, len);
+    c->offs[c->num++] = c->len;
+    c->len += len;
+}
+
+static size_t corpus_event_len(const struct corpus *c, size_t i)
+{
+    return ((i + 1 < c->num) ? c->offs[i + 1] : c->len) - c->offs[i];
+}
+
+/**
+ * @brief   Split all events into views once, after the corpus is complete
+ */
+static void corpus_finish(struct corpus *c)
+{
+    c->views = xrealloc(NULL, (c->num * BLE_ADV_REPORTS_MAX + 1) * sizeof(c->views[0]));
+    c->num_views = 0;
+    for (size_t i = 0; i < c->num; i++) {
+        int num = ble_adv_event_views(c->views + c->num_views, BLE_ADV_REPORTS_MAX,
+                                      c->data + c->offs[i], corpus_event_len(c, i));
+        if (num > 0) {
+            c->num_views += (size_t)num;
+        }
+    }
+    c->selected = xrealloc(NULL, (c->num_views + 1) * sizeof(c->selected[0]));
+}
+
+static void corpus_free(struct corpus *c)
+{
+    free(c->data);
+    free(c->offs);
+    free(c->views);
+    free(c->selected);
+}
+
+/**
+ * @brief   Wrap @p eir into an LE Advertising Report event with a single report
+ */
+static void add_adv(struct corpus *c, uint8_t evt_type, const uint8_t *eir, size_t eir_len)
+{
+    uint8_t event[HCI_MAX_EVENT_SIZE];
+    event[0] = HCI_EVENT_PKT;
+    event[1] = EVT_LE_META_EVENT;
+    event[2] = (uint8_t)(EIR_OFFSET - 3 + eir_len + 1);
+    event[3] = 0x02; /* LE Advertising Report */
+    event[4] = 1;
+    event[5] = evt_type;
+    event[6] = rng() & 1;
+    for (unsigned i = 0; i < 6; i++) {
+        event[7 + i] = (uint8_t)rng();
+    }
+    event[13] = (uint8_t)eir_len;
+    memcpy(event + EIR_OFFSET, eir, eir_len);
+    event[EIR_OFFSET + eir_len] = (uint8_t)(-40 - (int)(rng() % 60));
+    corpus_add(c, event, EIR_OFFSET + eir_len + 1);
+}
+
+static size_t put_field(uint8_t *dest, uint8_t type, const void *data, size_t len)
+{
+    dest[0] = (uint8_t)(len + 1);
+    dest[1] = type;
+    memcpy(dest + 2, data, len);
+    return len + 2;
+}
+
+static void gen_beacons(struct corpus *c)
+{
+    snprintf(c->name, sizeof(c->name), "synthetic beacons");
+    for (unsigned i = 0; i < SYNTHETIC_EVENTS; i++) {
+        uint8_t eir[31], data[27];
+        size_t len = put_field(eir, EIR_FLAGS, "\x06", 1);
+        for (unsigned j = 0; j < sizeof(data); j++) {
+            data[j] = (uint8_t)rng();
+        }
+        if (i & 1) {
+            /* iBeacon */
+            memcpy(data, "\x4c\x00\x02\x15", 4);
+            len += put_field(eir + len, EIR_MANUFACTURER_SPECIFIC_DATA, data, 25);
+        }
+        else {
+            /* Eddystone UID */
+            len += put_field(eir + len, EIR_UUID16_ALL, "\xaa\xfe", 2);
+            memcpy(data, "\xaa\xfe\x00", 3);
+            len += put_field(eir + len, EIR_SERVICE_DATA, data, 20);
+        }
+        add_adv(c, 0x03, eir, len);
+    }
+}
+
+static void gen_names(struct corpus *c)
+{
+    static const char *names[] = {
+        "Living Room Speaker", "Galaxy Watch Active", "Keyboard K380", "Fitness Tracker 4",
+        "LE-Bose Headphones", "Smart Toothbrush",
+    };
+    snprintf(c->name, sizeof(c->name), "synthetic names");
+    for (unsigned i = 0; i < SYNTHETIC_EVENTS; i++) {
+        uint8_t eir[31];
+        const char *name = names[rng() % (sizeof(names) / sizeof(names[0]))];
+        size_t len = put_field(eir, EIR_FLAGS, "\x1a", 1);
+        len += put_field(eir + len, EIR_TX_POWER, "\x08", 1);
+        len += put_field(eir + len, (i & 3) ? EIR_NAME_COMPLETE : EIR_NAME_SHORT, name,
+                         strlen(name));
+        add_adv(c, 0x00, eir, len);
+    }
+}
+
+static void gen_sensors(struct corpus *c)
+{
+    snprintf(c->name, sizeof(c->name), "synthetic LYWSD03MMC");
+    for (unsigned i = 0; i < SYNTHETIC_EVENTS; i++) {
+        uint8_t eir[31], data[17];
+        /* 0x181A, followed by the atc1441 (13 bytes) or pvvx (15 bytes) format */
+        size_t data_len = (i & 1) ? 15 : 13;
+        data[0] = 0x1a;
+        data[1] = 0x18;
+        for (unsigned j = 2; j < data_len + 2; j++) {
+            data[j] = (uint8_t)rng();
+        }
+        size_t len = put_field(eir, EIR_FLAGS, "\x06", 1);
+        len += put_field(eir + len, EIR_SERVICE_DATA, data, data_len + 2);
+        add_adv(c, 0x00, eir, len);
+    }
+}
+
+static void gen_malformed(struct corpus *c)
+{
+    snprintf(c->name, sizeof(c->name), "synthetic malformed");
+    for (unsigned i = 0; i < SYNTHETIC_EVENTS; i++) {
+        uint8_t eir[31];
+        size_t len = 1 + rng() % sizeof(eir);
+        for (size_t j = 0; j < len; j++) {
+            eir[j] = (uint8_t)rng();
+        }
+        /* keep a valid first field every other time, so that parsing gets a bit further */
+        if ((i & 1) && (len > 3)) {
+            eir[0] = 2;
+            eir[1] = EIR_FLAGS;
+        }
+        add_adv(c, 0x00, eir, len);
+    }
+}
+
+static int load_recording(struct corpus *c, const char *path)
+{
+    struct ble_adv_rec_reader r;
+    if (ble_adv_rec_reader_open(&r, path)) {
+        return -1;
+    }
+
+    snprintf(c->name, sizeof(c->name), "recording %s", path);
+    struct ble_adv_rec_event ev;
+    int retval;
+    while ((retval = ble_adv_rec_next(&r, &ev)) == 1) {
+        corpus_add(c, ev.buf, ev.len);
+    }
+
+    ble_adv_rec_reader_close(&r);
+    return retval;
+}
+
+/**
+ * @brief   Copy @p src to @p dest and apply a few random mutations, mostly to the EIR data
+ *
+ * @return  Length of the mutated event in bytes
+ */
+static size_t mutate(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    memcpy(dest, src, len);
+    unsigned mutations = 1 + rng() % 4;
+    for (unsigned i = 0; (i < mutations) && (len > 1); i++) {
+        size_t pos = (len > EIR_OFFSET) ? EIR_OFFSET - 1 + rng() % (len - EIR_OFFSET + 1)
+                                        : 1 + rng() % (len - 1);
+        switch (rng() % 4) {
+        case 0:
+            dest[pos] ^= (uint8_t)(1U << (rng() % 8));
+            break;
+        case 1:
+            dest[pos] = (uint8_t)rng();
+            break;
+        case 2:
+            /* mostly off by a few bytes, to hit the bounds checks */
+            dest[pos] = (uint8_t)(dest[pos] + (int)(rng() % 5) - 2);
+            break;
+        default:
+            len = 1 + rng() % len;
+            break;
+        }
+    }
+    return len;
+}
+
+static void print_hex(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        printf("%02x", buf[i]);
+    }
+    puts("");
+}
+
+/**
+ * @brief   Compare the fast paths to the reference decoders on all events of the corpus and
+ *          on mutated copies, with and without @ref BLE_ADV_PARSE_FLAG_LENIENT
+ *
+ * @return  Number of mismatches
+ */
+static size_t check_corpus(const struct corpus *c)
+{
+    static const unsigned flags[] = { 0, BLE_ADV_PARSE_FLAG_LENIENT };
+    uint8_t buf[HCI_MAX_EVENT_SIZE];
+    size_t checked = 0, failed = 0;
+
+    for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+        for (size_t i = 0; i < c->num; i++) {
+            for (unsigned m = 0; m <= CHECK_MUTATIONS; m++) {
+                const uint8_t *event = c->data + c->offs[i];
+                size_t len = corpus_event_len(c, i);
+                if (m) {
+                    if (len > sizeof(buf)) {
+                        break;
+                    }
+                    len = mutate(buf, event, len);
+                    event = buf;
+                }
+
+                const char *err = check_event(event, len, flags[f]);
+                checked++;
+                if (err && (failed++ < 8)) {
+                    printf("%s: event %zu, mutation %u, flags 0x%02x: %s\n", c->name, i, m,
+                           flags[f], err);
+                    print_hex(event, len);
+                }
+            }
+        }
+    }
+
+    printf("%-32s check  %9zu events %9zu mismatches\n", c->name, checked, failed);
+    return failed;
+}
+
+static int perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void perf_init(struct perf *p)
+{
+    p->cycles = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    p->branch_misses = -1;
+    if (p->cycles >= 0) {
+        p->branch_misses = perf_open(PERF_COUNT_HW_BRANCH_MISSES, p->cycles);
+    }
+}
+
+static void perf_start(const struct perf *p)
+{
+    if (p->cycles >= 0) {
+        ioctl(p->cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(p->cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void perf_stop(const struct perf *p, uint64_t *cycles, uint64_t *branch_misses)
+{
+    *cycles = *branch_misses = 0;
+    if (p->cycles >= 0) {
+        ioctl(p->cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (read(p->cycles, cycles, sizeof(*cycles)) != sizeof(*cycles)) {
+            *cycles = 0;
+        }
+    }
+    if ((p->branch_misses < 0)
+        || (read(p->branch_misses, branch_misses, sizeof(*branch_misses))
+            != sizeof(*branch_misses)))
+    {
+        *branch_misses = 0;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief   Run a single pass of a benchmark stage over the corpus
+ *
+ * @return  Number of packets processed
+ */
+typedef size_t (*stage_fn_t)(const struct corpus *c, unsigned *sink);
+
+static size_t stage_eir(const struct corpus *c, unsigned *sink)
+{
+    struct ble_adv adv;
+    for (size_t i = 0; i < c->num_views; i++) {
+        *sink += (unsigned)ble_adv_parse_eir(&adv, c->views[i].eir, c->views[i].eir_len, 0);
+        *sink += adv.has;
+    }
+    return c->num_views;
+}
+
+static size_t stage_views(const struct corpus *c, unsigned *sink)
+{
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+    for (size_t i = 0; i < c->num; i++) {
+        *sink += (unsigned)ble_adv_event_views(views, BLE_ADV_REPORTS_MAX,
+                                               c->data + c->offs[i], corpus_event_len(c, i));
+    }
+    return c->num;
+}
+
+static size_t stage_event(const struct corpus *c, unsigned *sink)
+{
+    struct ble_adv advs[BLE_ADV_REPORTS_MAX];
+    for (size_t i = 0; i < c->num; i++) {
+        *sink += (unsigned)ble_adv_parse_event(advs, BLE_ADV_REPORTS_MAX,
+                                               c->data + c->offs[i], corpus_event_len(c, i), 0);
+    }
+    return c->num;
+}
+
+static size_t stage_select(const struct corpus *c, unsigned *sink)
+{
+    *sink += (unsigned)ble_adv_bulk_select(c->selected, c->views, c->num_views, EIR_SERVICE_DATA,
+                                           0x181A);
+    return c->num_views;
+}
+
+static void pipeline_cb(unsigned worker, const struct ble_adv *adv,
+                        const struct ble_adv_sensor *sensor, void *ctx)
+{
+    (void)ctx;
+    worker_sinks[worker].value += adv->has + (sensor ? sensor->decoder : 0);
+}
+
+static size_t stage_pipe(const struct corpus *c, unsigned *sink)
+{
+    for (size_t i = 0; i < c->num; i++) {
+        int num = ble_adv_pipeline_submit(&pipeline, c->data + c->offs[i],
+                                          corpus_event_len(c, i), 0, 0);
+        *sink += (unsigned)num;
+    }
+
+    if (ble_adv_pipeline_sync(&pipeline)) {
+        perror("ble_adv_pipeline_sync()");
+        exit(EXIT_FAILURE);
+    }
+    return c->num;
+}
+
+static void run(const struct corpus *c, const char *stage, stage_fn_t fn, double seconds,
+                const struct perf *p)
+{
+    static unsigned sink;
+    uint64_t budget = (uint64_t)(seconds * 1e9);
+    uint64_t packets = 0, cycles, branch_misses;
+
+    /* warm up caches and branch predictors */
+    fn(c, &sink);
+
+    perf_start(p);
+    uint64_t start = now_ns(), elapsed;
+    do {
+        packets += fn(c, &sink);
+        elapsed = now_ns() - start;
+    } while (elapsed < budget);
+    perf_stop(p, &cycles, &branch_misses);
+
+    if (!packets) {
+        printf("%-32s %-6s no packets\n", c->name, stage);
+        return;
+    }
+
+    double ns = (double)elapsed / (double)packets;
+    printf("%-32s %-6s %9.1f ns/pkt %9.3f Mpkt/s", c->name, stage, ns,
+           (double)packets * 1e3 / (double)elapsed);
+    if (cycles) {
+        printf(" %9.1f cycles/pkt %7.3f br-miss/pkt", (double)cycles / (double)packets,
+               (double)branch_misses / (double)packets);
+    }
+    puts("");
+
+    if (!(num_results & (num_results + 1))) {
+        /* grow whenever num_results + 1 is a power of two */
+        results = xrealloc(results, 2 * (num_results + 1) * sizeof(results[0]));
+    }
+    struct result *r = &results[num_results++];
+    snprintf(r->corpus, sizeof(r->corpus), "%s", c->name);
+    snprintf(r->stage, sizeof(r->stage), "%s", stage);
+    r->ns = ns;
+}
+
+static int save_results(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_results; i++) {
+        fprintf(f, "%s\t%s\t%.1f\n", results[i].corpus, results[i].stage, results[i].ns);
+    }
+
+    return fclose(f);
+}
+
+/**
+ * @brief   Compare the results to those in the baseline file at @p path
+ *
+ * @return  Number of results more than @p percent slower than in the baseline
+ * @retval  -1                  The baseline could not be read
+ *
+ * Results missing in the baseline are not compared, e.g. if a recording was added.
+ */
+static long compare_baseline(const char *path, double percent)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    char line[128];
+    size_t compared = 0;
+    long regressed = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *stage = strchr(line, '\t');
+        char *ns = stage ? strchr(stage + 1, '\t') : NULL;
+        if (!ns) {
+            continue;
+        }
+        *stage++ = '\0';
+        *ns++ = '\0';
+        double base = strtod(ns, NULL);
+
+        for (size_t i = 0; i < num_results; i++) {
+            const struct result *r = &results[i];
+            if (strcmp(r->corpus, line) || strcmp(r->stage, stage)) {
+                continue;
+            }
+            compared++;
+            if (r->ns > base * (1.0 + percent / 100.0)) {
+                printf("REGRESSION %s %s: %.1f ns/pkt, baseline %.1f ns/pkt (%+.1f %%)\n",
+                       r->corpus, r->stage, r->ns, base, (r->ns / base - 1.0) * 100.0);
+                regressed++;
+            }
+        }
+    }
+
+    fclose(f);
+    printf("%zu results compared to the baseline, %ld slower by more than %.0f %%\n", compared,
+           regressed, percent);
+    return regressed;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 0.5, percent = 20.0;
+    unsigned long workers = 0;
+    const char *output = NULL, *baseline = NULL;
+    int check = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:j:co:b:r:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = strtod(optarg, NULL);
+            break;
+        case 'j':
+            workers = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            check = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'r':
+            percent = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t SECONDS] [-j WORKERS] [-c] [-o FILE] "
+                    "[-b FILE [-r PERCENT]] [RECORDING...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (workers > BLE_ADV_PIPELINE_WORKERS_MAX) {
+        fprintf(stderr, "At most %u workers supported\n", BLE_ADV_PIPELINE_WORKERS_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    if (workers && ble_adv_pipeline_init(&pipeline, (unsigned)workers, 0, pipeline_cb, NULL)) {
+        perror("ble_adv_pipeline_init()");
+        exit(EXIT_FAILURE);
+    }
+
+    struct perf p;
+    perf_init(&p);
+    if (!check && (p.cycles < 0)) {
+        puts("perf_event_open() not permitted, only reporting times");
+    }
+
+    static void (*const generators[])(struct corpus *c) = {
+        gen_beacons, gen_names, gen_sensors, gen_malformed,
+    };
+    size_t num_generators = sizeof(generators) / sizeof(generators[0]);
+    size_t num_corpora = num_generators + (size_t)(argc - optind);
+    size_t mismatches = 0;
+    struct corpus *corpora = calloc(num_corpora, sizeof(corpora[0]));
+    if (!corpora) {
+        perror("calloc()");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < num_corpora; i++) {
+        struct corpus *c = &corpora[i];
+        if (i < num_generators) {
+            generators[i](c);
+        }
+        else if (load_recording(c, argv[optind + (int)(i - num_generators)])) {
+            perror("loading recording");
+            exit(EXIT_FAILURE);
+        }
+        corpus_finish(c);
+
+        if (check) {
+            mismatches += check_corpus(c);
+        }
+        else {
+            run(c, "eir", stage_eir, seconds, &p);
+            run(c, "views", stage_views, seconds, &p);
+            run(c, "event", stage_event, seconds, &p);
+            run(c, "select", stage_select, seconds, &p);
+            if (workers) {
+                run(c, "pipe", stage_pipe, seconds, &p);
+            }
+        }
+        corpus_free(c);
+    }
+
+    free(corpora);
+    if (workers) {
+        ble_adv_pipeline_destroy(&pipeline);
+    }
+
+    int retval = mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (!check && output && save_results(output)) {
+        perror("writing results");
+        retval = EXIT_FAILURE;
+    }
+    if (!check && baseline) {
+        long regressed = compare_baseline(baseline, percent);
+        if (regressed < 0) {
+            perror("reading baseline");
+        }
+        if (regressed) {
+            retval = EXIT_FAILURE;
+        }
+    }
+
+    free(results);
+    return retval;
+}
+
+#else /* BLE_ADV_BENCH_FUZZ */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!size) {
+        return 0;
+    }
+
+    unsigned flags = (data[0] & 0x01) ? BLE_ADV_PARSE_FLAG_LENIENT : 0;
+    const uint8_t *buf = data + 1;
+    size_t len = size - 1;
+
+    uint8_t event[HCI_MAX_EVENT_SIZE];
+    if (data[0] & 0x02) {
+        /* wrap the input into an LE Advertising Report event with a single report */
+        size_t eir_len = (len < UINT8_MAX - EIR_OFFSET + 2) ? len : UINT8_MAX - EIR_OFFSET + 2;
+        memset(event, 0, EIR_OFFSET);
+        event[0] = HCI_EVENT_PKT;
+        event[1] = EVT_LE_META_EVENT;
+        event[2] = (uint8_t)(EIR_OFFSET - 3 + eir_len + 1);
+        event[3] = 0x02; /* LE Advertising Report */
+        event[4] = 1;
+        event[13] = (uint8_t)eir_len;
+        memcpy(event + EIR_OFFSET, buf, eir_len);
+        event[EIR_OFFSET + eir_len] = 0xc0;
+        buf = event;
+        len = EIR_OFFSET + eir_len + 1;
+    }
+
+    const char *err = check_event(buf, len, flags);
+    if (err) {
+        fprintf(stderr, "%s\n", err);
+        abort();
+    }
+
+    return 0;
+}
+
+#endif /* BLE_ADV_BENCH_FUZZ */
+
+/** @} */
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_bulk
+ *
+ * @{
+ * @brief   Implementation of the bulk selection of advertisements
+ * @file
+ */
+#include "ble_adv_bulk.h"
+
+/**
+ * @brief   Walk the EIR fields and check for a field with the given type and UUID16
+ */
+static inline int has_field(const uint8_t *eir, size_t eir_len, uint8_t type, uint16_t uuid16)
+{
+    while (eir_len >= 2) {
+        uint8_t field_len = eir[0];
+        if ((field_len == 0) || (field_len > eir_len - 1)) {
+            return 0;
+        }
+
+        if ((eir[1] == type) && (field_len >= 3)
+            && (eir[2] == (uuid16 & 0xff)) && (eir[3] == (uuid16 >> 8)))
+        {
+            return 1;
+        }
+
+        eir += field_len + 1U;
+        eir_len -= field_len + 1U;
+    }
+
+    return 0;
+}
+
+size_t ble_adv_bulk_select(uint32_t *dest, const struct ble_adv_view *views, size_t num,
+                           uint8_t type, uint16_t uuid16)
+{
+    size_t matches = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        if (has_field(views[i].eir, views[i].eir_len, type, uuid16)) {
+            dest[matches++] = (uint32_t)i;
+        }
+    }
+
+    return matches;
+}
+
+/** @} */
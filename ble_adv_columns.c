@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_columns
+ *
+ * @{
+ * @brief   Implementation of the column-oriented batches
+ * @file
+ */
+#include "ble_adv_columns.h"
+#include "ble_adv_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief   Alignment of each column
+ */
+#define COLUMN_ALIGN            64
+
+/**
+ * @brief   Advance @p off past a column of @p size bytes and return the column's offset
+ */
+static size_t carve(size_t *off, size_t size)
+{
+    size_t start = *off;
+    *off = (start + size + COLUMN_ALIGN - 1) & ~(size_t)(COLUMN_ALIGN - 1);
+    return start;
+}
+
+/**
+ * @brief   Lay out all columns starting at @p mem
+ *
+ * @return  Total number of bytes needed
+ *
+ * @note    Pass `NULL` as @p mem to only compute the size
+ */
+static size_t layout(struct ble_adv_columns *cols, uint8_t *mem, size_t capacity,
+                     size_t arena_size)
+{
+    size_t off = 0;
+#define COLUMN(name) \
+    do { \
+        size_t start = carve(&off, capacity * sizeof(cols->name[0])); \
+        if (mem) { \
+            cols->name = (void *)(mem + start); \
+        } \
+    } while (0)
+    COLUMN(addr);
+    COLUMN(timestamp_us);
+    COLUMN(has);
+    COLUMN(service_uuid16);
+    COLUMN(ms_uuid16);
+    COLUMN(service_data_off);
+    COLUMN(ms_data_off);
+    COLUMN(name_off);
+    COLUMN(service_data_len);
+    COLUMN(ms_data_len);
+    COLUMN(name_len);
+    COLUMN(addr_type);
+    COLUMN(adapter);
+    COLUMN(flags);
+    COLUMN(rssi);
+    COLUMN(tx_power);
+#undef COLUMN
+    size_t start = carve(&off, arena_size);
+    if (mem) {
+        cols->arena = mem + start;
+    }
+    return off;
+}
+
+int ble_adv_columns_init(struct ble_adv_columns *cols, size_t capacity, size_t arena_size)
+{
+    /* offsets into the arena are 32 bit */
+    if (!cols || !capacity || (capacity > UINT32_MAX) || (arena_size > UINT32_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = layout(cols, NULL, capacity, arena_size);
+    cols->mem = aligned_alloc(COLUMN_ALIGN, size);
+    if (!cols->mem) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    layout(cols, cols->mem, capacity, arena_size);
+    cols->capacity = capacity;
+    cols->arena_size = arena_size;
+    ble_adv_columns_clear(cols);
+    return 0;
+}
+
+void ble_adv_columns_destroy(struct ble_adv_columns *cols)
+{
+    free(cols->mem);
+    cols->mem = NULL;
+}
+
+void ble_adv_columns_clear(struct ble_adv_columns *cols)
+{
+    cols->len = 0;
+    cols->arena_len = 0;
+    cols->dropped = 0;
+    cols->invalid = 0;
+}
+
+/**
+ * @brief   Copy @p len bytes to the arena
+ *
+ * @return  Offset of the copy in the arena
+ */
+static uint32_t arena_put(struct ble_adv_columns *cols, const uint8_t *data, size_t len)
+{
+    size_t off = cols->arena_len;
+    memcpy(cols->arena + off, data, len);
+    cols->arena_len += len;
+    return (uint32_t)off;
+}
+
+int ble_adv_columns_append_view(struct ble_adv_columns *cols, const struct ble_adv_view *view,
+                                uint8_t adapter, uint64_t timestamp_us, unsigned parse_flags)
+{
+    if (!cols || !view) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* the row is only committed by incrementing len, and the arena space it uses is only
+     * committed along with it. This allows bailing out at any point */
+    size_t row = cols->len;
+    size_t arena_start = cols->arena_len;
+    if (row >= cols->capacity) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    uint16_t has = 0;
+    const uint8_t *eir = view->eir;
+    size_t eir_len = view->eir_len;
+    cols->name_len[row] = 0;
+    cols->service_data_len[row] = 0;
+    cols->ms_data_len[row] = 0;
+    cols->tx_power[row] = INT8_MAX;
+    cols->flags[row] = 0;
+    cols->service_uuid16[row] = 0;
+    cols->ms_uuid16[row] = 0;
+    cols->service_data_off[row] = 0;
+    cols->ms_data_off[row] = 0;
+    cols->name_off[row] = 0;
+
+    while (eir_len) {
+        size_t field_len = eir[0];
+        if (!field_len) {
+            break;
+        }
+        if (field_len > eir_len - 1) {
+            if (parse_flags & BLE_ADV_PARSE_FLAG_LENIENT) {
+                has |= BLE_ADV_HAS_TRUNCATED;
+                break;
+            }
+            cols->arena_len = arena_start;
+            errno = EPROTO;
+            return -1;
+        }
+
+        uint8_t type = eir[1];
+        const uint8_t *data = eir + 2;
+        size_t data_len = field_len - 1;
+        eir += field_len + 1;
+        eir_len -= field_len + 1;
+
+        /* payload and name lengths fit into the uint8_t columns, as field_len does */
+        int is_name = (type == EIR_NAME_SHORT) || (type == EIR_NAME_COMPLETE);
+        int is_service = (type == EIR_SERVICE_DATA) && (data_len >= 2)
+                         && !(has & BLE_ADV_HAS_SERVICE_DATA);
+        int is_ms = (type == EIR_MANUFACTURER_SPECIFIC_DATA) && (data_len >= 2)
+                    && !(has & BLE_ADV_HAS_MS_DATA);
+        if ((is_name || is_service || is_ms)
+            && (cols->arena_size - cols->arena_len < data_len))
+        {
+            cols->arena_len = arena_start;
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        if (is_name && data_len) {
+            cols->name_off[row] = arena_put(cols, data, data_len);
+            cols->name_len[row] = (uint8_t)data_len;
+        }
+        else if (is_service) {
+            cols->service_uuid16[row] = (uint16_t)(data[0] | (data[1] << 8));
+            cols->service_data_off[row] = arena_put(cols, data + 2, data_len - 2);
+            cols->service_data_len[row] = (uint8_t)(data_len - 2);
+            has |= BLE_ADV_HAS_SERVICE_DATA;
+        }
+        else if (is_ms) {
+            cols->ms_uuid16[row] = (uint16_t)(data[0] | (data[1] << 8));
+            cols->ms_data_off[row] = arena_put(cols, data + 2, data_len - 2);
+            cols->ms_data_len[row] = (uint8_t)(data_len - 2);
+            has |= BLE_ADV_HAS_MS_DATA;
+        }
+        else if ((type == EIR_FLAGS) && data_len) {
+            cols->flags[row] = data[0];
+            has |= BLE_ADV_HAS_FLAGS;
+        }
+        else if ((type == EIR_TX_POWER) && (data_len == 1)) {
+            cols->tx_power[row] = (int8_t)data[0];
+        }
+    }
+
+    ble_adv_view_addr(view, cols->addr[row]);
+    cols->addr_type[row] = view->addr_type;
+    cols->rssi[row] = view->rssi;
+    cols->adapter[row] = adapter;
+    cols->timestamp_us[row] = timestamp_us;
+    cols->has[row] = has;
+    cols->len++;
+    return 0;
+}
+
+int ble_adv_columns_append_event(struct ble_adv_columns *cols, const void *buf, size_t len,
+                                 uint8_t adapter, uint64_t timestamp_us, unsigned parse_flags)
+{
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+
+    if (!cols || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned cut;
+    int num = ble_adv_split_event(views, BLE_ADV_REPORTS_MAX, buf, len, &cut);
+    if (num < 0) {
+        errno = -num;
+        return -1;
+    }
+
+    cols->invalid += cut;
+
+    int appended = 0;
+    for (int i = 0; i < num; i++) {
+        if (!ble_adv_columns_append_view(cols, &views[i], adapter, timestamp_us,
+                                         parse_flags))
+        {
+            appended++;
+        }
+        else if (errno == ENOBUFS) {
+            cols->dropped++;
+        }
+        else {
+            cols->invalid++;
+        }
+    }
+
+    return appended;
+}
+
+int ble_adv_columns_read(int dev, struct ble_adv_columns *cols, uint8_t adapter,
+                         unsigned parse_flags)
+{
+    struct ble_adv_events evs;
+
+    if ((dev == -1) || !cols) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (cols->len >= cols->capacity) {
+        /* do not consume events there is no row for */
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    unsigned vlen = ble_adv_events_fitting(cols->capacity - cols->len);
+    int received = ble_adv_recv_events(dev, &evs, vlen, adapter);
+    if (received < 0) {
+        return -1;
+    }
+
+    size_t first_row = cols->len;
+    size_t dropped = cols->dropped;
+    size_t invalid = cols->invalid;
+    size_t skipped = 0;
+    size_t bad_events = 0;
+    for (int i = 0; i < received; i++) {
+        int num = ble_adv_columns_append_event(cols, evs.buf[i], evs.len[i], adapter,
+                                               evs.timestamp_us[i], parse_flags);
+        if (num < 0) {
+            skipped += (errno == ENOENT);
+            bad_events += (errno != ENOENT);
+        }
+    }
+
+    size_t truncated = 0;
+    for (size_t row = first_row; row < cols->len; row++) {
+        truncated += !!(cols->has[row] & BLE_ADV_HAS_TRUNCATED);
+    }
+
+    struct ble_adv_read_tally tally = {
+        .events = (uint64_t)received,
+        .reports = cols->len - first_row,
+        .skipped = skipped,
+        .proto = cols->invalid - invalid + bad_events,
+        .space = cols->dropped - dropped,
+        .truncated = truncated,
+    };
+    ble_adv_stats_account(adapter, &tally);
+
+    return (int)(cols->len - first_row);
+}
+
+/** @} */
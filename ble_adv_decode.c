@@ -0,0 +1,609 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_decode
+ *
+ * @{
+ * @brief   Implementation of the decoder registry and the decoders
+ * @file
+ */
+#include "ble_adv_decode.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define UUID16_ENVIRONMENTAL_SENSING    0x181A  /**< Used by the custom LYWSD03MMC firmwares */
+#define UUID16_BTHOME                   0xFCD2  /**< BTHome */
+#define UUID16_XIAOMI                   0xFE95  /**< MiBeacon */
+#define UUID16_EDDYSTONE                0xFEAA  /**< Eddystone */
+#define COMPANY_ID_APPLE                0x004C  /**< iBeacon */
+#define COMPANY_ID_RUUVI                0x0499  /**< Ruuvi Innovations */
+
+#define MIBEACON_FC_ENCRYPTED           0x0008  /**< Payload is encrypted */
+#define MIBEACON_FC_MAC                 0x0010  /**< Address is included */
+#define MIBEACON_FC_CAPABILITY          0x0020  /**< Capability byte is included */
+#define MIBEACON_FC_OBJECT              0x0040  /**< Object is included */
+
+#define MIBEACON_OBJ_TEMPERATURE        0x1004  /**< int16 in 0.1 °C */
+#define MIBEACON_OBJ_HUMIDITY           0x1006  /**< uint16 in 0.1 % */
+#define MIBEACON_OBJ_BAT                0x100A  /**< uint8 in % */
+#define MIBEACON_OBJ_TEMP_HUMIDITY      0x100D  /**< int16 in 0.1 °C, uint16 in 0.1 % */
+
+#define BTHOME_INFO_ENCRYPTED           0x01    /**< Payload is encrypted */
+#define BTHOME_INFO_VERSION_MASK        0xE0    /**< Bits holding the version */
+#define BTHOME_INFO_VERSION_2           0x40    /**< Version 2 */
+#define BTHOME_SIZE_VARIABLE            0xFF    /**< Object starts with a length byte */
+
+#define EDDYSTONE_FRAME_UID             0x00    /**< Namespace and instance */
+#define EDDYSTONE_FRAME_URL             0x10    /**< Compressed URL */
+#define EDDYSTONE_FRAME_TLM             0x20    /**< Telemetry */
+#define EDDYSTONE_FRAME_EID             0x30    /**< Ephemeral ID */
+
+static inline uint16_t get_le16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static inline uint32_t get_le24(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16);
+}
+
+static inline uint16_t get_be16(const uint8_t *data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static inline uint32_t get_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8)
+           | data[3];
+}
+
+static int decode_atc1441(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    (void)len;
+    /* layout: addr[6], temperature (int16, 0.1 °C), humidity (%), battery (%), battery (mV),
+     * frame counter; all big endian */
+    dest->temperature = (int16_t)get_be16(data + 6) * 10;
+    dest->humidity = (uint16_t)(data[8] * 100U);
+    dest->bat = data[9];
+    dest->bat_mv = get_be16(data + 10);
+    dest->counter = data[12];
+    dest->has = BLE_ADV_SENSOR_HAS_TEMPERATURE | BLE_ADV_SENSOR_HAS_HUMIDITY
+                | BLE_ADV_SENSOR_HAS_BAT | BLE_ADV_SENSOR_HAS_BAT_MV
+                | BLE_ADV_SENSOR_HAS_COUNTER;
+    return 0;
+}
+
+static int decode_pvvx(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    (void)len;
+    /* layout: addr[6] (reversed), temperature (int16, 0.01 °C), humidity (0.01 %),
+     * battery (mV), battery (%), frame counter, flags; all little endian */
+    dest->temperature = (int16_t)get_le16(data + 6);
+    dest->humidity = get_le16(data + 8);
+    dest->bat_mv = get_le16(data + 10);
+    dest->bat = data[12];
+    dest->counter = data[13];
+    dest->has = BLE_ADV_SENSOR_HAS_TEMPERATURE | BLE_ADV_SENSOR_HAS_HUMIDITY
+                | BLE_ADV_SENSOR_HAS_BAT | BLE_ADV_SENSOR_HAS_BAT_MV
+                | BLE_ADV_SENSOR_HAS_COUNTER;
+    return 0;
+}
+
+/**
+ * @brief   Size of the BTHome objects by object ID, 0 for unknown objects
+ *
+ * Objects have no length field, so a single unknown object prevents decoding any object
+ * following it.
+ */
+static const uint8_t bthome_obj_size[256] = {
+    [0x00] = 1, [0x01] = 1, [0x02] = 2, [0x03] = 2, [0x04] = 3, [0x05] = 3, [0x06] = 2,
+    [0x07] = 2, [0x08] = 2, [0x09] = 1, [0x0A] = 3, [0x0B] = 3, [0x0C] = 2, [0x0D] = 2,
+    [0x0E] = 2, [0x0F] = 1, [0x10] = 1, [0x11] = 1, [0x12] = 2, [0x13] = 2, [0x14] = 2,
+    /* binary sensors */
+    [0x15] = 1, [0x16] = 1, [0x17] = 1, [0x18] = 1, [0x19] = 1, [0x1A] = 1, [0x1B] = 1,
+    [0x1C] = 1, [0x1D] = 1, [0x1E] = 1, [0x1F] = 1, [0x20] = 1, [0x21] = 1, [0x22] = 1,
+    [0x23] = 1, [0x24] = 1, [0x25] = 1, [0x26] = 1, [0x27] = 1, [0x28] = 1, [0x29] = 1,
+    [0x2A] = 1, [0x2B] = 1, [0x2C] = 1, [0x2D] = 1,
+    [0x2E] = 1, [0x2F] = 1, [0x3A] = 1, [0x3C] = 2, [0x3D] = 2, [0x3E] = 4, [0x3F] = 2,
+    [0x40] = 2, [0x41] = 2, [0x42] = 3, [0x43] = 2, [0x44] = 2, [0x45] = 2, [0x46] = 1,
+    [0x47] = 2, [0x48] = 2, [0x49] = 2, [0x4A] = 2, [0x4B] = 3, [0x4C] = 4, [0x4D] = 4,
+    [0x4E] = 4, [0x4F] = 4, [0x50] = 4, [0x51] = 2, [0x52] = 2,
+    [0x53] = BTHOME_SIZE_VARIABLE, [0x54] = BTHOME_SIZE_VARIABLE,
+    [0x55] = 4, [0x56] = 2, [0x57] = 1, [0x58] = 1, [0x59] = 1, [0x5A] = 2, [0x5B] = 4,
+    [0x5C] = 4, [0x5D] = 2,
+    /* device information */
+    [0xF0] = 2, [0xF1] = 4, [0xF2] = 3,
+};
+
+static void bthome_obj(struct ble_adv_sensor *dest, uint8_t id, const uint8_t *obj)
+{
+    switch (id) {
+    case 0x00:  /* packet id */
+        dest->counter = obj[0];
+        dest->has |= BLE_ADV_SENSOR_HAS_COUNTER;
+        break;
+    case 0x01:  /* battery, 1 % */
+        dest->bat = obj[0];
+        dest->has |= BLE_ADV_SENSOR_HAS_BAT;
+        break;
+    case 0x02:  /* temperature, 0.01 °C */
+        dest->temperature = (int16_t)get_le16(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+        break;
+    case 0x45:  /* temperature, 0.1 °C */
+        dest->temperature = (int16_t)get_le16(obj) * 10;
+        dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+        break;
+    case 0x57:  /* temperature, 1 °C */
+        dest->temperature = (int8_t)obj[0] * 100;
+        dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+        break;
+    case 0x03:  /* humidity, 0.01 % */
+        dest->humidity = get_le16(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_HUMIDITY;
+        break;
+    case 0x2E:  /* humidity, 1 % */
+        dest->humidity = (uint16_t)(obj[0] * 100U);
+        dest->has |= BLE_ADV_SENSOR_HAS_HUMIDITY;
+        break;
+    case 0x04:  /* pressure, 0.01 hPa = 1 Pa */
+        dest->pressure = get_le24(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_PRESSURE;
+        break;
+    case 0x05:  /* illuminance, 0.01 lx */
+        dest->illuminance = get_le24(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_ILLUMINANCE;
+        break;
+    case 0x0C:  /* voltage, 1 mV */
+        dest->bat_mv = get_le16(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_BAT_MV;
+        break;
+    case 0x4A:  /* voltage, 0.1 V */
+        dest->bat_mv = (uint16_t)(get_le16(obj) * 100U);
+        dest->has |= BLE_ADV_SENSOR_HAS_BAT_MV;
+        break;
+    case 0x12:  /* CO2, 1 ppm */
+        dest->co2 = get_le16(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_CO2;
+        break;
+    case 0x14:  /* moisture, 0.01 % */
+        dest->moisture = get_le16(obj);
+        dest->has |= BLE_ADV_SENSOR_HAS_MOISTURE;
+        break;
+    case 0x2F:  /* moisture, 1 % */
+        dest->moisture = (uint16_t)(obj[0] * 100U);
+        dest->has |= BLE_ADV_SENSOR_HAS_MOISTURE;
+        break;
+    case 0x3A:  /* button event */
+        dest->button = obj[0];
+        dest->has |= BLE_ADV_SENSOR_HAS_BUTTON;
+        break;
+    default:
+        break;
+    }
+}
+
+static int decode_bthome_v2(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    if (len < 1) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    if ((data[0] & BTHOME_INFO_VERSION_MASK) != BTHOME_INFO_VERSION_2) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    if (data[0] & BTHOME_INFO_ENCRYPTED) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t pos = 1;
+    while (pos < len) {
+        uint8_t id = data[pos++];
+        size_t size = bthome_obj_size[id];
+        if (size == BTHOME_SIZE_VARIABLE) {
+            size = (pos < len) ? (size_t)data[pos++] : SIZE_MAX;
+        }
+        else if (!size) {
+            /* cannot skip objects of unknown size, keep what was decoded so far */
+            return 0;
+        }
+
+        if (size > len - pos) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        bthome_obj(dest, id, data + pos);
+        pos += size;
+    }
+
+    return 0;
+}
+
+static int decode_mibeacon(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    if (len < 5) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    uint16_t fc = get_le16(data);
+    dest->counter = data[4];
+    dest->has = BLE_ADV_SENSOR_HAS_COUNTER;
+    if (fc & MIBEACON_FC_ENCRYPTED) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t pos = 5;
+    if (fc & MIBEACON_FC_MAC) {
+        pos += 6;
+    }
+    if (fc & MIBEACON_FC_CAPABILITY) {
+        pos += 1;
+    }
+
+    if (!(fc & MIBEACON_FC_OBJECT)) {
+        return 0;
+    }
+
+    while (pos + 3 <= len) {
+        uint16_t type = get_le16(data + pos);
+        size_t obj_len = data[pos + 2];
+        const uint8_t *obj = data + pos + 3;
+        pos += 3 + obj_len;
+        if (pos > len) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        switch (type) {
+        case MIBEACON_OBJ_TEMPERATURE:
+            if (obj_len >= 2) {
+                dest->temperature = (int16_t)get_le16(obj) * 10;
+                dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+            }
+            break;
+        case MIBEACON_OBJ_HUMIDITY:
+            if (obj_len >= 2) {
+                dest->humidity = (uint16_t)(get_le16(obj) * 10U);
+                dest->has |= BLE_ADV_SENSOR_HAS_HUMIDITY;
+            }
+            break;
+        case MIBEACON_OBJ_BAT:
+            if (obj_len >= 1) {
+                dest->bat = obj[0];
+                dest->has |= BLE_ADV_SENSOR_HAS_BAT;
+            }
+            break;
+        case MIBEACON_OBJ_TEMP_HUMIDITY:
+            if (obj_len >= 4) {
+                dest->temperature = (int16_t)get_le16(obj) * 10;
+                dest->humidity = (uint16_t)(get_le16(obj + 2) * 10U);
+                dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE | BLE_ADV_SENSOR_HAS_HUMIDITY;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int decode_ruuvi_rawv2(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    (void)len;
+    if (data[0] != 5) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    /* all fields big endian, all ones (or INT16_MIN for signed fields) mark invalid values */
+    uint16_t raw = get_be16(data + 1);
+    if (raw != 0x8000) {
+        /* 0.005 °C to 0.01 °C */
+        dest->temperature = (int16_t)raw / 2;
+        dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+    }
+
+    raw = get_be16(data + 3);
+    if (raw != 0xFFFF) {
+        /* 0.0025 % to 0.01 % */
+        dest->humidity = raw / 4;
+        dest->has |= BLE_ADV_SENSOR_HAS_HUMIDITY;
+    }
+
+    raw = get_be16(data + 5);
+    if (raw != 0xFFFF) {
+        dest->pressure = raw + 50000U;
+        dest->has |= BLE_ADV_SENSOR_HAS_PRESSURE;
+    }
+
+    int have_accel = 1;
+    for (unsigned i = 0; i < 3; i++) {
+        raw = get_be16(data + 7 + 2 * i);
+        dest->accel[i] = (int16_t)raw;
+        have_accel = have_accel && (raw != 0x8000);
+    }
+    if (have_accel) {
+        dest->has |= BLE_ADV_SENSOR_HAS_ACCEL;
+    }
+
+    /* 11 bit battery voltage above 1600 mV, 5 bit TX power above -40 dBm in steps of 2 dBm */
+    raw = get_be16(data + 13);
+    if ((raw >> 5) != 0x7FF) {
+        dest->bat_mv = (uint16_t)((raw >> 5) + 1600U);
+        dest->has |= BLE_ADV_SENSOR_HAS_BAT_MV;
+    }
+    if ((raw & 0x1F) != 0x1F) {
+        dest->tx_power = (int8_t)(-40 + 2 * (raw & 0x1F));
+        dest->has |= BLE_ADV_SENSOR_HAS_TX_POWER;
+    }
+
+    raw = get_be16(data + 16);
+    if (raw != 0xFFFF) {
+        dest->counter = raw;
+        dest->has |= BLE_ADV_SENSOR_HAS_COUNTER;
+    }
+
+    return 0;
+}
+
+static int decode_ibeacon(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    (void)len;
+    /* type 0x02 and length 0x15 tell iBeacons apart from other Apple advertisements */
+    if ((data[0] != 0x02) || (data[1] != 0x15)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    memcpy(dest->beacon_id, data + 2, 20);
+    dest->beacon_id_len = 20;
+    dest->tx_power = (int8_t)data[22];
+    dest->has = BLE_ADV_SENSOR_HAS_BEACON_ID | BLE_ADV_SENSOR_HAS_TX_POWER;
+    return 0;
+}
+
+static int decode_eddystone(struct ble_adv_sensor *dest, const uint8_t *data, size_t len)
+{
+    if (len < 2) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    switch (data[0]) {
+    case EDDYSTONE_FRAME_UID:
+        if (len < 18) {
+            break;
+        }
+        dest->tx_power = (int8_t)data[1];
+        memcpy(dest->beacon_id, data + 2, 16);
+        dest->beacon_id_len = 16;
+        dest->has = BLE_ADV_SENSOR_HAS_BEACON_ID | BLE_ADV_SENSOR_HAS_TX_POWER;
+        return 0;
+    case EDDYSTONE_FRAME_EID:
+        if (len < 10) {
+            break;
+        }
+        dest->tx_power = (int8_t)data[1];
+        memcpy(dest->beacon_id, data + 2, 8);
+        dest->beacon_id_len = 8;
+        dest->has = BLE_ADV_SENSOR_HAS_BEACON_ID | BLE_ADV_SENSOR_HAS_TX_POWER;
+        return 0;
+    case EDDYSTONE_FRAME_URL:
+        /* the URL itself is not decoded */
+        dest->tx_power = (int8_t)data[1];
+        dest->has = BLE_ADV_SENSOR_HAS_TX_POWER;
+        return 0;
+    case EDDYSTONE_FRAME_TLM:
+        /* only the unencrypted version 0 is supported */
+        if (len < 14) {
+            break;
+        }
+        if (data[1] != 0x00) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        dest->bat_mv = get_be16(data + 2);
+        if (dest->bat_mv) {
+            dest->has |= BLE_ADV_SENSOR_HAS_BAT_MV;
+        }
+        if (get_be16(data + 4) != 0x8000) {
+            /* signed 8.8 fixed point to 0.01 °C */
+            dest->temperature = (int16_t)get_be16(data + 4) * 100 / 256;
+            dest->has |= BLE_ADV_SENSOR_HAS_TEMPERATURE;
+        }
+        dest->counter = get_be32(data + 6);
+        dest->has |= BLE_ADV_SENSOR_HAS_COUNTER;
+        return 0;
+    default:
+        break;
+    }
+
+    errno = EBADMSG;
+    return -1;
+}
+
+/**
+ * @brief   The decoder registry
+ *
+ * @warning This must be sorted by kind, id and len, as it is searched with a binary search
+ */
+static const struct ble_adv_decoder decoders[] = {
+    {
+        .kind = BLE_ADV_DECODE_KIND_SERVICE_DATA, .id = UUID16_ENVIRONMENTAL_SENSING, .len = 13,
+        .decoder = BLE_ADV_DECODER_ATC1441, .name = "atc1441", .decode = decode_atc1441,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_SERVICE_DATA, .id = UUID16_ENVIRONMENTAL_SENSING, .len = 15,
+        .decoder = BLE_ADV_DECODER_PVVX, .name = "pvvx", .decode = decode_pvvx,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_SERVICE_DATA, .id = UUID16_BTHOME,
+        .len = BLE_ADV_DECODE_LEN_ANY, .decoder = BLE_ADV_DECODER_BTHOME_V2,
+        .name = "BTHome v2", .decode = decode_bthome_v2,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_SERVICE_DATA, .id = UUID16_XIAOMI,
+        .len = BLE_ADV_DECODE_LEN_ANY, .decoder = BLE_ADV_DECODER_MIBEACON, .name = "MiBeacon",
+        .decode = decode_mibeacon,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_SERVICE_DATA, .id = UUID16_EDDYSTONE,
+        .len = BLE_ADV_DECODE_LEN_ANY, .decoder = BLE_ADV_DECODER_EDDYSTONE,
+        .name = "Eddystone", .decode = decode_eddystone,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_MS_DATA, .id = COMPANY_ID_APPLE, .len = 23,
+        .decoder = BLE_ADV_DECODER_IBEACON, .name = "iBeacon", .decode = decode_ibeacon,
+    },
+    {
+        .kind = BLE_ADV_DECODE_KIND_MS_DATA, .id = COMPANY_ID_RUUVI, .len = 24,
+        .decoder = BLE_ADV_DECODER_RUUVI_RAWV2, .name = "Ruuvi RAWv2",
+        .decode = decode_ruuvi_rawv2,
+    },
+};
+
+#define NUM_DECODERS    (sizeof(decoders) / sizeof(decoders[0]))
+
+static uint32_t decoder_key(uint8_t kind, uint16_t id, uint8_t len)
+{
+    return ((uint32_t)kind << 24) | ((uint32_t)id << 8) | len;
+}
+
+static const struct ble_adv_decoder *search(uint32_t key)
+{
+    size_t lo = 0, hi = NUM_DECODERS;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        uint32_t cur = decoder_key(decoders[mid].kind, decoders[mid].id, decoders[mid].len);
+        if (cur == key) {
+            return &decoders[mid];
+        }
+        if (cur < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+const struct ble_adv_decoder *ble_adv_decoder_lookup(uint8_t kind, uint16_t id, size_t len)
+{
+    const struct ble_adv_decoder *result = NULL;
+    if ((len > BLE_ADV_DECODE_LEN_ANY) && (len <= UINT8_MAX)) {
+        result = search(decoder_key(kind, id, (uint8_t)len));
+    }
+
+    if (!result) {
+        result = search(decoder_key(kind, id, BLE_ADV_DECODE_LEN_ANY));
+    }
+
+    return result;
+}
+
+static int try_decode(struct ble_adv_sensor *dest, uint8_t kind, uint16_t id,
+                      const uint8_t *data, size_t len)
+{
+    const struct ble_adv_decoder *decoder = ble_adv_decoder_lookup(kind, id, len);
+    if (!decoder) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    memset(dest, 0, sizeof(*dest));
+    dest->decoder = decoder->decoder;
+    return decoder->decode(dest, data, len);
+}
+
+int ble_adv_decode(struct ble_adv_sensor *dest, const struct ble_adv *adv)
+{
+    if (!dest || !adv) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((adv->has & BLE_ADV_HAS_SERVICE_DATA)
+        && (ble_adv_decoder_lookup(BLE_ADV_DECODE_KIND_SERVICE_DATA, adv->service_uuid16,
+                                   adv->service_data_len)
+            || !(adv->has & BLE_ADV_HAS_MS_DATA)))
+    {
+        return try_decode(dest, BLE_ADV_DECODE_KIND_SERVICE_DATA, adv->service_uuid16,
+                          adv->service_data, adv->service_data_len);
+    }
+
+    if (adv->has & BLE_ADV_HAS_MS_DATA) {
+        return try_decode(dest, BLE_ADV_DECODE_KIND_MS_DATA, adv->ms_uuid16, adv->ms_data,
+                          adv->ms_data_len);
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+int ble_adv_decode_view(struct ble_adv_sensor *dest, const struct ble_adv_view *view)
+{
+    if (!dest || !view) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const uint8_t *pos = view->eir;
+    const uint8_t *end = view->eir + view->eir_len;
+    while (pos < end) {
+        size_t field_len = *pos++;
+        if (!field_len || (field_len > (size_t)(end - pos))) {
+            break;
+        }
+
+        uint8_t type = pos[0];
+        const uint8_t *data = pos + 1;
+        pos += field_len;
+        if (field_len < 3) {
+            continue;
+        }
+
+        uint8_t kind;
+        if (type == EIR_SERVICE_DATA) {
+            kind = BLE_ADV_DECODE_KIND_SERVICE_DATA;
+        }
+        else if (type == EIR_MANUFACTURER_SPECIFIC_DATA) {
+            kind = BLE_ADV_DECODE_KIND_MS_DATA;
+        }
+        else {
+            continue;
+        }
+
+        uint16_t id = get_le16(data);
+        if (ble_adv_decoder_lookup(kind, id, field_len - 3)) {
+            return try_decode(dest, kind, id, data + 2, field_len - 3);
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+const char *ble_adv_decoder_name(uint8_t decoder)
+{
+    for (size_t i = 0; i < NUM_DECODERS; i++) {
+        if (decoders[i].decoder == decoder) {
+            return decoders[i].name;
+        }
+    }
+
+    return "<unknown>";
+}
+
+/** @} */
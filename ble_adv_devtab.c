@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_devtab
+ *
+ * @{
+ * @brief   Implementation of the device table
+ * @file
+ */
+#include "ble_adv_devtab.h"
+#include "ble_adv_stats.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief   Marks an empty slot or the end of a list
+ */
+#define NIL                     UINT32_MAX
+
+/**
+ * @brief   Maximum number of expired entries to evict per update
+ */
+#define EXPIRE_PER_UPDATE       2
+
+#define FNV_OFFSET              UINT32_C(2166136261)
+#define FNV_PRIME               UINT32_C(16777619)
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint32_t hash_addr(const uint8_t addr[6])
+{
+    uint64_t key = 0;
+    memcpy(&key, addr, 6);
+    /* Fibonacci hashing, the upper bits are well mixed */
+    return (uint32_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static uint32_t hash_payload(const struct ble_adv *adv)
+{
+    uint32_t hash = FNV_OFFSET;
+    if (adv->has & BLE_ADV_HAS_SERVICE_DATA) {
+        uint8_t uuid[2] = { (uint8_t)adv->service_uuid16, (uint8_t)(adv->service_uuid16 >> 8) };
+        hash = fnv1a(hash, uuid, sizeof(uuid));
+        hash = fnv1a(hash, adv->service_data, adv->service_data_len);
+    }
+    if (adv->has & BLE_ADV_HAS_MS_DATA) {
+        uint8_t uuid[2] = { (uint8_t)adv->ms_uuid16, (uint8_t)(adv->ms_uuid16 >> 8) };
+        hash = fnv1a(hash, uuid, sizeof(uuid));
+        hash = fnv1a(hash, adv->ms_data, adv->ms_data_len);
+    }
+    return hash;
+}
+
+int ble_adv_devtab_init(struct ble_adv_devtab *tab, size_t capacity, uint64_t ttl_ms)
+{
+    if (!tab || !capacity || (capacity > BLE_ADV_DEVTAB_CAPACITY_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* keep the load factor at or below 50% */
+    size_t num_slots = 2;
+    while (num_slots < 2 * capacity) {
+        num_slots <<= 1;
+    }
+
+    tab->entries = calloc(capacity, sizeof(tab->entries[0]));
+    tab->slots = malloc(num_slots * sizeof(tab->slots[0]));
+    if (!tab->entries || !tab->slots) {
+        free(tab->entries);
+        free(tab->slots);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(tab->slots, 0xff, num_slots * sizeof(tab->slots[0]));
+    for (size_t i = 0; i < capacity; i++) {
+        tab->entries[i].lru_next = (i + 1 < capacity) ? (uint32_t)(i + 1) : NIL;
+    }
+    tab->slot_mask = (uint32_t)(num_slots - 1);
+    tab->capacity = (uint32_t)capacity;
+    tab->len = 0;
+    tab->lru_head = NIL;
+    tab->lru_tail = NIL;
+    tab->free_head = 0;
+    tab->ttl_ms = ttl_ms;
+    tab->evicted = 0;
+    tab->expired = 0;
+    return 0;
+}
+
+void ble_adv_devtab_destroy(struct ble_adv_devtab *tab)
+{
+    free(tab->entries);
+    free(tab->slots);
+    tab->entries = NULL;
+    tab->slots = NULL;
+}
+
+static uint32_t find_slot(const struct ble_adv_devtab *tab, const uint8_t addr[6],
+                          uint32_t hash)
+{
+    uint32_t slot = hash & tab->slot_mask;
+    while (tab->slots[slot] != NIL) {
+        const struct ble_adv_devtab_entry *e = &tab->entries[tab->slots[slot]];
+        if ((e->addr_hash == hash) && !memcmp(e->addr, addr, sizeof(e->addr))) {
+            break;
+        }
+        slot = (slot + 1) & tab->slot_mask;
+    }
+
+    return slot;
+}
+
+static void lru_unlink(struct ble_adv_devtab *tab, uint32_t idx)
+{
+    struct ble_adv_devtab_entry *e = &tab->entries[idx];
+    if (e->lru_prev != NIL) {
+        tab->entries[e->lru_prev].lru_next = e->lru_next;
+    }
+    else {
+        tab->lru_head = e->lru_next;
+    }
+
+    if (e->lru_next != NIL) {
+        tab->entries[e->lru_next].lru_prev = e->lru_prev;
+    }
+    else {
+        tab->lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(struct ble_adv_devtab *tab, uint32_t idx)
+{
+    struct ble_adv_devtab_entry *e = &tab->entries[idx];
+    e->lru_prev = NIL;
+    e->lru_next = tab->lru_head;
+    if (tab->lru_head != NIL) {
+        tab->entries[tab->lru_head].lru_prev = idx;
+    }
+    else {
+        tab->lru_tail = idx;
+    }
+    tab->lru_head = idx;
+}
+
+static void remove_entry(struct ble_adv_devtab *tab, uint32_t idx)
+{
+    struct ble_adv_devtab_entry *e = &tab->entries[idx];
+    uint32_t hole = find_slot(tab, e->addr, e->addr_hash);
+
+    /* backward shift deletion: move later entries of the probe sequence into the hole, so that
+     * no tombstones are needed and lookups stay short */
+    uint32_t slot = hole;
+    while (1) {
+        slot = (slot + 1) & tab->slot_mask;
+        if (tab->slots[slot] == NIL) {
+            break;
+        }
+        uint32_t home = tab->entries[tab->slots[slot]].addr_hash & tab->slot_mask;
+        /* may the entry in slot be moved to hole without breaking its probe sequence? */
+        if (((slot - home) & tab->slot_mask) >= ((slot - hole) & tab->slot_mask)) {
+            tab->slots[hole] = tab->slots[slot];
+            hole = slot;
+        }
+    }
+    tab->slots[hole] = NIL;
+
+    lru_unlink(tab, idx);
+    e->lru_next = tab->free_head;
+    tab->free_head = idx;
+    tab->len--;
+}
+
+static int is_expired(const struct ble_adv_devtab *tab, uint32_t idx, uint64_t now_ms)
+{
+    return tab->ttl_ms && (now_ms - tab->entries[idx].last_seen_ms > tab->ttl_ms);
+}
+
+static size_t expire(struct ble_adv_devtab *tab, uint64_t now_ms, size_t max)
+{
+    size_t num = 0;
+    while ((num < max) && (tab->lru_tail != NIL) && is_expired(tab, tab->lru_tail, now_ms)) {
+        remove_entry(tab, tab->lru_tail);
+        num++;
+    }
+
+    tab->expired += num;
+    return num;
+}
+
+int ble_adv_devtab_update(struct ble_adv_devtab *tab, const struct ble_adv *adv,
+                          uint64_t now_ms, const struct ble_adv_devtab_entry **entry)
+{
+    expire(tab, now_ms, EXPIRE_PER_UPDATE);
+
+    uint32_t hash = hash_addr(adv->addr);
+    uint32_t slot = find_slot(tab, adv->addr, hash);
+    uint32_t payload_hash = hash_payload(adv);
+    struct ble_adv_devtab_entry *e;
+    int retval;
+
+    if (tab->slots[slot] != NIL) {
+        uint32_t idx = tab->slots[slot];
+        e = &tab->entries[idx];
+        lru_unlink(tab, idx);
+        lru_push_front(tab, idx);
+        retval = (e->payload_hash != payload_hash);
+        if (retval) {
+            e->payload_hash = payload_hash;
+            e->changed_ms = now_ms;
+        }
+        e->seen++;
+    }
+    else {
+        if (tab->free_head == NIL) {
+            remove_entry(tab, tab->lru_tail);
+            tab->evicted++;
+            /* the probe sequence may have changed */
+            slot = find_slot(tab, adv->addr, hash);
+        }
+
+        uint32_t idx = tab->free_head;
+        e = &tab->entries[idx];
+        tab->free_head = e->lru_next;
+        tab->slots[slot] = idx;
+        tab->len++;
+        lru_push_front(tab, idx);
+        memcpy(e->addr, adv->addr, sizeof(e->addr));
+        e->addr_hash = hash;
+        e->payload_hash = payload_hash;
+        e->first_seen_ms = now_ms;
+        e->changed_ms = now_ms;
+        e->seen = 1;
+        retval = 1;
+    }
+
+    if (!retval) {
+        ble_adv_stats_add(adv->adapter, BLE_ADV_STATS_DEDUPLICATED, 1);
+    }
+
+    e->last_seen_ms = now_ms;
+    e->addr_type = adv->addr_type;
+    e->rssi = adv->rssi;
+    if (entry) {
+        *entry = e;
+    }
+
+    return retval;
+}
+
+const struct ble_adv_devtab_entry *ble_adv_devtab_find(const struct ble_adv_devtab *tab,
+                                                       const uint8_t addr[6])
+{
+    uint32_t slot = find_slot(tab, addr, hash_addr(addr));
+    if (tab->slots[slot] == NIL) {
+        return NULL;
+    }
+
+    return &tab->entries[tab->slots[slot]];
+}
+
+size_t ble_adv_devtab_expire(struct ble_adv_devtab *tab, uint64_t now_ms)
+{
+    return expire(tab, now_ms, SIZE_MAX);
+}
+
+/** @} */
@@ -0,0 +1,360 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_ext
+ *
+ * @{
+ * @brief   Implementation of extended advertising scanning
+ * @file
+ */
+#include "ble_adv_ext.h"
+#include "ble_adv_internal.h"
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * @name    HCI commands and events of extended scanning
+ * @{
+ */
+#define OCF_LE_SET_EXT_SCAN_PARAMETERS              0x0041
+#define OCF_LE_SET_EXT_SCAN_ENABLE                  0x0042
+#define EVT_LE_EXT_ADVERTISING_REPORT               0x0D
+/** @} */
+
+/**
+ * @brief   Length of a single report in the LE Extended Advertising Report event without data
+ */
+#define EXT_REPORT_HDR_LEN                          24
+
+/**
+ * @name    Data status, stored in bits 5 and 6 of the event type
+ * @{
+ */
+#define DATA_STATUS_SHIFT                           5
+#define DATA_STATUS_MASK                            0x03
+#define DATA_STATUS_INCOMPLETE                      0x01
+/** @} */
+
+/**
+ * @name    States of a reassembly slot
+ * @{
+ */
+#define SLOT_FREE                                   0
+#define SLOT_ASSEMBLING                             1
+#define SLOT_HANDED_OUT                             2
+/** @} */
+
+static int send_status_cmd(int dev, uint16_t ocf, void *cparam, int clen, int to)
+{
+    uint8_t status;
+    struct hci_request rq;
+
+    memset(&rq, 0, sizeof(rq));
+    rq.ogf = OGF_LE_CTL;
+    rq.ocf = ocf;
+    rq.cparam = cparam;
+    rq.clen = clen;
+    rq.rparam = &status;
+    rq.rlen = 1;
+
+    if (hci_send_req(dev, &rq, to) < 0) {
+        return -1;
+    }
+
+    if (status) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int set_ext_scan_enable(int dev, uint8_t enable, uint8_t filter_dup, uint16_t duration,
+                               uint16_t period, int to)
+{
+    uint8_t cp[6] = {
+        enable,
+        filter_dup,
+        (uint8_t)duration, (uint8_t)(duration >> 8),
+        (uint8_t)period, (uint8_t)(period >> 8),
+    };
+
+    return send_status_cmd(dev, OCF_LE_SET_EXT_SCAN_ENABLE, cp, sizeof(cp), to);
+}
+
+static int set_ext_scan_parameters(int dev, const struct ble_adv_ext_scan_params *params,
+                                   int to)
+{
+    /* own address type, filter policy, PHYs, followed by one entry per PHY */
+    uint8_t cp[3 + 2 * 5];
+    int len = 0;
+
+    cp[len++] = params->own_addr_type;
+    cp[len++] = params->filter_policy;
+    cp[len++] = params->phys;
+
+    const struct ble_adv_ext_scan_phy *phys[] = { &params->phy_1m, &params->phy_coded };
+    const uint8_t bits[] = { BLE_ADV_EXT_PHY_1M, BLE_ADV_EXT_PHY_CODED };
+    for (unsigned i = 0; i < sizeof(bits); i++) {
+        if (!(params->phys & bits[i])) {
+            continue;
+        }
+        cp[len++] = phys[i]->scan_type;
+        cp[len++] = (uint8_t)phys[i]->interval;
+        cp[len++] = (uint8_t)(phys[i]->interval >> 8);
+        cp[len++] = (uint8_t)phys[i]->window;
+        cp[len++] = (uint8_t)(phys[i]->window >> 8);
+    }
+
+    return send_status_cmd(dev, OCF_LE_SET_EXT_SCAN_PARAMETERS, cp, len, to);
+}
+
+static int is_valid_phy(const struct ble_adv_ext_scan_phy *phy)
+{
+    return (phy->interval >= BLE_ADV_SCAN_INTERVAL_MIN)
+        && (phy->window >= BLE_ADV_SCAN_INTERVAL_MIN)
+        && (phy->window <= phy->interval);
+}
+
+int ble_adv_ext_scan_params_init(struct ble_adv_ext_scan_params *params, unsigned profile,
+                                 unsigned flags, uint8_t phys)
+{
+    struct ble_adv_scan_params legacy;
+
+    if (!params || !phys || (phys & ~(BLE_ADV_EXT_PHY_1M | BLE_ADV_EXT_PHY_CODED))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ble_adv_scan_params_init(&legacy, profile, flags)) {
+        return -1;
+    }
+
+    memset(params, 0, sizeof(*params));
+    params->phy_1m.interval = legacy.interval;
+    params->phy_1m.window = legacy.window;
+    params->phy_1m.scan_type = legacy.scan_type;
+    params->phy_coded = params->phy_1m;
+    params->phys = phys;
+    params->own_addr_type = legacy.own_addr_type;
+    params->filter_policy = legacy.filter_policy;
+    params->filter_duplicates = legacy.filter_duplicates;
+    params->hci_timeout_ms = legacy.hci_timeout_ms;
+    return 0;
+}
+
+int ble_adv_ext_scan(int dev, const struct ble_adv_ext_scan_params *params)
+{
+    if ((dev == -1) || !params || !params->phys
+        || (params->phys & ~(BLE_ADV_EXT_PHY_1M | BLE_ADV_EXT_PHY_CODED))
+        || ((params->phys & BLE_ADV_EXT_PHY_1M) && !is_valid_phy(&params->phy_1m))
+        || ((params->phys & BLE_ADV_EXT_PHY_CODED) && !is_valid_phy(&params->phy_coded)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int to = (params->hci_timeout_ms > 0) ? params->hci_timeout_ms : HCI_TIMEOUT_MS;
+
+    if (set_ext_scan_parameters(dev, params, to)) {
+        if (errno != EIO) {
+            return -1;
+        }
+        /* maybe already scanning, trying to disable scanning first to be able to
+         * apply the config */
+        if (set_ext_scan_enable(dev, 0, 0, 0, 0, to) || set_ext_scan_parameters(dev, params, to)) {
+            return -1;
+        }
+    }
+
+    if (set_ext_scan_enable(dev, 1, params->filter_duplicates, params->duration,
+                            params->period, to))
+    {
+        return -1;
+    }
+
+    return ble_adv_set_hci_filter(dev);
+}
+
+int ble_adv_ext_scan_disable(int dev)
+{
+    if (dev == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return set_ext_scan_enable(dev, 0, 0, 0, 0, HCI_TIMEOUT_MS);
+}
+
+void ble_adv_ext_reasm_init(struct ble_adv_ext_reasm *reasm)
+{
+    memset(reasm, 0, sizeof(*reasm));
+}
+
+/**
+ * @brief   Find the slot currently assembling the given advertisement
+ */
+static struct ble_adv_ext_reasm_slot *find_slot(struct ble_adv_ext_reasm *reasm,
+                                                const uint8_t *bdaddr, uint8_t addr_type,
+                                                uint8_t sid)
+{
+    for (unsigned i = 0; i < BLE_ADV_EXT_REASM_SLOTS; i++) {
+        struct ble_adv_ext_reasm_slot *slot = &reasm->slots[i];
+        if ((slot->state == SLOT_ASSEMBLING) && (slot->sid == sid)
+            && (slot->addr_type == addr_type) && !memcmp(slot->bdaddr, bdaddr, 6))
+        {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief   Get a free slot, evicting the least recently used one still assembling if needed
+ *
+ * @return  The slot or `NULL` if all slots have been handed out in the current call
+ */
+static struct ble_adv_ext_reasm_slot *alloc_slot(struct ble_adv_ext_reasm *reasm)
+{
+    struct ble_adv_ext_reasm_slot *victim = NULL;
+    for (unsigned i = 0; i < BLE_ADV_EXT_REASM_SLOTS; i++) {
+        struct ble_adv_ext_reasm_slot *slot = &reasm->slots[i];
+        if (slot->state == SLOT_FREE) {
+            return slot;
+        }
+        if ((slot->state == SLOT_ASSEMBLING)
+            && (!victim || ((int32_t)(slot->age - victim->age) < 0)))
+        {
+            victim = slot;
+        }
+    }
+
+    return victim;
+}
+
+static void slot_append(struct ble_adv_ext_reasm_slot *slot, const uint8_t *data, size_t len)
+{
+    if (len > sizeof(slot->data) - slot->len) {
+        len = sizeof(slot->data) - slot->len;
+        slot->truncated = 1;
+    }
+    memcpy(slot->data + slot->len, data, len);
+    slot->len = (uint16_t)(slot->len + len);
+}
+
+int ble_adv_ext_parse_event(struct ble_adv_ext_reasm *reasm, struct ble_adv_ext_report *dest,
+                            size_t max, const void *_buf, size_t len)
+{
+    const uint8_t *buf = _buf;
+
+    if (!reasm || !dest || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (len < 1 + HCI_EVENT_HDR_SIZE + 2) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if ((buf[1] != EVT_LE_META_EVENT)
+        || (buf[1 + HCI_EVENT_HDR_SIZE] != EVT_LE_EXT_ADVERTISING_REPORT))
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* data handed out in the previous call is no longer referenced */
+    for (unsigned i = 0; i < BLE_ADV_EXT_REASM_SLOTS; i++) {
+        if (reasm->slots[i].state == SLOT_HANDED_OUT) {
+            reasm->slots[i].state = SLOT_FREE;
+        }
+    }
+
+    unsigned num_reports = buf[1 + HCI_EVENT_HDR_SIZE + 1];
+    const uint8_t *pos = buf + 1 + HCI_EVENT_HDR_SIZE + 2;
+    const uint8_t *end = buf + len;
+    size_t used = 0;
+
+    for (unsigned i = 0; i < num_reports; i++) {
+        if ((size_t)(end - pos) < EXT_REPORT_HDR_LEN) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        uint8_t data_len = pos[EXT_REPORT_HDR_LEN - 1];
+        const uint8_t *data = pos + EXT_REPORT_HDR_LEN;
+        if ((size_t)(end - data) < data_len) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        uint16_t event_type = (uint16_t)(pos[0] | (pos[1] << 8));
+        uint8_t addr_type = pos[2];
+        const uint8_t *bdaddr = pos + 3;
+        uint8_t sid = pos[11];
+        uint8_t status = (event_type >> DATA_STATUS_SHIFT) & DATA_STATUS_MASK;
+
+        struct ble_adv_ext_reasm_slot *slot = find_slot(reasm, bdaddr, addr_type, sid);
+        if (status == DATA_STATUS_INCOMPLETE) {
+            if (!slot) {
+                slot = alloc_slot(reasm);
+                if (!slot) {
+                    /* all buffers handed out in this call, drop the fragment */
+                    pos = data + data_len;
+                    continue;
+                }
+                memcpy(slot->bdaddr, bdaddr, sizeof(slot->bdaddr));
+                slot->addr_type = addr_type;
+                slot->sid = sid;
+                slot->len = 0;
+                slot->truncated = 0;
+                slot->state = SLOT_ASSEMBLING;
+            }
+            slot->age = reasm->clock++;
+            slot_append(slot, data, data_len);
+            pos = data + data_len;
+            continue;
+        }
+
+        if (slot) {
+            slot_append(slot, data, data_len);
+            slot->state = SLOT_HANDED_OUT;
+        }
+
+        if (used < max) {
+            struct ble_adv_ext_report *r = &dest[used++];
+            r->event_type = event_type;
+            r->primary_phy = pos[9];
+            r->secondary_phy = pos[10];
+            r->sid = sid;
+            r->tx_power = (int8_t)pos[12];
+            r->periodic_interval = (uint16_t)(pos[14] | (pos[15] << 8));
+            r->view.evt_type = (uint8_t)event_type;
+            r->view.addr_type = addr_type;
+            r->view.rssi = (int8_t)pos[13];
+            if (slot) {
+                r->view.bdaddr = slot->bdaddr;
+                r->view.eir = slot->data;
+                r->view.eir_len = slot->len;
+                r->status = slot->truncated ? BLE_ADV_EXT_STATUS_TRUNCATED : status;
+            }
+            else {
+                r->view.bdaddr = bdaddr;
+                r->view.eir = data;
+                r->view.eir_len = data_len;
+                r->status = status;
+            }
+        }
+
+        pos = data + data_len;
+    }
+
+    return (int)used;
+}
+
+/** @} */
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_fields
+ *
+ * @{
+ * @brief   Implementation of the EIR field index
+ * @file
+ */
+#include "ble_adv_fields.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+int ble_adv_fields_index(struct ble_adv_fields *dest, const struct ble_adv_view *view,
+                         unsigned flags)
+{
+    if (!dest || !view) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const uint8_t *eir = view->eir;
+    size_t eir_len = view->eir_len;
+    size_t offset = 0;
+    dest->len = 0;
+    dest->truncated = 0;
+
+    while (offset < eir_len) {
+        uint8_t field_len = eir[offset];
+        if (field_len == 0) {
+            /* reached end of EIR */
+            break;
+        }
+
+        if (field_len > eir_len - offset - 1) {
+            if (flags & BLE_ADV_PARSE_FLAG_LENIENT) {
+                dest->truncated = 1;
+                break;
+            }
+            errno = EPROTO;
+            return -1;
+        }
+
+        if (dest->len == BLE_ADV_FIELDS_MAX) {
+            dest->truncated = 1;
+            break;
+        }
+
+        struct ble_adv_field *field = &dest->fields[dest->len++];
+        field->type = eir[offset + 1];
+        field->offset = (uint16_t)(offset + 2);
+        field->len = field_len - 1;
+        offset += field_len + 1U;
+    }
+
+    return dest->len;
+}
+
+const struct ble_adv_field *ble_adv_fields_next(const struct ble_adv_fields *fields,
+                                                uint8_t type, size_t *pos)
+{
+    while (*pos < fields->len) {
+        const struct ble_adv_field *field = &fields->fields[(*pos)++];
+        if ((type == BLE_ADV_FIELD_ANY) || (field->type == type)) {
+            return field;
+        }
+    }
+
+    return NULL;
+}
+
+int ble_adv_fields_next_service_data(const struct ble_adv_fields *fields,
+                                     const struct ble_adv_view *view, size_t *pos,
+                                     struct ble_adv_service_data *dest)
+{
+    while (*pos < fields->len) {
+        const struct ble_adv_field *field = &fields->fields[(*pos)++];
+        uint8_t uuid_len;
+        switch (field->type) {
+        case EIR_SERVICE_DATA:
+            uuid_len = 2;
+            break;
+        case EIR_SERVICE_DATA32:
+            uuid_len = 4;
+            break;
+        case EIR_SERVICE_DATA128:
+            uuid_len = 16;
+            break;
+        default:
+            continue;
+        }
+
+        if (field->len < uuid_len) {
+            continue;
+        }
+
+        dest->uuid = ble_adv_field_data(view, field);
+        dest->uuid_len = uuid_len;
+        dest->data = dest->uuid + uuid_len;
+        dest->len = field->len - uuid_len;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   Collect the UUIDs of the given size from the UUID list fields of type @p some or
+ *          @p all
+ */
+static size_t collect_uuids(void *dest, size_t max, size_t size, uint8_t some, uint8_t all,
+                            const struct ble_adv_fields *fields, const struct ble_adv_view *view)
+{
+    size_t num = 0;
+
+    for (size_t i = 0; i < fields->len; i++) {
+        const struct ble_adv_field *field = &fields->fields[i];
+        if ((field->type != some) && (field->type != all)) {
+            continue;
+        }
+
+        const uint8_t *data = ble_adv_field_data(view, field);
+        for (size_t j = 0; j + size <= field->len; j += size) {
+            if (num < max) {
+                /* data may be unaligned, byte order is fixed up by the caller */
+                memcpy((uint8_t *)dest + num * size, data + j, size);
+            }
+            num++;
+        }
+    }
+
+    return num;
+}
+
+size_t ble_adv_fields_uuid16s(uint16_t *dest, size_t max, const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view)
+{
+    size_t num = collect_uuids(dest, max, sizeof(*dest), EIR_UUID16_SOME, EIR_UUID16_ALL,
+                               fields, view);
+    for (size_t i = 0; (i < num) && (i < max); i++) {
+        dest[i] = le16toh(dest[i]);
+    }
+
+    return num;
+}
+
+size_t ble_adv_fields_uuid32s(uint32_t *dest, size_t max, const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view)
+{
+    size_t num = collect_uuids(dest, max, sizeof(*dest), EIR_UUID32_SOME, EIR_UUID32_ALL,
+                               fields, view);
+    for (size_t i = 0; (i < num) && (i < max); i++) {
+        dest[i] = le32toh(dest[i]);
+    }
+
+    return num;
+}
+
+size_t ble_adv_fields_uuid128s(uint8_t (*dest)[16], size_t max,
+                               const struct ble_adv_fields *fields,
+                               const struct ble_adv_view *view)
+{
+    return collect_uuids(dest, max, sizeof(*dest), EIR_UUID128_SOME, EIR_UUID128_ALL,
+                         fields, view);
+}
+
+int ble_adv_fields_appearance(const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view, uint16_t *dest)
+{
+    size_t pos = 0;
+    const struct ble_adv_field *field = ble_adv_fields_next(fields, EIR_APPEARANCE, &pos);
+    if (!field || (field->len != sizeof(*dest))) {
+        return 0;
+    }
+
+    const uint8_t *data = ble_adv_field_data(view, field);
+    *dest = (uint16_t)(data[0] | (data[1] << 8));
+    return 1;
+}
+
+/** @} */
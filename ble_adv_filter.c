@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_filter
+ *
+ * @{
+ * @brief   Implementation of the kernel-side advertisement filter
+ * @file
+ */
+#include "ble_adv_filter.h"
+#include "ble_adv_stats.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/**
+ * @name    Offsets of the fields of the first advertising report in the HCI event
+ * @{
+ */
+#define OFF_PKT_TYPE        0   /**< HCI packet type */
+#define OFF_EVT             1   /**< HCI event code */
+#define OFF_SUBEVENT        3   /**< LE meta subevent code */
+#define OFF_NUM_REPORTS     4   /**< Number of advertising reports */
+#define OFF_BDADDR          7   /**< Address of the sender (reversed byte order) */
+#define OFF_EIR_LEN         13  /**< Length of the EIR data */
+#define OFF_EIR             14  /**< Start of the EIR data */
+/** @} */
+
+/**
+ * @brief   Maximum number of EIR fields in a legacy advertisement (each at least two bytes)
+ */
+#define EIR_FIELDS_MAX      15
+
+/**
+ * @name    Scratch memory slots used by the filter program
+ * @{
+ */
+#define MEM_EIR_END         0   /**< Offset of the first byte after the EIR data */
+#define MEM_FIELD_LEN       1   /**< Length byte of the current EIR field */
+#define MEM_FIELD_POS       2   /**< Offset of the current EIR field */
+/** @} */
+
+#define RET_ACCEPT          0xffffffffU /**< Return value to accept the full packet */
+#define RET_DROP            0U          /**< Return value to drop the packet */
+
+/**
+ * @brief   State of the filter program generation
+ */
+struct prog {
+    struct sock_filter *insns;  /**< Generated instructions, or NULL to only count */
+    size_t len;                 /**< Number of instructions generated so far */
+    size_t max;                 /**< Number of entries in @ref prog::insns */
+    int err;                    /**< Set to a negative errno on failure */
+    size_t pass_addr;           /**< Position of the end of the address stage */
+    size_t pass_payload;        /**< Position of the end of the payload stage */
+};
+
+static size_t emit(struct prog *p, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+    if (p->len >= p->max) {
+        p->err = -E2BIG;
+    }
+    else if (p->insns) {
+        p->insns[p->len] = (struct sock_filter)BPF_JUMP(code, k, jt, jf);
+    }
+    return p->len++;
+}
+
+static void stmt(struct prog *p, uint16_t code, uint32_t k)
+{
+    emit(p, code, 0, 0, k);
+}
+
+/**
+ * @brief   Let the false branch of the conditional jump at @p pos jump to the current position
+ */
+static void patch_jf(struct prog *p, size_t pos)
+{
+    size_t dist = p->len - pos - 1;
+    if (dist > UINT8_MAX) {
+        p->err = -E2BIG;
+    }
+    else if (p->insns && (pos < p->max)) {
+        p->insns[pos].jf = (uint8_t)dist;
+    }
+}
+
+/**
+ * @brief   Let the unconditional jump at @p pos jump to the current position
+ */
+static void patch_ja(struct prog *p, size_t pos)
+{
+    if (p->insns && (pos < p->max)) {
+        p->insns[pos].k = (uint32_t)(p->len - pos - 1);
+    }
+}
+
+/**
+ * @brief   Unconditional jump to the position @p target, which may be not known yet
+ */
+static void ja(struct prog *p, size_t target)
+{
+    /* during the first pass the target is unknown (zero), don't underflow */
+    uint32_t dist = (target > p->len) ? (uint32_t)(target - p->len - 1) : 0;
+    stmt(p, BPF_JMP | BPF_JA, dist);
+}
+
+/**
+ * @brief   Accept the packet unless the byte at @p off has the value @p val
+ */
+static void accept_unless_byte(struct prog *p, uint32_t off, uint32_t val)
+{
+    stmt(p, BPF_LD | BPF_B | BPF_ABS, off);
+    emit(p, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, val);
+    stmt(p, BPF_RET | BPF_K, RET_ACCEPT);
+}
+
+static void gen_addr_stage(struct prog *p, const struct ble_adv_filter *f)
+{
+    stmt(p, BPF_LD | BPF_W | BPF_ABS, OFF_BDADDR);
+    for (size_t i = 0; i < f->addrs_len; i++) {
+        const uint8_t *a = f->addrs[i];
+        /* BPF loads are big endian, the HCI address is in reversed byte order */
+        uint32_t hi = ((uint32_t)a[5] << 24) | ((uint32_t)a[4] << 16) | ((uint32_t)a[3] << 8)
+                    | a[2];
+        uint32_t lo = ((uint32_t)a[1] << 8) | a[0];
+        emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 4, hi);
+        stmt(p, BPF_LD | BPF_H | BPF_ABS, OFF_BDADDR + 4);
+        emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, lo);
+        ja(p, p->pass_addr);
+        stmt(p, BPF_LD | BPF_W | BPF_ABS, OFF_BDADDR);
+    }
+    stmt(p, BPF_RET | BPF_K, RET_DROP);
+}
+
+static void gen_rssi_stage(struct prog *p, const struct ble_adv_filter *f)
+{
+    /* the RSSI is located right after the EIR data */
+    stmt(p, BPF_LD | BPF_B | BPF_ABS, OFF_EIR_LEN);
+    stmt(p, BPF_ALU | BPF_ADD | BPF_K, OFF_EIR);
+    stmt(p, BPF_MISC | BPF_TAX, 0);
+    stmt(p, BPF_LD | BPF_B | BPF_IND, 0);
+    /* comparisons are unsigned, flipping the sign bit maps int8_t onto uint8_t in order */
+    stmt(p, BPF_ALU | BPF_XOR | BPF_K, 0x80);
+    emit(p, BPF_JMP | BPF_JGE | BPF_K, 1, 0, (uint32_t)(f->min_rssi + 128));
+    stmt(p, BPF_RET | BPF_K, RET_DROP);
+}
+
+/**
+ * @brief   Match the UUID16 at the start of the current field against @p uuids
+ *
+ * @pre     A holds the field type, which has been checked to be of the data type expected
+ */
+static void gen_uuid_match(struct prog *p, const uint16_t *uuids, size_t uuids_len)
+{
+    stmt(p, BPF_LD | BPF_MEM, MEM_FIELD_LEN);
+    emit(p, BPF_JMP | BPF_JGE | BPF_K, 1, 0, 3);
+    size_t too_short = p->len;
+    stmt(p, BPF_JMP | BPF_JA, 0);
+    stmt(p, BPF_LD | BPF_H | BPF_IND, 2);
+    for (size_t i = 0; i < uuids_len; i++) {
+        /* UUIDs are little endian on the air, but BPF loads are big endian */
+        uint32_t k = (uint32_t)(((uuids[i] & 0xff) << 8) | (uuids[i] >> 8));
+        emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, k);
+        ja(p, p->pass_payload);
+    }
+    patch_ja(p, too_short);
+}
+
+static void gen_payload_stage(struct prog *p, const struct ble_adv_filter *f)
+{
+    stmt(p, BPF_LD | BPF_B | BPF_ABS, OFF_EIR_LEN);
+    stmt(p, BPF_ALU | BPF_ADD | BPF_K, OFF_EIR);
+    stmt(p, BPF_ST, MEM_EIR_END);
+    stmt(p, BPF_LDX | BPF_W | BPF_IMM, OFF_EIR);
+
+    /* classic BPF has no loops, so the TLV walk is unrolled. X points to the current field */
+    for (unsigned i = 0; i < EIR_FIELDS_MAX; i++) {
+        stmt(p, BPF_LD | BPF_MEM, MEM_EIR_END);
+        emit(p, BPF_JMP | BPF_JGT | BPF_X, 1, 0, 0);
+        stmt(p, BPF_RET | BPF_K, RET_DROP);
+        stmt(p, BPF_LD | BPF_B | BPF_IND, 0);
+        emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+        stmt(p, BPF_RET | BPF_K, RET_DROP);
+        stmt(p, BPF_ST, MEM_FIELD_LEN);
+        /* the field has to end within the EIR data, not in the RSSI byte or beyond */
+        stmt(p, BPF_STX, MEM_FIELD_POS);
+        stmt(p, BPF_ALU | BPF_ADD | BPF_K, 1);
+        stmt(p, BPF_ALU | BPF_ADD | BPF_X, 0);
+        stmt(p, BPF_LDX | BPF_MEM, MEM_EIR_END);
+        emit(p, BPF_JMP | BPF_JGT | BPF_X, 0, 1, 0);
+        stmt(p, BPF_RET | BPF_K, RET_DROP);
+        stmt(p, BPF_LDX | BPF_MEM, MEM_FIELD_POS);
+        stmt(p, BPF_LD | BPF_B | BPF_IND, 1);
+
+        size_t no_service = 0, no_ms = 0, skip_ms = 0;
+        int have_service = f->service_uuid16s_len != 0;
+        int have_ms = f->ms_uuid16s_len != 0;
+        if (have_service) {
+            no_service = emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, EIR_SERVICE_DATA);
+            gen_uuid_match(p, f->service_uuid16s, f->service_uuid16s_len);
+            skip_ms = p->len;
+            stmt(p, BPF_JMP | BPF_JA, 0);
+            patch_jf(p, no_service);
+        }
+        if (have_ms) {
+            no_ms = emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, EIR_MANUFACTURER_SPECIFIC_DATA);
+            gen_uuid_match(p, f->ms_uuid16s, f->ms_uuid16s_len);
+            patch_jf(p, no_ms);
+        }
+        if (have_service) {
+            patch_ja(p, skip_ms);
+        }
+
+        /* advance to next field: X += field_len + 1 */
+        stmt(p, BPF_LD | BPF_MEM, MEM_FIELD_LEN);
+        stmt(p, BPF_ALU | BPF_ADD | BPF_K, 1);
+        stmt(p, BPF_ALU | BPF_ADD | BPF_X, 0);
+        stmt(p, BPF_MISC | BPF_TAX, 0);
+    }
+    stmt(p, BPF_RET | BPF_K, RET_DROP);
+}
+
+static void gen(struct prog *p, const struct ble_adv_filter *f)
+{
+    p->len = 0;
+    p->err = 0;
+
+    accept_unless_byte(p, OFF_PKT_TYPE, HCI_EVENT_PKT);
+    accept_unless_byte(p, OFF_EVT, EVT_LE_META_EVENT);
+    accept_unless_byte(p, OFF_SUBEVENT, EVT_LE_ADVERTISING_REPORT);
+    accept_unless_byte(p, OFF_NUM_REPORTS, 1);
+
+    if (f->addrs_len) {
+        gen_addr_stage(p, f);
+        p->pass_addr = p->len;
+    }
+
+    if (f->min_rssi != BLE_ADV_FILTER_RSSI_ANY) {
+        gen_rssi_stage(p, f);
+    }
+
+    if (f->service_uuid16s_len || f->ms_uuid16s_len) {
+        gen_payload_stage(p, f);
+        p->pass_payload = p->len;
+    }
+
+    stmt(p, BPF_RET | BPF_K, RET_ACCEPT);
+}
+
+int ble_adv_filter_compile(struct sock_filter *dest, size_t max,
+                           const struct ble_adv_filter *filter)
+{
+    if (!dest || !filter || (filter->addrs_len && !filter->addrs)
+        || (filter->service_uuid16s_len && !filter->service_uuid16s)
+        || (filter->ms_uuid16s_len && !filter->ms_uuid16s))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((filter->service_uuid16s_len > BLE_ADV_FILTER_MAX_UUIDS)
+        || (filter->ms_uuid16s_len > BLE_ADV_FILTER_MAX_UUIDS))
+    {
+        errno = E2BIG;
+        return -1;
+    }
+
+    if (max > BLE_ADV_FILTER_MAX_INSNS) {
+        max = BLE_ADV_FILTER_MAX_INSNS;
+    }
+
+    /* first pass: determine the position of the stage ends, second pass: emit */
+    struct prog p = { .insns = NULL, .max = max };
+    gen(&p, filter);
+    if (p.err) {
+        errno = -p.err;
+        return -1;
+    }
+
+    p.insns = dest;
+    gen(&p, filter);
+    if (p.err) {
+        errno = -p.err;
+        return -1;
+    }
+
+    return (int)p.len;
+}
+
+int ble_adv_filter_attach(int dev, const struct ble_adv_filter *filter)
+{
+    struct sock_filter insns[BLE_ADV_FILTER_MAX_INSNS];
+
+    if (dev == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int len = ble_adv_filter_compile(insns, BLE_ADV_FILTER_MAX_INSNS, filter);
+    if (len < 0) {
+        return -1;
+    }
+
+    struct sock_fprog fprog = {
+        .len = (unsigned short)len,
+        .filter = insns,
+    };
+
+    return setsockopt(dev, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}
+
+int ble_adv_filter_detach(int dev)
+{
+    int dummy = 0;
+
+    if (dev == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return setsockopt(dev, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+}
+
+static int uuid_in(const uint16_t *uuids, size_t uuids_len, uint16_t uuid)
+{
+    for (size_t i = 0; i < uuids_len; i++) {
+        if (uuids[i] == uuid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Check the payload stage, walking the EIR data just like the generated program
+ *
+ * Both reject the advertisement at the first field that is empty or runs past the EIR data.
+ */
+static int payload_matches(const struct ble_adv_filter *f, const struct ble_adv_view *view)
+{
+    const uint8_t *eir = view->eir;
+    size_t pos = 0;
+    for (unsigned i = 0; (i < EIR_FIELDS_MAX) && (pos < view->eir_len); i++) {
+        size_t field_len = eir[pos];
+        if (!field_len || (pos + 1 + field_len > view->eir_len)) {
+            return 0;
+        }
+
+        uint8_t type = eir[pos + 1];
+        if ((field_len >= 3)
+            && ((type == EIR_SERVICE_DATA) || (type == EIR_MANUFACTURER_SPECIFIC_DATA)))
+        {
+            /* UUIDs and IDs are little endian on the air */
+            uint16_t uuid = (uint16_t)(eir[pos + 2] | (eir[pos + 3] << 8));
+            if ((type == EIR_SERVICE_DATA)
+                ? uuid_in(f->service_uuid16s, f->service_uuid16s_len, uuid)
+                : uuid_in(f->ms_uuid16s, f->ms_uuid16s_len, uuid))
+            {
+                return 1;
+            }
+        }
+        pos += field_len + 1;
+    }
+
+    return 0;
+}
+
+int ble_adv_filter_match(const struct ble_adv_filter *filter, const struct ble_adv_view *view,
+                         uint8_t adapter)
+{
+    if (!filter || !view) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int match = 1;
+    if (filter->addrs_len) {
+        uint8_t addr[6];
+        ble_adv_view_addr(view, addr);
+        match = 0;
+        for (size_t i = 0; !match && (i < filter->addrs_len); i++) {
+            match = !memcmp(filter->addrs[i], addr, sizeof(addr));
+        }
+    }
+
+    if (match && (filter->min_rssi != BLE_ADV_FILTER_RSSI_ANY)) {
+        match = view->rssi >= filter->min_rssi;
+    }
+
+    if (match && (filter->service_uuid16s_len || filter->ms_uuid16s_len)) {
+        match = payload_matches(filter, view);
+    }
+
+    if (!match) {
+        ble_adv_stats_add(adapter, BLE_ADV_STATS_FILTERED, 1);
+    }
+
+    return match;
+}
+
+/** @} */
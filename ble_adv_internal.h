@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_INTERNAL_H
+#define BLE_ADV_INTERNAL_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/**
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Helpers shared between the translation units of the library, not installed
+ * @file
+ */
+
+/**
+ * @brief   Timeout in milliseconds for synchronous HCI commands
+ */
+#define HCI_TIMEOUT_MS                              10000
+
+/**
+ * @brief   Let the HCI socket only pass LE meta events (which carry the advertising reports)
+ *          and request kernel receive timestamps
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_set_hci_filter(int dev);
+
+/**
+ * @brief   Size of the control buffer needed to receive the timestamp of an HCI event
+ */
+#define BLE_ADV_CMSG_SIZE                           CMSG_SPACE(sizeof(struct timeval))
+
+/**
+ * @brief   Get the kernel receive timestamp of an HCI event received with `recvmsg()`
+ *
+ * @param[in]       msg         Message header of the received event
+ *
+ * @return  Timestamp in µs since the epoch, or 0 if @p msg carries none
+ */
+uint64_t ble_adv_msg_timestamp(const struct msghdr *msg);
+
+/**
+ * @brief   HCI events received by @ref ble_adv_recv_events
+ */
+struct ble_adv_events {
+    uint8_t buf[BLE_ADV_READ_MANY_EVENTS][HCI_MAX_EVENT_SIZE];  /**< Raw HCI events */
+    size_t len[BLE_ADV_READ_MANY_EVENTS];                       /**< Length of each event */
+    /**
+     * @brief   Kernel receive timestamp of each event in µs since the epoch, or 0 if none
+     *
+     * There is deliberately no fallback to the time of the read: a missing timestamp is
+     * reported as 0 everywhere, as documented for @ref ble_adv::timestamp_us.
+     */
+    uint64_t timestamp_us[BLE_ADV_READ_MANY_EVENTS];
+};
+
+/**
+ * @brief   Get the number of HCI events that can be consumed without dropping reports
+ *
+ * @param[in]       space       Number of advertisements the caller has room for
+ *
+ * @return  @p space divided by @ref BLE_ADV_REPORTS_MAX, but at least 1 and at most
+ *          @ref BLE_ADV_READ_MANY_EVENTS
+ *
+ * Events are lost once received, so a batched read must not take more events than the worst
+ * case of its destination can hold.
+ */
+static inline unsigned ble_adv_events_fitting(size_t space)
+{
+    size_t vlen = space / BLE_ADV_REPORTS_MAX;
+    if (vlen > BLE_ADV_READ_MANY_EVENTS) {
+        return BLE_ADV_READ_MANY_EVENTS;
+    }
+    return vlen ? (unsigned)vlen : 1;
+}
+
+/**
+ * @brief   Receive up to @p vlen HCI events with their kernel receive timestamps
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[out]      evs         Write the received events here
+ * @param[in]       vlen        Maximum number of events to receive, clamped to
+ *                              @ref BLE_ADV_READ_MANY_EVENTS
+ * @param[in]       adapter     Record the reception latency to the statistics of this adapter
+ *
+ * @return  Number of events received (at least one)
+ * @retval  -1                  Failure and errno set to indicate the cause
+ *
+ * Blocks (unless @p dev is in non-blocking mode) until at least one event is available, but
+ * does not wait for further events. This is the single receive path of all batched reads.
+ */
+int ble_adv_recv_events(int dev, struct ble_adv_events *evs, unsigned vlen, uint8_t adapter);
+
+/**
+ * @brief   Same as @ref ble_adv_read_many, but tag the advertisements with and account the
+ *          statistics to the given adapter
+ *
+ * @param[in]       dev         Descriptor of the HCI interfaces
+ * @param[out]      dest        Array to write the received BLE advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[out]      info        Statistics about the consumed events, may be `NULL`
+ * @param[in]       adapter     Value to set @ref ble_adv::adapter to
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT
+ *
+ * @return  Number of advertisements written to @p dest
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ */
+int ble_adv_read_many_adapter(int dev, struct ble_adv *dest, size_t max,
+                              struct ble_adv_read_info *info, uint8_t adapter, unsigned flags);
+
+/**
+ * @name    Histograms kept per adapter by @ref ble_adv_stats_record
+ * @{
+ */
+#define BLE_ADV_STATS_HIST_LATENCY                  0   /**< @ref ble_adv_stats::latency_us */
+#define BLE_ADV_STATS_HIST_BATCH                    1   /**< @ref ble_adv_stats::batch */
+#define BLE_ADV_STATS_HISTS                         2   /**< Number of histograms */
+/** @} */
+
+/**
+ * @brief   Record a value in a histogram of an adapter
+ *
+ * @param[in]       adapter     Adapter to account to, ignored if out of range
+ * @param[in]       hist        Histogram to record to, e.g. @ref BLE_ADV_STATS_HIST_LATENCY
+ * @param[in]       value       Value to record
+ */
+void ble_adv_stats_record(uint8_t adapter, unsigned hist, uint64_t value);
+
+/**
+ * @brief   What a single read did with the events it received
+ *
+ * Paths that cannot encounter a condition leave its member at 0.
+ */
+struct ble_adv_read_tally {
+    uint64_t events;            /**< HCI events received */
+    uint64_t reports;           /**< Advertisements returned */
+    uint64_t skipped;           /**< Events that are no advertising reports */
+    uint64_t proto;             /**< Advertisements or events dropped as malformed */
+    uint64_t overflow;          /**< Advertisements dropped as a field did not fit */
+    uint64_t space;             /**< Advertisements dropped for lack of space */
+    uint64_t pool;              /**< Advertisements dropped as the pool was exhausted */
+    uint64_t truncated;         /**< Advertisements returned with @ref BLE_ADV_HAS_TRUNCATED */
+};
+
+/**
+ * @brief   Account a read to the statistics of an adapter
+ *
+ * @param[in]       adapter     Adapter to account to, ignored if out of range
+ * @param[in]       tally       What the read did
+ *
+ * This is the single place all receive paths update the counters and the batch histogram
+ * from, so that they cannot drift apart.
+ */
+void ble_adv_stats_account(uint8_t adapter, const struct ble_adv_read_tally *tally);
+
+/**
+ * @brief   Split an HCI event into views of the contained advertising reports
+ *
+ * @param[out]      dest        Write the views here
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       event       HCI event as read from the HCI socket (including packet type)
+ * @param[in]       len         Length of @p event in bytes
+ * @param[out]      cut         Number of reports lost as the event ends in the middle of one
+ *
+ * @return  Number of views written to @p dest, i.e. the complete reports in front of the cut
+ * @retval -ENOENT              @p event is not an LE Advertising Report event
+ * @retval -EPROTO              The event header is invalid
+ *
+ * This is @ref ble_adv_event_views, but lets the library account for cut off reports.
+ *
+ * @note    If the event contains more than @p max reports, the surplus reports are ignored
+ */
+int ble_adv_split_event(struct ble_adv_view *dest, size_t max, const void *event, size_t len,
+                        unsigned *cut);
+
+/**
+ * @brief   Parse the EIR data of the BLE advertisements
+ *
+ * This is the per-advertisement hot path of the library. It is only exposed to the library
+ * itself and to the benchmark.
+ *
+ * @param[out]      dest        Write decoded fields here
+ * @param[in]       eir         Data to decode
+ * @param[in]       eir_len     Length of @p eir
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT
+ * @retval  0                   Success
+ * @retval -EPROTO              Invalid encoding detected
+ * @retval -EOVERFLOW           EIR field larger than space in @p dest
+ */
+int ble_adv_parse_eir(struct ble_adv *dest, const uint8_t *eir, size_t eir_len, unsigned flags);
+
+/** @} */
+#endif /* BLE_ADV_INTERNAL_H */
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_multi
+ *
+ * @{
+ * @brief   Implementation of scanning on multiple adapters
+ * @file
+ */
+#include "ble_adv_multi.h"
+#include "ble_adv_internal.h"
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static int collect_dev_id(int dd, int dev_id, long arg)
+{
+    struct ble_adv_multi *multi = (struct ble_adv_multi *)(intptr_t)arg;
+    (void)dd;
+
+    if (multi->len < BLE_ADV_MULTI_MAX) {
+        multi->dev_ids[multi->len++] = dev_id;
+    }
+
+    /* continue iterating */
+    return 0;
+}
+
+static int add_dev(struct ble_adv_multi *multi, size_t idx)
+{
+    int dev = hci_open_dev(multi->dev_ids[idx]);
+    if (dev < 0) {
+        return -1;
+    }
+    multi->devs[idx] = dev;
+
+    int flags = fcntl(dev, F_GETFL);
+    if ((flags == -1) || fcntl(dev, F_SETFL, flags | O_NONBLOCK)) {
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)idx };
+    return epoll_ctl(multi->epfd, EPOLL_CTL_ADD, dev, &ev);
+}
+
+int ble_adv_multi_open(struct ble_adv_multi *multi, const int *dev_ids, size_t len)
+{
+    if (!multi || (dev_ids && !len) || (len > BLE_ADV_MULTI_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    multi->len = 0;
+    for (size_t i = 0; i < BLE_ADV_MULTI_MAX; i++) {
+        multi->devs[i] = -1;
+    }
+
+    if (dev_ids) {
+        for (size_t i = 0; i < len; i++) {
+            multi->dev_ids[i] = dev_ids[i];
+        }
+        multi->len = len;
+    }
+    else {
+        hci_for_each_dev(HCI_UP, collect_dev_id, (long)(intptr_t)multi);
+    }
+
+    if (!multi->len) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    multi->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (multi->epfd < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < multi->len; i++) {
+        if (add_dev(multi, i)) {
+            int err = errno;
+            ble_adv_multi_close(multi);
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void ble_adv_multi_close(struct ble_adv_multi *multi)
+{
+    for (size_t i = 0; i < multi->len; i++) {
+        if (multi->devs[i] >= 0) {
+            hci_close_dev(multi->devs[i]);
+            multi->devs[i] = -1;
+        }
+    }
+
+    close(multi->epfd);
+    multi->epfd = -1;
+    multi->len = 0;
+}
+
+int ble_adv_multi_scan(struct ble_adv_multi *multi, const struct ble_adv_scan_params *params)
+{
+    int retval = 0;
+
+    if (!multi || !params) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* try all adapters even if one fails, so that a single bad adapter does not stop the others */
+    for (size_t i = 0; i < multi->len; i++) {
+        if (ble_adv_scan_ex(multi->devs[i], params)) {
+            retval = -1;
+        }
+    }
+
+    return retval;
+}
+
+int ble_adv_multi_scan_disable(struct ble_adv_multi *multi)
+{
+    int retval = 0;
+
+    if (!multi) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < multi->len; i++) {
+        if (ble_adv_scan(multi->devs[i], 0)) {
+            retval = -1;
+        }
+    }
+
+    return retval;
+}
+
+int ble_adv_multi_read(struct ble_adv_multi *multi, struct ble_adv *dest, size_t max,
+                       int timeout_ms, unsigned flags)
+{
+    struct epoll_event events[BLE_ADV_MULTI_MAX];
+
+    if (!multi || !dest || !max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int num = epoll_wait(multi->epfd, events, BLE_ADV_MULTI_MAX, timeout_ms);
+    if (num < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+
+    size_t used = 0;
+    for (int i = 0; (i < num) && (used < max); i++) {
+        uint32_t idx = events[i].data.u32;
+        int got = ble_adv_read_many_adapter(multi->devs[idx], dest + used, max - used, NULL,
+                                            (uint8_t)idx, flags);
+        if (got < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                continue;
+            }
+            return -1;
+        }
+
+        used += (size_t)got;
+    }
+
+    return (int)used;
+}
+
+/** @} */
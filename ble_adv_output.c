@@ -0,0 +1,566 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_output
+ *
+ * @{
+ * @brief   Implementation of the buffered machine readable output
+ * @file
+ */
+#include "ble_adv_output.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @name    Binary encoding helpers, each returns the position after the written bytes
+ * @{
+ */
+static uint8_t *put_u8(uint8_t *pos, unsigned value)
+{
+    *pos = (uint8_t)value;
+    return pos + 1;
+}
+
+static uint8_t *put_u16(uint8_t *pos, unsigned value)
+{
+    pos[0] = (uint8_t)value;
+    pos[1] = (uint8_t)(value >> 8);
+    return pos + 2;
+}
+
+static uint8_t *put_u32(uint8_t *pos, uint32_t value)
+{
+    pos = put_u16(pos, value & 0xffff);
+    return put_u16(pos, value >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *pos, uint64_t value)
+{
+    pos = put_u32(pos, (uint32_t)value);
+    return put_u32(pos, (uint32_t)(value >> 32));
+}
+
+static uint8_t *put_bytes(uint8_t *pos, const void *data, size_t len)
+{
+    memcpy(pos, data, len);
+    return pos + len;
+}
+
+static uint8_t *put_lv(uint8_t *pos, const void *data, uint8_t len)
+{
+    pos = put_u8(pos, len);
+    return put_bytes(pos, data, len);
+}
+/** @} */
+
+/**
+ * @name    NDJSON formatting helpers, each returns the position after the written bytes
+ * @{
+ */
+static uint8_t *put_str(uint8_t *pos, const char *str)
+{
+    return put_bytes(pos, str, strlen(str));
+}
+
+static uint8_t *put_dec(uint8_t *pos, uint64_t value)
+{
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (len) {
+        *pos++ = (uint8_t)tmp[--len];
+    }
+
+    return pos;
+}
+
+static uint8_t *put_int(uint8_t *pos, int64_t value)
+{
+    if (value < 0) {
+        *pos++ = '-';
+        return put_dec(pos, (uint64_t)0 - (uint64_t)value);
+    }
+
+    return put_dec(pos, (uint64_t)value);
+}
+
+static uint8_t *put_hex(uint8_t *pos, const uint8_t *data, size_t len)
+{
+    *pos++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        *pos++ = (uint8_t)hex_digits[data[i] >> 4];
+        *pos++ = (uint8_t)hex_digits[data[i] & 0xf];
+    }
+    *pos++ = '"';
+    return pos;
+}
+
+static uint8_t *put_addr(uint8_t *pos, const uint8_t addr[6])
+{
+    *pos++ = '"';
+    for (unsigned i = 0; i < 6; i++) {
+        if (i) {
+            *pos++ = ':';
+        }
+        *pos++ = (uint8_t)hex_digits[addr[i] >> 4];
+        *pos++ = (uint8_t)hex_digits[addr[i] & 0xf];
+    }
+    *pos++ = '"';
+    return pos;
+}
+
+/**
+ * @brief   Get the length of the valid UTF-8 sequence at @p str, or 0 if invalid
+ */
+static size_t utf8_len(const uint8_t *str, size_t len)
+{
+    size_t need;
+    if (str[0] < 0x80) {
+        return 1;
+    }
+    else if ((str[0] & 0xe0) == 0xc0) {
+        need = 2;
+    }
+    else if ((str[0] & 0xf0) == 0xe0) {
+        need = 3;
+    }
+    else if ((str[0] & 0xf8) == 0xf0) {
+        need = 4;
+    }
+    else {
+        return 0;
+    }
+
+    if (need > len) {
+        return 0;
+    }
+
+    for (size_t i = 1; i < need; i++) {
+        if ((str[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+
+    return need;
+}
+
+/**
+ * @brief   Write a JSON string, replacing invalid UTF-8 by U+FFFD
+ */
+static uint8_t *put_json_str(uint8_t *pos, const uint8_t *str, size_t len)
+{
+    *pos++ = '"';
+    size_t i = 0;
+    while (i < len) {
+        uint8_t c = str[i];
+        if ((c == '"') || (c == '\\')) {
+            *pos++ = '\\';
+            *pos++ = c;
+            i++;
+        }
+        else if (c < 0x20) {
+            pos = put_str(pos, "\\u00");
+            *pos++ = (uint8_t)hex_digits[c >> 4];
+            *pos++ = (uint8_t)hex_digits[c & 0xf];
+            i++;
+        }
+        else {
+            size_t n = utf8_len(str + i, len - i);
+            if (n) {
+                pos = put_bytes(pos, str + i, n);
+                i += n;
+            }
+            else {
+                pos = put_str(pos, "\\ufffd");
+                i++;
+            }
+        }
+    }
+    *pos++ = '"';
+    return pos;
+}
+
+static uint8_t *put_member(uint8_t *pos, const char *name)
+{
+    *pos++ = ',';
+    *pos++ = '"';
+    pos = put_str(pos, name);
+    *pos++ = '"';
+    *pos++ = ':';
+    return pos;
+}
+/** @} */
+
+int ble_adv_output_init(struct ble_adv_output *out, int fd, unsigned format, size_t size,
+                        uint64_t flush_ms)
+{
+    if (!out || (fd < 0) || (format > BLE_ADV_OUTPUT_BINARY)
+        || (size < BLE_ADV_OUTPUT_RECORD_MAX))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    out->buf = malloc(size);
+    if (!out->buf) {
+        return -1;
+    }
+
+    out->len = 0;
+    out->size = size;
+    out->flush_ms = flush_ms;
+    out->pending_since_ms = 0;
+    out->records = 0;
+    out->fd = fd;
+    out->format = format;
+    return 0;
+}
+
+int ble_adv_output_destroy(struct ble_adv_output *out)
+{
+    int retval = ble_adv_output_flush(out);
+    int err = errno;
+    free(out->buf);
+    out->buf = NULL;
+    errno = err;
+    return retval;
+}
+
+int ble_adv_output_flush(struct ble_adv_output *out)
+{
+    size_t written = 0;
+    while (written < out->len) {
+        ssize_t n = write(out->fd, out->buf + written, out->len - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* keep what was not written yet */
+            memmove(out->buf, out->buf + written, out->len - written);
+            out->len -= written;
+            return -1;
+        }
+        written += (size_t)n;
+    }
+
+    out->len = 0;
+    return 0;
+}
+
+int ble_adv_output_tick(struct ble_adv_output *out)
+{
+    if (!out->len || !out->flush_ms || (now_ms() - out->pending_since_ms < out->flush_ms)) {
+        return 0;
+    }
+
+    return ble_adv_output_flush(out);
+}
+
+/**
+ * @brief   Get space for a record of at most @ref BLE_ADV_OUTPUT_RECORD_MAX bytes
+ * @return  Position to write the record to
+ * @retval  NULL    Flushing the full buffer failed
+ */
+static uint8_t *begin(struct ble_adv_output *out)
+{
+    if ((out->size - out->len < BLE_ADV_OUTPUT_RECORD_MAX) && ble_adv_output_flush(out)) {
+        return NULL;
+    }
+
+    if (!out->len) {
+        out->pending_since_ms = now_ms();
+    }
+
+    return out->buf + out->len;
+}
+
+static int commit(struct ble_adv_output *out, size_t len)
+{
+    out->len += len;
+    out->records++;
+    return 0;
+}
+
+/**
+ * @brief   Complete the record started at @p start and ending at @p pos
+ * @return  Length of the record in bytes
+ */
+static size_t finish(unsigned format, uint8_t *start, uint8_t *pos)
+{
+    if (format == BLE_ADV_OUTPUT_BINARY) {
+        /* fill in the length prefix reserved by begin_binary() */
+        put_u16(start, (unsigned)(pos - start - 2));
+    }
+    else {
+        *pos++ = '}';
+        *pos++ = '\n';
+    }
+
+    return (size_t)(pos - start);
+}
+
+static uint8_t *begin_binary(uint8_t *start, unsigned type)
+{
+    return put_u8(start + 2, type);
+}
+
+static uint8_t *begin_json(uint8_t *start, const char *type)
+{
+    uint8_t *pos = put_str(start, "{\"type\":\"");
+    pos = put_str(pos, type);
+    *pos++ = '"';
+    return pos;
+}
+
+size_t ble_adv_output_format_adv(void *dest, unsigned format, const struct ble_adv *adv)
+{
+    uint8_t *start = dest;
+    uint8_t *pos;
+    if (format == BLE_ADV_OUTPUT_BINARY) {
+        pos = begin_binary(start, BLE_ADV_OUTPUT_REC_ADV);
+        pos = put_u64(pos, adv->timestamp_us);
+        pos = put_bytes(pos, adv->addr, sizeof(adv->addr));
+        pos = put_u8(pos, adv->addr_type);
+        pos = put_u8(pos, adv->adapter);
+        pos = put_u8(pos, adv->rssi);
+        pos = put_u8(pos, (uint8_t)adv->tx_power);
+        pos = put_u8(pos, adv->has);
+        pos = put_u8(pos, adv->flags);
+        pos = put_u16(pos, adv->uuid16);
+        pos = put_u16(pos, adv->service_uuid16);
+        pos = put_u16(pos, adv->ms_uuid16);
+        pos = put_u32(pos, adv->uuid32);
+        pos = put_bytes(pos, adv->uuid128, sizeof(adv->uuid128));
+        pos = put_lv(pos, adv->name, adv->name_len);
+        pos = put_lv(pos, adv->uri, adv->uri_len);
+        pos = put_lv(pos, adv->service_data, adv->service_data_len);
+        pos = put_lv(pos, adv->ms_data, adv->ms_data_len);
+        return finish(format, start, pos);
+    }
+
+    pos = begin_json(start, "adv");
+    pos = put_member(pos, "ts_us");
+    pos = put_dec(pos, adv->timestamp_us);
+    pos = put_member(pos, "addr");
+    pos = put_addr(pos, adv->addr);
+    pos = put_member(pos, "addr_type");
+    pos = put_dec(pos, adv->addr_type);
+    pos = put_member(pos, "adapter");
+    pos = put_dec(pos, adv->adapter);
+    pos = put_member(pos, "rssi");
+    pos = put_int(pos, (int8_t)adv->rssi);
+    if (adv->tx_power != INT8_MAX) {
+        pos = put_member(pos, "tx_power");
+        pos = put_int(pos, adv->tx_power);
+    }
+    if (adv->name_len) {
+        pos = put_member(pos, "name");
+        pos = put_json_str(pos, (const uint8_t *)adv->name, adv->name_len);
+    }
+    if (adv->uri_len) {
+        pos = put_member(pos, "uri");
+        pos = put_json_str(pos, (const uint8_t *)adv->uri, adv->uri_len);
+    }
+    if (adv->has & BLE_ADV_HAS_FLAGS) {
+        pos = put_member(pos, "flags");
+        pos = put_dec(pos, adv->flags);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID16) {
+        pos = put_member(pos, "uuid16");
+        pos = put_dec(pos, adv->uuid16);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID32) {
+        pos = put_member(pos, "uuid32");
+        pos = put_dec(pos, adv->uuid32);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID128) {
+        pos = put_member(pos, "uuid128");
+        pos = put_hex(pos, adv->uuid128, sizeof(adv->uuid128));
+    }
+    if (adv->has & BLE_ADV_HAS_SERVICE_DATA) {
+        pos = put_member(pos, "service_uuid16");
+        pos = put_dec(pos, adv->service_uuid16);
+        pos = put_member(pos, "service_data");
+        pos = put_hex(pos, adv->service_data, adv->service_data_len);
+    }
+    if (adv->has & BLE_ADV_HAS_MS_DATA) {
+        pos = put_member(pos, "ms_uuid16");
+        pos = put_dec(pos, adv->ms_uuid16);
+        pos = put_member(pos, "ms_data");
+        pos = put_hex(pos, adv->ms_data, adv->ms_data_len);
+    }
+    if (adv->has & BLE_ADV_HAS_TRUNCATED) {
+        pos = put_member(pos, "truncated");
+        pos = put_str(pos, "true");
+    }
+    return finish(format, start, pos);
+}
+
+size_t ble_adv_output_format_sensor(void *dest, unsigned format, const struct ble_adv *adv,
+                                    const struct ble_adv_sensor *sensor)
+{
+    uint8_t *start = dest;
+    uint8_t *pos;
+    if (format == BLE_ADV_OUTPUT_BINARY) {
+        pos = begin_binary(start, BLE_ADV_OUTPUT_REC_SENSOR);
+        pos = put_u64(pos, adv->timestamp_us);
+        pos = put_bytes(pos, adv->addr, sizeof(adv->addr));
+        pos = put_u8(pos, sensor->decoder);
+        pos = put_u32(pos, sensor->has);
+        pos = put_u32(pos, (uint32_t)sensor->temperature);
+        pos = put_u32(pos, sensor->pressure);
+        pos = put_u32(pos, sensor->counter);
+        pos = put_u32(pos, sensor->illuminance);
+        pos = put_u16(pos, sensor->humidity);
+        pos = put_u16(pos, sensor->bat_mv);
+        pos = put_u16(pos, sensor->co2);
+        pos = put_u16(pos, sensor->moisture);
+        for (unsigned i = 0; i < 3; i++) {
+            pos = put_u16(pos, (uint16_t)sensor->accel[i]);
+        }
+        pos = put_u8(pos, sensor->bat);
+        pos = put_u8(pos, sensor->button);
+        pos = put_u8(pos, (uint8_t)sensor->tx_power);
+        return finish(format, start, pos);
+    }
+
+    pos = begin_json(start, "sensor");
+    pos = put_member(pos, "ts_us");
+    pos = put_dec(pos, adv->timestamp_us);
+    pos = put_member(pos, "addr");
+    pos = put_addr(pos, adv->addr);
+    pos = put_member(pos, "decoder");
+    pos = put_json_str(pos, (const uint8_t *)ble_adv_decoder_name(sensor->decoder),
+                       strlen(ble_adv_decoder_name(sensor->decoder)));
+    if (sensor->has & BLE_ADV_SENSOR_HAS_TEMPERATURE) {
+        pos = put_member(pos, "temperature");
+        pos = put_int(pos, sensor->temperature);
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_HUMIDITY) {
+        pos = put_member(pos, "humidity");
+        pos = put_dec(pos, sensor->humidity);
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_PRESSURE) {
+        pos = put_member(pos, "pressure");
+        pos = put_dec(pos, sensor->pressure);
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_BAT) {
+        pos = put_member(pos, "bat");
+        pos = put_dec(pos, sensor->bat);
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_BAT_MV) {
+        pos = put_member(pos, "bat_mv");
+        pos = put_dec(pos, sensor->bat_mv);
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_COUNTER) {
+        pos = put_member(pos, "counter");
+        pos = put_dec(pos, sensor->counter);
+    }
+    return finish(format, start, pos);
+}
+
+size_t ble_adv_output_format_agg(void *dest, unsigned format,
+                                 const struct ble_adv_agg_record *record)
+{
+    static const char *const names[BLE_ADV_AGG_CHANNELS] = {
+        [BLE_ADV_AGG_TEMPERATURE] = "temperature",
+        [BLE_ADV_AGG_HUMIDITY] = "humidity",
+        [BLE_ADV_AGG_BAT_MV] = "bat_mv",
+    };
+
+    uint8_t *start = dest;
+    uint8_t *pos;
+    if (format == BLE_ADV_OUTPUT_BINARY) {
+        pos = begin_binary(start, BLE_ADV_OUTPUT_REC_AGG);
+        pos = put_u64(pos, record->start_ms);
+        pos = put_u32(pos, record->len_ms);
+        pos = put_bytes(pos, record->addr, sizeof(record->addr));
+        pos = put_u8(pos, record->window);
+        pos = put_u8(pos, record->partial);
+        for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+            pos = put_u64(pos, (uint64_t)record->channels[c].sum);
+            pos = put_u32(pos, (uint32_t)record->channels[c].min);
+            pos = put_u32(pos, (uint32_t)record->channels[c].max);
+            pos = put_u32(pos, record->channels[c].count);
+        }
+        return finish(format, start, pos);
+    }
+
+    pos = begin_json(start, "agg");
+    pos = put_member(pos, "start_ms");
+    pos = put_dec(pos, record->start_ms);
+    pos = put_member(pos, "len_ms");
+    pos = put_dec(pos, record->len_ms);
+    pos = put_member(pos, "addr");
+    pos = put_addr(pos, record->addr);
+    if (record->partial) {
+        pos = put_member(pos, "partial");
+        pos = put_str(pos, "true");
+    }
+    for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+        const struct ble_adv_agg_stat *stat = &record->channels[c];
+        if (!stat->count) {
+            continue;
+        }
+        pos = put_member(pos, names[c]);
+        pos = put_str(pos, "{\"min\":");
+        pos = put_int(pos, stat->min);
+        pos = put_str(pos, ",\"mean\":");
+        pos = put_int(pos, ble_adv_agg_mean(stat));
+        pos = put_str(pos, ",\"max\":");
+        pos = put_int(pos, stat->max);
+        pos = put_str(pos, ",\"count\":");
+        pos = put_dec(pos, stat->count);
+        *pos++ = '}';
+    }
+    return finish(format, start, pos);
+}
+
+int ble_adv_output_adv(struct ble_adv_output *out, const struct ble_adv *adv)
+{
+    uint8_t *start = begin(out);
+    if (!start) {
+        return -1;
+    }
+
+    return commit(out, ble_adv_output_format_adv(start, out->format, adv));
+}
+
+int ble_adv_output_sensor(struct ble_adv_output *out, const struct ble_adv *adv,
+                          const struct ble_adv_sensor *sensor)
+{
+    uint8_t *start = begin(out);
+    if (!start) {
+        return -1;
+    }
+
+    return commit(out, ble_adv_output_format_sensor(start, out->format, adv, sensor));
+}
+
+int ble_adv_output_agg(struct ble_adv_output *out, const struct ble_adv_agg_record *record)
+{
+    uint8_t *start = begin(out);
+    if (!start) {
+        return -1;
+    }
+
+    return commit(out, ble_adv_output_format_agg(start, out->format, record));
+}
+
+/** @} */
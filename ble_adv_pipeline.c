@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_pipeline
+ *
+ * @{
+ * @brief   Implementation of the sharded parallel decoding
+ * @file
+ */
+#include "ble_adv_pipeline.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief   Number of records released with a single atomic operation by a worker
+ */
+#define RELEASE_BATCH           64
+
+/**
+ * @brief   Time in ms to back off after waiting for a block failed, e.g. with `ENOMEM`
+ */
+#define BACKOFF_MS              10
+
+static unsigned shard(const struct ble_adv_pipeline *pipe, const uint8_t *bdaddr)
+{
+    uint64_t key = 0;
+    for (unsigned i = 0; i < 6; i++) {
+        key |= (uint64_t)bdaddr[i] << (8 * i);
+    }
+
+    /* Fibonacci hashing, the upper bits are well mixed */
+    uint32_t hash = (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+    return (unsigned)(((uint64_t)hash * pipe->num_workers) >> 32);
+}
+
+static void process_block(struct ble_adv_pipeline_worker *w, struct ble_adv_block *block)
+{
+    struct ble_adv_pipeline *pipe = w->pipe;
+    struct ble_adv_record *done[RELEASE_BATCH];
+    size_t num_done = 0;
+    uint64_t processed = 0, invalid = 0;
+
+    struct ble_adv_record *record = NULL;
+    while ((record = ble_adv_block_next(block, record))) {
+        struct ble_adv adv;
+        if (ble_adv_view_parse(&adv, &record->view, pipe->parse_flags)) {
+            invalid++;
+        }
+        else {
+            struct ble_adv_sensor sensor;
+            adv.timestamp_us = record->timestamp_us;
+            adv.adapter = record->adapter;
+            pipe->cb(w->idx, &adv, ble_adv_decode(&sensor, &adv) ? NULL : &sensor, pipe->ctx);
+            processed++;
+        }
+
+        if (num_done == RELEASE_BATCH) {
+            ble_adv_records_release(done, num_done);
+            num_done = 0;
+        }
+        done[num_done++] = record;
+    }
+
+    ble_adv_records_release(done, num_done);
+    atomic_fetch_add_explicit(&w->processed, processed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->invalid, invalid, memory_order_relaxed);
+    /* drop the reference handed over by the ingest thread, returning the block to the pool */
+    ble_adv_block_release(block);
+}
+
+static void backoff(void)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = BACKOFF_MS * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void *worker_thread(void *arg)
+{
+    struct ble_adv_pipeline_worker *w = arg;
+
+    while (1) {
+        struct ble_adv_block *block;
+        if (ble_adv_ring_pop_wait(&w->ring, &block, -1)) {
+            /* Waiting failed, e.g. poll() with ENOMEM. Exiting would never return the blocks
+             * queued for this worker and stall the ingest thread, so try again later. */
+            backoff();
+            continue;
+        }
+
+        if (!block) {
+            break;
+        }
+
+        process_block(w, block);
+    }
+
+    return NULL;
+}
+
+static void hand_over(struct ble_adv_pipeline_worker *w)
+{
+    /* cannot fail, the ring has room for all blocks and the stop request */
+    ble_adv_ring_push(&w->ring, &w->block);
+    ble_adv_ring_notify(&w->ring);
+    w->block = NULL;
+}
+
+static void stop_workers(struct ble_adv_pipeline *pipe, unsigned num)
+{
+    for (unsigned i = 0; i < num; i++) {
+        struct ble_adv_pipeline_worker *w = &pipe->workers[i];
+        struct ble_adv_block *stop = NULL;
+        ble_adv_ring_push(&w->ring, &stop);
+        ble_adv_ring_notify(&w->ring);
+        pthread_join(w->thread, NULL);
+        ble_adv_ring_destroy(&w->ring);
+    }
+}
+
+int ble_adv_pipeline_init(struct ble_adv_pipeline *pipe, unsigned num_workers,
+                          unsigned parse_flags, ble_adv_pipeline_cb_t cb, void *ctx)
+{
+    if (!pipe || !num_workers || (num_workers > BLE_ADV_PIPELINE_WORKERS_MAX) || !cb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t num_blocks = (size_t)num_workers * BLE_ADV_PIPELINE_BLOCKS_PER_WORKER;
+    if (ble_adv_pool_init(&pipe->pool, BLE_ADV_PIPELINE_BLOCK_SIZE, num_blocks)) {
+        return -1;
+    }
+
+    pipe->workers = aligned_alloc(BLE_ADV_CACHE_LINE, num_workers * sizeof(pipe->workers[0]));
+    if (!pipe->workers) {
+        ble_adv_pool_destroy(&pipe->pool);
+        return -1;
+    }
+
+    pipe->cb = cb;
+    pipe->ctx = ctx;
+    pipe->submitted = 0;
+    pipe->num_workers = num_workers;
+    pipe->parse_flags = parse_flags;
+
+    /* a single worker may end up with all blocks, plus the stop request */
+    size_t capacity = 2;
+    while (capacity < num_blocks + 1) {
+        capacity <<= 1;
+    }
+
+    for (unsigned i = 0; i < num_workers; i++) {
+        struct ble_adv_pipeline_worker *w = &pipe->workers[i];
+        w->pipe = pipe;
+        w->block = NULL;
+        w->idx = i;
+        atomic_init(&w->processed, 0);
+        atomic_init(&w->invalid, 0);
+
+        if (ble_adv_ring_init(&w->ring, capacity, sizeof(struct ble_adv_block *),
+                              BLE_ADV_RING_DROP_NEWEST))
+        {
+            int err = errno;
+            stop_workers(pipe, i);
+            free(pipe->workers);
+            ble_adv_pool_destroy(&pipe->pool);
+            errno = err;
+            return -1;
+        }
+
+        int err = pthread_create(&w->thread, NULL, worker_thread, w);
+        if (err) {
+            ble_adv_ring_destroy(&w->ring);
+            stop_workers(pipe, i);
+            free(pipe->workers);
+            ble_adv_pool_destroy(&pipe->pool);
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void ble_adv_pipeline_destroy(struct ble_adv_pipeline *pipe)
+{
+    ble_adv_pipeline_flush(pipe);
+    stop_workers(pipe, pipe->num_workers);
+    free(pipe->workers);
+    pipe->workers = NULL;
+    ble_adv_pool_destroy(&pipe->pool);
+}
+
+/**
+ * @brief   Take a block from the pool, waiting for the workers to return one
+ *
+ * Unlike @ref ble_adv_pool_get_wait this never fails, so that an event is never left
+ * submitted in part.
+ */
+static struct ble_adv_block *get_block(struct ble_adv_pipeline *pipe)
+{
+    struct ble_adv_block *block;
+    while (!(block = ble_adv_pool_get_wait(&pipe->pool, -1))) {
+        backoff();
+    }
+    return block;
+}
+
+int ble_adv_pipeline_submit(struct ble_adv_pipeline *pipe, const void *buf, size_t len,
+                            uint64_t timestamp_us, uint8_t adapter)
+{
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+    int num = ble_adv_event_views(views, BLE_ADV_REPORTS_MAX, buf, len);
+    if (num < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < num; i++) {
+        struct ble_adv_pipeline_worker *w = &pipe->workers[shard(pipe, views[i].bdaddr)];
+        struct ble_adv_record *record = NULL;
+        if (w->block) {
+            record = ble_adv_block_add(w->block, &views[i], adapter, timestamp_us);
+            if (!record) {
+                hand_over(w);
+            }
+        }
+
+        if (!record) {
+            /* wait for the workers to return a block rather than dropping advertisements, an
+             * empty block always has room for a legacy advertisement */
+            w->block = get_block(pipe);
+            ble_adv_block_add(w->block, &views[i], adapter, timestamp_us);
+        }
+
+        pipe->submitted++;
+    }
+
+    return num;
+}
+
+void ble_adv_pipeline_flush(struct ble_adv_pipeline *pipe)
+{
+    for (unsigned i = 0; i < pipe->num_workers; i++) {
+        if (pipe->workers[i].block) {
+            hand_over(&pipe->workers[i]);
+        }
+    }
+}
+
+int ble_adv_pipeline_sync(struct ble_adv_pipeline *pipe)
+{
+    struct ble_adv_block *blocks[BLE_ADV_PIPELINE_WORKERS_MAX
+                                 * BLE_ADV_PIPELINE_BLOCKS_PER_WORKER];
+    size_t num_blocks = pipe->pool.num_blocks;
+
+    ble_adv_pipeline_flush(pipe);
+
+    /* once all blocks are back in the pool, all advertisements have been processed */
+    size_t num = 0;
+    int retval = 0;
+    while (num < num_blocks) {
+        blocks[num] = ble_adv_pool_get_wait(&pipe->pool, -1);
+        if (!blocks[num]) {
+            retval = -1;
+            break;
+        }
+        num++;
+    }
+
+    int err = errno;
+    for (size_t i = 0; i < num; i++) {
+        ble_adv_block_release(blocks[i]);
+    }
+    errno = err;
+    return retval;
+}
+
+void ble_adv_pipeline_stats(const struct ble_adv_pipeline *pipe,
+                            struct ble_adv_pipeline_stats *dest)
+{
+    dest->submitted = pipe->submitted;
+    dest->processed = 0;
+    dest->invalid = 0;
+    for (unsigned i = 0; i < pipe->num_workers; i++) {
+        dest->processed += atomic_load_explicit(&pipe->workers[i].processed,
+                                                memory_order_relaxed);
+        dest->invalid += atomic_load_explicit(&pipe->workers[i].invalid, memory_order_relaxed);
+    }
+}
+
+/** @} */
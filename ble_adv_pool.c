@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_pool
+ *
+ * @{
+ * @brief   Implementation of the block pool
+ * @file
+ */
+#include "ble_adv_pool.h"
+#include "ble_adv_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_ALIGN            alignof(struct ble_adv_record)
+
+static struct ble_adv_block *block_at(const struct ble_adv_pool *pool, size_t idx)
+{
+    return (struct ble_adv_block *)(void *)(pool->mem + idx * pool->block_size);
+}
+
+int ble_adv_pool_init(struct ble_adv_pool *pool, size_t block_size, size_t num_blocks)
+{
+    if (!pool || (block_size < BLE_ADV_POOL_BLOCK_MIN) || !num_blocks
+        || (block_size > UINT32_MAX))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    block_size = (block_size + BLE_ADV_CACHE_LINE - 1) & ~(size_t)(BLE_ADV_CACHE_LINE - 1);
+    if (num_blocks > SIZE_MAX / block_size) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* the free list must hold all blocks, but its capacity must be a power of two */
+    size_t capacity = 2;
+    while (capacity < num_blocks) {
+        capacity <<= 1;
+    }
+
+    if (ble_adv_ring_init(&pool->free, capacity, sizeof(struct ble_adv_block *),
+                          BLE_ADV_RING_DROP_NEWEST))
+    {
+        return -1;
+    }
+
+    pool->mem = aligned_alloc(BLE_ADV_CACHE_LINE, num_blocks * block_size);
+    if (!pool->mem) {
+        ble_adv_ring_destroy(&pool->free);
+        return -1;
+    }
+
+    pool->block_size = block_size;
+    pool->num_blocks = num_blocks;
+    for (size_t i = 0; i < num_blocks; i++) {
+        struct ble_adv_block *block = block_at(pool, i);
+        block->pool = pool;
+        block->size = (uint32_t)(block_size - offsetof(struct ble_adv_block, data));
+        block->used = 0;
+        atomic_init(&block->refs, 0);
+        ble_adv_ring_push(&pool->free, &block);
+    }
+
+    return 0;
+}
+
+void ble_adv_pool_destroy(struct ble_adv_pool *pool)
+{
+    ble_adv_ring_destroy(&pool->free);
+    free(pool->mem);
+    pool->mem = NULL;
+}
+
+struct ble_adv_block *ble_adv_pool_get(struct ble_adv_pool *pool)
+{
+    struct ble_adv_block *block;
+    if (ble_adv_ring_pop(&pool->free, &block)) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    block->used = 0;
+    atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+    return block;
+}
+
+struct ble_adv_block *ble_adv_pool_get_wait(struct ble_adv_pool *pool, int timeout_ms)
+{
+    struct ble_adv_block *block;
+    if (ble_adv_ring_pop_wait(&pool->free, &block, timeout_ms)) {
+        return NULL;
+    }
+
+    block->used = 0;
+    atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+    return block;
+}
+
+struct ble_adv_record *ble_adv_block_add(struct ble_adv_block *block,
+                                         const struct ble_adv_view *view, uint8_t adapter,
+                                         uint64_t timestamp_us)
+{
+    size_t offset = (block->used + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    size_t size = sizeof(struct ble_adv_record) + view->eir_len;
+    if ((offset > block->size) || (size > block->size - offset)) {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    struct ble_adv_record *record = (struct ble_adv_record *)(void *)(block->data + offset);
+    record->block = block;
+    record->timestamp_us = timestamp_us;
+    record->adapter = adapter;
+    memcpy(record->bdaddr, view->bdaddr, sizeof(record->bdaddr));
+    memcpy(record->eir, view->eir, view->eir_len);
+    record->view = *view;
+    record->view.bdaddr = record->bdaddr;
+    record->view.eir = record->eir;
+
+    block->used = (uint32_t)(offset + size);
+    /* the caller holds a reference, so the block cannot be returned concurrently */
+    atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+    return record;
+}
+
+struct ble_adv_record *ble_adv_block_next(struct ble_adv_block *block,
+                                          const struct ble_adv_record *prev)
+{
+    size_t offset = 0;
+    if (prev) {
+        offset = (size_t)((const unsigned char *)prev - block->data) + sizeof(*prev)
+                 + prev->view.eir_len;
+        offset = (offset + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    }
+
+    if (offset >= block->used) {
+        return NULL;
+    }
+
+    return (struct ble_adv_record *)(void *)(block->data + offset);
+}
+
+static void release(struct ble_adv_block *block, unsigned refs)
+{
+    if (atomic_fetch_sub_explicit(&block->refs, refs, memory_order_acq_rel) == refs) {
+        /* cannot fail, the free list has room for all blocks */
+        ble_adv_ring_push(&block->pool->free, &block);
+        ble_adv_ring_notify(&block->pool->free);
+    }
+}
+
+void ble_adv_block_release(struct ble_adv_block *block)
+{
+    release(block, 1);
+}
+
+void ble_adv_records_release(struct ble_adv_record *const *records, size_t num)
+{
+    size_t i = 0;
+    while (i < num) {
+        struct ble_adv_block *block = records[i]->block;
+        unsigned refs = 0;
+        while ((i < num) && (records[i]->block == block)) {
+            refs++;
+            i++;
+        }
+        release(block, refs);
+    }
+}
+
+int ble_adv_pool_read(int dev, struct ble_adv_pool *pool, struct ble_adv_block **block,
+                      struct ble_adv_record **dest, size_t max, uint8_t adapter)
+{
+    struct ble_adv_events evs;
+    struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+
+    if ((dev == -1) || !pool || !block || !dest || !max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int received = ble_adv_recv_events(dev, &evs, ble_adv_events_fitting(max), adapter);
+    if (received < 0) {
+        return -1;
+    }
+
+    size_t used = 0;
+    size_t skipped = 0;
+    size_t invalid = 0;
+    size_t no_space = 0;
+    size_t no_block = 0;
+    for (int i = 0; i < received; i++) {
+        unsigned cut;
+        int num = ble_adv_split_event(views, BLE_ADV_REPORTS_MAX, evs.buf[i], evs.len[i], &cut);
+        if (num < 0) {
+            if (num == -ENOENT) {
+                skipped++;
+            }
+            else {
+                invalid++;
+            }
+            continue;
+        }
+
+        invalid += cut;
+
+        uint64_t timestamp_us = evs.timestamp_us[i];
+
+        for (int j = 0; j < num; j++) {
+            if (used == max) {
+                no_space++;
+                continue;
+            }
+
+            struct ble_adv_record *record = NULL;
+            if (*block) {
+                record = ble_adv_block_add(*block, &views[j], adapter, timestamp_us);
+            }
+            if (!record && !no_block) {
+                /* refill: the records keep the old block alive until they are released */
+                if (*block) {
+                    ble_adv_block_release(*block);
+                }
+                *block = ble_adv_pool_get(pool);
+                if (*block) {
+                    record = ble_adv_block_add(*block, &views[j], adapter, timestamp_us);
+                }
+            }
+            if (!record) {
+                no_block++;
+                continue;
+            }
+
+            dest[used++] = record;
+        }
+    }
+
+    /* the records keep the raw EIR data, so nothing is parsed, overflows or is truncated */
+    struct ble_adv_read_tally tally = {
+        .events = (uint64_t)received,
+        .reports = used,
+        .skipped = skipped,
+        .proto = invalid,
+        .space = no_space,
+        .pool = no_block,
+    };
+    ble_adv_stats_account(adapter, &tally);
+
+    return (int)used;
+}
+
+/** @} */
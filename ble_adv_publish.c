@@ -0,0 +1,654 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_publish
+ *
+ * @{
+ * @brief   Implementation of the batching publisher
+ * @file
+ */
+#include "ble_adv_publish.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @name    States of the connection
+ * @{
+ */
+#define STATE_IDLE              0   /**< Disconnected, waiting to reconnect */
+#define STATE_CONNECTING        1   /**< TCP handshake in progress */
+#define STATE_CONNACK           2   /**< CONNECT sent, waiting for CONNACK */
+#define STATE_CONNECTED         3   /**< Ready to publish */
+/** @} */
+
+/**
+ * @name    Delay between connection attempts in ms, doubled on each failure
+ * @{
+ */
+#define BACKOFF_MIN_MS          1000
+#define BACKOFF_MAX_MS          30000
+/** @} */
+
+/**
+ * @name    MQTT control packet types, already shifted into the upper nibble
+ * @{
+ */
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PINGREQ            0xc0
+#define MQTT_PINGRESP           0xd0
+/** @} */
+
+#define MQTT_PORT               "1883"
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint8_t *slot_mem(const struct ble_adv_publish *pub, size_t idx)
+{
+    return pub->mem + idx * pub->slot_size;
+}
+
+static size_t fill_idx(const struct ble_adv_publish *pub)
+{
+    return (pub->head + pub->queued) % pub->num_slots;
+}
+
+/**
+ * @brief   Split @p url into host and port (and the topic for MQTT)
+ * @retval  0   Success
+ * @retval  -1  Malformed URL
+ */
+static int parse_url(struct ble_adv_publish *pub, const char *url, char *host, size_t host_size,
+                     char *port, size_t port_size)
+{
+    const char *pos;
+    if (!strncmp(url, "udp://", 6)) {
+        pub->transport = BLE_ADV_PUBLISH_UDP;
+        pos = url + 6;
+    }
+    else if (!strncmp(url, "mqtt://", 7)) {
+        pub->transport = BLE_ADV_PUBLISH_MQTT;
+        pos = url + 7;
+    }
+    else {
+        return -1;
+    }
+
+    const char *host_end;
+    const char *after;
+    if (*pos == '[') {
+        /* IPv6 address literal */
+        pos++;
+        host_end = strchr(pos, ']');
+        if (!host_end) {
+            return -1;
+        }
+        after = host_end + 1;
+    }
+    else {
+        host_end = pos + strcspn(pos, ":/");
+        after = host_end;
+    }
+
+    size_t host_len = (size_t)(host_end - pos);
+    if (!host_len || (host_len >= host_size)) {
+        return -1;
+    }
+    memcpy(host, pos, host_len);
+    host[host_len] = '\0';
+
+    pos = after;
+    if (*pos == ':') {
+        pos++;
+        size_t port_len = strcspn(pos, "/");
+        if (!port_len || (port_len >= port_size)) {
+            return -1;
+        }
+        memcpy(port, pos, port_len);
+        port[port_len] = '\0';
+        pos += port_len;
+    }
+    else if (pub->transport == BLE_ADV_PUBLISH_MQTT) {
+        snprintf(port, port_size, "%s", MQTT_PORT);
+    }
+    else {
+        return -1;
+    }
+
+    if (pub->transport == BLE_ADV_PUBLISH_UDP) {
+        return *pos ? -1 : 0;
+    }
+
+    if (*pos != '/') {
+        return -1;
+    }
+    pos++;
+
+    /* wildcards are not allowed in the topic of a PUBLISH */
+    pub->topic_len = strlen(pos);
+    if (!pub->topic_len || (pub->topic_len >= sizeof(pub->topic)) || strpbrk(pos, "+#")) {
+        return -1;
+    }
+    memcpy(pub->topic, pos, pub->topic_len + 1);
+    return 0;
+}
+
+static void disconnect(struct ble_adv_publish *pub, uint64_t now)
+{
+    if (pub->fd >= 0) {
+        close(pub->fd);
+    }
+
+    pub->fd = -1;
+    pub->state = STATE_IDLE;
+    /* a partially sent batch is sent again in full over the next connection */
+    pub->sent = 0;
+    pub->ctrl_len = pub->ctrl_sent = 0;
+    pub->in_len = 0;
+    pub->in_skip = 0;
+    pub->ping_since_ms = 0;
+    pub->next_connect_ms = now + pub->backoff_ms;
+    pub->backoff_ms = (pub->backoff_ms * 2 > BACKOFF_MAX_MS) ? BACKOFF_MAX_MS
+                                                             : pub->backoff_ms * 2;
+}
+
+static void send_connect(struct ble_adv_publish *pub)
+{
+    char id[24];
+    int id_len = snprintf(id, sizeof(id), "ble_adv-%u", (unsigned)getpid());
+    uint8_t *pos = pub->ctrl;
+
+    *pos++ = MQTT_CONNECT;
+    *pos++ = (uint8_t)(10 + 2 + id_len);
+    memcpy(pos, "\x00\x04MQTT\x04\x02", 8); /* protocol 3.1.1, clean session */
+    pos += 8;
+    *pos++ = (uint8_t)(BLE_ADV_PUBLISH_KEEPALIVE_S >> 8);
+    *pos++ = (uint8_t)BLE_ADV_PUBLISH_KEEPALIVE_S;
+    *pos++ = 0;
+    *pos++ = (uint8_t)id_len;
+    memcpy(pos, id, (size_t)id_len);
+    pos += id_len;
+
+    pub->ctrl_len = (uint8_t)(pos - pub->ctrl);
+    pub->ctrl_sent = 0;
+    pub->state = STATE_CONNACK;
+}
+
+static void start_connect(struct ble_adv_publish *pub, uint64_t now)
+{
+    pub->fd = socket(pub->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (pub->fd < 0) {
+        disconnect(pub, now);
+        return;
+    }
+
+    if (!connect(pub->fd, (const struct sockaddr *)&pub->addr, pub->addr_len)) {
+        send_connect(pub);
+    }
+    else if (errno == EINPROGRESS) {
+        pub->state = STATE_CONNECTING;
+    }
+    else {
+        disconnect(pub, now);
+    }
+}
+
+static void check_connect(struct ble_adv_publish *pub, uint64_t now)
+{
+    struct pollfd pfd = { .fd = pub->fd, .events = POLLOUT };
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+
+    int err;
+    socklen_t len = sizeof(err);
+    if (getsockopt(pub->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+        disconnect(pub, now);
+        return;
+    }
+
+    send_connect(pub);
+}
+
+static void send_ctrl(struct ble_adv_publish *pub, uint64_t now)
+{
+    while (pub->ctrl_sent < pub->ctrl_len) {
+        ssize_t n = send(pub->fd, pub->ctrl + pub->ctrl_sent,
+                         (size_t)(pub->ctrl_len - pub->ctrl_sent), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                disconnect(pub, now);
+            }
+            return;
+        }
+        pub->ctrl_sent = (uint8_t)(pub->ctrl_sent + n);
+        pub->last_tx_ms = now;
+    }
+
+    pub->ctrl_len = pub->ctrl_sent = 0;
+}
+
+static void consume(struct ble_adv_publish *pub, size_t len)
+{
+    memmove(pub->in, pub->in + len, pub->in_len - len);
+    pub->in_len = (uint8_t)(pub->in_len - len);
+}
+
+/**
+ * @brief   Handle the control packets sent by the broker
+ */
+static void receive(struct ble_adv_publish *pub, uint64_t now)
+{
+    while (1) {
+        ssize_t n = recv(pub->fd, pub->in + pub->in_len, sizeof(pub->in) - pub->in_len, 0);
+        if (n == 0) {
+            disconnect(pub, now);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                disconnect(pub, now);
+                return;
+            }
+            break;
+        }
+        pub->in_len = (uint8_t)(pub->in_len + n);
+
+        while (pub->in_len) {
+            if (pub->in_skip) {
+                size_t skip = (pub->in_skip < pub->in_len) ? pub->in_skip : pub->in_len;
+                consume(pub, skip);
+                pub->in_skip -= skip;
+                continue;
+            }
+
+            /* fixed header: type and variable length remaining length */
+            size_t rem = 0, hdr_len = 1;
+            int complete = 0;
+            while ((hdr_len < pub->in_len) && (hdr_len <= 4)) {
+                uint8_t byte = pub->in[hdr_len];
+                rem |= (size_t)(byte & 0x7f) << (7 * (hdr_len - 1));
+                hdr_len++;
+                if (!(byte & 0x80)) {
+                    complete = 1;
+                    break;
+                }
+            }
+            if (!complete) {
+                if (hdr_len > 4) {
+                    /* malformed remaining length */
+                    disconnect(pub, now);
+                    return;
+                }
+                break;
+            }
+
+            if (hdr_len + rem > sizeof(pub->in)) {
+                /* never expected from a broker we only publish to, skip it */
+                pub->in_skip = hdr_len + rem - pub->in_len;
+                pub->in_len = 0;
+                continue;
+            }
+            if (hdr_len + rem > pub->in_len) {
+                break;
+            }
+
+            uint8_t type = pub->in[0] & 0xf0;
+            if (type == MQTT_CONNACK) {
+                if ((rem < 2) || pub->in[hdr_len + 1]) {
+                    /* connection refused */
+                    disconnect(pub, now);
+                    return;
+                }
+                pub->state = STATE_CONNECTED;
+                pub->backoff_ms = BACKOFF_MIN_MS;
+                pub->stats.connects++;
+            }
+            else if (type == MQTT_PINGRESP) {
+                pub->ping_since_ms = 0;
+            }
+            consume(pub, hdr_len + rem);
+        }
+    }
+}
+
+static void pop_batch(struct ble_adv_publish *pub)
+{
+    pub->head = (pub->head + 1) % pub->num_slots;
+    pub->queued--;
+    pub->sent = 0;
+}
+
+static void send_queue(struct ble_adv_publish *pub, uint64_t now)
+{
+    while (pub->queued) {
+        struct ble_adv_publish_slot *slot = &pub->slots[pub->head];
+        const uint8_t *msg = slot_mem(pub, pub->head) + slot->off;
+        ssize_t n;
+
+        if (pub->transport == BLE_ADV_PUBLISH_UDP) {
+            n = send(pub->fd, msg, slot->len, 0);
+            if (n < 0) {
+                if ((errno == EMSGSIZE) || (errno == EINVAL)) {
+                    /* will never succeed */
+                    pub->stats.dropped += slot->records;
+                    pop_batch(pub);
+                    continue;
+                }
+                /* e.g. EAGAIN, ENOBUFS, or ECONNREFUSED reported for an earlier datagram */
+                if (errno != EINTR) {
+                    pub->stats.retries++;
+                    return;
+                }
+                continue;
+            }
+        }
+        else {
+            n = send(pub->fd, msg + pub->sent, slot->len - pub->sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                    pub->stats.retries++;
+                    disconnect(pub, now);
+                }
+                return;
+            }
+            pub->sent += (size_t)n;
+            pub->last_tx_ms = now;
+            if (pub->sent < slot->len) {
+                continue;
+            }
+        }
+
+        pub->stats.batches++;
+        pub->stats.bytes += slot->len;
+        pop_batch(pub);
+    }
+}
+
+int ble_adv_publish_init(struct ble_adv_publish *pub, const char *url, unsigned format,
+                         size_t queue_len, uint64_t flush_ms)
+{
+    char host[256], port[8];
+    if (!pub || !url || (format > BLE_ADV_OUTPUT_BINARY)
+        || parse_url(pub, url, host, sizeof(host), port, sizeof(port)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = (pub->transport == BLE_ADV_PUBLISH_UDP) ? SOCK_DGRAM : SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    memcpy(&pub->addr, res->ai_addr, res->ai_addrlen);
+    pub->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    if (!queue_len) {
+        queue_len = BLE_ADV_PUBLISH_QUEUE_LEN;
+    }
+
+    if (pub->transport == BLE_ADV_PUBLISH_UDP) {
+        pub->hdr_room = 0;
+        pub->payload_max = BLE_ADV_PUBLISH_UDP_PAYLOAD;
+    }
+    else {
+        /* type, up to 4 bytes remaining length, topic length and topic */
+        pub->hdr_room = 1 + 4 + 2 + pub->topic_len;
+        pub->payload_max = BLE_ADV_PUBLISH_MQTT_PAYLOAD;
+    }
+    pub->slot_size = pub->hdr_room + pub->payload_max;
+    /* one more slot than queued batches for the one being filled */
+    pub->num_slots = queue_len + 1;
+    if (pub->num_slots > SIZE_MAX / pub->slot_size) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pub->slots = calloc(pub->num_slots, sizeof(pub->slots[0]));
+    pub->mem = malloc(pub->num_slots * pub->slot_size);
+    if (!pub->slots || !pub->mem) {
+        free(pub->slots);
+        free(pub->mem);
+        return -1;
+    }
+
+    pub->head = pub->queued = pub->sent = pub->fill_len = 0;
+    pub->fill_since_ms = 0;
+    pub->flush_ms = flush_ms;
+    pub->next_connect_ms = 0;
+    pub->backoff_ms = BACKOFF_MIN_MS;
+    pub->last_tx_ms = 0;
+    pub->ping_since_ms = 0;
+    memset(&pub->stats, 0, sizeof(pub->stats));
+    pub->format = format;
+    pub->ctrl_len = pub->ctrl_sent = 0;
+    pub->in_len = 0;
+    pub->in_skip = 0;
+    pub->fd = -1;
+    pub->state = STATE_IDLE;
+
+    if (pub->transport == BLE_ADV_PUBLISH_UDP) {
+        pub->fd = socket(pub->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if ((pub->fd < 0)
+            || connect(pub->fd, (const struct sockaddr *)&pub->addr, pub->addr_len))
+        {
+            int err = errno;
+            if (pub->fd >= 0) {
+                close(pub->fd);
+            }
+            free(pub->slots);
+            free(pub->mem);
+            errno = err;
+            return -1;
+        }
+        pub->state = STATE_CONNECTED;
+    }
+
+    return 0;
+}
+
+void ble_adv_publish_destroy(struct ble_adv_publish *pub)
+{
+    ble_adv_publish_flush(pub);
+    ble_adv_publish_run(pub);
+    if (pub->fd >= 0) {
+        close(pub->fd);
+    }
+    free(pub->slots);
+    free(pub->mem);
+    pub->slots = NULL;
+    pub->mem = NULL;
+}
+
+int ble_adv_publish_flush(struct ble_adv_publish *pub)
+{
+    if (!pub->fill_len) {
+        return 0;
+    }
+
+    if (pub->queued == pub->num_slots - 1) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    size_t idx = fill_idx(pub);
+    struct ble_adv_publish_slot *slot = &pub->slots[idx];
+    slot->off = (uint32_t)pub->hdr_room;
+    slot->len = (uint32_t)pub->fill_len;
+
+    if (pub->transport == BLE_ADV_PUBLISH_MQTT) {
+        /* build the header right in front of the payload */
+        uint8_t hdr[1 + 4 + 2];
+        size_t hdr_len = 0;
+        size_t rem = 2 + pub->topic_len + pub->fill_len;
+        hdr[hdr_len++] = MQTT_PUBLISH;
+        do {
+            uint8_t byte = rem & 0x7f;
+            rem >>= 7;
+            hdr[hdr_len++] = rem ? (byte | 0x80) : byte;
+        } while (rem);
+        hdr[hdr_len++] = (uint8_t)(pub->topic_len >> 8);
+        hdr[hdr_len++] = (uint8_t)pub->topic_len;
+
+        uint8_t *payload = slot_mem(pub, idx) + pub->hdr_room;
+        memcpy(payload - pub->topic_len, pub->topic, pub->topic_len);
+        memcpy(payload - pub->topic_len - hdr_len, hdr, hdr_len);
+        slot->off = (uint32_t)(pub->hdr_room - pub->topic_len - hdr_len);
+        slot->len = (uint32_t)(hdr_len + pub->topic_len + pub->fill_len);
+    }
+
+    pub->queued++;
+    pub->fill_len = 0;
+    return 0;
+}
+
+static int add(struct ble_adv_publish *pub, const uint8_t *record, size_t len)
+{
+    if ((pub->fill_len + len > pub->payload_max) && ble_adv_publish_flush(pub)) {
+        pub->stats.rejected++;
+        return -1;
+    }
+
+    size_t idx = fill_idx(pub);
+    if (!pub->fill_len) {
+        pub->fill_since_ms = now_ms();
+        pub->slots[idx].records = 0;
+    }
+
+    memcpy(slot_mem(pub, idx) + pub->hdr_room + pub->fill_len, record, len);
+    pub->fill_len += len;
+    pub->slots[idx].records++;
+    pub->stats.records++;
+    return 0;
+}
+
+int ble_adv_publish_adv(struct ble_adv_publish *pub, const struct ble_adv *adv)
+{
+    uint8_t record[BLE_ADV_OUTPUT_RECORD_MAX];
+    return add(pub, record, ble_adv_output_format_adv(record, pub->format, adv));
+}
+
+int ble_adv_publish_sensor(struct ble_adv_publish *pub, const struct ble_adv *adv,
+                           const struct ble_adv_sensor *sensor)
+{
+    uint8_t record[BLE_ADV_OUTPUT_RECORD_MAX];
+    return add(pub, record, ble_adv_output_format_sensor(record, pub->format, adv, sensor));
+}
+
+int ble_adv_publish_agg(struct ble_adv_publish *pub, const struct ble_adv_agg_record *record)
+{
+    uint8_t buf[BLE_ADV_OUTPUT_RECORD_MAX];
+    return add(pub, buf, ble_adv_output_format_agg(buf, pub->format, record));
+}
+
+int ble_adv_publish_ready(const struct ble_adv_publish *pub)
+{
+    return (pub->fill_len + BLE_ADV_OUTPUT_RECORD_MAX <= pub->payload_max)
+           || (pub->queued < pub->num_slots - 1);
+}
+
+void ble_adv_publish_run(struct ble_adv_publish *pub)
+{
+    uint64_t now = now_ms();
+
+    if (pub->fill_len && pub->flush_ms && (now - pub->fill_since_ms >= pub->flush_ms)) {
+        /* if the queue is full, the batch is closed once there is room */
+        ble_adv_publish_flush(pub);
+    }
+
+    if (pub->transport == BLE_ADV_PUBLISH_MQTT) {
+        if ((pub->state == STATE_IDLE) && (now >= pub->next_connect_ms)) {
+            start_connect(pub, now);
+        }
+        if (pub->state == STATE_CONNECTING) {
+            check_connect(pub, now);
+        }
+        if (pub->state >= STATE_CONNACK) {
+            receive(pub, now);
+        }
+        if (pub->state == STATE_CONNECTED) {
+            uint64_t keepalive_ms = BLE_ADV_PUBLISH_KEEPALIVE_S * 1000;
+            if (pub->ping_since_ms && (now - pub->ping_since_ms >= keepalive_ms)) {
+                /* the broker went away silently */
+                disconnect(pub, now);
+            }
+            else if (!pub->ping_since_ms && !pub->ctrl_len && !pub->queued
+                     && (now - pub->last_tx_ms >= keepalive_ms / 2))
+            {
+                pub->ctrl[0] = MQTT_PINGREQ;
+                pub->ctrl[1] = 0;
+                pub->ctrl_len = 2;
+                pub->ctrl_sent = 0;
+                pub->ping_since_ms = now;
+            }
+        }
+        if ((pub->state >= STATE_CONNACK) && pub->ctrl_len) {
+            send_ctrl(pub, now);
+        }
+    }
+
+    if ((pub->state == STATE_CONNECTED) && !pub->ctrl_len) {
+        send_queue(pub, now);
+    }
+}
+
+int ble_adv_publish_pollfd(const struct ble_adv_publish *pub, short *events)
+{
+    *events = 0;
+    switch (pub->state) {
+    case STATE_CONNECTING:
+        *events = POLLOUT;
+        break;
+    case STATE_CONNACK:
+        *events = (short)(POLLIN | (pub->ctrl_len ? POLLOUT : 0));
+        break;
+    case STATE_CONNECTED:
+        if (pub->transport == BLE_ADV_PUBLISH_MQTT) {
+            *events = POLLIN;
+        }
+        if (pub->ctrl_len || pub->queued) {
+            *events = (short)(*events | POLLOUT);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return pub->fd;
+}
+
+void ble_adv_publish_stats(const struct ble_adv_publish *pub,
+                           struct ble_adv_publish_stats *dest)
+{
+    *dest = pub->stats;
+}
+
+/** @} */
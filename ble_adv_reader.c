@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_reader
+ *
+ * @{
+ * @brief   Implementation of the non-blocking advertisement reader
+ * @file
+ */
+#include "ble_adv_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+int ble_adv_reader_init(struct ble_adv_reader *reader, int dev, unsigned parse_flags,
+                        ble_adv_reader_cb_t cb, void *ctx)
+{
+    if (!reader || (dev == -1) || !cb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int flags = fcntl(dev, F_GETFL);
+    if ((flags == -1) || fcntl(dev, F_SETFL, flags | O_NONBLOCK)) {
+        return -1;
+    }
+
+    reader->dev = dev;
+    reader->cb = cb;
+    reader->ctx = ctx;
+    reader->err = 0;
+    reader->parse_flags = parse_flags;
+    return 0;
+}
+
+int ble_adv_reader_dispatch(struct ble_adv_reader *reader)
+{
+    size_t events = 0;
+    int delivered = 0;
+
+    if (!reader) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (reader->err) {
+        /* failure of the previous call, which still delivered advertisements */
+        errno = reader->err;
+        reader->err = 0;
+        return -1;
+    }
+
+    while (events < BLE_ADV_READER_BUDGET) {
+        struct ble_adv_read_info info;
+        int num = ble_adv_read_many(reader->dev, reader->batch, BLE_ADV_READER_BATCH, &info,
+                                    reader->parse_flags);
+        if (num < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (delivered) {
+                /* do not hide the advertisements already passed to the callback */
+                reader->err = errno;
+                break;
+            }
+            return -1;
+        }
+
+        for (int i = 0; i < num; i++) {
+            reader->cb(&reader->batch[i], reader->ctx);
+        }
+
+        events += info.events;
+        delivered += num;
+    }
+
+    return delivered;
+}
+
+/** @} */
@@ -0,0 +1,483 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_rec
+ *
+ * @{
+ * @brief   Implementation of the recording and replay of raw HCI events
+ * @file
+ */
+#include "ble_adv_rec.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_MAGIC              "BLEADVRC"  /**< First 8 bytes of a recording */
+#define FILE_VERSION            1           /**< Version of the format */
+#define FILE_HDR_SIZE           16          /**< magic, version, reserved */
+#define BLOCK_HDR_SIZE          16          /**< raw len, payload len, records, flags */
+#define BLOCK_FLAG_COMPRESSED   0x01        /**< Payload is compressed */
+#define RECORD_HDR_SIZE         12          /**< timestamp, adapter, reserved, len */
+
+#define LZ_MIN_MATCH            4           /**< Shortest match encoded */
+#define LZ_MAX_OFFSET           UINT16_MAX  /**< Largest distance of a match */
+#define LZ_HASH_BITS            12          /**< Size of the compressor's hash table */
+/**
+ * @brief   Worst case size of the compressed data
+ */
+#define LZ_BOUND(len)           ((len) + (len) / 255 + 16)
+
+static inline void put_le16(uint8_t *dest, uint16_t val)
+{
+    dest[0] = (uint8_t)val;
+    dest[1] = (uint8_t)(val >> 8);
+}
+
+static inline void put_le32(uint8_t *dest, uint32_t val)
+{
+    put_le16(dest, (uint16_t)val);
+    put_le16(dest + 2, (uint16_t)(val >> 16));
+}
+
+static inline void put_le64(uint8_t *dest, uint64_t val)
+{
+    put_le32(dest, (uint32_t)val);
+    put_le32(dest + 4, (uint32_t)(val >> 32));
+}
+
+static inline uint16_t get_le16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *data)
+{
+    return get_le16(data) | ((uint32_t)get_le16(data + 2) << 16);
+}
+
+static inline uint64_t get_le64(const uint8_t *data)
+{
+    return get_le32(data) | ((uint64_t)get_le32(data + 4) << 32);
+}
+
+static inline uint32_t lz_hash(const uint8_t *data)
+{
+    uint32_t val;
+    memcpy(&val, data, sizeof(val));
+    return (val * UINT32_C(2654435761)) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_put_len(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/**
+ * @brief   Emit a sequence of literals optionally followed by a match
+ *
+ * A sequence is a token holding the number of literals and the match length in its nibbles
+ * (15 meaning further length bytes follow), the literals, and unless this is the last
+ * sequence the offset of the match.
+ */
+static uint8_t *lz_put_seq(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset,
+                           size_t match_len)
+{
+    uint8_t *token = op++;
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    *token = (uint8_t)(((lit_len < 15) ? lit_len : 15) << 4);
+    *token |= (uint8_t)((match_code < 15) ? match_code : 15);
+    if (lit_len >= 15) {
+        op = lz_put_len(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len) {
+        put_le16(op, (uint16_t)offset);
+        op += 2;
+        if (match_code >= 15) {
+            op = lz_put_len(op, match_code - 15);
+        }
+    }
+    return op;
+}
+
+/**
+ * @brief   Compress @p len bytes of @p src into @p dest
+ *
+ * @return  Length of the compressed data, or 0 if it is not smaller than the input
+ *
+ * @pre     @p dest has room for `LZ_BOUND(len)` bytes
+ */
+static size_t lz_compress(uint8_t *dest, const uint8_t *src, size_t len, uint32_t *hash)
+{
+    memset(hash, 0, sizeof(hash[0]) << LZ_HASH_BITS);
+    uint8_t *op = dest;
+    size_t anchor = 0, ip = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t h = lz_hash(src + ip);
+        /* positions are stored plus one, so that zero marks an empty bucket */
+        size_t ref = hash[h];
+        hash[h] = (uint32_t)(ip + 1);
+        if (!ref || (ip - (ref - 1) > LZ_MAX_OFFSET)
+            || memcmp(src + ref - 1, src + ip, LZ_MIN_MATCH))
+        {
+            ip++;
+            continue;
+        }
+
+        ref--;
+        size_t match_len = LZ_MIN_MATCH;
+        while ((ip + match_len < len) && (src[ref + match_len] == src[ip + match_len])) {
+            match_len++;
+        }
+
+        op = lz_put_seq(op, src + anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = lz_put_seq(op, src + anchor, len - anchor, 0, 0);
+    size_t comp_len = (size_t)(op - dest);
+    return (comp_len < len) ? comp_len : 0;
+}
+
+static int lz_get_len(const uint8_t *src, size_t len, size_t *ip, size_t *dest)
+{
+    uint8_t b;
+    do {
+        if (*ip >= len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *dest += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+/**
+ * @brief   Decompress @p len bytes of @p src into @p dest of size @p size
+ *
+ * @return  Length of the decompressed data
+ * @retval  -1                  Corrupted input
+ */
+static ssize_t lz_decompress(uint8_t *dest, size_t size, const uint8_t *src, size_t len)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t lit_len = token >> 4;
+        if ((lit_len == 15) && lz_get_len(src, len, &ip, &lit_len)) {
+            return -1;
+        }
+        if ((lit_len > len - ip) || (lit_len > size - op)) {
+            return -1;
+        }
+        memcpy(dest + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == len) {
+            /* last sequence has no match */
+            break;
+        }
+
+        if (len - ip < 2) {
+            return -1;
+        }
+        size_t offset = get_le16(src + ip);
+        ip += 2;
+        size_t match_len = token & 0x0f;
+        if ((match_len == 15) && lz_get_len(src, len, &ip, &match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (!offset || (offset > op) || (match_len > size - op)) {
+            return -1;
+        }
+        /* byte by byte, as source and destination may overlap */
+        for (size_t i = 0; i < match_len; i++, op++) {
+            dest[op] = dest[op - offset];
+        }
+    }
+
+    return (ssize_t)op;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+int ble_adv_rec_open(struct ble_adv_rec_writer *w, const char *path)
+{
+    if (!w || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w->raw = malloc(BLE_ADV_REC_BLOCK_SIZE);
+    w->comp = malloc(BLOCK_HDR_SIZE + LZ_BOUND(BLE_ADV_REC_BLOCK_SIZE));
+    w->hash = malloc(sizeof(w->hash[0]) << LZ_HASH_BITS);
+    if (!w->raw || !w->comp || !w->hash) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    w->raw_len = 0;
+    w->num_records = 0;
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        goto fail;
+    }
+
+    uint8_t hdr[FILE_HDR_SIZE] = { 0 };
+    memcpy(hdr, FILE_MAGIC, 8);
+    put_le16(hdr + 8, FILE_VERSION);
+    if (write_all(w->fd, hdr, sizeof(hdr))) {
+        int err = errno;
+        close(w->fd);
+        errno = err;
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    free(w->raw);
+    free(w->comp);
+    free(w->hash);
+    return -1;
+}
+
+int ble_adv_rec_flush(struct ble_adv_rec_writer *w)
+{
+    if (!w->num_records) {
+        return 0;
+    }
+
+    uint8_t *hdr = w->comp;
+    const uint8_t *payload = w->comp + BLOCK_HDR_SIZE;
+    size_t payload_len = lz_compress(w->comp + BLOCK_HDR_SIZE, w->raw, w->raw_len, w->hash);
+    uint32_t flags = BLOCK_FLAG_COMPRESSED;
+    if (!payload_len) {
+        payload = w->raw;
+        payload_len = w->raw_len;
+        flags = 0;
+    }
+
+    put_le32(hdr, (uint32_t)w->raw_len);
+    put_le32(hdr + 4, (uint32_t)payload_len);
+    put_le32(hdr + 8, w->num_records);
+    put_le32(hdr + 12, flags);
+    if (write_all(w->fd, hdr, BLOCK_HDR_SIZE) || write_all(w->fd, payload, payload_len)) {
+        return -1;
+    }
+
+    w->raw_len = 0;
+    w->num_records = 0;
+    return 0;
+}
+
+int ble_adv_rec_append(struct ble_adv_rec_writer *w, uint64_t timestamp_us, uint8_t adapter,
+                       const void *buf, size_t len)
+{
+    if (!w || !buf || (len > BLE_ADV_REC_EVENT_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((BLE_ADV_REC_BLOCK_SIZE - w->raw_len < RECORD_HDR_SIZE + len) && ble_adv_rec_flush(w)) {
+        return -1;
+    }
+
+    uint8_t *rec = w->raw + w->raw_len;
+    put_le64(rec, timestamp_us);
+    rec[8] = adapter;
+    rec[9] = 0;
+    put_le16(rec + 10, (uint16_t)len);
+    memcpy(rec + RECORD_HDR_SIZE, buf, len);
+    w->raw_len += RECORD_HDR_SIZE + len;
+    w->num_records++;
+    return 0;
+}
+
+int ble_adv_rec_close(struct ble_adv_rec_writer *w)
+{
+    int retval = ble_adv_rec_flush(w);
+    int err = errno;
+    if (close(w->fd) && !retval) {
+        retval = -1;
+        err = errno;
+    }
+
+    free(w->raw);
+    free(w->comp);
+    free(w->hash);
+    w->raw = w->comp = NULL;
+    w->hash = NULL;
+    errno = err;
+    return retval;
+}
+
+int ble_adv_rec_reader_open(struct ble_adv_rec_reader *r, const char *path)
+{
+    if (!r || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if ((st.st_size < FILE_HDR_SIZE) || ((uintmax_t)st.st_size > SIZE_MAX)) {
+        close(fd);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    r->map_len = (size_t)st.st_size;
+    void *map = mmap(NULL, r->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    r->map = map;
+    madvise(map, r->map_len, MADV_SEQUENTIAL);
+
+    if (memcmp(r->map, FILE_MAGIC, 8) || (get_le16(r->map + 8) != FILE_VERSION)) {
+        munmap(map, r->map_len);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    r->block = malloc(BLE_ADV_REC_BLOCK_SIZE);
+    if (!r->block) {
+        munmap(map, r->map_len);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ble_adv_rec_rewind(r);
+    return 0;
+}
+
+void ble_adv_rec_reader_close(struct ble_adv_rec_reader *r)
+{
+    munmap((void *)r->map, r->map_len);
+    free(r->block);
+    r->map = NULL;
+    r->block = NULL;
+}
+
+void ble_adv_rec_rewind(struct ble_adv_rec_reader *r)
+{
+    r->next_block = FILE_HDR_SIZE;
+    r->records = NULL;
+    r->records_len = 0;
+    r->pos = 0;
+}
+
+static int load_block(struct ble_adv_rec_reader *r)
+{
+    if (r->map_len - r->next_block < BLOCK_HDR_SIZE) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    const uint8_t *hdr = r->map + r->next_block;
+    size_t raw_len = get_le32(hdr);
+    size_t payload_len = get_le32(hdr + 4);
+    uint32_t flags = get_le32(hdr + 12);
+    const uint8_t *payload = hdr + BLOCK_HDR_SIZE;
+    if ((raw_len > BLE_ADV_REC_BLOCK_SIZE)
+        || (payload_len > r->map_len - r->next_block - BLOCK_HDR_SIZE))
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    if (flags & BLOCK_FLAG_COMPRESSED) {
+        if (lz_decompress(r->block, raw_len, payload, payload_len) != (ssize_t)raw_len) {
+            errno = EBADMSG;
+            return -1;
+        }
+        r->records = r->block;
+    }
+    else {
+        if (payload_len != raw_len) {
+            errno = EBADMSG;
+            return -1;
+        }
+        /* no need to copy stored blocks */
+        r->records = payload;
+    }
+
+    r->records_len = raw_len;
+    r->pos = 0;
+    r->next_block += BLOCK_HDR_SIZE + payload_len;
+    return 0;
+}
+
+int ble_adv_rec_next(struct ble_adv_rec_reader *r, struct ble_adv_rec_event *ev)
+{
+    while (r->pos == r->records_len) {
+        if (r->next_block == r->map_len) {
+            return 0;
+        }
+        if (load_block(r)) {
+            return -1;
+        }
+    }
+
+    const uint8_t *rec = r->records + r->pos;
+    size_t left = r->records_len - r->pos;
+    if ((left < RECORD_HDR_SIZE) || (get_le16(rec + 10) > left - RECORD_HDR_SIZE)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    ev->timestamp_us = get_le64(rec);
+    ev->adapter = rec[8];
+    ev->len = get_le16(rec + 10);
+    ev->buf = rec + RECORD_HDR_SIZE;
+    r->pos += RECORD_HDR_SIZE + ev->len;
+    return 1;
+}
+
+/** @} */
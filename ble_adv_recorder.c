@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @defgroup    ble_adv_recorder    Example program: Record raw HCI events to a file
+ *
+ * @{
+ * @brief   This program records the raw HCI events received while scanning
+ * @file
+ *
+ * Usage: `ble_adv_recorder <FILE>`. Press Ctrl+C to stop recording. Replay the recording with
+ * @ref ble_adv_replay. Each event is stored with its kernel receive timestamp, just as live
+ * reads fill in @ref ble_adv::timestamp_us.
+ */
+#include "ble_adv.h"
+#include "ble_adv_rec.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static volatile sig_atomic_t stop;
+
+static void handle_exit(int signal)
+{
+    (void)signal;
+    stop = 1;
+}
+
+static struct sigaction exit_handler = {
+    .sa_handler = handle_exit,
+};
+
+int main(int argc, const char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <FILE>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int dev_id = hci_get_route(NULL);
+    int dev = hci_open_dev(dev_id);
+    if (dev < 0) {
+        perror("hci_open_dev()");
+        exit(EXIT_FAILURE);
+    }
+
+    static struct ble_adv_rec_writer rec;
+    if (ble_adv_rec_open(&rec, argv[1])) {
+        perror("ble_adv_rec_open()");
+        exit(EXIT_FAILURE);
+    }
+
+    if (sigaction(SIGINT, &exit_handler, NULL) || sigaction(SIGTERM, &exit_handler, NULL)) {
+        puts("WARNING: Couldn't register exit handler, recording may be incomplete on exit");
+    }
+
+    if (ble_adv_scan(dev, BLE_ADV_SCAN_FLAG_ENABLED)) {
+        int err = errno;
+        perror("ble_adv_scan() failed");
+        if (err == EPERM) {
+            printf("Try running \"sudo setcap 'cap_net_raw,cap_net_admin+eip' %s\"\n", argv[0]);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long num_events = 0;
+    int retval = EXIT_SUCCESS;
+    while (!stop) {
+        /* poll() is interrupted by the signal, the receive is retried by ble_adv_read_event() */
+        struct pollfd pfd = { .fd = dev, .events = POLLIN };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll()");
+            retval = EXIT_FAILURE;
+            break;
+        }
+
+        uint8_t buf[HCI_MAX_EVENT_SIZE];
+        uint64_t timestamp_us;
+        ssize_t len = ble_adv_read_event(dev, buf, sizeof(buf), &timestamp_us);
+        if (len < 0) {
+            perror("ble_adv_read_event()");
+            retval = EXIT_FAILURE;
+            break;
+        }
+
+        if (ble_adv_rec_append(&rec, timestamp_us, (uint8_t)dev_id, buf, (size_t)len)) {
+            perror("ble_adv_rec_append()");
+            retval = EXIT_FAILURE;
+            break;
+        }
+        num_events++;
+    }
+
+    ble_adv_scan(dev, 0);
+    if (ble_adv_rec_close(&rec)) {
+        perror("ble_adv_rec_close()");
+        retval = EXIT_FAILURE;
+    }
+
+    printf("Recorded %lu events\n", num_events);
+    return retval;
+}
+
+/** @} */
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @defgroup    ble_adv_replay      Example program: Replay a recording as fast as possible
+ *
+ * @{
+ * @brief   This program decodes all events of a recording and reports the throughput
+ * @file
+ *
+ * Usage: `ble_adv_replay [-j WORKERS] <FILE> [LOOPS]`. The recording (as created by
+ * @ref ble_adv_recorder) is decoded @p LOOPS times (default 1) via the same code path as used
+ * for live scanning. With `-j`, the advertisements and their sensor data are decoded on
+ * @p WORKERS threads via @ref ble_adv_pipeline instead.
+ */
+#include "ble_adv.h"
+#include "ble_adv_pipeline.h"
+#include "ble_adv_rec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void ignore_adv(unsigned worker, const struct ble_adv *adv,
+                       const struct ble_adv_sensor *sensor, void *ctx)
+{
+    (void)worker;
+    (void)adv;
+    (void)sensor;
+    (void)ctx;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long workers = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        switch (opt) {
+        case 'j':
+            workers = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j WORKERS] <FILE> [LOOPS]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((argc - optind != 1) && (argc - optind != 2)) {
+        fprintf(stderr, "Usage: %s [-j WORKERS] <FILE> [LOOPS]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long loops = (argc - optind == 2) ? strtoul(argv[optind + 1], NULL, 0) : 1;
+    static struct ble_adv_rec_reader rec;
+    if (ble_adv_rec_reader_open(&rec, argv[optind])) {
+        perror("ble_adv_rec_reader_open()");
+        exit(EXIT_FAILURE);
+    }
+
+    static struct ble_adv_pipeline pipeline;
+    if (workers && ((workers > BLE_ADV_PIPELINE_WORKERS_MAX)
+                    || ble_adv_pipeline_init(&pipeline, (unsigned)workers, 0, ignore_adv, NULL)))
+    {
+        fprintf(stderr, "Failed to start %lu workers\n", workers);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long num_events = 0, num_advs = 0, num_other = 0;
+    double start = now_s();
+    for (unsigned long i = 0; i < loops; i++) {
+        struct ble_adv_rec_event ev;
+        int retval;
+        ble_adv_rec_rewind(&rec);
+        while ((retval = ble_adv_rec_next(&rec, &ev)) == 1) {
+            struct ble_adv advs[BLE_ADV_REPORTS_MAX];
+            int num = workers ? ble_adv_pipeline_submit(&pipeline, ev.buf, ev.len,
+                                                        ev.timestamp_us, ev.adapter)
+                              : ble_adv_parse_event(advs, BLE_ADV_REPORTS_MAX, ev.buf, ev.len, 0);
+            num_events++;
+            if (num < 0) {
+                num_other++;
+                continue;
+            }
+            num_advs += (unsigned)num;
+        }
+
+        if (retval < 0) {
+            perror("ble_adv_rec_next()");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (workers && ble_adv_pipeline_sync(&pipeline)) {
+        perror("ble_adv_pipeline_sync()");
+        exit(EXIT_FAILURE);
+    }
+    double elapsed = now_s() - start;
+
+    printf("%llu events (%llu advertisements, %llu not decoded) in %.3f s\n",
+           num_events, num_advs, num_other, elapsed);
+    if (elapsed > 0) {
+        printf("%.3f M events/s\n", (double)num_events / elapsed * 1e-6);
+    }
+
+    if (workers) {
+        struct ble_adv_pipeline_stats stats;
+        ble_adv_pipeline_stats(&pipeline, &stats);
+        printf("%u workers decoded %llu advertisements (%llu invalid)\n", (unsigned)workers,
+               (unsigned long long)stats.processed, (unsigned long long)stats.invalid);
+        ble_adv_pipeline_destroy(&pipeline);
+    }
+
+    ble_adv_rec_reader_close(&rec);
+    return EXIT_SUCCESS;
+}
+
+/** @} */
@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_ring
+ *
+ * @{
+ * @brief   Implementation of the lock-free ring buffer and the reader thread
+ * @file
+ */
+#include "ble_adv_ring.h"
+#include "ble_adv_internal.h"
+#include "ble_adv_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief   Offset of the element data in a cell, the sequence number comes first
+ */
+#define CELL_DATA_OFFSET        ((sizeof(atomic_size_t) + alignof(max_align_t) - 1) \
+                                 & ~(alignof(max_align_t) - 1))
+
+/**
+ * @brief   Interval in which the reader thread checks for a stop request
+ */
+#define THREAD_POLL_MS          100
+
+/**
+ * @brief   Number of advertisements the reader thread decodes per syscall
+ *
+ * Enough for @ref ble_adv_read_many to consume the largest batch of events
+ */
+#define THREAD_BATCH            (BLE_ADV_READ_MANY_EVENTS * BLE_ADV_REPORTS_MAX)
+
+static inline unsigned char *cell_at(const struct ble_adv_ring *ring, size_t pos)
+{
+    return ring->cells + (pos & ring->mask) * ring->cell_size;
+}
+
+static inline atomic_size_t *cell_seq(unsigned char *cell)
+{
+    return (atomic_size_t *)(void *)cell;
+}
+
+int ble_adv_ring_init(struct ble_adv_ring *ring, size_t capacity, size_t elem_size,
+                      unsigned policy)
+{
+    if (!ring || (capacity < 2) || (capacity & (capacity - 1)) || !elem_size
+        || (policy > BLE_ADV_RING_DROP_OLDEST))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t cell_size = CELL_DATA_OFFSET + elem_size;
+    cell_size = (cell_size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    if (capacity > SIZE_MAX / cell_size) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t total = capacity * cell_size;
+    total = (total + BLE_ADV_CACHE_LINE - 1) & ~(size_t)(BLE_ADV_CACHE_LINE - 1);
+    ring->cells = aligned_alloc(BLE_ADV_CACHE_LINE, total);
+    if (!ring->cells) {
+        return -1;
+    }
+
+    ring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->efd < 0) {
+        free(ring->cells);
+        return -1;
+    }
+
+    ring->mask = capacity - 1;
+    ring->elem_size = elem_size;
+    ring->cell_size = cell_size;
+    ring->policy = policy;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(cell_seq(cell_at(ring, i)), i);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped_newest, 0);
+    atomic_init(&ring->dropped_oldest, 0);
+    atomic_init(&ring->waiters, 0);
+    return 0;
+}
+
+void ble_adv_ring_destroy(struct ble_adv_ring *ring)
+{
+    close(ring->efd);
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+static int try_push(struct ble_adv_ring *ring, const void *elem)
+{
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned char *cell;
+
+    while (1) {
+        cell = cell_at(ring, pos);
+        size_t seq = atomic_load_explicit(cell_seq(cell), memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* full */
+            return -1;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(cell + CELL_DATA_OFFSET, elem, ring->elem_size);
+    atomic_store_explicit(cell_seq(cell), pos + 1, memory_order_release);
+    return 0;
+}
+
+int ble_adv_ring_push(struct ble_adv_ring *ring, const void *elem)
+{
+    if (!try_push(ring, elem)) {
+        return 0;
+    }
+
+    if (ring->policy == BLE_ADV_RING_DROP_OLDEST) {
+        /* make room by discarding the oldest element. Concurrent producers may grab the freed
+         * cell first, so retry a few times before giving up */
+        for (unsigned i = 0; i < 4; i++) {
+            if (!ble_adv_ring_pop(ring, NULL)) {
+                atomic_fetch_add_explicit(&ring->dropped_oldest, 1, memory_order_relaxed);
+            }
+            if (!try_push(ring, elem)) {
+                return 0;
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&ring->dropped_newest, 1, memory_order_relaxed);
+    errno = ENOBUFS;
+    return -1;
+}
+
+int ble_adv_ring_pop(struct ble_adv_ring *ring, void *elem)
+{
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned char *cell;
+
+    while (1) {
+        cell = cell_at(ring, pos);
+        size_t seq = atomic_load_explicit(cell_seq(cell), memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    if (elem) {
+        memcpy(elem, cell + CELL_DATA_OFFSET, ring->elem_size);
+    }
+    atomic_store_explicit(cell_seq(cell), pos + ring->mask + 1, memory_order_release);
+    return 0;
+}
+
+int ble_adv_ring_pop_wait(struct ble_adv_ring *ring, void *elem, int timeout_ms)
+{
+    while (1) {
+        if (!ble_adv_ring_pop(ring, elem)) {
+            return 0;
+        }
+
+        /* announce waiting before checking again, so that a producer either sees us waiting
+         * or we see its element */
+        atomic_fetch_add_explicit(&ring->waiters, 1, memory_order_seq_cst);
+        if (!ble_adv_ring_pop(ring, elem)) {
+            atomic_fetch_sub_explicit(&ring->waiters, 1, memory_order_relaxed);
+            return 0;
+        }
+
+        struct pollfd pfd = { .fd = ring->efd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+        atomic_fetch_sub_explicit(&ring->waiters, 1, memory_order_relaxed);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (ready == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        uint64_t dummy;
+        ssize_t unused = read(ring->efd, &dummy, sizeof(dummy));
+        (void)unused;
+    }
+}
+
+void ble_adv_ring_notify(struct ble_adv_ring *ring)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->waiters, memory_order_relaxed)) {
+        uint64_t one = 1;
+        ssize_t unused = write(ring->efd, &one, sizeof(one));
+        (void)unused;
+    }
+}
+
+void ble_adv_ring_stats(const struct ble_adv_ring *ring, struct ble_adv_ring_stats *dest)
+{
+    dest->pushed = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    dest->popped = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    dest->dropped_newest = atomic_load_explicit(&ring->dropped_newest, memory_order_relaxed);
+    dest->dropped_oldest = atomic_load_explicit(&ring->dropped_oldest, memory_order_relaxed);
+}
+
+static void *reader_thread(void *arg)
+{
+    struct ble_adv_ring_thread *thread = arg;
+    struct ble_adv batch[THREAD_BATCH];
+
+    while (!atomic_load_explicit(&thread->stop, memory_order_relaxed)) {
+        struct pollfd pfd = { .fd = thread->dev, .events = POLLIN };
+        int ready = poll(&pfd, 1, THREAD_POLL_MS);
+        if (ready <= 0) {
+            if ((ready < 0) && (errno != EINTR)) {
+                thread->err = errno;
+                break;
+            }
+            continue;
+        }
+
+        int num = ble_adv_read_many_adapter(thread->dev, batch, THREAD_BATCH, NULL,
+                                            thread->adapter, thread->parse_flags);
+        if (num < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                continue;
+            }
+            thread->err = errno;
+            break;
+        }
+
+        for (int i = 0; i < num; i++) {
+            /* a drop is also accounted for in the ring's counters */
+            if (ble_adv_ring_push(thread->ring, &batch[i])) {
+                ble_adv_stats_add(thread->adapter, BLE_ADV_STATS_DROP_RING, 1);
+            }
+        }
+
+        if (num) {
+            ble_adv_ring_notify(thread->ring);
+        }
+    }
+
+    return NULL;
+}
+
+int ble_adv_ring_thread_start(struct ble_adv_ring_thread *thread, int dev, uint8_t adapter,
+                              unsigned parse_flags, struct ble_adv_ring *ring)
+{
+    if (!thread || (dev == -1) || !ring || (ring->elem_size != sizeof(struct ble_adv))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int flags = fcntl(dev, F_GETFL);
+    if ((flags == -1) || fcntl(dev, F_SETFL, flags | O_NONBLOCK)) {
+        return -1;
+    }
+
+    thread->ring = ring;
+    thread->dev = dev;
+    thread->adapter = adapter;
+    thread->parse_flags = parse_flags;
+    thread->err = 0;
+    atomic_init(&thread->stop, 0);
+
+    int err = pthread_create(&thread->thread, NULL, reader_thread, thread);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+int ble_adv_ring_thread_stop(struct ble_adv_ring_thread *thread)
+{
+    atomic_store_explicit(&thread->stop, 1, memory_order_relaxed);
+
+    int err = pthread_join(thread->thread, NULL);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    if (thread->err) {
+        errno = thread->err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/** @} */
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_scanctl
+ *
+ * @{
+ * @brief   Implementation of the adaptive scan duty cycle
+ * @file
+ */
+#include "ble_adv_scanctl.h"
+#include "ble_adv_stats.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/**
+ * @brief   End of the LRU list of a @ref ble_adv_devtab
+ */
+#define LRU_END                 UINT32_MAX
+
+static int apply(struct ble_adv_scanctl *ctl, uint16_t window)
+{
+    struct ble_adv_scan_params params = ctl->params;
+    params.window = window;
+    if (ble_adv_scan_ex(ctl->dev, &params)) {
+        ctl->status.failed++;
+        return -1;
+    }
+
+    /* ble_adv_scan_ex() let LE meta events pass, but nobody reads them from this descriptor */
+    struct hci_filter filter;
+    hci_filter_clear(&filter);
+    if (setsockopt(ctl->dev, SOL_HCI, HCI_FILTER, &filter, sizeof(filter))) {
+        ctl->status.failed++;
+        return -1;
+    }
+
+    ctl->params.window = window;
+    ctl->status.window = window;
+    return 0;
+}
+
+static void evaluate(struct ble_adv_scanctl *ctl, uint64_t now_ms)
+{
+    const struct ble_adv_devtab *tab = ctl->tab;
+    uint32_t known = 0, missed = 0;
+
+    for (uint32_t idx = tab->lru_head; idx != LRU_END; idx = tab->entries[idx].lru_next) {
+        const struct ble_adv_devtab_entry *e = &tab->entries[idx];
+        if (e->seen < BLE_ADV_SCANCTL_MIN_SEEN) {
+            continue;
+        }
+
+        uint64_t period_ms = (e->last_seen_ms - e->first_seen_ms) / (e->seen - 1);
+        if (period_ms < BLE_ADV_SCANCTL_PERIOD_MIN_MS) {
+            period_ms = BLE_ADV_SCANCTL_PERIOD_MIN_MS;
+        }
+        uint64_t silent_ms = (now_ms > e->last_seen_ms) ? now_ms - e->last_seen_ms : 0;
+        if (silent_ms > BLE_ADV_SCANCTL_GONE_FACTOR * period_ms) {
+            continue;
+        }
+
+        known++;
+        if (silent_ms > BLE_ADV_SCANCTL_MISS_FACTOR * period_ms) {
+            missed++;
+        }
+    }
+
+    struct ble_adv_stats stats;
+    if (!ble_adv_stats_snapshot(&stats, ctl->adapter)) {
+        uint64_t reports = stats.counters[BLE_ADV_STATS_REPORTS];
+        uint64_t elapsed_ms = now_ms - ctl->last_eval_ms;
+        if (elapsed_ms) {
+            ctl->status.reports_per_s = (uint32_t)((reports - ctl->reports) * 1000 / elapsed_ms);
+        }
+        ctl->reports = reports;
+    }
+
+    ctl->status.known = known;
+    ctl->status.missed = missed;
+    ctl->last_eval_ms = now_ms;
+}
+
+int ble_adv_scanctl_init(struct ble_adv_scanctl *ctl, int dev, const struct ble_adv_devtab *tab,
+                         const struct ble_adv_scan_params *params, uint16_t window_min,
+                         uint16_t window_max, uint8_t adapter)
+{
+    if (!ctl || (dev == -1) || !tab || !params || (window_min < BLE_ADV_SCAN_INTERVAL_MIN)
+        || (window_min > window_max) || (window_max > params->interval))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->params = *params;
+    ctl->tab = tab;
+    ctl->dev = dev;
+    ctl->window_min = window_min;
+    ctl->window_max = window_max;
+    ctl->adapter = adapter;
+    ctl->status.interval = params->interval;
+
+    struct ble_adv_stats stats;
+    if (!ble_adv_stats_snapshot(&stats, adapter)) {
+        ctl->reports = stats.counters[BLE_ADV_STATS_REPORTS];
+    }
+
+    /* start at the upper bound, so that all devices around are found quickly */
+    return apply(ctl, window_max);
+}
+
+int ble_adv_scanctl_tick(struct ble_adv_scanctl *ctl, uint64_t now_ms)
+{
+    if (!ctl->next_eval_ms) {
+        ctl->last_eval_ms = now_ms;
+        ctl->next_eval_ms = now_ms + BLE_ADV_SCANCTL_EVAL_MS;
+        return 0;
+    }
+
+    if (now_ms < ctl->next_eval_ms) {
+        return 0;
+    }
+
+    ctl->next_eval_ms = now_ms + BLE_ADV_SCANCTL_EVAL_MS;
+    evaluate(ctl, now_ms);
+
+    uint16_t window = ctl->params.window;
+    if (ctl->status.missed || !ctl->status.known) {
+        if (ctl->status.missed) {
+            ctl->miss_window = window;
+        }
+        ctl->calm = 0;
+        ctl->calm_total = 0;
+        uint32_t raised = (uint32_t)window * 2;
+        window = (raised < ctl->window_max) ? (uint16_t)raised : ctl->window_max;
+    }
+    else {
+        if (++ctl->calm_total >= BLE_ADV_SCANCTL_FORGET_EVALS) {
+            /* conditions may have improved, allow probing below the last failing window */
+            ctl->miss_window = 0;
+            ctl->calm_total = 0;
+        }
+
+        if (++ctl->calm >= BLE_ADV_SCANCTL_CALM_EVALS) {
+            uint16_t step = (window / 4) ? window / 4 : 1;
+            int floor = (ctl->miss_window >= ctl->window_min) ? ctl->miss_window + 1
+                                                              : ctl->window_min;
+            window = (window - step > floor) ? window - step : floor;
+            if (window > ctl->params.window) {
+                window = ctl->params.window;
+            }
+        }
+    }
+
+    if (window == ctl->params.window) {
+        return 0;
+    }
+
+    int lower = (window < ctl->params.window);
+    if (apply(ctl, window)) {
+        return -1;
+    }
+
+    if (lower) {
+        /* give the sensors a full round of evaluations at the new window */
+        ctl->calm = 0;
+        ctl->status.lowered++;
+    }
+    else {
+        ctl->status.raised++;
+    }
+
+    return 1;
+}
+
+void ble_adv_scanctl_status(const struct ble_adv_scanctl *ctl,
+                            struct ble_adv_scanctl_status *dest)
+{
+    *dest = ctl->status;
+}
+
+/** @} */
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_stats
+ *
+ * @{
+ * @brief   Implementation of the statistics
+ * @file
+ */
+#include "ble_adv_stats.h"
+#include "ble_adv_internal.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define SUB_BUCKETS             (1U << BLE_ADV_STATS_HIST_SUB_BITS)
+
+struct hist {
+    atomic_uint_fast64_t buckets[BLE_ADV_STATS_HIST_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+};
+
+/* each adapter is updated by its own reader, so keep them on separate cache lines */
+struct adapter_stats {
+    _Alignas(64) atomic_uint_fast64_t counters[BLE_ADV_STATS_NUM];
+    struct hist hists[BLE_ADV_STATS_HISTS];
+};
+
+static struct adapter_stats stats[BLE_ADV_STATS_ADAPTERS];
+
+static unsigned bucket_of(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return (unsigned)value;
+    }
+
+    unsigned msb = 63 - (unsigned)__builtin_clzll(value);
+    if (msb >= 32) {
+        return BLE_ADV_STATS_HIST_BUCKETS - 1;
+    }
+
+    unsigned shift = msb - BLE_ADV_STATS_HIST_SUB_BITS;
+    return ((shift + 1) << BLE_ADV_STATS_HIST_SUB_BITS)
+           + (unsigned)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_max(unsigned bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    if (bucket == BLE_ADV_STATS_HIST_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+
+    unsigned shift = (bucket >> BLE_ADV_STATS_HIST_SUB_BITS) - 1;
+    uint64_t lower = (uint64_t)(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+    return lower + (UINT64_C(1) << shift) - 1;
+}
+
+void ble_adv_stats_add(uint8_t adapter, unsigned counter, uint64_t n)
+{
+    if ((adapter >= BLE_ADV_STATS_ADAPTERS) || (counter >= BLE_ADV_STATS_NUM) || !n) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&stats[adapter].counters[counter], n, memory_order_relaxed);
+}
+
+void ble_adv_stats_record(uint8_t adapter, unsigned hist, uint64_t value)
+{
+    if ((adapter >= BLE_ADV_STATS_ADAPTERS) || (hist >= BLE_ADV_STATS_HISTS)) {
+        return;
+    }
+
+    struct hist *h = &stats[adapter].hists[hist];
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+}
+
+void ble_adv_stats_account(uint8_t adapter, const struct ble_adv_read_tally *tally)
+{
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_READS, 1);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_EVENTS, tally->events);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_REPORTS, tally->reports);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_SKIPPED, tally->skipped);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_DROP_PROTO, tally->proto);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_DROP_OVERFLOW, tally->overflow);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_DROP_SPACE, tally->space);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_DROP_POOL, tally->pool);
+    ble_adv_stats_add(adapter, BLE_ADV_STATS_TRUNCATED, tally->truncated);
+    ble_adv_stats_record(adapter, BLE_ADV_STATS_HIST_BATCH, tally->events);
+}
+
+static void snapshot_hist(struct ble_adv_stats_hist *dest, struct hist *src)
+{
+    for (unsigned i = 0; i < BLE_ADV_STATS_HIST_BUCKETS; i++) {
+        dest->buckets[i] = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+    }
+    dest->count = atomic_load_explicit(&src->count, memory_order_relaxed);
+    dest->sum = atomic_load_explicit(&src->sum, memory_order_relaxed);
+}
+
+int ble_adv_stats_snapshot(struct ble_adv_stats *dest, uint8_t adapter)
+{
+    if (!dest || (adapter >= BLE_ADV_STATS_ADAPTERS)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct adapter_stats *src = &stats[adapter];
+    for (unsigned i = 0; i < BLE_ADV_STATS_NUM; i++) {
+        dest->counters[i] = atomic_load_explicit(&src->counters[i], memory_order_relaxed);
+    }
+    snapshot_hist(&dest->latency_us, &src->hists[BLE_ADV_STATS_HIST_LATENCY]);
+    snapshot_hist(&dest->batch, &src->hists[BLE_ADV_STATS_HIST_BATCH]);
+
+    return 0;
+}
+
+uint64_t ble_adv_stats_hist_quantile(const struct ble_adv_stats_hist *hist, double q)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < BLE_ADV_STATS_HIST_BUCKETS; i++) {
+        total += hist->buckets[i];
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    if (q < 0.0) {
+        q = 0.0;
+    }
+    if (q > 1.0) {
+        q = 1.0;
+    }
+
+    /* rank of the value to find, counting from 1 */
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BLE_ADV_STATS_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return bucket_max(i);
+        }
+    }
+
+    return bucket_max(BLE_ADV_STATS_HIST_BUCKETS - 1);
+}
+
+/** @} */
@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @ingroup     ble_adv_uring
+ *
+ * @{
+ * @brief   Implementation of the io_uring based ingestion
+ * @file
+ */
+#include "ble_adv_uring.h"
+#include "ble_adv_internal.h"
+
+#include <errno.h>
+#include <liburing.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void provide_buf(struct ble_adv_uring *uring, unsigned short bid, int offset)
+{
+    io_uring_buf_ring_add(uring->br, uring->bufs[bid], sizeof(uring->bufs[bid]), bid,
+                          io_uring_buf_ring_mask(uring->nbufs), offset);
+}
+
+int ble_adv_uring_init(struct ble_adv_uring *uring, int dev, unsigned nbufs,
+                       unsigned parse_flags, ble_adv_reader_cb_t cb, void *ctx)
+{
+    if (!uring || (dev == -1) || !cb || !nbufs || (nbufs & (nbufs - 1)) || (nbufs > 32768)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(uring, 0, sizeof(*uring));
+    uring->dev = dev;
+    uring->cb = cb;
+    uring->ctx = ctx;
+    uring->nbufs = nbufs;
+    uring->parse_flags = parse_flags;
+
+    uring->bufs = malloc(sizeof(uring->bufs[0]) * nbufs);
+    if (!uring->bufs) {
+        return -1;
+    }
+
+    int err = io_uring_queue_init(BLE_ADV_URING_CQES, &uring->ring, 0);
+    if (err) {
+        free(uring->bufs);
+        errno = -err;
+        return -1;
+    }
+
+    uring->br = io_uring_setup_buf_ring(&uring->ring, nbufs, BLE_ADV_URING_BGID, 0, &err);
+    if (!uring->br) {
+        io_uring_queue_exit(&uring->ring);
+        free(uring->bufs);
+        errno = -err;
+        return -1;
+    }
+
+    for (unsigned i = 0; i < nbufs; i++) {
+        provide_buf(uring, (unsigned short)i, (int)i);
+    }
+    io_uring_buf_ring_advance(uring->br, (int)nbufs);
+
+    return 0;
+}
+
+void ble_adv_uring_exit(struct ble_adv_uring *uring)
+{
+    io_uring_free_buf_ring(&uring->ring, uring->br, uring->nbufs, BLE_ADV_URING_BGID);
+    io_uring_queue_exit(&uring->ring);
+    free(uring->bufs);
+    uring->bufs = NULL;
+}
+
+static int arm(struct ble_adv_uring *uring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    io_uring_prep_recv_multishot(sqe, uring->dev, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BLE_ADV_URING_BGID;
+    uring->armed = 1;
+    return 0;
+}
+
+int ble_adv_uring_dispatch(struct ble_adv_uring *uring, int wait)
+{
+    if (!uring) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (uring->err) {
+        /* failure of the previous call, which still delivered advertisements */
+        errno = uring->err;
+        uring->err = 0;
+        return -1;
+    }
+
+    if (!uring->armed && arm(uring)) {
+        return -1;
+    }
+
+    int err = wait ? io_uring_submit_and_wait(&uring->ring, 1) : io_uring_submit(&uring->ring);
+    if (err < 0) {
+        if (err == -EINTR) {
+            return 0;
+        }
+        errno = -err;
+        return -1;
+    }
+
+    err = 0;
+    int delivered = 0;
+    uint64_t events = 0, skipped = 0, proto = 0, overflows = 0, truncated = 0;
+    struct io_uring_cqe *cqes[BLE_ADV_URING_CQES];
+    unsigned count;
+    while (!err && (count = io_uring_peek_batch_cqe(&uring->ring, cqes, BLE_ADV_URING_CQES))) {
+        int provided = 0;
+        unsigned i;
+        for (i = 0; i < count; i++) {
+            struct io_uring_cqe *cqe = cqes[i];
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                /* multishot receive terminated (e.g. ENOBUFS), needs to be re-armed */
+                uring->armed = 0;
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+                if ((cqe->res < 0) && (cqe->res != -ENOBUFS)) {
+                    err = -cqe->res;
+                    i++;
+                    break;
+                }
+                continue;
+            }
+
+            unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe->res > 0) {
+                struct ble_adv_view views[BLE_ADV_REPORTS_MAX];
+                unsigned cut;
+                int num = ble_adv_split_event(views, BLE_ADV_REPORTS_MAX, uring->bufs[bid],
+                                              (size_t)cqe->res, &cut);
+                events++;
+                if (num < 0) {
+                    skipped += (num == -ENOENT);
+                    proto += (num != -ENOENT);
+                }
+                else {
+                    proto += cut;
+                }
+                for (int j = 0; j < num; j++) {
+                    if (ble_adv_view_parse(&uring->batch[j], &views[j], uring->parse_flags)) {
+                        overflows += (errno == EOVERFLOW);
+                        proto += (errno != EOVERFLOW);
+                        continue;
+                    }
+                    truncated += !!(uring->batch[j].has & BLE_ADV_HAS_TRUNCATED);
+                    uring->cb(&uring->batch[j], uring->ctx);
+                    delivered++;
+                }
+            }
+
+            /* hand the buffer back to the kernel */
+            provide_buf(uring, bid, provided++);
+        }
+
+        /* also when stopping at an error, so that no buffer is lost */
+        io_uring_buf_ring_advance(uring->br, provided);
+        io_uring_cq_advance(&uring->ring, i);
+    }
+
+    if (!uring->armed) {
+        if (!arm(uring)) {
+            io_uring_submit(&uring->ring);
+        }
+        else if (!err) {
+            err = errno;
+        }
+    }
+
+    if (events) {
+        struct ble_adv_read_tally tally = {
+            .events = events,
+            .reports = (uint64_t)delivered,
+            .skipped = skipped,
+            .proto = proto,
+            .overflow = overflows,
+            .truncated = truncated,
+        };
+        ble_adv_stats_account(0, &tally);
+    }
+
+    if (err) {
+        if (delivered) {
+            /* do not hide the advertisements already passed to the callback */
+            uring->err = err;
+            return delivered;
+        }
+        errno = err;
+        return -1;
+    }
+
+    return delivered;
+}
+
+/** @} */
@@ -13,6 +13,9 @@
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 /**
  * @name    Flags used in the second argument of @ref ble_adv_scan
@@ -22,6 +25,29 @@
 #define BLE_ADV_SCAN_FLAG_NO_DUPLICATES     0x02    /**< Filter duplicates */
 #define BLE_ADV_SCAN_FLAG_PASSIVE           0x04    /**< Passive scanning */
 #define BLE_ADV_SCAN_FLAG_PUBLIC_ADDR       0x08    /**< Use public address for active scan */
+#define BLE_ADV_SCAN_FLAG_ACCEPT_LIST       0x10    /**< Only report advertisers in the filter
+                                                         accept list, see
+                                                         @ref ble_adv_accept_list_add */
+/** @} */
+
+/**
+ * @name    Scan profiles to pass to @ref ble_adv_scan_params_init
+ *
+ * The profiles trade discovery latency against radio time. On combo chips sharing the antenna
+ * between Wi-Fi and Bluetooth, a lower duty cycle leaves more air time to Wi-Fi.
+ * @{
+ */
+#define BLE_ADV_SCAN_PROFILE_LOW_LATENCY    0       /**< 100 % duty cycle (the default) */
+#define BLE_ADV_SCAN_PROFILE_BALANCED       1       /**< 25 % duty cycle, 200 ms interval */
+#define BLE_ADV_SCAN_PROFILE_LOW_POWER      2       /**< 6.25 % duty cycle, 1.28 s interval */
+/** @} */
+
+/**
+ * @name    Limits of @ref ble_adv_scan_params::interval and @ref ble_adv_scan_params::window
+ * @{
+ */
+#define BLE_ADV_SCAN_INTERVAL_MIN           0x0004  /**< 2.5 ms */
+#define BLE_ADV_SCAN_INTERVAL_MAX           0x4000  /**< 10.24 s */
 /** @} */
 
 /**
@@ -35,6 +61,26 @@
 #define BLE_ADV_HAS_MS_DATA                 0x10    /**< Advertisement contained manufacturer
                                                          specific data */
 #define BLE_ADV_HAS_FLAGS                   0x20    /**< Advertisement contained flags */
+#define BLE_ADV_HAS_TRUNCATED               0x40    /**< Fields were cut to fit or the EIR data
+                                                         ended in a truncated field, only set
+                                                         with @ref BLE_ADV_PARSE_FLAG_LENIENT */
+/** @} */
+
+/**
+ * @name    Parse flags to pass to the decoding functions, e.g. to @ref ble_adv_parse_event
+ * @{
+ *
+ * The flags are passed with each call (or to the object doing the calls on behalf of the
+ * application), so that e.g. a lenient scanner and a strict validator can share a process.
+ */
+/**
+ * @brief   Keep advertisements with fields that are too large or truncated
+ *
+ * Instead of failing with `EOVERFLOW`, fields too large for their buffer in @ref ble_adv are
+ * cut to fit. Instead of failing with `EPROTO`, a truncated trailing EIR field is ignored. In
+ * both cases the fields decoded are kept and @ref BLE_ADV_HAS_TRUNCATED is set.
+ */
+#define BLE_ADV_PARSE_FLAG_LENIENT          0x01
 /** @} */
 
 
@@ -51,10 +97,56 @@
                                                          Capable (Host) */
 /** @} */
 
+/**
+ * @name    EIR entry types
+ * @{
+ */
+#define EIR_FLAGS                                   0x01  /**< flags */
+#define EIR_UUID16_SOME                             0x02  /**< 16-bit UUID, more available */
+#define EIR_UUID16_ALL                              0x03  /**< 16-bit UUID, all listed */
+#define EIR_UUID32_SOME                             0x04  /**< 32-bit UUID, more available */
+#define EIR_UUID32_ALL                              0x05  /**< 32-bit UUID, all listed */
+#define EIR_UUID128_SOME                            0x06  /**< 128-bit UUID, more available */
+#define EIR_UUID128_ALL                             0x07  /**< 128-bit UUID, all listed */
+#define EIR_NAME_SHORT                              0x08  /**< shortened local name */
+#define EIR_NAME_COMPLETE                           0x09  /**< complete local name */
+#define EIR_TX_POWER                                0x0A  /**< transmit power level */
+#define EIR_DEVICE_ID                               0x10  /**< device ID */
+#define EIR_SOLICIT16                               0x14  /**< 16-bit service solicitation UUIDs */
+#define EIR_SOLICIT128                              0x15  /**< 128-bit service solicitation UUIDs */
+#define EIR_SERVICE_DATA                            0x16  /**< service data*/
+#define EIR_APPEARANCE                              0x19  /**< appearance */
+#define EIR_LE_ROLE                                 0x1C  /**< LE role */
+#define EIR_SOLICIT32                               0x1F  /**< 32-bit service solicitation UUIDs */
+#define EIR_SERVICE_DATA32                          0x20  /**< service data with 32-bit UUID */
+#define EIR_SERVICE_DATA128                         0x21  /**< service data with 128-bit UUID */
+#define EIR_URI                                     0x24  /**< URI */
+#define EIR_MANUFACTURER_SPECIFIC_DATA              0xFF  /**< manufacturer specific data */
+/** @} */
+
+
+/**
+ * @brief   Maximum number of advertising reports a single (legacy) HCI event can carry
+ */
+#define BLE_ADV_REPORTS_MAX                 25
+
+/**
+ * @brief   Maximum number of HCI events consumed by a single call to @ref ble_adv_read_many
+ */
+#define BLE_ADV_READ_MANY_EVENTS            16
+
 /**
  * @brief   Structure holding parsed info about a received advertisement
  */
 struct ble_adv {
+    /**
+     * @brief   Time the kernel received the advertisement in µs since the epoch
+     *
+     * Filled in by @ref ble_adv_read and friends, as @ref ble_adv_scan requests the kernel to
+     * timestamp each HCI event. All reports batched in one event share the timestamp. This is
+     * 0 if no timestamp is available, e.g. for events decoded with @ref ble_adv_parse_event.
+     */
+    uint64_t timestamp_us;
     uint8_t uuid128[16];        /**< UUID128 if present (little endian), check @ref ble_adv::has */
     uint32_t uuid32;            /**< UUID32 if present, check @ref ble_adv::has */
     uint16_t uuid16;            /**< UUID16 if present, check @ref ble_adv::has */
@@ -62,6 +154,7 @@ struct ble_adv {
     uint16_t ms_uuid16;         /**< UUID16 of the manufacturer specific data,
                                      check @ref ble_adv::has */
     uint8_t addr[6];            /**< Address of the sender in corrected byte order */
+    uint8_t addr_type;          /**< Type of @ref ble_adv::addr, e.g. `LE_PUBLIC_ADDRESS` */
     /**
      * @brief   Zero-terminated name of the sender or `"<unknown>"`
      *
@@ -86,6 +179,59 @@ struct ble_adv {
     uint8_t rssi;               /**< Received signal strength indicator */
     int8_t tx_power;            /**< TX-power the sender claimed it used or INT8_MAX */
     uint8_t has;                /**< Flags used to indicate availability of fields */
+    uint8_t adapter;            /**< Index of the adapter the advertisement was received on
+                                     when using @ref ble_adv_multi_read, 0 otherwise */
+};
+
+/**
+ * @brief   Scan parameters to pass to @ref ble_adv_scan_ex
+ *
+ * Use @ref ble_adv_scan_params_init to initialize this with sane values.
+ */
+struct ble_adv_scan_params {
+    uint16_t interval;          /**< Scan interval in units of 0.625 ms */
+    uint16_t window;            /**< Length of the scan window (at most
+                                     @ref ble_adv_scan_params::interval) in units of 0.625 ms */
+    uint8_t scan_type;          /**< 0 for passive scanning, 1 for active scanning */
+    uint8_t own_addr_type;      /**< `LE_PUBLIC_ADDRESS` or `LE_RANDOM_ADDRESS` */
+    uint8_t filter_policy;      /**< 0 to accept all advertisers, 1 to only accept those in the
+                                     filter accept list */
+    uint8_t filter_duplicates;  /**< 1 to let the controller filter duplicates, 0 otherwise */
+    int hci_timeout_ms;         /**< Timeout of each HCI command in milliseconds */
+};
+
+/**
+ * @brief   Lightweight view of a received advertisement pointing into the raw HCI event
+ *
+ * Contrary to @ref ble_adv nothing is copied or decoded when obtaining a view. Instead, the
+ * EIR data is only parsed on demand, e.g. via @ref ble_adv_view_find. This allows rejecting
+ * uninteresting advertisements at the cost of a few comparisons. Use @ref ble_adv_view_parse
+ * to obtain a @ref ble_adv for the advertisements to keep.
+ *
+ * @warning A view is only valid as long as the buffer holding the HCI event is
+ */
+struct ble_adv_view {
+    const uint8_t *bdaddr;      /**< Address of the sender in HCI (reversed) byte order */
+    const uint8_t *eir;         /**< Raw EIR data of the advertisement */
+    uint16_t eir_len;           /**< Length of @ref ble_adv_view::eir in bytes */
+    uint8_t evt_type;           /**< Advertising event type */
+    uint8_t addr_type;          /**< Type of @ref ble_adv_view::bdaddr (public/random) */
+    int8_t rssi;                /**< Received signal strength indicator in dBm */
+};
+
+/**
+ * @brief   Statistics about the HCI events consumed by @ref ble_adv_read_many
+ */
+struct ble_adv_read_info {
+    size_t events;              /**< Number of HCI events consumed */
+    size_t skipped;             /**< Number of HCI events skipped as they contained no
+                                     advertisements */
+    size_t invalid;             /**< Number of HCI events dropped due to invalid encoding */
+    size_t malformed;           /**< Number of advertisements dropped due to invalid encoding,
+                                     the other advertisements of their events are returned */
+    size_t dropped;             /**< Number of advertisements dropped due to lack of space */
+    size_t truncated;           /**< Number of advertisements returned with
+                                     @ref BLE_ADV_HAS_TRUNCATED set */
 };
 
 /**
@@ -110,6 +256,95 @@ static inline int ble_adv_open(void)
  */
 int ble_adv_scan(int dev, unsigned flags);
 
+/**
+ * @brief   Initialize scan parameters from a profile
+ *
+ * @param[out]      params      Scan parameters to initialize
+ * @param[in]       profile     Profile to use, e.g. @ref BLE_ADV_SCAN_PROFILE_BALANCED
+ * @param[in]       flags       Flags as passed to @ref ble_adv_scan, except for
+ *                              @ref BLE_ADV_SCAN_FLAG_ENABLED which is ignored
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_scan_params_init(struct ble_adv_scan_params *params, unsigned profile,
+                             unsigned flags);
+
+/**
+ * @brief   Enable BLE scanning with the given scan parameters and set appropriate filters
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       params      Scan parameters to apply
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    Use @ref ble_adv_scan with flags `0` to disable scanning again
+ */
+int ble_adv_scan_ex(int dev, const struct ble_adv_scan_params *params);
+
+/**
+ * @brief   Add a device to the LE filter accept list of the controller
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       addr        Address of the device in corrected byte order
+ * @param[in]       addr_type   Type of @p addr, `LE_PUBLIC_ADDRESS` or `LE_RANDOM_ADDRESS`
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * When scanning with @ref BLE_ADV_SCAN_FLAG_ACCEPT_LIST, the controller only reports
+ * advertisements of devices in its accept list. This moves the filtering into the radio and
+ * saves host CPU time and HCI bandwidth.
+ *
+ * @warning The controller refuses to modify the accept list while it is in use for scanning
+ */
+int ble_adv_accept_list_add(int dev, const uint8_t addr[6], uint8_t addr_type);
+
+/**
+ * @brief   Remove a device from the LE filter accept list of the controller
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       addr        Address of the device in corrected byte order
+ * @param[in]       addr_type   Type of @p addr, `LE_PUBLIC_ADDRESS` or `LE_RANDOM_ADDRESS`
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @warning The controller refuses to modify the accept list while it is in use for scanning
+ */
+int ble_adv_accept_list_remove(int dev, const uint8_t addr[6], uint8_t addr_type);
+
+/**
+ * @brief   Remove all devices from the LE filter accept list of the controller
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @warning The controller refuses to modify the accept list while it is in use for scanning
+ */
+int ble_adv_accept_list_clear(int dev);
+
+/**
+ * @brief   Replace the LE filter accept list of the controller with the given devices
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       addrs       Addresses of the devices in corrected byte order
+ * @param[in]       addr_types  Types of the addresses in @p addrs, or `NULL` if all addresses
+ *                              are public
+ * @param[in]       len         Number of entries in @p addrs
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `ENOSPC` if the
+ *                              accept list of the controller is too small
+ *
+ * @warning The controller refuses to modify the accept list while it is in use for scanning
+ */
+int ble_adv_accept_list_load(int dev, const uint8_t (*addrs)[6], const uint8_t *addr_types,
+                             size_t len);
+
 /**
  * @brief   Read a single BLE advertisement from the HCI descriptor
  *
@@ -125,8 +360,174 @@ int ble_adv_scan(int dev, unsigned flags);
  *          reason.
  *
  * @pre     Scanning for BLE has been enabled via @ref ble_adv_scan first
+ *
+ * @warning The controller may batch several advertisements into a single HCI event. Only the
+ *          first of them is returned, the others are dropped. Use @ref ble_adv_read_batch to
+ *          receive all of them.
  */
 int ble_adv_read(int dev, struct ble_adv *dest);
 
+/**
+ * @brief   Read a single HCI event and decode every BLE advertisement contained in it
+ *
+ * @param[in]       dev         Descriptor of the HCI interfaces
+ * @param[out]      dest        Array to write the received BLE advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ *
+ * @return  Number of advertisements written to @p dest
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ *
+ * Malformed advertisements are dropped, the others of the same event are still returned. The
+ * call only fails with `EPROTO` or `EOVERFLOW` if none of them could be decoded. Decoding is
+ * strict, use @ref ble_adv_read_many to pass @ref BLE_ADV_PARSE_FLAG_LENIENT.
+ *
+ * @note    An HCI event carries at most 25 advertisements. If it contains more than @p max of
+ *          them, the surplus ones are dropped.
+ * @note    The same notes as for @ref ble_adv_read regarding `EINTR`, `EAGAIN` and
+ *          `EWOULDBLOCK` apply.
+ *
+ * @pre     Scanning for BLE has been enabled via @ref ble_adv_scan first
+ */
+int ble_adv_read_batch(int dev, struct ble_adv *dest, size_t max);
+
+/**
+ * @brief   Read as many HCI events as are pending (using a single syscall) and decode every BLE
+ *          advertisement contained in them
+ *
+ * @param[in]       dev         Descriptor of the HCI interfaces
+ * @param[out]      dest        Array to write the received BLE advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[out]      info        Statistics about the consumed events, may be `NULL`
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0 to drop
+ *                              any malformed advertisement
+ *
+ * @return  Number of advertisements written to @p dest, which is zero if none of the consumed
+ *          events contained a valid advertisement
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ *
+ * This will block until at least one HCI event is available (unless @p dev is in non-blocking
+ * mode), but will not wait for more than that. Up to @ref BLE_ADV_READ_MANY_EVENTS events, but
+ * only as many as @p dest can hold even if every event carries @ref BLE_ADV_REPORTS_MAX
+ * reports (and at least one), are consumed. Pass `max >= BLE_ADV_READ_MANY_EVENTS *
+ * BLE_ADV_REPORTS_MAX` for the largest batches. Contrary to @ref ble_adv_read_batch events that
+ * are not advertising reports or that fail to decode do not fail the call, but are only counted
+ * in @p info.
+ *
+ * @note    The same notes as for @ref ble_adv_read regarding `EINTR`, `EAGAIN` and
+ *          `EWOULDBLOCK` apply.
+ *
+ * @pre     Scanning for BLE has been enabled via @ref ble_adv_scan first
+ */
+int ble_adv_read_many(int dev, struct ble_adv *dest, size_t max, struct ble_adv_read_info *info,
+                      unsigned flags);
+
+/**
+ * @brief   Read a single raw HCI event from the HCI descriptor
+ *
+ * @param[in]       dev         Descriptor of the HCI interfaces
+ * @param[out]      buf         Buffer to write the HCI event to
+ * @param[in]       size        Size of @p buf in bytes, @ref HCI_MAX_EVENT_SIZE is sufficient
+ * @param[out]      timestamp_us    If not `NULL`, the kernel receive timestamp of the event is
+ *                                  stored here, as in @ref ble_adv::timestamp_us (0 if none)
+ *
+ * @return  Length of the event written to @p buf in bytes
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ *
+ * @note    The same notes as for @ref ble_adv_read regarding `EINTR`, `EAGAIN` and
+ *          `EWOULDBLOCK` apply.
+ */
+ssize_t ble_adv_read_event(int dev, void *buf, size_t size, uint64_t *timestamp_us);
+
+/**
+ * @brief   Obtain views of the advertisements in a raw HCI event without decoding them
+ *
+ * @param[out]      dest        Array to write the views to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ *
+ * @return  Number of views written to @p dest
+ * @retval  -1                  Failure and errno is set to indicate the cause, `ENOENT` if
+ *                              @p buf is not an LE Advertising Report event
+ *
+ * If @p buf ends in the middle of a report, views of the complete reports in front of it are
+ * still returned. The call only fails with `EPROTO` if there are none.
+ *
+ * @note    If the event contains more than @p max reports, the surplus reports are dropped.
+ */
+int ble_adv_event_views(struct ble_adv_view *dest, size_t max, const void *buf, size_t len);
+
+/**
+ * @brief   Decode the advertisements in a raw HCI event
+ *
+ * @param[out]      dest        Array to write the decoded advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0 to drop
+ *                              any malformed advertisement
+ *
+ * @return  Number of advertisements written to @p dest
+ * @retval  -1                  Failure and errno is set to indicate the cause, `ENOENT` if
+ *                              @p buf is not an LE Advertising Report event
+ *
+ * This is the same decoding step used by @ref ble_adv_read, e.g. to process previously
+ * recorded events. Malformed advertisements are dropped, the others are written to @p dest
+ * back to back. The call only fails with `EPROTO` or `EOVERFLOW` if none could be decoded.
+ *
+ * @note    If the event contains more than @p max reports, the surplus reports are dropped.
+ */
+int ble_adv_parse_event(struct ble_adv *dest, size_t max, const void *buf, size_t len,
+                        unsigned flags);
+
+/**
+ * @brief   Get the address of the sender in corrected byte order
+ *
+ * @param[in]       view        View of the advertisement
+ * @param[out]      addr        Write the address here, as in @ref ble_adv::addr
+ */
+void ble_adv_view_addr(const struct ble_adv_view *view, uint8_t addr[6]);
+
+/**
+ * @brief   Find the first EIR field of the given type
+ *
+ * @param[in]       view        View of the advertisement to search
+ * @param[in]       type        EIR type to search for, e.g. @ref EIR_SERVICE_DATA
+ * @param[out]      data        On match: Pointer to the payload (after the type byte)
+ * @param[out]      len         On match: Length of the payload in bytes
+ *
+ * @retval  1                   Found, @p data and @p len have been written
+ * @retval  0                   Not found (or a format error was detected before)
+ */
+int ble_adv_view_find(const struct ble_adv_view *view, uint8_t type,
+                      const uint8_t **data, size_t *len);
+
+/**
+ * @brief   Find the service data with the given 16 bit UUID
+ *
+ * @param[in]       view        View of the advertisement to search
+ * @param[in]       uuid16      UUID of the service to search for
+ * @param[out]      data        On match: Pointer to the service data (after the UUID)
+ * @param[out]      len         On match: Length of the service data in bytes
+ *
+ * @retval  1                   Found, @p data and @p len have been written
+ * @retval  0                   Not found (or a format error was detected before)
+ */
+int ble_adv_view_service_data(const struct ble_adv_view *view, uint16_t uuid16,
+                              const uint8_t **data, size_t *len);
+
+/**
+ * @brief   Decode the advertisement pointed to by a view
+ *
+ * @param[out]      dest        Structure to write the decoded BLE advertisement to
+ * @param[in]       view        View of the advertisement to decode
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0 to fail on
+ *                              any malformed field
+ *
+ * @retval  0                   Success
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ */
+int ble_adv_view_parse(struct ble_adv *dest, const struct ble_adv_view *view, unsigned flags);
+
 /** @} */
 #endif /* BLE_ADV_H */
@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_AGG_H
+#define BLE_ADV_AGG_H
+
+#include "ble_adv_decode.h"
+#include "ble_adv_devtab.h"
+#include "lywsd03mmc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_agg     Per-sensor aggregation of measurements over time windows
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Reduce a stream of measurements to min / max / mean per sensor and time window
+ * @file
+ *
+ * The aggregation keeps fixed-point running minimum, maximum, sum and count of temperature,
+ * humidity and battery voltage in tumbling windows of up to @ref BLE_ADV_AGG_WINDOWS_MAX
+ * lengths, e.g. 1 minute and 15 minutes. The windows are aligned to multiples of their length,
+ * so windows of different sensors close at the same time.
+ *
+ * The state of a sensor lives next to its entry in a @ref ble_adv_devtab, so memory use is
+ * constant per sensor and bounded by the capacity of the device table. If the device table
+ * reuses the entry of a sensor for another device, the open windows of the old sensor are
+ * emitted early.
+ */
+
+/**
+ * @brief   Maximum number of window lengths
+ */
+#define BLE_ADV_AGG_WINDOWS_MAX             4
+
+/**
+ * @name    Channels, used as index into @ref ble_adv_agg_sample::values and
+ *          @ref ble_adv_agg_record::channels
+ * @{
+ */
+#define BLE_ADV_AGG_TEMPERATURE             0   /**< Temperature in 0.01 °C */
+#define BLE_ADV_AGG_HUMIDITY                1   /**< Relative humidity in 0.01 % */
+#define BLE_ADV_AGG_BAT_MV                  2   /**< Battery voltage in mV */
+#define BLE_ADV_AGG_CHANNELS                3   /**< Number of channels */
+/** @} */
+
+/**
+ * @brief   A single measurement to aggregate
+ */
+struct ble_adv_agg_sample {
+    int32_t values[BLE_ADV_AGG_CHANNELS];   /**< Values, e.g. @ref BLE_ADV_AGG_TEMPERATURE */
+    uint8_t has;                            /**< Bit `1 << channel` set if the value of the
+                                                 channel is present */
+};
+
+/**
+ * @brief   Running statistics of a channel in a window
+ */
+struct ble_adv_agg_stat {
+    int64_t sum;                /**< Sum of all values */
+    int32_t min;                /**< Minimum value */
+    int32_t max;                /**< Maximum value */
+    uint32_t count;             /**< Number of values */
+};
+
+/**
+ * @brief   A closed window of a sensor
+ */
+struct ble_adv_agg_record {
+    uint64_t start_ms;          /**< Start of the window in ms */
+    uint32_t len_ms;            /**< Length of the window in ms */
+    /**
+     * @brief   Statistics per channel, only valid if @ref ble_adv_agg_stat::count is non-zero
+     */
+    struct ble_adv_agg_stat channels[BLE_ADV_AGG_CHANNELS];
+    uint8_t addr[6];            /**< Address of the sensor in corrected byte order */
+    uint8_t window;             /**< Index of the window length, as passed to
+                                     @ref ble_adv_agg_init */
+    uint8_t partial;            /**< 1 if emitted before the window ended */
+};
+
+/**
+ * @brief   Function called for each closed window
+ *
+ * @param[in]       record      The closed window
+ * @param[in]       ctx         Context pointer as passed to @ref ble_adv_agg_init
+ */
+typedef void (*ble_adv_agg_cb_t)(const struct ble_adv_agg_record *record, void *ctx);
+
+/**
+ * @brief   Open window of a sensor
+ *
+ * @note    This is private, only exposed to allow allocating @ref ble_adv_agg
+ */
+struct ble_adv_agg_window {
+    uint64_t start_ms;                                      /**< Start of the window */
+    struct ble_adv_agg_stat channels[BLE_ADV_AGG_CHANNELS]; /**< Running statistics */
+};
+
+/**
+ * @brief   State of a sensor
+ *
+ * @note    This is private, only exposed to allow allocating @ref ble_adv_agg
+ */
+struct ble_adv_agg_slot {
+    uint64_t first_seen_ms;     /**< Copy of @ref ble_adv_devtab_entry::first_seen_ms */
+    uint8_t addr[6];            /**< Address of the sensor */
+    uint8_t used;               /**< Slot holds a sensor */
+};
+
+/**
+ * @brief   Aggregation state
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_agg {
+    const struct ble_adv_devtab *tab;       /**< Device table keying the sensors */
+    struct ble_adv_agg_slot *slots;         /**< A slot per device table entry */
+    struct ble_adv_agg_window *windows;     /**< `num_windows` windows per slot */
+    ble_adv_agg_cb_t cb;                    /**< Called for each closed window */
+    void *ctx;                              /**< Passed to @ref ble_adv_agg::cb */
+    uint32_t windows_ms[BLE_ADV_AGG_WINDOWS_MAX];   /**< Window lengths */
+    size_t num_windows;                     /**< Number of window lengths */
+    uint64_t emitted;                       /**< Number of records emitted */
+};
+
+/**
+ * @brief   Initialize the aggregation
+ *
+ * @param[out]      agg         Aggregation state to initialize
+ * @param[in]       tab         Device table to key the sensors by, must outlive @p agg
+ * @param[in]       windows_ms  Lengths of the windows in ms
+ * @param[in]       num_windows Number of entries in @p windows_ms, at most
+ *                              @ref BLE_ADV_AGG_WINDOWS_MAX
+ * @param[in]       cb          Function to call for each closed window
+ * @param[in]       ctx         Context pointer to pass to @p cb
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    This allocates `capacity * (16 + num_windows * 80)` bytes, with `capacity` being
+ *          the capacity of @p tab
+ */
+int ble_adv_agg_init(struct ble_adv_agg *agg, const struct ble_adv_devtab *tab,
+                     const uint32_t *windows_ms, size_t num_windows, ble_adv_agg_cb_t cb,
+                     void *ctx);
+
+/**
+ * @brief   Free the memory of the aggregation, without emitting the open windows
+ *
+ * @param[in,out]   agg         Aggregation state to destroy
+ */
+void ble_adv_agg_destroy(struct ble_adv_agg *agg);
+
+/**
+ * @brief   Add a measurement of a sensor
+ *
+ * @param[in,out]   agg         Aggregation state
+ * @param[in]       entry       Entry of the sensor as obtained by @ref ble_adv_devtab_update
+ *                              from the device table passed to @ref ble_adv_agg_init
+ * @param[in]       sample      The measurement
+ * @param[in]       now_ms      Time of the measurement in ms, e.g.
+ *                              `ble_adv::timestamp_us / 1000`
+ *
+ * Windows of the sensor that ended before @p now_ms are emitted first.
+ */
+void ble_adv_agg_add(struct ble_adv_agg *agg, const struct ble_adv_devtab_entry *entry,
+                     const struct ble_adv_agg_sample *sample, uint64_t now_ms);
+
+/**
+ * @brief   Emit all windows that ended before @p now_ms
+ *
+ * @param[in,out]   agg         Aggregation state
+ * @param[in]       now_ms      Current time in ms, of the same clock as passed to
+ *                              @ref ble_adv_agg_add
+ *
+ * @return  Number of windows emitted
+ *
+ * Call this periodically, e.g. once per second, to emit the windows of sensors that went
+ * silent.
+ */
+size_t ble_adv_agg_tick(struct ble_adv_agg *agg, uint64_t now_ms);
+
+/**
+ * @brief   Emit all open windows, e.g. on exit
+ *
+ * @param[in,out]   agg         Aggregation state
+ *
+ * @return  Number of windows emitted
+ */
+size_t ble_adv_agg_flush(struct ble_adv_agg *agg);
+
+/**
+ * @brief   Get the mean of a channel in a closed window, rounded to nearest
+ *
+ * @param[in]       stat        Statistics of the channel
+ *
+ * @pre     `stat->count != 0`
+ */
+static inline int32_t ble_adv_agg_mean(const struct ble_adv_agg_stat *stat)
+{
+    int64_t half = (int64_t)stat->count / 2;
+    int64_t sum = stat->sum;
+    return (int32_t)((sum < 0) ? (sum - half) / (int64_t)stat->count
+                               : (sum + half) / (int64_t)stat->count);
+}
+
+/**
+ * @brief   Get the channels to aggregate from decoded sensor data
+ *
+ * @param[out]      dest        Sample to fill
+ * @param[in]       sensor      Decoded sensor data, as obtained by @ref ble_adv_decode
+ */
+static inline void ble_adv_agg_sample_from_sensor(struct ble_adv_agg_sample *dest,
+                                                  const struct ble_adv_sensor *sensor)
+{
+    dest->has = 0;
+    if (sensor->has & BLE_ADV_SENSOR_HAS_TEMPERATURE) {
+        dest->values[BLE_ADV_AGG_TEMPERATURE] = sensor->temperature;
+        dest->has |= 1U << BLE_ADV_AGG_TEMPERATURE;
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_HUMIDITY) {
+        dest->values[BLE_ADV_AGG_HUMIDITY] = sensor->humidity;
+        dest->has |= 1U << BLE_ADV_AGG_HUMIDITY;
+    }
+    if (sensor->has & BLE_ADV_SENSOR_HAS_BAT_MV) {
+        dest->values[BLE_ADV_AGG_BAT_MV] = sensor->bat_mv;
+        dest->has |= 1U << BLE_ADV_AGG_BAT_MV;
+    }
+}
+
+/**
+ * @brief   Get the channels to aggregate from LYWSD03MMC measurement data
+ *
+ * @param[out]      dest        Sample to fill
+ * @param[in]       data        Measurement, as obtained by @ref lywsd03mmc_parse
+ */
+static inline void ble_adv_agg_sample_from_lywsd03mmc(struct ble_adv_agg_sample *dest,
+                                                      const struct lywsd03mmc_data *data)
+{
+    /* convert from 0.1 °C and 1 % to the 0.01 units of the channels */
+    dest->values[BLE_ADV_AGG_TEMPERATURE] = (int32_t)data->temperature * 10;
+    dest->values[BLE_ADV_AGG_HUMIDITY] = (int32_t)data->humidity * 100;
+    dest->values[BLE_ADV_AGG_BAT_MV] = data->bat_mv;
+    dest->has = (1U << BLE_ADV_AGG_TEMPERATURE) | (1U << BLE_ADV_AGG_HUMIDITY)
+                | (1U << BLE_ADV_AGG_BAT_MV);
+}
+
+/** @} */
+#endif /* BLE_ADV_AGG_H */
@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_AUTOSCAN_H
+#define BLE_ADV_AUTOSCAN_H
+
+#include "ble_adv.h"
+
+#include <poll.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_autoscan    Non-blocking scan state machine
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Start, reconfigure and restart scanning without waiting for the controller
+ * @file
+ *
+ * @ref ble_adv_scan_ex issues each HCI command synchronously and only learns that the
+ * controller is already scanning from a failing command, so that it needs up to four round
+ * trips, each waited for with a timeout of seconds. The state machine instead tracks whether
+ * the controller scans and writes the whole sequence (disable, set parameters, enable) at
+ * once. The kernel queues the commands and sends each as soon as the controller has room, so
+ * that (re)starting takes three controller round trips of typically a millisecond each and
+ * never blocks the calling thread. The command responses are consumed by
+ * @ref ble_adv_autoscan_run.
+ *
+ * A second socket, not bound to any adapter, receives the `HCI_DEV_*` events of the kernel.
+ * When the adapter goes down, the state machine waits for it to come up again and restarts
+ * scanning right away. When the adapter is removed, the descriptors are closed and opened
+ * again once an adapter with the same ID comes up. Both is reported (as
+ * @ref BLE_ADV_AUTOSCAN_EV_CLOSED and @ref BLE_ADV_AUTOSCAN_EV_REOPENED), so that a reader on
+ * the old descriptor can be dropped and one on the new descriptor set up. Commands failing or
+ * timing out are retried after @ref BLE_ADV_AUTOSCAN_RETRY_MS.
+ *
+ * @note    The adapter is not powered up by the state machine, this is left to e.g.
+ *          `bluetoothd` or `hciconfig hci0 up`
+ */
+
+/**
+ * @name    States returned by @ref ble_adv_autoscan_state
+ * @{
+ */
+#define BLE_ADV_AUTOSCAN_CLOSED             0   /**< The adapter is not present */
+#define BLE_ADV_AUTOSCAN_DOWN               1   /**< The adapter is down */
+#define BLE_ADV_AUTOSCAN_IDLE               2   /**< Scanning is not requested */
+#define BLE_ADV_AUTOSCAN_STARTING           3   /**< Commands to start scanning in flight */
+#define BLE_ADV_AUTOSCAN_SCANNING           4   /**< The controller is scanning */
+#define BLE_ADV_AUTOSCAN_FAILED             5   /**< Starting failed, waiting to retry */
+/** @} */
+
+/**
+ * @name    Events returned by @ref ble_adv_autoscan_run
+ * @{
+ */
+#define BLE_ADV_AUTOSCAN_EV_SCANNING        0x01    /**< Scanning (re)started */
+#define BLE_ADV_AUTOSCAN_EV_STOPPED         0x02    /**< Scanning stopped, as the adapter went
+                                                         down or was removed */
+#define BLE_ADV_AUTOSCAN_EV_REOPENED        0x04    /**< @ref ble_adv_autoscan_fd changed to
+                                                         a newly opened descriptor */
+#define BLE_ADV_AUTOSCAN_EV_CLOSED          0x08    /**< The descriptor previously returned by
+                                                         @ref ble_adv_autoscan_fd was closed and
+                                                         must no longer be used */
+/** @} */
+
+/**
+ * @brief   Time in ms to wait before retrying after a failure
+ */
+#define BLE_ADV_AUTOSCAN_RETRY_MS           500
+
+/**
+ * @brief   Number of descriptors filled in by @ref ble_adv_autoscan_pollfds
+ */
+#define BLE_ADV_AUTOSCAN_POLLFDS            2
+
+/**
+ * @brief   Scan state machine
+ *
+ * @note    The contents are private, use the functions below to access it
+ */
+struct ble_adv_autoscan {
+    struct ble_adv_scan_params params;  /**< Scan parameters to apply */
+    uint64_t deadline_ms;       /**< Timeout of the commands in flight, or time to retry */
+    int dev;                    /**< Descriptor to read advertisements from, or -1 */
+    int ctl;                    /**< Descriptor to issue commands on, or -1 */
+    int mon;                    /**< Descriptor receiving the `HCI_DEV_*` events */
+    int dev_id;                 /**< ID of the HCI device, e.g. 0 for hci0 */
+    unsigned state;             /**< e.g. @ref BLE_ADV_AUTOSCAN_SCANNING */
+    uint8_t step;               /**< Next command of the sequence to receive a response for */
+    uint8_t enabled;            /**< 1 if scanning is requested */
+    uint8_t status;             /**< HCI status of the last failing command */
+};
+
+/**
+ * @brief   Initialize the state machine and start scanning
+ *
+ * @param[out]      as          State machine to initialize
+ * @param[in]       dev_id      ID of the HCI device, e.g. from `hci_get_route(NULL)`
+ * @param[in]       params      Scan parameters to apply
+ *
+ * @retval  0                   Success, scanning starts in the background even if the
+ *                              adapter is not present or down
+ * @retval -1                   Failure and errno set to indicate the cause, `EINVAL` for
+ *                              invalid parameters and `EPERM` if the commands cannot be sent
+ */
+int ble_adv_autoscan_init(struct ble_adv_autoscan *as, int dev_id,
+                          const struct ble_adv_scan_params *params);
+
+/**
+ * @brief   Disable scanning without waiting for the controller and close all descriptors
+ *
+ * @param[in,out]   as          State machine to destroy
+ */
+void ble_adv_autoscan_destroy(struct ble_adv_autoscan *as);
+
+/**
+ * @brief   Apply new scan parameters without waiting for the controller
+ *
+ * @param[in,out]   as          State machine to reconfigure
+ * @param[in]       params      Scan parameters to apply
+ *
+ * @retval  0                   Success, the parameters are applied in the background
+ * @retval -1                   Failure and errno set to indicate the cause, `EINVAL` for
+ *                              invalid parameters
+ *
+ * This also requests scanning, if it was stopped via @ref ble_adv_autoscan_stop.
+ */
+int ble_adv_autoscan_set_params(struct ble_adv_autoscan *as,
+                                const struct ble_adv_scan_params *params);
+
+/**
+ * @brief   Disable scanning without waiting for the controller
+ *
+ * @param[in,out]   as          State machine to stop
+ */
+void ble_adv_autoscan_stop(struct ble_adv_autoscan *as);
+
+/**
+ * @brief   Process the pending command responses and `HCI_DEV_*` events without blocking
+ *
+ * @param[in,out]   as          State machine to run
+ *
+ * @return  Events that happened, e.g. @ref BLE_ADV_AUTOSCAN_EV_SCANNING, or 0
+ *
+ * Call this whenever one of the descriptors (see @ref ble_adv_autoscan_pollfds) is readable,
+ * and at least every @ref BLE_ADV_AUTOSCAN_RETRY_MS.
+ *
+ * @warning On @ref BLE_ADV_AUTOSCAN_EV_CLOSED, stop using the old descriptor (e.g. drop the
+ *          @ref ble_adv_reader on it) before polling again, as its number may already be
+ *          reused. If @ref BLE_ADV_AUTOSCAN_EV_REOPENED is reported by the same call, handle
+ *          it after @ref BLE_ADV_AUTOSCAN_EV_CLOSED.
+ */
+unsigned ble_adv_autoscan_run(struct ble_adv_autoscan *as);
+
+/**
+ * @brief   Get the descriptors to wait for readability on
+ *
+ * @param[in]       as          State machine to poll
+ * @param[out]      pfds        Descriptors to pass to `poll()`, -1 (which `poll()` ignores)
+ *                              for descriptors not open
+ */
+void ble_adv_autoscan_pollfds(const struct ble_adv_autoscan *as,
+                              struct pollfd pfds[BLE_ADV_AUTOSCAN_POLLFDS]);
+
+/**
+ * @brief   Get the descriptor to read advertisements from
+ *
+ * @param[in]       as          State machine to get the descriptor of
+ *
+ * @return  The non-blocking descriptor, e.g. to pass to @ref ble_adv_reader_init
+ * @retval  -1                  The adapter is not present
+ *
+ * @note    The descriptor is closed when the adapter is removed, reported as
+ *          @ref BLE_ADV_AUTOSCAN_EV_CLOSED, and a new one opened when it is added again,
+ *          reported as @ref BLE_ADV_AUTOSCAN_EV_REOPENED
+ */
+static inline int ble_adv_autoscan_fd(const struct ble_adv_autoscan *as)
+{
+    return as->dev;
+}
+
+/**
+ * @brief   Get the current state, e.g. @ref BLE_ADV_AUTOSCAN_SCANNING
+ *
+ * @param[in]       as          State machine to get the state of
+ */
+static inline unsigned ble_adv_autoscan_state(const struct ble_adv_autoscan *as)
+{
+    return as->state;
+}
+
+/** @} */
+#endif /* BLE_ADV_AUTOSCAN_H */
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_BULK_H
+#define BLE_ADV_BULK_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_bulk    Bulk selection of advertisements
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Quickly pick the interesting advertisements out of a large batch of views
+ * @file
+ *
+ * When reprocessing recordings, most advertisements are of no interest and only those with
+ * e.g. service data of a given UUID16 need to be decoded. @ref ble_adv_bulk_select only walks
+ * the EIR field headers of each advertisement without decoding any field, which is several
+ * times cheaper than fully decoding it with @ref ble_adv_view_parse. Only the selected
+ * advertisements then need to be decoded.
+ *
+ * @note    A SIMD search for the first bytes of a matching field was evaluated, but turned out
+ *          slower than walking the field headers: An advertisement has only a handful of
+ *          fields, while the search has to inspect every byte.
+ */
+
+/**
+ * @brief   Select the advertisements containing a field with the given type and UUID16
+ *
+ * @param[out]      dest        Write the indices of the matching views here, must have
+ *                              room for @p num entries
+ * @param[in]       views       Advertisements to search
+ * @param[in]       num         Number of entries in @p views
+ * @param[in]       type        Type of the field, @ref EIR_SERVICE_DATA or
+ *                              @ref EIR_MANUFACTURER_SPECIFIC_DATA
+ * @param[in]       uuid16      UUID16 of the service data or ID of the manufacturer
+ *
+ * @return  Number of indices written to @p dest, in ascending order
+ *
+ * @note    Decode the selected views with @ref ble_adv_view_parse, or get the payload with
+ *          @ref ble_adv_view_service_data
+ */
+size_t ble_adv_bulk_select(uint32_t *dest, const struct ble_adv_view *views, size_t num,
+                           uint8_t type, uint16_t uuid16);
+
+/** @} */
+#endif /* BLE_ADV_BULK_H */
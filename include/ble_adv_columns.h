@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_COLUMNS_H
+#define BLE_ADV_COLUMNS_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_columns Column-oriented batches of advertisements
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Decode advertisements into a structure of arrays for analytics
+ * @file
+ *
+ * @ref ble_adv is mostly made up of fixed size arrays, which are empty for most advertisements.
+ * Consumers only interested in a few fields of many advertisements waste a lot of memory
+ * bandwidth on it. A @ref ble_adv_columns instead stores each field in its own array, so that a
+ * loop over e.g. @ref ble_adv_columns::rssi streams through contiguous memory and can be
+ * vectorized by the compiler. Variable length fields (service data, manufacturer specific data
+ * and the name) are copied back to back into a shared arena and referenced by offset and length.
+ *
+ * All arrays are allocated at once in @ref ble_adv_columns_init and start at a cache line
+ * boundary. Appending never allocates.
+ */
+
+/**
+ * @brief   Batch of advertisements stored column by column
+ *
+ * Row `i` of the batch is made up of entry `i` of each array. Only the first
+ * @ref ble_adv_columns::len rows are valid.
+ */
+struct ble_adv_columns {
+    uint8_t (*addr)[6];         /**< Address in corrected byte order */
+    uint64_t *timestamp_us;     /**< Time of reception in µs since the epoch */
+    uint16_t *has;              /**< Flags such as @ref BLE_ADV_HAS_SERVICE_DATA */
+    uint16_t *service_uuid16;   /**< UUID16 of the service data, check has */
+    uint16_t *ms_uuid16;        /**< ID of the manufacturer specific data, check has */
+    uint32_t *service_data_off; /**< Offset of the service data in the arena */
+    uint32_t *ms_data_off;      /**< Offset of the manufacturer specific data in the arena */
+    uint32_t *name_off;         /**< Offset of the name (not zero terminated) in the arena */
+    uint8_t *service_data_len;  /**< Length of the service data */
+    uint8_t *ms_data_len;       /**< Length of the manufacturer specific data */
+    uint8_t *name_len;          /**< Length of the name, 0 if unknown */
+    uint8_t *addr_type;         /**< Type of the address, e.g. `LE_PUBLIC_ADDRESS` */
+    uint8_t *adapter;           /**< Adapter the advertisement was received on */
+    uint8_t *flags;             /**< Flags advertised, check has */
+    int8_t *rssi;               /**< RSSI in dBm */
+    int8_t *tx_power;           /**< Advertised TX power in dBm, or INT8_MAX */
+    uint8_t *arena;             /**< Storage of the variable length fields */
+    size_t arena_len;           /**< Bytes used in @ref ble_adv_columns::arena */
+    size_t arena_size;          /**< Size of @ref ble_adv_columns::arena */
+    size_t len;                 /**< Number of rows in use */
+    size_t capacity;            /**< Maximum number of rows */
+    size_t dropped;             /**< Advertisements dropped due to lack of space */
+    size_t invalid;             /**< Advertisements dropped due to invalid encoding */
+    void *mem;                  /**< The single allocation holding all arrays (private) */
+};
+
+/**
+ * @brief   Allocate a column batch
+ *
+ * @param[out]      cols        Batch to initialize
+ * @param[in]       capacity    Maximum number of advertisements
+ * @param[in]       arena_size  Size of the arena for variable length fields in bytes, e.g.
+ *                              `capacity * 16` for mostly sensor advertisements
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_columns_init(struct ble_adv_columns *cols, size_t capacity, size_t arena_size);
+
+/**
+ * @brief   Free the memory of a column batch
+ *
+ * @param[in,out]   cols        Batch to free
+ */
+void ble_adv_columns_destroy(struct ble_adv_columns *cols);
+
+/**
+ * @brief   Drop all rows (and reset the counters) to reuse the batch
+ *
+ * @param[in,out]   cols        Batch to clear
+ */
+void ble_adv_columns_clear(struct ble_adv_columns *cols);
+
+/**
+ * @brief   Decode an advertisement and append it as a row
+ *
+ * @param[in,out]   cols        Batch to append to
+ * @param[in]       view        Advertisement to append
+ * @param[in]       adapter     Value to store in @ref ble_adv_columns::adapter
+ * @param[in]       timestamp_us    Value to store in @ref ble_adv_columns::timestamp_us
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `ENOBUFS` if
+ *                              the batch is full and `EPROTO` if @p view is malformed
+ *
+ * @note    Only the first service data and the first manufacturer specific data are stored.
+ *          Unlike @ref ble_adv_view_parse, there is no length limit on them.
+ */
+int ble_adv_columns_append_view(struct ble_adv_columns *cols, const struct ble_adv_view *view,
+                                uint8_t adapter, uint64_t timestamp_us, unsigned parse_flags);
+
+/**
+ * @brief   Decode all advertisements of a raw HCI event and append them as rows
+ *
+ * @param[in,out]   cols        Batch to append to
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ * @param[in]       adapter     Value to store in @ref ble_adv_columns::adapter
+ * @param[in]       timestamp_us    Value to store in @ref ble_adv_columns::timestamp_us
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ *
+ * @return  Number of rows appended
+ * @retval  -1                  Failure and errno is set to indicate the cause, `ENOENT` if
+ *                              @p buf is not an LE Advertising Report event
+ *
+ * @note    Advertisements not fitting or being malformed are counted in
+ *          @ref ble_adv_columns::dropped and @ref ble_adv_columns::invalid
+ */
+int ble_adv_columns_append_event(struct ble_adv_columns *cols, const void *buf, size_t len,
+                                 uint8_t adapter, uint64_t timestamp_us, unsigned parse_flags);
+
+/**
+ * @brief   Receive up to @ref BLE_ADV_READ_MANY_EVENTS HCI events (but only as many as the
+ *          free rows can hold, as for @ref ble_adv_read_many) and append their advertisements
+ *          as rows
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in,out]   cols        Batch to append to
+ * @param[in]       adapter     Value to store in @ref ble_adv_columns::adapter
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ *
+ * @return  Number of rows appended
+ * @retval  -1                  Failure and errno is set to indicate the cause, `ENOBUFS` if
+ *                              @p cols is already full
+ *
+ * The kernel receive timestamp of each event is used, as requested by @ref ble_adv_scan. If
+ * unavailable, 0 is stored, as for @ref ble_adv::timestamp_us. The events are accounted in the
+ * statistics of @p adapter, as done by @ref ble_adv_read_many. Blocks (unless @p dev is in
+ * non-blocking mode) until at least one event is available, but does not wait for further
+ * events.
+ */
+int ble_adv_columns_read(int dev, struct ble_adv_columns *cols, uint8_t adapter,
+                         unsigned parse_flags);
+
+/**
+ * @brief   Get a pointer to the service data of a row
+ */
+static inline const uint8_t *ble_adv_columns_service_data(const struct ble_adv_columns *cols,
+                                                          size_t row)
+{
+    return cols->arena + cols->service_data_off[row];
+}
+
+/**
+ * @brief   Get a pointer to the manufacturer specific data of a row
+ */
+static inline const uint8_t *ble_adv_columns_ms_data(const struct ble_adv_columns *cols,
+                                                     size_t row)
+{
+    return cols->arena + cols->ms_data_off[row];
+}
+
+/** @} */
+#endif /* BLE_ADV_COLUMNS_H */
@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_DECODE_H
+#define BLE_ADV_DECODE_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_decode  Decoders for vendor specific payloads
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Decode sensor and beacon payloads into a common fixed-point record
+ * @file
+ *
+ * Decoders are registered in a constant table sorted by the kind of payload (service data or
+ * manufacturer specific data), the UUID16 / company ID and the payload length. So finding the
+ * decoder of a payload is a single binary search, regardless how many formats are supported.
+ * Formats with a variable payload length are registered with @ref BLE_ADV_DECODE_LEN_ANY and
+ * are only considered if no decoder for the exact length exists.
+ *
+ * All values are stored as integers in @ref ble_adv_sensor, no floating point math is done and
+ * no memory is allocated. Payloads with a list of objects (MiBeacon and BTHome) are decoded in a
+ * single pass, objects not representable in @ref ble_adv_sensor are skipped.
+ */
+
+/**
+ * @name    Kinds of payload, used in @ref ble_adv_decoder::kind
+ * @{
+ */
+#define BLE_ADV_DECODE_KIND_SERVICE_DATA    0x00    /**< Keyed by the service UUID16 */
+#define BLE_ADV_DECODE_KIND_MS_DATA         0x01    /**< Keyed by the company ID */
+/** @} */
+
+/**
+ * @brief   Value of @ref ble_adv_decoder::len matching any length
+ */
+#define BLE_ADV_DECODE_LEN_ANY              0
+
+/**
+ * @name    Supported formats, used in @ref ble_adv_sensor::decoder
+ * @{
+ */
+#define BLE_ADV_DECODER_NONE                0x00    /**< No decoder matched */
+#define BLE_ADV_DECODER_ATC1441             0x01    /**< atc1441 custom firmware format */
+#define BLE_ADV_DECODER_MIBEACON            0x02    /**< Xiaomi MiBeacon (unencrypted only) */
+#define BLE_ADV_DECODER_RUUVI_RAWV2         0x03    /**< Ruuvi data format 5 (RAWv2) */
+#define BLE_ADV_DECODER_IBEACON             0x04    /**< Apple iBeacon */
+#define BLE_ADV_DECODER_EDDYSTONE           0x05    /**< Google Eddystone UID/URL/TLM/EID */
+#define BLE_ADV_DECODER_PVVX                0x06    /**< pvvx custom firmware format */
+#define BLE_ADV_DECODER_BTHOME_V2           0x07    /**< BTHome v2 (unencrypted only) */
+/** @} */
+
+/**
+ * @name    Flags used in @ref ble_adv_sensor::has
+ * @{
+ */
+#define BLE_ADV_SENSOR_HAS_TEMPERATURE      0x0001  /**< @ref ble_adv_sensor::temperature */
+#define BLE_ADV_SENSOR_HAS_HUMIDITY         0x0002  /**< @ref ble_adv_sensor::humidity */
+#define BLE_ADV_SENSOR_HAS_PRESSURE         0x0004  /**< @ref ble_adv_sensor::pressure */
+#define BLE_ADV_SENSOR_HAS_BAT              0x0008  /**< @ref ble_adv_sensor::bat */
+#define BLE_ADV_SENSOR_HAS_BAT_MV           0x0010  /**< @ref ble_adv_sensor::bat_mv */
+#define BLE_ADV_SENSOR_HAS_ACCEL            0x0020  /**< @ref ble_adv_sensor::accel */
+#define BLE_ADV_SENSOR_HAS_COUNTER          0x0040  /**< @ref ble_adv_sensor::counter */
+#define BLE_ADV_SENSOR_HAS_TX_POWER         0x0080  /**< @ref ble_adv_sensor::tx_power */
+#define BLE_ADV_SENSOR_HAS_BEACON_ID        0x0100  /**< @ref ble_adv_sensor::beacon_id */
+#define BLE_ADV_SENSOR_HAS_ILLUMINANCE      0x0200  /**< @ref ble_adv_sensor::illuminance */
+#define BLE_ADV_SENSOR_HAS_CO2              0x0400  /**< @ref ble_adv_sensor::co2 */
+#define BLE_ADV_SENSOR_HAS_MOISTURE         0x0800  /**< @ref ble_adv_sensor::moisture */
+#define BLE_ADV_SENSOR_HAS_BUTTON           0x1000  /**< @ref ble_adv_sensor::button */
+/** @} */
+
+/**
+ * @brief   Decoded measurements or beacon identity
+ *
+ * Only the fields flagged in @ref ble_adv_sensor::has hold valid values.
+ */
+struct ble_adv_sensor {
+    uint32_t has;               /**< Flags used to indicate availability of fields */
+    int32_t temperature;        /**< Temperature in 0.01 °C */
+    uint32_t pressure;          /**< Air pressure in Pa */
+    uint32_t counter;           /**< Frame or measurement counter of the sender */
+    uint32_t illuminance;       /**< Illuminance in 0.01 lx */
+    uint16_t humidity;          /**< Relative humidity in 0.01 % */
+    uint16_t bat_mv;            /**< Battery voltage in mV */
+    uint16_t co2;               /**< CO2 concentration in ppm */
+    uint16_t moisture;          /**< Moisture in 0.01 % */
+    int16_t accel[3];           /**< Acceleration along X, Y and Z axis in mG */
+    uint8_t bat;                /**< Battery level in % */
+    uint8_t button;             /**< Button event, e.g. 0x01 for a press (BTHome numbering) */
+    int8_t tx_power;            /**< TX power (at 0 m for Eddystone, at 1 m for iBeacon) in dBm */
+    uint8_t decoder;            /**< Format decoded, e.g. @ref BLE_ADV_DECODER_ATC1441 */
+    /**
+     * @brief   Identity of a beacon
+     *
+     * For iBeacon this is the proximity UUID followed by major and minor (in network byte order),
+     * for Eddystone UID this is the namespace followed by the instance, and for Eddystone EID
+     * the ephemeral ID.
+     */
+    uint8_t beacon_id[20];
+    uint8_t beacon_id_len;      /**< Length of @ref ble_adv_sensor::beacon_id in bytes */
+};
+
+/**
+ * @brief   Signature of a decoder
+ *
+ * @param[out]      dest        Write the decoded values here, zero initialized by the caller
+ * @param[in]       data        Payload after the UUID16 / company ID
+ * @param[in]       len         Length of @p data in bytes
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+typedef int (*ble_adv_decode_fn_t)(struct ble_adv_sensor *dest, const uint8_t *data,
+                                   size_t len);
+
+/**
+ * @brief   Entry of the decoder registry
+ */
+struct ble_adv_decoder {
+    uint8_t kind;               /**< E.g. @ref BLE_ADV_DECODE_KIND_SERVICE_DATA */
+    uint16_t id;                /**< Service UUID16 or company ID */
+    uint8_t len;                /**< Payload length or @ref BLE_ADV_DECODE_LEN_ANY */
+    uint8_t decoder;            /**< Format, e.g. @ref BLE_ADV_DECODER_ATC1441 */
+    const char *name;           /**< Human readable name of the format */
+    ble_adv_decode_fn_t decode; /**< Function decoding the payload */
+};
+
+/**
+ * @brief   Look up the decoder of a payload
+ *
+ * @param[in]       kind        Kind of the payload, e.g. @ref BLE_ADV_DECODE_KIND_MS_DATA
+ * @param[in]       id          Service UUID16 or company ID
+ * @param[in]       len         Length of the payload (after the UUID16 / company ID)
+ *
+ * @return  The matching decoder
+ * @retval  NULL                No decoder registered for the payload
+ */
+const struct ble_adv_decoder *ble_adv_decoder_lookup(uint8_t kind, uint16_t id, size_t len);
+
+/**
+ * @brief   Decode the service data or manufacturer specific data of an advertisement
+ *
+ * @param[out]      dest        Write the decoded values here
+ * @param[in]       adv         Advertisement to decode
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `ENOENT` if no
+ *                              decoder matched, `EBADMSG` if the payload is malformed and
+ *                              `ENOTSUP` if it is encrypted
+ *
+ * @note    Service data is tried first. If it has no decoder, the manufacturer specific data is
+ *          tried.
+ */
+int ble_adv_decode(struct ble_adv_sensor *dest, const struct ble_adv *adv);
+
+/**
+ * @brief   Decode the first decodable service data or manufacturer specific data of a view
+ *
+ * @param[out]      dest        Write the decoded values here
+ * @param[in]       view        View of the advertisement to decode
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, see
+ *                              @ref ble_adv_decode
+ *
+ * @note    Unlike @ref ble_adv_decode this also works for payloads exceeding the fixed size
+ *          arrays of @ref ble_adv, e.g. in extended advertisements.
+ */
+int ble_adv_decode_view(struct ble_adv_sensor *dest, const struct ble_adv_view *view);
+
+/**
+ * @brief   Get the human readable name of a format
+ *
+ * @param[in]       decoder     Format, e.g. @ref BLE_ADV_DECODER_ATC1441
+ *
+ * @return  The name of the format, or `"<unknown>"`
+ */
+const char *ble_adv_decoder_name(uint8_t decoder);
+
+/** @} */
+#endif /* BLE_ADV_DECODE_H */
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_DEVTAB_H
+#define BLE_ADV_DEVTAB_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_devtab  Host-side device table and deduplication
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Track devices by address and suppress advertisements that carry no new information
+ * @file
+ *
+ * The duplicate filter of the controller (@ref BLE_ADV_SCAN_FLAG_NO_DUPLICATES) only holds a
+ * handful of addresses on many controllers and is keyed only by the address, so that it drops
+ * advertisements with changed payload as well. A @ref ble_adv_devtab instead remembers a
+ * fingerprint of the payload (service data and manufacturer specific data) of each device.
+ * An advertisement is considered new, if the device was not seen before or its payload
+ * changed. Sensors including a frame counter in their service data (such as the LYWSD03MMC
+ * custom firmware) hence pass exactly once per measurement.
+ *
+ * The table is an open-addressing hash map with linear probing, keyed by the address. All
+ * memory is allocated in @ref ble_adv_devtab_init, so that updates never allocate. If the
+ * table is full, the least recently seen device is evicted. Devices not seen for longer than
+ * the configured TTL are evicted as well.
+ */
+
+/**
+ * @brief   Maximum capacity of a @ref ble_adv_devtab
+ */
+#define BLE_ADV_DEVTAB_CAPACITY_MAX         (UINT32_C(1) << 24)
+
+/**
+ * @brief   A device tracked in @ref ble_adv_devtab
+ */
+struct ble_adv_devtab_entry {
+    uint64_t first_seen_ms;     /**< Timestamp of the first advertisement */
+    uint64_t last_seen_ms;      /**< Timestamp of the most recent advertisement */
+    uint64_t changed_ms;        /**< Timestamp the payload last changed */
+    uint32_t seen;              /**< Number of advertisements received */
+    uint32_t payload_hash;      /**< Fingerprint of the payload */
+    uint32_t addr_hash;         /**< Hash of the address (private) */
+    uint32_t lru_prev;          /**< Next more recently seen entry (private) */
+    uint32_t lru_next;          /**< Next less recently seen entry (private) */
+    uint8_t addr[6];            /**< Address of the device in corrected byte order */
+    uint8_t addr_type;          /**< Type of @ref ble_adv_devtab_entry::addr */
+    uint8_t rssi;               /**< RSSI of the most recent advertisement */
+};
+
+/**
+ * @brief   Table of devices
+ *
+ * @note    The contents are private, use the functions below to access it
+ */
+struct ble_adv_devtab {
+    struct ble_adv_devtab_entry *entries;   /**< Preallocated entries */
+    uint32_t *slots;            /**< Hash slots holding entry indices */
+    uint32_t slot_mask;         /**< Number of slots minus one */
+    uint32_t capacity;          /**< Number of entries */
+    uint32_t len;               /**< Number of entries in use */
+    uint32_t lru_head;          /**< Most recently seen entry */
+    uint32_t lru_tail;          /**< Least recently seen entry */
+    uint32_t free_head;         /**< First unused entry */
+    uint64_t ttl_ms;            /**< Time to live, or 0 for no expiry */
+    uint64_t evicted;           /**< Number of entries evicted because the table was full */
+    uint64_t expired;           /**< Number of entries evicted because of the TTL */
+};
+
+/**
+ * @brief   Initialize a device table
+ *
+ * @param[out]      tab         Table to initialize
+ * @param[in]       capacity    Maximum number of devices to track
+ * @param[in]       ttl_ms      Forget devices not seen for this many milliseconds, or 0 to
+ *                              only evict devices when the table is full
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    This allocates up to `capacity * 72` bytes
+ */
+int ble_adv_devtab_init(struct ble_adv_devtab *tab, size_t capacity, uint64_t ttl_ms);
+
+/**
+ * @brief   Free the memory of a device table
+ *
+ * @param[in,out]   tab         Table to destroy
+ */
+void ble_adv_devtab_destroy(struct ble_adv_devtab *tab);
+
+/**
+ * @brief   Record an advertisement in the device table
+ *
+ * @param[in,out]   tab         Table to update
+ * @param[in]       adv         Advertisement received
+ * @param[in]       now_ms      Current time in milliseconds of a monotonic clock
+ * @param[out]      entry       If not `NULL`, the entry of the device is stored here
+ *
+ * @retval  1                   The device is new or its payload changed
+ * @retval  0                   The advertisement is a duplicate
+ *
+ * @note    The pointer stored in @p entry is only valid until the next update
+ */
+int ble_adv_devtab_update(struct ble_adv_devtab *tab, const struct ble_adv *adv,
+                          uint64_t now_ms, const struct ble_adv_devtab_entry **entry);
+
+/**
+ * @brief   Look up a device by address
+ *
+ * @param[in]       tab         Table to search
+ * @param[in]       addr        Address of the device in corrected byte order
+ *
+ * @return  The entry of the device
+ * @retval  NULL                Device not in the table
+ */
+const struct ble_adv_devtab_entry *ble_adv_devtab_find(const struct ble_adv_devtab *tab,
+                                                       const uint8_t addr[6]);
+
+/**
+ * @brief   Evict all devices not seen within the TTL
+ *
+ * @param[in,out]   tab         Table to clean up
+ * @param[in]       now_ms      Current time in milliseconds of a monotonic clock
+ *
+ * @return  Number of devices evicted
+ *
+ * @note    @ref ble_adv_devtab_update already evicts a few expired devices on each call, so
+ *          calling this is only needed to free up entries while no advertisements are received
+ */
+size_t ble_adv_devtab_expire(struct ble_adv_devtab *tab, uint64_t now_ms);
+
+/**
+ * @brief   Get the number of devices in the table
+ */
+static inline size_t ble_adv_devtab_len(const struct ble_adv_devtab *tab)
+{
+    return tab->len;
+}
+
+/** @} */
+#endif /* BLE_ADV_DEVTAB_H */
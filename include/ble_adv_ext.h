@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_EXT_H
+#define BLE_ADV_EXT_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_ext     Extended advertising (Bluetooth 5) scanning
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Scan for extended advertisements on the LE 1M and LE Coded PHY
+ * @file
+ *
+ * Extended advertisements can carry up to @ref BLE_ADV_EXT_DATA_MAX bytes of advertising data,
+ * which the controller may split into several LE Extended Advertising Report events. These
+ * fragments are reassembled using a @ref ble_adv_ext_reasm. The payload is not copied into
+ * fixed size arrays, but exposed as @ref ble_adv_view, so that the accessors such as
+ * @ref ble_adv_view_find work on extended advertisements as well.
+ *
+ * @warning Most controllers refuse to mix the legacy scan commands used by @ref ble_adv_scan
+ *          with the extended ones until they are reset. Stick to one of them.
+ */
+
+/**
+ * @brief   Maximum length of the advertising data of an extended advertisement
+ */
+#define BLE_ADV_EXT_DATA_MAX                1650
+
+/**
+ * @brief   Number of advertisements that can be reassembled concurrently
+ */
+#define BLE_ADV_EXT_REASM_SLOTS             8
+
+/**
+ * @name    PHYs to scan on, used in @ref ble_adv_ext_scan_params::phys
+ * @{
+ */
+#define BLE_ADV_EXT_PHY_1M                  0x01    /**< LE 1M PHY */
+#define BLE_ADV_EXT_PHY_CODED               0x04    /**< LE Coded PHY (long range) */
+/** @} */
+
+/**
+ * @name    Values of @ref ble_adv_ext_report::primary_phy and
+ *          @ref ble_adv_ext_report::secondary_phy
+ * @{
+ */
+#define BLE_ADV_EXT_REPORT_PHY_NONE         0x00    /**< No packets on the secondary channel */
+#define BLE_ADV_EXT_REPORT_PHY_1M           0x01    /**< LE 1M PHY */
+#define BLE_ADV_EXT_REPORT_PHY_2M           0x02    /**< LE 2M PHY */
+#define BLE_ADV_EXT_REPORT_PHY_CODED        0x03    /**< LE Coded PHY */
+/** @} */
+
+/**
+ * @name    Flags used in @ref ble_adv_ext_report::event_type
+ * @{
+ */
+#define BLE_ADV_EXT_EVT_CONNECTABLE         0x0001  /**< Connectable advertising */
+#define BLE_ADV_EXT_EVT_SCANNABLE           0x0002  /**< Scannable advertising */
+#define BLE_ADV_EXT_EVT_DIRECTED            0x0004  /**< Directed advertising */
+#define BLE_ADV_EXT_EVT_SCAN_RSP            0x0008  /**< Scan response */
+#define BLE_ADV_EXT_EVT_LEGACY              0x0010  /**< Legacy advertising PDU */
+/** @} */
+
+/**
+ * @name    Values of @ref ble_adv_ext_report::status
+ * @{
+ */
+#define BLE_ADV_EXT_STATUS_COMPLETE         0x00    /**< All data was received */
+#define BLE_ADV_EXT_STATUS_TRUNCATED        0x02    /**< The controller (or the reassembly)
+                                                         gave up, data is incomplete */
+/** @} */
+
+/**
+ * @brief   Value of @ref ble_adv_ext_report::tx_power if not available
+ */
+#define BLE_ADV_EXT_TX_POWER_UNKNOWN        127
+
+/**
+ * @brief   A (reassembled) extended advertisement
+ */
+struct ble_adv_ext_report {
+    /**
+     * @brief   View of the advertisement
+     *
+     * @ref ble_adv_view::evt_type holds the lower byte of @ref ble_adv_ext_report::event_type.
+     */
+    struct ble_adv_view view;
+    uint16_t event_type;        /**< Event type, e.g. @ref BLE_ADV_EXT_EVT_CONNECTABLE */
+    uint16_t periodic_interval; /**< Interval of the periodic advertising in units of 1.25 ms,
+                                     or 0 if there is no periodic advertising */
+    uint8_t primary_phy;        /**< PHY of the primary advertising channel */
+    uint8_t secondary_phy;      /**< PHY of the secondary advertising channel */
+    uint8_t sid;                /**< Advertising set ID, or 0xFF if not available */
+    int8_t tx_power;            /**< TX power in dBm or @ref BLE_ADV_EXT_TX_POWER_UNKNOWN */
+    uint8_t status;             /**< @ref BLE_ADV_EXT_STATUS_COMPLETE or
+                                     @ref BLE_ADV_EXT_STATUS_TRUNCATED */
+};
+
+/**
+ * @brief   Reassembly buffer of a single advertisement
+ *
+ * @note    This is private, only exposed to allow allocating @ref ble_adv_ext_reasm
+ */
+struct ble_adv_ext_reasm_slot {
+    uint32_t age;                       /**< Value of @ref ble_adv_ext_reasm::clock on use */
+    uint16_t len;                       /**< Number of bytes in the buffer */
+    uint8_t bdaddr[6];                  /**< Address of the advertiser */
+    uint8_t addr_type;                  /**< Type of the address of the advertiser */
+    uint8_t sid;                        /**< Advertising set ID */
+    uint8_t state;                      /**< Free, assembling or handed out */
+    uint8_t truncated;                  /**< Data did not fit */
+    uint8_t data[BLE_ADV_EXT_DATA_MAX]; /**< Buffer holding the data */
+};
+
+/**
+ * @brief   State for reassembling fragmented extended advertisements
+ *
+ * Initialize with @ref ble_adv_ext_reasm_init. This is about 13 KiB in size and does not
+ * need any dynamic memory.
+ */
+struct ble_adv_ext_reasm {
+    struct ble_adv_ext_reasm_slot slots[BLE_ADV_EXT_REASM_SLOTS];   /**< Buffers */
+    uint32_t clock;                                                 /**< Used for LRU */
+};
+
+/**
+ * @brief   Scan parameters of a single PHY
+ */
+struct ble_adv_ext_scan_phy {
+    uint16_t interval;          /**< Scan interval in units of 0.625 ms */
+    uint16_t window;            /**< Length of the scan window in units of 0.625 ms */
+    uint8_t scan_type;          /**< 0 for passive scanning, 1 for active scanning */
+};
+
+/**
+ * @brief   Scan parameters to pass to @ref ble_adv_ext_scan
+ *
+ * Use @ref ble_adv_ext_scan_params_init to initialize this with sane values.
+ */
+struct ble_adv_ext_scan_params {
+    struct ble_adv_ext_scan_phy phy_1m;     /**< Parameters for the LE 1M PHY */
+    struct ble_adv_ext_scan_phy phy_coded;  /**< Parameters for the LE Coded PHY */
+    uint16_t duration;          /**< Scan duration in units of 10 ms, 0 to scan continuously */
+    uint16_t period;            /**< Scan period in units of 1.28 s, 0 to scan continuously */
+    uint8_t phys;               /**< PHYs to scan on, e.g. @ref BLE_ADV_EXT_PHY_CODED */
+    uint8_t own_addr_type;      /**< `LE_PUBLIC_ADDRESS` or `LE_RANDOM_ADDRESS` */
+    uint8_t filter_policy;      /**< 0 to accept all advertisers, 1 to only accept those in the
+                                     filter accept list */
+    uint8_t filter_duplicates;  /**< 1 to let the controller filter duplicates, 0 otherwise */
+    int hci_timeout_ms;         /**< Timeout of each HCI command in milliseconds */
+};
+
+/**
+ * @brief   Initialize extended scan parameters from a profile
+ *
+ * @param[out]      params      Scan parameters to initialize
+ * @param[in]       profile     Profile to use, e.g. @ref BLE_ADV_SCAN_PROFILE_BALANCED
+ * @param[in]       flags       Flags as passed to @ref ble_adv_scan, except for
+ *                              @ref BLE_ADV_SCAN_FLAG_ENABLED which is ignored
+ * @param[in]       phys        PHYs to scan on, e.g.
+ *                              `BLE_ADV_EXT_PHY_1M | BLE_ADV_EXT_PHY_CODED`
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    If scanning on both PHYs, the controller alternates between them. So each PHY only
+ *          gets roughly half of the scan time.
+ */
+int ble_adv_ext_scan_params_init(struct ble_adv_ext_scan_params *params, unsigned profile,
+                                 unsigned flags, uint8_t phys);
+
+/**
+ * @brief   Enable extended scanning with the given parameters and set appropriate filters
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       params      Scan parameters to apply
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EIO` if the
+ *                              controller rejected a command
+ */
+int ble_adv_ext_scan(int dev, const struct ble_adv_ext_scan_params *params);
+
+/**
+ * @brief   Disable extended scanning
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_ext_scan_disable(int dev);
+
+/**
+ * @brief   Initialize the reassembly state
+ *
+ * @param[out]      reasm       State to initialize
+ */
+void ble_adv_ext_reasm_init(struct ble_adv_ext_reasm *reasm);
+
+/**
+ * @brief   Parse an LE Extended Advertising Report event
+ *
+ * @param[in,out]   reasm       State for reassembling fragmented advertisements
+ * @param[out]      dest        Array to write the completed advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ *
+ * @return  Number of completed advertisements written to @p dest, which may be zero if the
+ *          event only contained fragments
+ * @retval  -1                  Failure and errno is set to indicate the cause, `ENOENT` if
+ *                              @p buf is not an LE Extended Advertising Report event
+ *
+ * @warning The views in @p dest point either into @p buf or into @p reasm. They are only valid
+ *          until the next call of this function with the same @p reasm and as long as @p buf is
+ *          valid.
+ * @note    Completed advertisements not fitting into @p dest are dropped, but fragments are
+ *          still processed.
+ */
+int ble_adv_ext_parse_event(struct ble_adv_ext_reasm *reasm, struct ble_adv_ext_report *dest,
+                            size_t max, const void *buf, size_t len);
+
+/** @} */
+#endif /* BLE_ADV_EXT_H */
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_FIELDS_H
+#define BLE_ADV_FIELDS_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_fields  Index of all EIR fields of an advertisement
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Locate every EIR field of a view in a single pass, including repeated ones
+ * @file
+ *
+ * @ref ble_adv only holds one field of each type it decodes, so e.g. a second service data
+ * field replaces the first one. @ref ble_adv_fields_index instead records the type, offset and
+ * length of every field of a @ref ble_adv_view. The helpers then iterate over the fields of a
+ * type, over the service data of any UUID size, or over the UUIDs listed, without parsing the
+ * raw bytes again.
+ *
+ * Like the views, the index does not copy any data. It is only valid as long as the view is.
+ */
+
+/**
+ * @brief   Maximum number of fields in an index
+ *
+ * The 31 bytes of a legacy advertisement hold at most 15 fields. Only extended advertisements
+ * may exceed this.
+ */
+#define BLE_ADV_FIELDS_MAX                  32
+
+/**
+ * @brief   Value of the type to pass to @ref ble_adv_fields_next to match any field
+ */
+#define BLE_ADV_FIELD_ANY                   0x00
+
+/**
+ * @brief   Location of a single EIR field
+ */
+struct ble_adv_field {
+    uint16_t offset;            /**< Offset of the data (after the type) in
+                                     @ref ble_adv_view::eir */
+    uint8_t len;                /**< Length of the data in bytes */
+    uint8_t type;               /**< EIR type, e.g. @ref EIR_SERVICE_DATA */
+};
+
+/**
+ * @brief   Index of the EIR fields of an advertisement
+ */
+struct ble_adv_fields {
+    struct ble_adv_field fields[BLE_ADV_FIELDS_MAX];    /**< Fields in order of appearance */
+    uint8_t len;                                        /**< Number of fields */
+    uint8_t truncated;                                  /**< More fields than fit, or the
+                                                             last field was truncated and
+                                                             lenient parsing is enabled */
+};
+
+/**
+ * @brief   Service data of any UUID size
+ */
+struct ble_adv_service_data {
+    const uint8_t *uuid;        /**< UUID in little endian byte order as transmitted */
+    const uint8_t *data;        /**< Service data following the UUID */
+    uint8_t uuid_len;           /**< Length of the UUID in bytes (2, 4 or 16) */
+    uint8_t len;                /**< Length of @ref ble_adv_service_data::data in bytes */
+};
+
+/**
+ * @brief   Build the index of the EIR fields of a view
+ *
+ * @param[out]      dest        Index to build
+ * @param[in]       view        View of the advertisement to index
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ *
+ * @return  Number of fields indexed
+ * @retval  -1                  Failure and errno is set to indicate the cause, `EPROTO` if the
+ *                              EIR data is malformed
+ *
+ * If @ref BLE_ADV_PARSE_FLAG_LENIENT is set in @p flags, a truncated trailing field is not an
+ * error. Instead, the fields before it are indexed and @ref ble_adv_fields::truncated is set.
+ */
+int ble_adv_fields_index(struct ble_adv_fields *dest, const struct ble_adv_view *view,
+                         unsigned flags);
+
+/**
+ * @brief   Get the next field of the given type
+ *
+ * @param[in]       fields      Index to search
+ * @param[in]       type        EIR type to search for, or @ref BLE_ADV_FIELD_ANY
+ * @param[in,out]   pos         Position to start searching at, initialize to 0. Updated to
+ *                              continue the search after the returned field.
+ *
+ * @return  The field found, or `NULL` if there is none left
+ */
+const struct ble_adv_field *ble_adv_fields_next(const struct ble_adv_fields *fields,
+                                                uint8_t type, size_t *pos);
+
+/**
+ * @brief   Get a pointer to the data of a field
+ *
+ * @param[in]       view        View the index was built from
+ * @param[in]       field       Field of that view
+ *
+ * @return  Pointer to the @ref ble_adv_field::len bytes of data
+ */
+static inline const uint8_t *ble_adv_field_data(const struct ble_adv_view *view,
+                                                const struct ble_adv_field *field)
+{
+    return view->eir + field->offset;
+}
+
+/**
+ * @brief   Get the next service data, regardless of the size of its UUID
+ *
+ * @param[in]       fields      Index to search
+ * @param[in]       view        View the index was built from
+ * @param[in,out]   pos         Position to start searching at, initialize to 0
+ * @param[out]      dest        Write the service data found here
+ *
+ * @retval  1                   Found service data
+ * @retval  0                   No service data left
+ *
+ * @note    Fields too short to hold their UUID are skipped
+ */
+int ble_adv_fields_next_service_data(const struct ble_adv_fields *fields,
+                                     const struct ble_adv_view *view, size_t *pos,
+                                     struct ble_adv_service_data *dest);
+
+/**
+ * @brief   Collect the 16 bit UUIDs listed in all @ref EIR_UUID16_SOME and @ref EIR_UUID16_ALL
+ *          fields
+ *
+ * @param[out]      dest        Write the UUIDs here
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       fields      Index to search
+ * @param[in]       view        View the index was built from
+ *
+ * @return  Number of UUIDs found, which may exceed @p max. Only the first @p max are written.
+ */
+size_t ble_adv_fields_uuid16s(uint16_t *dest, size_t max, const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view);
+
+/**
+ * @brief   Collect the 32 bit UUIDs listed in all @ref EIR_UUID32_SOME and @ref EIR_UUID32_ALL
+ *          fields
+ *
+ * @see     ble_adv_fields_uuid16s
+ */
+size_t ble_adv_fields_uuid32s(uint32_t *dest, size_t max, const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view);
+
+/**
+ * @brief   Collect the 128 bit UUIDs listed in all @ref EIR_UUID128_SOME and
+ *          @ref EIR_UUID128_ALL fields
+ *
+ * The UUIDs are copied in little endian byte order as transmitted, like
+ * @ref ble_adv::uuid128.
+ *
+ * @see     ble_adv_fields_uuid16s
+ */
+size_t ble_adv_fields_uuid128s(uint8_t (*dest)[16], size_t max,
+                               const struct ble_adv_fields *fields,
+                               const struct ble_adv_view *view);
+
+/**
+ * @brief   Get the appearance of the advertiser
+ *
+ * @param[in]       fields      Index to search
+ * @param[in]       view        View the index was built from
+ * @param[out]      dest        Write the appearance value here
+ *
+ * @retval  1                   Found the appearance
+ * @retval  0                   Advertisement contains no (valid) appearance
+ */
+int ble_adv_fields_appearance(const struct ble_adv_fields *fields,
+                              const struct ble_adv_view *view, uint16_t *dest);
+
+/** @} */
+#endif /* BLE_ADV_FIELDS_H */
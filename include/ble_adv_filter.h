@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_FILTER_H
+#define BLE_ADV_FILTER_H
+
+#include "ble_adv.h"
+
+#include <linux/filter.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_filter  Kernel-side filtering of BLE advertisements
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Drop uninteresting advertisements in the kernel using a classic BPF socket filter
+ * @file
+ *
+ * The match rules in @ref ble_adv_filter are compiled into a classic BPF program and attached
+ * to the HCI socket. Advertisements not matching are dropped by the kernel before they are
+ * copied to user space and without waking up the process.
+ *
+ * An advertisement matches, if all of the following conditions hold:
+ *
+ * 1. Its address is in @ref ble_adv_filter::addrs (or no addresses are given)
+ * 2. It contains service data with an UUID16 in @ref ble_adv_filter::service_uuid16s or
+ *    manufacturer specific data with an ID in @ref ble_adv_filter::ms_uuid16s (or neither
+ *    UUIDs nor IDs are given)
+ * 3. Its RSSI is at least @ref ble_adv_filter::min_rssi
+ *
+ * @note    HCI events other than advertising reports are never dropped, as otherwise the HCI
+ *          commands issued by e.g. @ref ble_adv_scan would no longer complete. The same is
+ *          true for HCI events that batch more than one advertising report, as the filter
+ *          only ever inspects the first report. Users still need to check the received
+ *          advertisements in user space, e.g. with @ref ble_adv_filter_match, but only rarely
+ *          have to throw any away.
+ */
+
+/**
+ * @brief   Maximum number of instructions of a compiled filter program (the kernel limit)
+ */
+#define BLE_ADV_FILTER_MAX_INSNS            BPF_MAXINSNS
+
+/**
+ * @brief   Maximum number of service data UUIDs and of manufacturer IDs each
+ */
+#define BLE_ADV_FILTER_MAX_UUIDS            64
+
+/**
+ * @brief   Value of @ref ble_adv_filter::min_rssi to disable filtering by RSSI
+ */
+#define BLE_ADV_FILTER_RSSI_ANY             INT8_MIN
+
+/**
+ * @brief   Match rules to compile into a socket filter
+ */
+struct ble_adv_filter {
+    const uint8_t (*addrs)[6];          /**< Addresses to accept in corrected byte order */
+    size_t addrs_len;                   /**< Number of entries in @ref ble_adv_filter::addrs */
+    const uint16_t *service_uuid16s;    /**< UUID16s of service data to accept */
+    size_t service_uuid16s_len;         /**< Number of entries in
+                                             @ref ble_adv_filter::service_uuid16s */
+    const uint16_t *ms_uuid16s;         /**< IDs of manufacturer specific data to accept */
+    size_t ms_uuid16s_len;              /**< Number of entries in
+                                             @ref ble_adv_filter::ms_uuid16s */
+    int8_t min_rssi;                    /**< Minimum RSSI in dBm to accept, or
+                                             @ref BLE_ADV_FILTER_RSSI_ANY */
+};
+
+/**
+ * @brief   Compile the given match rules into a classic BPF program
+ *
+ * @param[out]      dest        Write the instructions here
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       filter      Match rules to compile
+ *
+ * @return  Number of instructions written to @p dest
+ * @retval  -1                  Failure and errno is set to indicate the cause, `E2BIG` if
+ *                              the rules do not fit into @p max instructions
+ *
+ * @note    Each address costs five instructions, so that roughly 800 addresses fit into the
+ *          kernel limit of @ref BLE_ADV_FILTER_MAX_INSNS instructions.
+ */
+int ble_adv_filter_compile(struct sock_filter *dest, size_t max,
+                           const struct ble_adv_filter *filter);
+
+/**
+ * @brief   Compile the given match rules and attach them to the HCI socket
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       filter      Match rules to compile
+ *
+ * @retval  0                   Success
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ *
+ * @note    Attaching a filter replaces any previously attached filter
+ */
+int ble_adv_filter_attach(int dev, const struct ble_adv_filter *filter);
+
+/**
+ * @brief   Detach the socket filter from the HCI socket
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ *
+ * @retval  0                   Success
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ */
+int ble_adv_filter_detach(int dev);
+
+/**
+ * @brief   Check an advertisement against the match rules in user space
+ *
+ * @param[in]       filter      Match rules to check
+ * @param[in]       view        Advertisement to check
+ * @param[in]       adapter     On rejection, account to @ref BLE_ADV_STATS_FILTERED of this
+ *                              adapter
+ *
+ * @retval  1                   @p view matches
+ * @retval  0                   @p view does not match and has been counted as filtered
+ * @retval  -1                  Failure and errno is set to indicate the cause
+ *
+ * This applies the same rules as the program compiled by @ref ble_adv_filter_compile, e.g. to
+ * events batching multiple reports (which the kernel lets through) or to replayed events.
+ */
+int ble_adv_filter_match(const struct ble_adv_filter *filter, const struct ble_adv_view *view,
+                         uint8_t adapter);
+
+/** @} */
+#endif /* BLE_ADV_FILTER_H */
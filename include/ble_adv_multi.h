@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_MULTI_H
+#define BLE_ADV_MULTI_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+
+/**
+ * @defgroup    ble_adv_multi   Scanning on multiple adapters at once
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Open several HCI adapters and merge their advertisements into a single stream
+ * @file
+ *
+ * All adapters are multiplexed via a single epoll instance, so no threads are needed. Each
+ * advertisement is tagged with the index of the adapter it was received on in
+ * @ref ble_adv::adapter, which e.g. allows RSSI based localization with adapters at different
+ * places or with different antennas.
+ */
+
+/**
+ * @brief   Maximum number of adapters
+ */
+#define BLE_ADV_MULTI_MAX                   HCI_MAX_DEV
+
+/**
+ * @brief   A set of HCI adapters scanned at once
+ */
+struct ble_adv_multi {
+    int devs[BLE_ADV_MULTI_MAX];        /**< Descriptors of the HCI interfaces */
+    int dev_ids[BLE_ADV_MULTI_MAX];     /**< IDs of the HCI devices (e.g. 0 for hci0) */
+    size_t len;                         /**< Number of opened adapters */
+    int epfd;                           /**< epoll instance watching all descriptors */
+};
+
+/**
+ * @brief   Open the given HCI devices
+ *
+ * @param[out]      multi       Adapter set to initialize
+ * @param[in]       dev_ids     IDs of the HCI devices to open, or `NULL` to open every HCI
+ *                              device that is up
+ * @param[in]       len         Number of entries in @p dev_ids
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `ENODEV` if no
+ *                              adapter is available
+ *
+ * The index of an adapter in @ref ble_adv::adapter matches the index in @p dev_ids. The HCI
+ * descriptors are switched to non-blocking mode.
+ */
+int ble_adv_multi_open(struct ble_adv_multi *multi, const int *dev_ids, size_t len);
+
+/**
+ * @brief   Close all adapters
+ *
+ * @param[in,out]   multi       Adapter set to close
+ */
+void ble_adv_multi_close(struct ble_adv_multi *multi);
+
+/**
+ * @brief   Enable scanning with the same parameters on all adapters
+ *
+ * @param[in]       multi       Adapter set to scan on
+ * @param[in]       params      Scan parameters to apply
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure on at least one of the adapters and errno set to
+ *                              indicate the cause
+ */
+int ble_adv_multi_scan(struct ble_adv_multi *multi, const struct ble_adv_scan_params *params);
+
+/**
+ * @brief   Disable scanning on all adapters
+ *
+ * @param[in]       multi       Adapter set to stop scanning on
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure on at least one of the adapters and errno set to
+ *                              indicate the cause
+ */
+int ble_adv_multi_scan_disable(struct ble_adv_multi *multi);
+
+/**
+ * @brief   Get a descriptor that becomes readable when any adapter has pending events
+ *
+ * @param[in]       multi       Adapter set
+ *
+ * @return  The epoll descriptor, which itself can be added to an outer event loop
+ */
+static inline int ble_adv_multi_fd(const struct ble_adv_multi *multi)
+{
+    return multi->epfd;
+}
+
+/**
+ * @brief   Wait for and read advertisements from all adapters
+ *
+ * @param[in]       multi       Adapter set to read from
+ * @param[out]      dest        Array to write the received BLE advertisements to
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       timeout_ms  Maximum time to wait in milliseconds, -1 to wait forever, 0 to
+ *                              not wait at all
+ * @param[in]       flags       Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ *
+ * @return  Number of advertisements written to @p dest, zero on timeout
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_multi_read(struct ble_adv_multi *multi, struct ble_adv *dest, size_t max,
+                       int timeout_ms, unsigned flags);
+
+/** @} */
+#endif /* BLE_ADV_MULTI_H */
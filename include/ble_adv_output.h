@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_OUTPUT_H
+#define BLE_ADV_OUTPUT_H
+
+#include "ble_adv.h"
+#include "ble_adv_agg.h"
+#include "ble_adv_decode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_output  Buffered machine readable output
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Stream advertisements, sensor readings and aggregates as NDJSON or binary records
+ * @file
+ *
+ * Records are formatted into a single large buffer without going through stdio, which is
+ * written to the file descriptor when it is about to fill up, or when the data is older than
+ * the configured flush interval (see @ref ble_adv_output_tick).
+ *
+ * In @ref BLE_ADV_OUTPUT_NDJSON format each record is a JSON object on its own line. The
+ * member `"type"` is one of `"adv"`, `"sensor"` and `"agg"`. Binary data is hex encoded.
+ *
+ * In @ref BLE_ADV_OUTPUT_BINARY format each record starts with a little endian `uint16_t`
+ * holding the number of bytes following it, followed by a `uint8_t` record type (e.g.
+ * @ref BLE_ADV_OUTPUT_REC_ADV). All integers that follow are little endian, in the order of
+ * the members of the corresponding structure:
+ *
+ * - @ref BLE_ADV_OUTPUT_REC_ADV: `timestamp_us` (u64), `addr` (6 bytes), `addr_type`,
+ *   `adapter`, `rssi` (as signed), `tx_power`, `has`, `flags` (u8 each), `uuid16`,
+ *   `service_uuid16`, `ms_uuid16` (u16 each), `uuid32` (u32), `uuid128` (16 bytes), then
+ *   `name`, `uri`, `service_data` and `ms_data`, each as u8 length followed by the bytes
+ * - @ref BLE_ADV_OUTPUT_REC_SENSOR: `timestamp_us` (u64), `addr` (6 bytes), `decoder` (u8),
+ *   `has`, `temperature`, `pressure`, `counter`, `illuminance` (u32 each), `humidity`,
+ *   `bat_mv`, `co2`, `moisture`, `accel[3]` (u16 each), `bat`, `button`, `tx_power` (u8 each)
+ * - @ref BLE_ADV_OUTPUT_REC_AGG: `start_ms` (u64), `len_ms` (u32), `addr` (6 bytes),
+ *   `window`, `partial` (u8 each), then per channel `sum` (i64), `min`, `max`, `count`
+ *   (u32 each)
+ *
+ * Readers must skip records of unknown type and bytes past the fields they know, so that
+ * fields can be appended later.
+ */
+
+/**
+ * @name    Output formats
+ * @{
+ */
+#define BLE_ADV_OUTPUT_NDJSON               0   /**< Newline delimited JSON */
+#define BLE_ADV_OUTPUT_BINARY               1   /**< Length prefixed binary records */
+/** @} */
+
+/**
+ * @name    Types of binary records
+ * @{
+ */
+#define BLE_ADV_OUTPUT_REC_ADV              1   /**< A @ref ble_adv */
+#define BLE_ADV_OUTPUT_REC_SENSOR           2   /**< A @ref ble_adv_sensor */
+#define BLE_ADV_OUTPUT_REC_AGG              3   /**< A @ref ble_adv_agg_record */
+/** @} */
+
+/**
+ * @brief   Upper bound of the size of any record in any format
+ */
+#define BLE_ADV_OUTPUT_RECORD_MAX           1024
+
+/**
+ * @brief   Default size of the output buffer
+ */
+#define BLE_ADV_OUTPUT_BUF_SIZE             (64 * 1024)
+
+/**
+ * @brief   Buffered output state
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_output {
+    uint8_t *buf;               /**< Output buffer */
+    size_t len;                 /**< Bytes pending in @ref ble_adv_output::buf */
+    size_t size;                /**< Size of @ref ble_adv_output::buf */
+    uint64_t flush_ms;          /**< Maximum age of pending data in ms, 0 to disable */
+    uint64_t pending_since_ms;  /**< Time the oldest pending record was added */
+    uint64_t records;           /**< Number of records formatted */
+    int fd;                     /**< File descriptor to write to */
+    unsigned format;            /**< Format, e.g. @ref BLE_ADV_OUTPUT_NDJSON */
+};
+
+/**
+ * @brief   Initialize the buffered output
+ *
+ * @param[out]      out         Output state to initialize
+ * @param[in]       fd          File descriptor to write to, e.g. `STDOUT_FILENO`
+ * @param[in]       format      Format, e.g. @ref BLE_ADV_OUTPUT_BINARY
+ * @param[in]       size        Size of the buffer, at least @ref BLE_ADV_OUTPUT_RECORD_MAX
+ * @param[in]       flush_ms    Maximum time in ms data is held back, 0 to only flush on a full
+ *                              buffer
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_output_init(struct ble_adv_output *out, int fd, unsigned format, size_t size,
+                        uint64_t flush_ms);
+
+/**
+ * @brief   Flush the pending data and free the buffer
+ *
+ * @param[in,out]   out         Output state to destroy
+ *
+ * @retval  0                   Success
+ * @retval -1                   Flushing failed and errno set to indicate the cause, the
+ *                              buffer is freed regardless
+ */
+int ble_adv_output_destroy(struct ble_adv_output *out);
+
+/**
+ * @brief   Add an advertisement
+ *
+ * @param[in,out]   out         Output to write to
+ * @param[in]       adv         Advertisement to format
+ *
+ * @retval  0                   Success
+ * @retval -1                   Writing the full buffer failed and errno set to indicate the
+ *                              cause, the record was not added
+ */
+int ble_adv_output_adv(struct ble_adv_output *out, const struct ble_adv *adv);
+
+/**
+ * @brief   Add decoded sensor data
+ *
+ * @param[in,out]   out         Output to write to
+ * @param[in]       adv         Advertisement the data was decoded from, for the address and
+ *                              timestamp
+ * @param[in]       sensor      Decoded data to format
+ *
+ * @retval  0                   Success
+ * @retval -1                   As for @ref ble_adv_output_adv
+ */
+int ble_adv_output_sensor(struct ble_adv_output *out, const struct ble_adv *adv,
+                          const struct ble_adv_sensor *sensor);
+
+/**
+ * @brief   Add a closed aggregation window
+ *
+ * @param[in,out]   out         Output to write to
+ * @param[in]       record      Aggregate to format
+ *
+ * @retval  0                   Success
+ * @retval -1                   As for @ref ble_adv_output_adv
+ */
+int ble_adv_output_agg(struct ble_adv_output *out, const struct ble_adv_agg_record *record);
+
+/**
+ * @brief   Format an advertisement into a caller supplied buffer
+ *
+ * @param[out]      dest        Write the record here, must hold
+ *                              @ref BLE_ADV_OUTPUT_RECORD_MAX bytes
+ * @param[in]       format      Format, e.g. @ref BLE_ADV_OUTPUT_BINARY
+ * @param[in]       adv         Advertisement to format
+ *
+ * @return  Length of the record in bytes
+ *
+ * This allows batching records into other containers than a file descriptor, e.g. datagrams.
+ */
+size_t ble_adv_output_format_adv(void *dest, unsigned format, const struct ble_adv *adv);
+
+/**
+ * @brief   Format decoded sensor data into a caller supplied buffer
+ *
+ * @param[out]      dest        As for @ref ble_adv_output_format_adv
+ * @param[in]       format      Format, e.g. @ref BLE_ADV_OUTPUT_BINARY
+ * @param[in]       adv         As for @ref ble_adv_output_sensor
+ * @param[in]       sensor      Decoded data to format
+ *
+ * @return  Length of the record in bytes
+ */
+size_t ble_adv_output_format_sensor(void *dest, unsigned format, const struct ble_adv *adv,
+                                    const struct ble_adv_sensor *sensor);
+
+/**
+ * @brief   Format a closed aggregation window into a caller supplied buffer
+ *
+ * @param[out]      dest        As for @ref ble_adv_output_format_adv
+ * @param[in]       format      Format, e.g. @ref BLE_ADV_OUTPUT_BINARY
+ * @param[in]       record      Aggregate to format
+ *
+ * @return  Length of the record in bytes
+ */
+size_t ble_adv_output_format_agg(void *dest, unsigned format,
+                                 const struct ble_adv_agg_record *record);
+
+/**
+ * @brief   Write all pending data
+ *
+ * @param[in,out]   out         Output to flush
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_output_flush(struct ble_adv_output *out);
+
+/**
+ * @brief   Flush if the pending data is older than the flush interval
+ *
+ * @param[in,out]   out         Output to flush
+ *
+ * @retval  0                   Success or nothing to do
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * Call this periodically, e.g. whenever `poll()` times out.
+ */
+int ble_adv_output_tick(struct ble_adv_output *out);
+
+/** @} */
+#endif /* BLE_ADV_OUTPUT_H */
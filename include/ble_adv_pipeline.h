@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_PIPELINE_H
+#define BLE_ADV_PIPELINE_H
+
+#include "ble_adv.h"
+#include "ble_adv_decode.h"
+#include "ble_adv_pool.h"
+#include "ble_adv_ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_pipeline    Sharded parallel decoding
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Decode HCI events on several worker threads, sharded by the address of the sender
+ * @file
+ *
+ * A single ingest thread passes raw HCI events (e.g. from a recording or from several
+ * adapters) to @ref ble_adv_pipeline_submit. The advertisements are split into views and
+ * copied into a @ref ble_adv_block per worker, selected by a hash of the address. Full blocks
+ * are handed to the worker via a @ref ble_adv_ring. The worker decodes each advertisement
+ * with @ref ble_adv_view_parse and @ref ble_adv_decode and passes the result to the callback.
+ *
+ * All advertisements of a device are processed by the same worker in the order they were
+ * submitted. Hence, state kept per device and worker (e.g. a @ref ble_adv_devtab or a
+ * @ref ble_adv_agg per worker) needs no locking.
+ *
+ * Blocks are only handed over when full, call @ref ble_adv_pipeline_flush after each batch
+ * of live events to bound the latency. If all blocks are in flight, submitting waits for a
+ * worker to return one, so that no advertisement is dropped.
+ */
+
+/**
+ * @brief   Maximum number of worker threads
+ */
+#define BLE_ADV_PIPELINE_WORKERS_MAX        64
+
+/**
+ * @brief   Size of the blocks handed to the workers
+ */
+#define BLE_ADV_PIPELINE_BLOCK_SIZE         (16 * 1024)
+
+/**
+ * @brief   Number of blocks per worker
+ */
+#define BLE_ADV_PIPELINE_BLOCKS_PER_WORKER  8
+
+/**
+ * @brief   Function called by a worker for each decoded advertisement
+ *
+ * @param[in]       worker      Index of the worker calling, less than the number of workers
+ * @param[in]       adv         The decoded advertisement
+ * @param[in]       sensor      The decoded sensor data, or `NULL` if no decoder matched
+ * @param[in]       ctx         Context pointer as passed to @ref ble_adv_pipeline_init
+ */
+typedef void (*ble_adv_pipeline_cb_t)(unsigned worker, const struct ble_adv *adv,
+                                      const struct ble_adv_sensor *sensor, void *ctx);
+
+struct ble_adv_pipeline;
+
+/**
+ * @brief   State of a worker
+ *
+ * @note    This is private, only exposed to allow allocating @ref ble_adv_pipeline
+ */
+struct ble_adv_pipeline_worker {
+    struct ble_adv_ring ring;           /**< Blocks to process, `NULL` requests to exit */
+    struct ble_adv_pipeline *pipe;      /**< Pipeline the worker belongs to */
+    struct ble_adv_block *block;        /**< Block being filled by the ingest thread */
+    pthread_t thread;                   /**< The worker thread */
+    atomic_uint_fast64_t processed;     /**< Number of advertisements decoded */
+    atomic_uint_fast64_t invalid;       /**< Number of advertisements failing to decode */
+    unsigned idx;                       /**< Index of the worker */
+};
+
+/**
+ * @brief   Pipeline state
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_pipeline {
+    struct ble_adv_pool pool;                   /**< Blocks shared by all workers */
+    struct ble_adv_pipeline_worker *workers;    /**< The workers */
+    ble_adv_pipeline_cb_t cb;                   /**< Called for each advertisement */
+    void *ctx;                                  /**< Passed to @ref ble_adv_pipeline::cb */
+    uint64_t submitted;                         /**< Number of advertisements submitted */
+    unsigned num_workers;                       /**< Number of workers */
+    unsigned parse_flags;                       /**< Parse flags the workers decode with */
+};
+
+/**
+ * @brief   Counters of a pipeline
+ */
+struct ble_adv_pipeline_stats {
+    uint64_t submitted;         /**< Number of advertisements submitted */
+    uint64_t processed;         /**< Number of advertisements decoded by all workers */
+    uint64_t invalid;           /**< Number of advertisements failing to decode */
+};
+
+/**
+ * @brief   Initialize the pipeline and start the workers
+ *
+ * @param[out]      pipe        Pipeline to initialize
+ * @param[in]       num_workers Number of worker threads, at most
+ *                              @ref BLE_ADV_PIPELINE_WORKERS_MAX
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ * @param[in]       cb          Function to call for each decoded advertisement
+ * @param[in]       ctx         Context pointer to pass to @p cb
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    This allocates @ref BLE_ADV_PIPELINE_BLOCKS_PER_WORKER blocks of
+ *          @ref BLE_ADV_PIPELINE_BLOCK_SIZE bytes per worker
+ */
+int ble_adv_pipeline_init(struct ble_adv_pipeline *pipe, unsigned num_workers,
+                          unsigned parse_flags, ble_adv_pipeline_cb_t cb, void *ctx);
+
+/**
+ * @brief   Process all pending advertisements, stop the workers and free all memory
+ *
+ * @param[in,out]   pipe        Pipeline to destroy
+ */
+void ble_adv_pipeline_destroy(struct ble_adv_pipeline *pipe);
+
+/**
+ * @brief   Submit a raw HCI event
+ *
+ * @param[in,out]   pipe        Pipeline to submit to
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ * @param[in]       timestamp_us    Value of @ref ble_adv::timestamp_us of the advertisements
+ * @param[in]       adapter     Value of @ref ble_adv::adapter of the advertisements
+ *
+ * @return  Number of advertisements submitted
+ * @retval -1                   Failure and errno set to indicate the cause, as for
+ *                              @ref ble_adv_event_views. Nothing was submitted then.
+ *
+ * An event is always submitted as a whole: if all blocks are in use, this waits for the
+ * workers to return one instead of failing.
+ *
+ * @warning Only a single thread may submit to and flush a pipeline
+ */
+int ble_adv_pipeline_submit(struct ble_adv_pipeline *pipe, const void *buf, size_t len,
+                            uint64_t timestamp_us, uint8_t adapter);
+
+/**
+ * @brief   Hand all partially filled blocks to the workers
+ *
+ * @param[in,out]   pipe        Pipeline to flush
+ */
+void ble_adv_pipeline_flush(struct ble_adv_pipeline *pipe);
+
+/**
+ * @brief   Flush and wait until the workers processed all submitted advertisements
+ *
+ * @param[in,out]   pipe        Pipeline to wait for
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_pipeline_sync(struct ble_adv_pipeline *pipe);
+
+/**
+ * @brief   Get the counters of the pipeline
+ *
+ * @param[in]       pipe        Pipeline to get the counters of
+ * @param[out]      dest        Write the counters here
+ */
+void ble_adv_pipeline_stats(const struct ble_adv_pipeline *pipe,
+                            struct ble_adv_pipeline_stats *dest);
+
+/** @} */
+#endif /* BLE_ADV_PIPELINE_H */
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_POOL_H
+#define BLE_ADV_POOL_H
+
+#include "ble_adv.h"
+#include "ble_adv_ring.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_pool    Pool of reference counted blocks for received advertisements
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Store advertisements of any length without calling malloc on the hot path
+ * @file
+ *
+ * All memory of a pool is allocated once by @ref ble_adv_pool_init, so the memory use is
+ * bounded by the configured number and size of the blocks. A producer takes a block from the
+ * pool and appends variable length @ref ble_adv_record to it until it is full. Each record
+ * holds a reference to its block. Once the producer and all consumers dropped their
+ * references, the block returns to the pool.
+ *
+ * To hand records to consumer threads without copying, push pointers to them into a
+ * @ref ble_adv_ring with an element size of `sizeof(struct ble_adv_record *)`. The consumer
+ * calls @ref ble_adv_record_release (or @ref ble_adv_records_release for a batch) when done.
+ *
+ * Taking and returning blocks is thread-safe and lock-free. Appending to a block is only
+ * allowed for the thread that took it from the pool.
+ */
+
+/**
+ * @brief   Minimum size of a block, sufficient for one record of a legacy advertisement
+ */
+#define BLE_ADV_POOL_BLOCK_MIN              256
+
+struct ble_adv_pool;
+
+/**
+ * @brief   A block of memory holding records
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_block {
+    struct ble_adv_pool *pool;          /**< Pool the block belongs to */
+    atomic_uint refs;                   /**< Number of references */
+    uint32_t used;                      /**< Bytes in @ref ble_adv_block::data in use */
+    uint32_t size;                      /**< Size of @ref ble_adv_block::data in bytes */
+    alignas(max_align_t) unsigned char data[];  /**< Storage of the records */
+};
+
+/**
+ * @brief   A received advertisement stored in a block
+ */
+struct ble_adv_record {
+    struct ble_adv_block *block;        /**< Block holding the record */
+    uint64_t timestamp_us;              /**< As in @ref ble_adv::timestamp_us */
+    struct ble_adv_view view;           /**< View of the advertisement pointing into
+                                             the record */
+    uint8_t adapter;                    /**< As in @ref ble_adv::adapter */
+    uint8_t bdaddr[6];                  /**< Storage of @ref ble_adv_view::bdaddr */
+    uint8_t eir[];                      /**< Storage of @ref ble_adv_view::eir */
+};
+
+/**
+ * @brief   A bounded pool of blocks
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_pool {
+    struct ble_adv_ring free;           /**< Blocks available */
+    unsigned char *mem;                 /**< Storage of all blocks */
+    size_t block_size;                  /**< Size of a block including its header */
+    size_t num_blocks;                  /**< Number of blocks */
+};
+
+/**
+ * @brief   Initialize a pool
+ *
+ * @param[out]      pool        Pool to initialize
+ * @param[in]       block_size  Size of each block in bytes, at least
+ *                              @ref BLE_ADV_POOL_BLOCK_MIN. Rounded up to a cache line.
+ * @param[in]       num_blocks  Number of blocks
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    E.g. 1024 blocks of 16 KiB limit the pool to 16 MiB, enough for about 200000 legacy
+ *          advertisements in flight
+ */
+int ble_adv_pool_init(struct ble_adv_pool *pool, size_t block_size, size_t num_blocks);
+
+/**
+ * @brief   Free the storage of the pool
+ *
+ * @param[in,out]   pool        Pool to destroy
+ *
+ * @pre     All blocks have been released
+ */
+void ble_adv_pool_destroy(struct ble_adv_pool *pool);
+
+/**
+ * @brief   Take an empty block from the pool
+ *
+ * @param[in,out]   pool        Pool to take the block from
+ *
+ * @return  The block, holding one reference owned by the caller
+ * @retval  NULL                The pool is exhausted, errno is `ENOBUFS`
+ */
+struct ble_adv_block *ble_adv_pool_get(struct ble_adv_pool *pool);
+
+/**
+ * @brief   Take an empty block from the pool, waiting for one to be released if exhausted
+ *
+ * @param[in,out]   pool        Pool to take the block from
+ * @param[in]       timeout_ms  Maximum time to wait in milliseconds, -1 to wait forever
+ *
+ * @return  The block, holding one reference owned by the caller
+ * @retval  NULL                Failure and errno set to indicate the cause, `EAGAIN` on timeout
+ */
+struct ble_adv_block *ble_adv_pool_get_wait(struct ble_adv_pool *pool, int timeout_ms);
+
+/**
+ * @brief   Append a record to a block
+ *
+ * @param[in,out]   block       Block to append to
+ * @param[in]       view        Advertisement to copy into the record
+ * @param[in]       adapter     Value of @ref ble_adv_record::adapter
+ * @param[in]       timestamp_us    Value of @ref ble_adv_record::timestamp_us
+ *
+ * @return  The record, holding a reference to @p block
+ * @retval  NULL                The record does not fit, errno is `ENOSPC`
+ */
+struct ble_adv_record *ble_adv_block_add(struct ble_adv_block *block,
+                                         const struct ble_adv_view *view, uint8_t adapter,
+                                         uint64_t timestamp_us);
+
+/**
+ * @brief   Iterate over the records of a block in the order they were added
+ *
+ * @param[in]       block       Block to iterate over
+ * @param[in]       prev        Record returned by the previous call, or `NULL` to get the first
+ *
+ * @return  The record following @p prev
+ * @retval  NULL                No more records
+ *
+ * @note    This does not take references, the caller has to hold one to @p block
+ */
+struct ble_adv_record *ble_adv_block_next(struct ble_adv_block *block,
+                                          const struct ble_adv_record *prev);
+
+/**
+ * @brief   Drop a reference to a block, returning it to its pool on the last one
+ *
+ * @param[in,out]   block       Block to release
+ */
+void ble_adv_block_release(struct ble_adv_block *block);
+
+/**
+ * @brief   Drop the reference a record holds to its block
+ *
+ * @param[in]       record      Record to release, invalid afterwards
+ */
+static inline void ble_adv_record_release(struct ble_adv_record *record)
+{
+    ble_adv_block_release(record->block);
+}
+
+/**
+ * @brief   Release a batch of records
+ *
+ * @param[in]       records     Records to release
+ * @param[in]       num         Number of entries in @p records
+ *
+ * Consecutive records of the same block are released with a single atomic operation.
+ */
+void ble_adv_records_release(struct ble_adv_record *const *records, size_t num);
+
+/**
+ * @brief   Receive advertisements into records
+ *
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in,out]   pool        Pool to take blocks from
+ * @param[in,out]   block       Block to append to. If `NULL` or full, the reference held
+ *                              is dropped and a new block is taken from @p pool. Release it
+ *                              when done reading.
+ * @param[out]      dest        Write pointers to the records here
+ * @param[in]       max         Number of entries in @p dest
+ * @param[in]       adapter     Value of @ref ble_adv_record::adapter
+ *
+ * @return  Number of records written to @p dest, each holding a reference to its block
+ * @retval  -1                  Failure and errno set to indicate the cause
+ *
+ * Only as many HCI events are consumed as @p dest can hold, as for @ref ble_adv_read_many.
+ * Advertisements not fitting into @p dest or for which the pool has no more blocks are dropped
+ * and accounted for in @ref BLE_ADV_STATS_DROP_SPACE and @ref BLE_ADV_STATS_DROP_POOL.
+ *
+ * @note    The same notes as for @ref ble_adv_read regarding `EINTR`, `EAGAIN` and
+ *          `EWOULDBLOCK` apply.
+ */
+int ble_adv_pool_read(int dev, struct ble_adv_pool *pool, struct ble_adv_block **block,
+                      struct ble_adv_record **dest, size_t max, uint8_t adapter);
+
+/** @} */
+#endif /* BLE_ADV_POOL_H */
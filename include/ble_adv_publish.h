@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_PUBLISH_H
+#define BLE_ADV_PUBLISH_H
+
+#include "ble_adv.h"
+#include "ble_adv_agg.h"
+#include "ble_adv_decode.h"
+#include "ble_adv_output.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * @defgroup    ble_adv_publish     Batching publisher for UDP and MQTT
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Send records to a collector in batches instead of one message per advertisement
+ * @file
+ *
+ * Records are formatted as by @ref ble_adv_output and packed into batches. A batch is sent
+ * as a single UDP datagram of at most @ref BLE_ADV_PUBLISH_UDP_PAYLOAD bytes, or as the
+ * payload of a single MQTT PUBLISH (QoS 0) of at most @ref BLE_ADV_PUBLISH_MQTT_PAYLOAD bytes.
+ * A batch is closed when the next record does not fit, or when its oldest record is older
+ * than the flush interval.
+ *
+ * Closed batches wait in a bounded queue until the socket accepts them, are retried when
+ * sending fails temporarily, and are kept across reconnects to the MQTT broker. Nothing ever
+ * blocks: if the queue is full, adding a record fails with `EAGAIN`. Consumers of a
+ * @ref ble_adv_ring should check @ref ble_adv_publish_ready before popping, so that the
+ * ring (and not the HCI socket) absorbs a slow network, dropping according to its overflow
+ * policy.
+ *
+ * The URL is either `udp://HOST:PORT` or `mqtt://HOST[:PORT]/TOPIC`, the host name is
+ * resolved once during @ref ble_adv_publish_init.
+ */
+
+/**
+ * @name    Transports
+ * @{
+ */
+#define BLE_ADV_PUBLISH_UDP                 0   /**< One datagram per batch */
+#define BLE_ADV_PUBLISH_MQTT                1   /**< One MQTT 3.1.1 PUBLISH per batch */
+/** @} */
+
+/**
+ * @brief   Maximum payload of a UDP datagram, leaves room for IPv6 and a tunnel in 1500 bytes
+ */
+#define BLE_ADV_PUBLISH_UDP_PAYLOAD         1400
+
+/**
+ * @brief   Maximum payload of an MQTT message
+ */
+#define BLE_ADV_PUBLISH_MQTT_PAYLOAD        8192
+
+/**
+ * @brief   Default number of batches that can be queued
+ */
+#define BLE_ADV_PUBLISH_QUEUE_LEN           32
+
+/**
+ * @brief   Maximum length of an MQTT topic
+ */
+#define BLE_ADV_PUBLISH_TOPIC_MAX           128
+
+/**
+ * @brief   MQTT keep alive interval in seconds
+ */
+#define BLE_ADV_PUBLISH_KEEPALIVE_S         60
+
+/**
+ * @brief   A queued batch
+ *
+ * @note    This is private, only exposed to allow allocating @ref ble_adv_publish
+ */
+struct ble_adv_publish_slot {
+    uint32_t off;               /**< Offset of the message in the slot */
+    uint32_t len;               /**< Length of the message (including MQTT header) */
+    uint32_t records;           /**< Number of records in the batch */
+};
+
+/**
+ * @brief   Counters of a publisher
+ */
+struct ble_adv_publish_stats {
+    uint64_t records;           /**< Records accepted */
+    uint64_t batches;           /**< Batches sent */
+    uint64_t bytes;             /**< Bytes sent, including MQTT headers */
+    uint64_t rejected;          /**< Records rejected, as the queue was full */
+    uint64_t dropped;           /**< Records dropped, as sending their batch failed
+                                     permanently */
+    uint64_t retries;           /**< Failed attempts to send a batch that were retried */
+    uint64_t connects;          /**< Connections established to the MQTT broker */
+};
+
+/**
+ * @brief   Publisher state
+ *
+ * @note    The contents are private, use @ref ble_adv_publish_stats to get the counters
+ */
+struct ble_adv_publish {
+    struct ble_adv_publish_slot *slots; /**< The batches, the one after the queued ones is
+                                             being filled */
+    uint8_t *mem;                       /**< Storage of the batches */
+    size_t slot_size;                   /**< Size of the storage of a batch */
+    size_t hdr_room;                    /**< Room for the MQTT header in front of a batch */
+    size_t payload_max;                 /**< Maximum payload of a batch */
+    size_t num_slots;                   /**< Number of slots */
+    size_t head;                        /**< First queued slot */
+    size_t queued;                      /**< Number of queued slots */
+    size_t sent;                        /**< Bytes of the first queued batch already sent */
+    size_t fill_len;                    /**< Payload bytes in the batch being filled */
+    uint64_t fill_since_ms;             /**< Time the first record was added to it */
+    uint64_t flush_ms;                  /**< Maximum age of a batch in ms, 0 to disable */
+    uint64_t next_connect_ms;           /**< Time to try reconnecting */
+    uint64_t backoff_ms;                /**< Current delay between connection attempts */
+    uint64_t last_tx_ms;                /**< Time something was last sent */
+    uint64_t ping_since_ms;             /**< Time the pending ping was sent, or 0 */
+    struct ble_adv_publish_stats stats; /**< Counters */
+    struct sockaddr_storage addr;       /**< Address of the collector */
+    socklen_t addr_len;                 /**< Length of @ref ble_adv_publish::addr */
+    int fd;                             /**< Socket, -1 if disconnected */
+    unsigned transport;                 /**< e.g. @ref BLE_ADV_PUBLISH_MQTT */
+    unsigned format;                    /**< e.g. @ref BLE_ADV_OUTPUT_NDJSON */
+    unsigned state;                     /**< State of the MQTT connection */
+    uint8_t ctrl[64];                   /**< MQTT control packet being sent */
+    uint8_t ctrl_len;                   /**< Length of @ref ble_adv_publish::ctrl */
+    uint8_t ctrl_sent;                  /**< Bytes of @ref ble_adv_publish::ctrl sent */
+    uint8_t in[64];                     /**< Received data not yet parsed */
+    uint8_t in_len;                     /**< Bytes in @ref ble_adv_publish::in */
+    size_t in_skip;                     /**< Bytes of an unexpected packet still to skip */
+    char topic[BLE_ADV_PUBLISH_TOPIC_MAX];  /**< MQTT topic */
+    size_t topic_len;                   /**< Length of @ref ble_adv_publish::topic */
+};
+
+/**
+ * @brief   Initialize the publisher
+ *
+ * @param[out]      pub         Publisher to initialize
+ * @param[in]       url         Where to publish to, e.g. `"mqtt://broker/ble/readings"`
+ * @param[in]       format      Format of the records, e.g. @ref BLE_ADV_OUTPUT_NDJSON
+ * @param[in]       queue_len   Number of batches to queue, 0 for
+ *                              @ref BLE_ADV_PUBLISH_QUEUE_LEN
+ * @param[in]       flush_ms    Maximum time in ms a record is held back, 0 to only send full
+ *                              batches
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EINVAL` for a
+ *                              malformed URL and `EHOSTUNREACH` if the host name could not be
+ *                              resolved
+ *
+ * The connection to an MQTT broker is established (and re-established) by
+ * @ref ble_adv_publish_run.
+ */
+int ble_adv_publish_init(struct ble_adv_publish *pub, const char *url, unsigned format,
+                         size_t queue_len, uint64_t flush_ms);
+
+/**
+ * @brief   Try to send the pending batches once, then close the socket and free all memory
+ *
+ * @param[in,out]   pub         Publisher to destroy
+ */
+void ble_adv_publish_destroy(struct ble_adv_publish *pub);
+
+/**
+ * @brief   Add an advertisement
+ *
+ * @param[in,out]   pub         Publisher to add to
+ * @param[in]       adv         Advertisement to publish
+ *
+ * @retval  0                   Success
+ * @retval -1                   The queue is full and errno is `EAGAIN`, the record was not
+ *                              added
+ */
+int ble_adv_publish_adv(struct ble_adv_publish *pub, const struct ble_adv *adv);
+
+/**
+ * @brief   Add decoded sensor data
+ *
+ * @param[in,out]   pub         Publisher to add to
+ * @param[in]       adv         Advertisement the data was decoded from
+ * @param[in]       sensor      Decoded data to publish
+ *
+ * @retval  0                   Success
+ * @retval -1                   As for @ref ble_adv_publish_adv
+ */
+int ble_adv_publish_sensor(struct ble_adv_publish *pub, const struct ble_adv *adv,
+                           const struct ble_adv_sensor *sensor);
+
+/**
+ * @brief   Add a closed aggregation window
+ *
+ * @param[in,out]   pub         Publisher to add to
+ * @param[in]       record      Aggregate to publish
+ *
+ * @retval  0                   Success
+ * @retval -1                   As for @ref ble_adv_publish_adv
+ */
+int ble_adv_publish_agg(struct ble_adv_publish *pub, const struct ble_adv_agg_record *record);
+
+/**
+ * @brief   Check if the next record will be accepted
+ *
+ * @param[in]       pub         Publisher to check
+ *
+ * @retval  1                   The next record will be accepted
+ * @retval  0                   Adding a record may fail with `EAGAIN`
+ */
+int ble_adv_publish_ready(const struct ble_adv_publish *pub);
+
+/**
+ * @brief   Close the batch being filled, so that it is sent by the next
+ *          @ref ble_adv_publish_run
+ *
+ * @param[in,out]   pub         Publisher to flush
+ *
+ * @retval  0                   Success or nothing to do
+ * @retval -1                   The queue is full and errno is `EAGAIN`
+ */
+int ble_adv_publish_flush(struct ble_adv_publish *pub);
+
+/**
+ * @brief   Do the pending work without blocking
+ *
+ * @param[in,out]   pub         Publisher to run
+ *
+ * This closes batches older than the flush interval, sends queued batches as far as the socket
+ * accepts them, and maintains the connection to the MQTT broker. Call this whenever the socket
+ * (see @ref ble_adv_publish_pollfd) is ready, and at least once per second.
+ */
+void ble_adv_publish_run(struct ble_adv_publish *pub);
+
+/**
+ * @brief   Get the socket and the events to wait for
+ *
+ * @param[in]       pub         Publisher to poll
+ * @param[out]      events      Events to pass to `poll()`, e.g. `POLLOUT` while batches are
+ *                              queued
+ *
+ * @return  The socket, or -1 while disconnected (which `poll()` ignores)
+ */
+int ble_adv_publish_pollfd(const struct ble_adv_publish *pub, short *events);
+
+/**
+ * @brief   Get the counters of the publisher
+ *
+ * @param[in]       pub         Publisher to get the counters of
+ * @param[out]      dest        Write the counters here
+ */
+void ble_adv_publish_stats(const struct ble_adv_publish *pub,
+                           struct ble_adv_publish_stats *dest);
+
+/** @} */
+#endif /* BLE_ADV_PUBLISH_H */
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_READER_H
+#define BLE_ADV_READER_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+
+/**
+ * @defgroup    ble_adv_reader  Non-blocking reader for integration into event loops
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Drain pending advertisements into a callback when the HCI socket becomes readable
+ * @file
+ *
+ * Register the descriptor returned by @ref ble_adv_reader_fd for readability with `poll()`,
+ * `epoll` or `io_uring` and call @ref ble_adv_reader_dispatch whenever it is readable:
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * static struct ble_adv_reader reader;
+ * ble_adv_reader_init(&reader, dev, 0, handle_adv, NULL);
+ * struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &reader };
+ * epoll_ctl(epfd, EPOLL_CTL_ADD, ble_adv_reader_fd(&reader), &ev);
+ * ...
+ * // on EPOLLIN
+ * ble_adv_reader_dispatch(&reader);
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+
+/**
+ * @brief   Number of advertisements decoded per syscall
+ *
+ * Room for four HCI events per syscall, even if each carries @ref BLE_ADV_REPORTS_MAX reports
+ */
+#define BLE_ADV_READER_BATCH                (4 * BLE_ADV_REPORTS_MAX)
+
+/**
+ * @brief   Maximum number of HCI events consumed by a single call to
+ *          @ref ble_adv_reader_dispatch
+ *
+ * This bounds the time spent in @ref ble_adv_reader_dispatch, so that other event sources
+ * are not starved under heavy load.
+ */
+#define BLE_ADV_READER_BUDGET               256
+
+/**
+ * @brief   Signature of the callback receiving the advertisements
+ *
+ * @param[in]       adv         The received advertisement, only valid during the call
+ * @param[in]       ctx         Context pointer passed to @ref ble_adv_reader_init
+ */
+typedef void (*ble_adv_reader_cb_t)(const struct ble_adv *adv, void *ctx);
+
+/**
+ * @brief   Non-blocking advertisement reader
+ *
+ * @note    The contents are private. This is about 17 KiB in size due to the batch buffer, so
+ *          better not place it on a small stack.
+ */
+struct ble_adv_reader {
+    struct ble_adv batch[BLE_ADV_READER_BATCH]; /**< Buffer to decode into */
+    ble_adv_reader_cb_t cb;                     /**< Callback to pass advertisements to */
+    void *ctx;                                  /**< Context to pass to the callback */
+    int dev;                                    /**< Descriptor of the HCI interface */
+    int err;                                    /**< Error to report on the next call, or 0 */
+    unsigned parse_flags;                       /**< Parse flags to decode with */
+};
+
+/**
+ * @brief   Initialize the reader and switch the HCI descriptor to non-blocking mode
+ *
+ * @param[out]      reader      Reader to initialize
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ * @param[in]       cb          Callback to pass the advertisements to
+ * @param[in]       ctx         Context to pass to @p cb
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_reader_init(struct ble_adv_reader *reader, int dev, unsigned parse_flags,
+                        ble_adv_reader_cb_t cb, void *ctx);
+
+/**
+ * @brief   Get the descriptor to wait for readability on
+ *
+ * @param[in]       reader      Reader to get the descriptor of
+ *
+ * @return  The HCI descriptor
+ */
+static inline int ble_adv_reader_fd(const struct ble_adv_reader *reader)
+{
+    return reader->dev;
+}
+
+/**
+ * @brief   Pass all pending advertisements to the callback
+ *
+ * @param[in,out]   reader      Reader to dispatch
+ *
+ * @return  Number of advertisements passed to the callback
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * This reads until no more events are pending or @ref BLE_ADV_READER_BUDGET events have been
+ * consumed. In the latter case the descriptor is still readable, which with edge triggered
+ * `epoll` requires calling this function again.
+ *
+ * If reading fails after advertisements were already passed to the callback, their number is
+ * returned and the failure is reported by the next call.
+ */
+int ble_adv_reader_dispatch(struct ble_adv_reader *reader);
+
+/** @} */
+#endif /* BLE_ADV_READER_H */
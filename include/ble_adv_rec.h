@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_REC_H
+#define BLE_ADV_REC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_rec     Recording and replay of raw HCI events
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Record raw HCI events to a compact file and replay them faster than real time
+ * @file
+ *
+ * A recording starts with a 16 byte file header, followed by blocks. Each block consists of a
+ * 16 byte block header and up to @ref BLE_ADV_REC_BLOCK_SIZE bytes of records, compressed
+ * with a small LZ77 variant (stored uncompressed if that does not pay off). Each record is a
+ * 12 byte header holding the timestamp, the adapter and the length, followed by the raw HCI
+ * event as returned by @ref ble_adv_read_event. All integers are little endian.
+ *
+ * The reader maps the file into memory and decompresses one block at a time into a buffer
+ * allocated on open, so that replaying does not allocate and does no syscall per event. Pass
+ * the events to @ref ble_adv_parse_event (or @ref ble_adv_event_views) to decode them.
+ */
+
+/**
+ * @brief   Size of the uncompressed records in a block
+ */
+#define BLE_ADV_REC_BLOCK_SIZE              (64U * 1024U)
+
+/**
+ * @brief   Maximum length of a recorded HCI event
+ */
+#define BLE_ADV_REC_EVENT_MAX               4096
+
+/**
+ * @brief   A recorded HCI event
+ */
+struct ble_adv_rec_event {
+    uint64_t timestamp_us;      /**< Timestamp in µs since the epoch, as
+                                     @ref ble_adv::timestamp_us */
+    const uint8_t *buf;         /**< The raw HCI event */
+    uint16_t len;               /**< Length of @ref ble_adv_rec_event::buf in bytes */
+    uint8_t adapter;            /**< ID of the adapter the event was received on */
+};
+
+/**
+ * @brief   State of a recording being written
+ *
+ * @note    The contents are private, use the functions below to access it
+ */
+struct ble_adv_rec_writer {
+    uint8_t *raw;               /**< Records of the current block */
+    uint8_t *comp;              /**< Buffer for the compressed block */
+    uint32_t *hash;             /**< Hash table of the compressor */
+    size_t raw_len;             /**< Bytes in @ref ble_adv_rec_writer::raw */
+    uint32_t num_records;       /**< Records in @ref ble_adv_rec_writer::raw */
+    int fd;                     /**< File descriptor of the recording */
+};
+
+/**
+ * @brief   State of a recording being replayed
+ *
+ * @note    The contents are private, use the functions below to access it
+ */
+struct ble_adv_rec_reader {
+    const uint8_t *map;         /**< The memory mapped recording */
+    size_t map_len;             /**< Size of the recording in bytes */
+    size_t next_block;          /**< Offset of the next block in the recording */
+    uint8_t *block;             /**< Buffer holding the decompressed block */
+    const uint8_t *records;     /**< Records of the current block */
+    size_t records_len;         /**< Bytes in @ref ble_adv_rec_reader::records */
+    size_t pos;                 /**< Offset of the next record in the current block */
+};
+
+/**
+ * @brief   Create a new recording, truncating the file if it exists
+ *
+ * @param[out]      w           Writer to initialize
+ * @param[in]       path        Path of the file to write
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_rec_open(struct ble_adv_rec_writer *w, const char *path);
+
+/**
+ * @brief   Append a raw HCI event to a recording
+ *
+ * @param[in,out]   w           Writer to append to
+ * @param[in]       timestamp_us    Kernel receive timestamp in µs since the epoch, e.g. as
+ *                                  obtained by @ref ble_adv_read_event, or 0 if none
+ * @param[in]       adapter     ID of the adapter the event was received on
+ * @param[in]       buf         HCI event as obtained by @ref ble_adv_read_event
+ * @param[in]       len         Length of @p buf in bytes
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    Events are buffered and only written when a block is full, or on
+ *          @ref ble_adv_rec_flush and @ref ble_adv_rec_close
+ */
+int ble_adv_rec_append(struct ble_adv_rec_writer *w, uint64_t timestamp_us, uint8_t adapter,
+                       const void *buf, size_t len);
+
+/**
+ * @brief   Write buffered events as a (short) block to the file
+ *
+ * @param[in,out]   w           Writer to flush
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ */
+int ble_adv_rec_flush(struct ble_adv_rec_writer *w);
+
+/**
+ * @brief   Flush buffered events and close the recording
+ *
+ * @param[in,out]   w           Writer to close
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, the writer is
+ *                              closed regardless
+ */
+int ble_adv_rec_close(struct ble_adv_rec_writer *w);
+
+/**
+ * @brief   Open a recording for replay
+ *
+ * @param[out]      r           Reader to initialize
+ * @param[in]       path        Path of the recording
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EBADMSG` if
+ *                              the file is no recording
+ */
+int ble_adv_rec_reader_open(struct ble_adv_rec_reader *r, const char *path);
+
+/**
+ * @brief   Close a recording opened with @ref ble_adv_rec_reader_open
+ *
+ * @param[in,out]   r           Reader to close
+ */
+void ble_adv_rec_reader_close(struct ble_adv_rec_reader *r);
+
+/**
+ * @brief   Get the next event of the recording
+ *
+ * @param[in,out]   r           Reader to read from
+ * @param[out]      ev          Write the event here
+ *
+ * @retval  1                   Success, @p ev has been written
+ * @retval  0                   End of the recording reached
+ * @retval -1                   Failure and errno set to indicate the cause, `EBADMSG` if the
+ *                              recording is corrupted
+ *
+ * @warning @ref ble_adv_rec_event::buf is only valid until the next call of this function
+ */
+int ble_adv_rec_next(struct ble_adv_rec_reader *r, struct ble_adv_rec_event *ev);
+
+/**
+ * @brief   Restart the replay at the first event
+ *
+ * @param[in,out]   r           Reader to rewind
+ */
+void ble_adv_rec_rewind(struct ble_adv_rec_reader *r);
+
+/** @} */
+#endif /* BLE_ADV_REC_H */
@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_RING_H
+#define BLE_ADV_RING_H
+
+#include "ble_adv.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_ring    Lock-free ring buffer and reader thread
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Hand advertisements from an HCI reader thread to consumer threads without locks
+ * @file
+ *
+ * The ring is a bounded multi-producer multi-consumer queue with a sequence number per cell
+ * (as described by Dmitry Vyukov). A single reader thread per adapter pushes into it, so one
+ * ring can aggregate several adapters, too. Any number of consumer threads can pop from it.
+ *
+ * If the ring is full, either the newest element (the one to push) or the oldest element in
+ * the ring is dropped, depending on the overflow policy. Pushing never blocks, so that a slow
+ * consumer does not stall draining the HCI socket.
+ */
+
+/**
+ * @brief   Size of a cache line, used to pad the indices to avoid false sharing
+ */
+#define BLE_ADV_CACHE_LINE                  64
+
+/**
+ * @name    Overflow policies
+ * @{
+ */
+#define BLE_ADV_RING_DROP_NEWEST            0   /**< Drop the element to push when full */
+#define BLE_ADV_RING_DROP_OLDEST            1   /**< Drop the oldest element when full */
+/** @} */
+
+/**
+ * @brief   A lock-free ring buffer of fixed size elements
+ *
+ * @note    The contents are private, use @ref ble_adv_ring_stats to get the counters
+ */
+struct ble_adv_ring {
+    _Alignas(BLE_ADV_CACHE_LINE) atomic_size_t head;    /**< Next position to push to */
+    _Alignas(BLE_ADV_CACHE_LINE) atomic_size_t tail;    /**< Next position to pop from */
+    _Alignas(BLE_ADV_CACHE_LINE) atomic_uint_fast64_t dropped_newest;   /**< Counter */
+    atomic_uint_fast64_t dropped_oldest;                /**< Counter */
+    atomic_uint waiters;                                /**< Consumers blocked in
+                                                             @ref ble_adv_ring_pop_wait */
+    _Alignas(BLE_ADV_CACHE_LINE) unsigned char *cells;  /**< Storage */
+    size_t mask;                                        /**< Capacity - 1 */
+    size_t elem_size;                                   /**< Size of an element */
+    size_t cell_size;                                   /**< Size of a cell */
+    unsigned policy;                                    /**< Overflow policy */
+    int efd;                                            /**< eventfd to wake up waiters */
+};
+
+/**
+ * @brief   Counters of a ring buffer
+ */
+struct ble_adv_ring_stats {
+    uint64_t pushed;            /**< Number of elements pushed */
+    uint64_t popped;            /**< Number of elements popped (including dropped oldest) */
+    uint64_t dropped_newest;    /**< Number of elements dropped when pushing into a full ring */
+    uint64_t dropped_oldest;    /**< Number of elements dropped from a full ring to make space */
+};
+
+/**
+ * @brief   A reader thread draining an HCI socket into a ring buffer
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_ring_thread {
+    pthread_t thread;                   /**< The reader thread */
+    struct ble_adv_ring *ring;          /**< Ring to push to */
+    atomic_int stop;                    /**< Set to request the thread to exit */
+    int dev;                            /**< Descriptor of the HCI interface */
+    int err;                            /**< errno of the failure terminating the thread */
+    uint8_t adapter;                    /**< Value to set @ref ble_adv::adapter to */
+    unsigned parse_flags;               /**< Parse flags to decode with */
+};
+
+/**
+ * @brief   Initialize a ring buffer
+ *
+ * @param[out]      ring        Ring to initialize
+ * @param[in]       capacity    Number of elements, must be a power of two
+ * @param[in]       elem_size   Size of each element, e.g. `sizeof(struct ble_adv)`
+ * @param[in]       policy      Overflow policy, e.g. @ref BLE_ADV_RING_DROP_OLDEST
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    The storage is allocated here once, pushing and popping never allocates
+ */
+int ble_adv_ring_init(struct ble_adv_ring *ring, size_t capacity, size_t elem_size,
+                      unsigned policy);
+
+/**
+ * @brief   Free the storage of the ring buffer
+ *
+ * @param[in,out]   ring        Ring to destroy
+ */
+void ble_adv_ring_destroy(struct ble_adv_ring *ring);
+
+/**
+ * @brief   Push an element into the ring, thread-safe and lock-free
+ *
+ * @param[in,out]   ring        Ring to push to
+ * @param[in]       elem        Element to copy into the ring
+ *
+ * @retval  0                   Success
+ * @retval -1                   The ring was full and @p elem was dropped, errno is `ENOBUFS`
+ *
+ * @note    This does not wake up consumers blocked in @ref ble_adv_ring_pop_wait, call
+ *          @ref ble_adv_ring_notify after pushing a batch
+ */
+int ble_adv_ring_push(struct ble_adv_ring *ring, const void *elem);
+
+/**
+ * @brief   Pop an element from the ring, thread-safe and lock-free
+ *
+ * @param[in,out]   ring        Ring to pop from
+ * @param[out]      elem        Write the element here, may be `NULL` to discard it
+ *
+ * @retval  0                   Success
+ * @retval -1                   The ring was empty, errno is `EAGAIN`
+ */
+int ble_adv_ring_pop(struct ble_adv_ring *ring, void *elem);
+
+/**
+ * @brief   Pop an element from the ring, waiting if it is empty
+ *
+ * @param[in,out]   ring        Ring to pop from
+ * @param[out]      elem        Write the element here
+ * @param[in]       timeout_ms  Maximum time to wait in milliseconds, -1 to wait forever
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EAGAIN` on timeout
+ */
+int ble_adv_ring_pop_wait(struct ble_adv_ring *ring, void *elem, int timeout_ms);
+
+/**
+ * @brief   Wake up consumers waiting in @ref ble_adv_ring_pop_wait, if any
+ *
+ * @param[in,out]   ring        Ring to notify the consumers of
+ *
+ * This costs a syscall only if a consumer is actually waiting.
+ */
+void ble_adv_ring_notify(struct ble_adv_ring *ring);
+
+/**
+ * @brief   Get the counters of the ring
+ *
+ * @param[in]       ring        Ring to get the counters of
+ * @param[out]      dest        Write the counters here
+ */
+void ble_adv_ring_stats(const struct ble_adv_ring *ring, struct ble_adv_ring_stats *dest);
+
+/**
+ * @brief   Start a thread pushing all received advertisements into @p ring
+ *
+ * @param[out]      thread      Thread state to initialize
+ * @param[in]       dev         Descriptor of the HCI interface, will be set to non-blocking
+ * @param[in]       adapter     Value to store in @ref ble_adv::adapter of each advertisement
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ * @param[in,out]   ring        Ring to push to, the element size must be
+ *                              `sizeof(struct ble_adv)`
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    Start one thread per adapter to aggregate several adapters into one ring
+ */
+int ble_adv_ring_thread_start(struct ble_adv_ring_thread *thread, int dev, uint8_t adapter,
+                              unsigned parse_flags, struct ble_adv_ring *ring);
+
+/**
+ * @brief   Stop and join the reader thread
+ *
+ * @param[in,out]   thread      Thread to stop
+ *
+ * @retval  0                   Success
+ * @retval -1                   The thread terminated early due to a failure, errno is set to
+ *                              indicate the cause
+ */
+int ble_adv_ring_thread_stop(struct ble_adv_ring_thread *thread);
+
+/** @} */
+#endif /* BLE_ADV_RING_H */
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_SCANCTL_H
+#define BLE_ADV_SCANCTL_H
+
+#include "ble_adv.h"
+#include "ble_adv_devtab.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_scanctl     Adaptive scan duty cycle
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Scan only as much as needed to hear every known sensor
+ * @file
+ *
+ * The controller keeps the scan interval fixed and moves the scan window between the bounds
+ * given by the user. Once per @ref BLE_ADV_SCANCTL_EVAL_MS it walks the @ref ble_adv_devtab
+ * and estimates the period of each device seen at least @ref BLE_ADV_SCANCTL_MIN_SEEN times
+ * from its first and last time seen. A device not seen for more than
+ * @ref BLE_ADV_SCANCTL_MISS_FACTOR periods is missed, one not seen for more than
+ * @ref BLE_ADV_SCANCTL_GONE_FACTOR periods is considered gone and ignored.
+ *
+ * If any known device is missed, the window is doubled at once. After
+ * @ref BLE_ADV_SCANCTL_CALM_EVALS evaluations in a row without misses, the window is reduced
+ * by a quarter, but not down to the window at which the last miss happened. That window
+ * is forgotten after @ref BLE_ADV_SCANCTL_FORGET_EVALS evaluations without misses, so that
+ * the controller probes lower windows again when the conditions improved. With no known
+ * device at all, the window is raised to find some.
+ *
+ * If the device table only records new measurements (as in the LYWSD03MMC dumper), the
+ * period is that of the measurements and a miss is a lost measurement.
+ *
+ * The new parameters are applied with @ref ble_adv_scan_ex on a descriptor used only for
+ * this. The BlueZ helpers wait for the command response by reading from the descriptor they
+ * send on and discard everything else received meanwhile, so issuing the commands on the
+ * descriptor advertisements are read from would lose the queued advertisements. On a
+ * separate descriptor, the reader continues without noticing, except for the few
+ * milliseconds the controller needs to restart scanning.
+ */
+
+/**
+ * @brief   Time between two evaluations in ms
+ */
+#define BLE_ADV_SCANCTL_EVAL_MS             10000
+
+/**
+ * @brief   Number of times a device must have been seen to estimate its period
+ */
+#define BLE_ADV_SCANCTL_MIN_SEEN            3
+
+/**
+ * @brief   Shorter periods are rounded up to this many ms, so that a device advertising many
+ *          times per second is not missed because of a short gap
+ */
+#define BLE_ADV_SCANCTL_PERIOD_MIN_MS       1000
+
+/**
+ * @brief   A device not seen for this many periods is missed
+ */
+#define BLE_ADV_SCANCTL_MISS_FACTOR         3
+
+/**
+ * @brief   A device not seen for this many periods is gone and no longer counts as missed
+ */
+#define BLE_ADV_SCANCTL_GONE_FACTOR         10
+
+/**
+ * @brief   Number of evaluations in a row without misses before the window is reduced
+ */
+#define BLE_ADV_SCANCTL_CALM_EVALS          6
+
+/**
+ * @brief   Number of evaluations in a row without misses before the window at the last miss
+ *          is forgotten
+ */
+#define BLE_ADV_SCANCTL_FORGET_EVALS        60
+
+/**
+ * @brief   Result of the evaluations and counters of a scan controller
+ */
+struct ble_adv_scanctl_status {
+    uint64_t raised;            /**< Number of times the window was raised */
+    uint64_t lowered;           /**< Number of times the window was lowered */
+    uint64_t failed;            /**< Number of times applying new parameters failed */
+    uint32_t known;             /**< Devices with a period estimate at the last evaluation */
+    uint32_t missed;            /**< Known devices missed at the last evaluation */
+    uint32_t reports_per_s;     /**< Advertisements per second since the previous evaluation,
+                                     see @ref BLE_ADV_STATS_REPORTS */
+    uint16_t interval;          /**< Scan interval in units of 0.625 ms */
+    uint16_t window;            /**< Scan window currently applied in units of 0.625 ms */
+};
+
+/**
+ * @brief   Scan controller state
+ *
+ * @note    The contents are private, use @ref ble_adv_scanctl_status to inspect it
+ */
+struct ble_adv_scanctl {
+    struct ble_adv_scan_params params;  /**< Parameters applied */
+    const struct ble_adv_devtab *tab;   /**< Table of devices to watch */
+    struct ble_adv_scanctl_status status;   /**< Counters and last evaluation */
+    uint64_t next_eval_ms;              /**< Time of the next evaluation, 0 for not yet known */
+    uint64_t last_eval_ms;              /**< Time of the previous evaluation */
+    uint64_t reports;                   /**< Value of the reports counter at that time */
+    int dev;                            /**< Descriptor to issue HCI commands on */
+    uint16_t window_min;                /**< Lower bound of the scan window */
+    uint16_t window_max;                /**< Upper bound of the scan window */
+    uint8_t adapter;                    /**< Adapter to get the reports counter of */
+    uint16_t miss_window;               /**< Window at the last miss, or 0 */
+    uint8_t calm;                       /**< Evaluations in a row without misses since the
+                                             last change */
+    uint8_t calm_total;                 /**< Evaluations in a row without misses */
+};
+
+/**
+ * @brief   Initialize the controller and apply the upper bound of the window
+ *
+ * @param[out]      ctl         Controller to initialize
+ * @param[in]       dev         Descriptor of the HCI interface used only by the controller,
+ *                              e.g. a second one obtained from @ref ble_adv_open
+ * @param[in]       tab         Device table updated by the reader, must outlive @p ctl
+ * @param[in]       params      Scan parameters to use, the window is replaced
+ * @param[in]       window_min  Lower bound of the scan window in units of 0.625 ms
+ * @param[in]       window_max  Upper bound of the scan window in units of 0.625 ms, at most
+ *                              @ref ble_adv_scan_params::interval
+ * @param[in]       adapter     Value of @ref ble_adv::adapter of the advertisements, used
+ *                              to obtain the packet rate from @ref ble_adv_stats_snapshot
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EINVAL` for
+ *                              invalid bounds
+ *
+ * @note    The descriptor advertisements are read from still needs to be set up with
+ *          @ref ble_adv_scan or @ref ble_adv_scan_ex
+ */
+int ble_adv_scanctl_init(struct ble_adv_scanctl *ctl, int dev, const struct ble_adv_devtab *tab,
+                         const struct ble_adv_scan_params *params, uint16_t window_min,
+                         uint16_t window_max, uint8_t adapter);
+
+/**
+ * @brief   Evaluate the device table if due and apply new scan parameters if needed
+ *
+ * @param[in,out]   ctl         Controller to run
+ * @param[in]       now_ms      Current time in milliseconds of the clock used for the device
+ *                              table
+ *
+ * @retval  1                   New scan parameters were applied
+ * @retval  0                   Nothing changed
+ * @retval -1                   Applying the new parameters failed and errno set to indicate
+ *                              the cause, the next evaluation tries again
+ *
+ * Call this at least once per second, e.g. from the poll loop of the reader.
+ */
+int ble_adv_scanctl_tick(struct ble_adv_scanctl *ctl, uint64_t now_ms);
+
+/**
+ * @brief   Get the counters and the result of the last evaluation
+ *
+ * @param[in]       ctl         Controller to get the status of
+ * @param[out]      dest        Write the status here
+ */
+void ble_adv_scanctl_status(const struct ble_adv_scanctl *ctl,
+                            struct ble_adv_scanctl_status *dest);
+
+/** @} */
+#endif /* BLE_ADV_SCANCTL_H */
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_STATS_H
+#define BLE_ADV_STATS_H
+
+#include "ble_adv.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_stats   Counters and histograms of the library
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Find out where advertisements go missing and how long they take to arrive
+ * @file
+ *
+ * The library keeps a set of counters and histograms per adapter, indexed the same way as
+ * @ref ble_adv::adapter. @ref ble_adv_read, @ref ble_adv_read_batch and
+ * @ref ble_adv_read_many account to adapter 0, @ref ble_adv_multi_read and the ring buffer
+ * reader threads to the adapter they tag the advertisements with. Updates use relaxed atomics
+ * and are batched per read call, so they are cheap enough to be always on.
+ *
+ * The histograms use logarithmic buckets with @ref BLE_ADV_STATS_HIST_SUB_BITS bits of
+ * sub-bucket precision (as done by HDR histograms), so each bucket is at most 12.5 % wide.
+ *
+ * @note    Raw HCI sockets do not report the number of events the kernel dropped due to a full
+ *          socket buffer, so these cannot be counted.
+ */
+
+/**
+ * @brief   Number of adapters to keep statistics for
+ */
+#define BLE_ADV_STATS_ADAPTERS              HCI_MAX_DEV
+
+/**
+ * @name    Counters, used as index into @ref ble_adv_stats::counters
+ * @{
+ */
+#define BLE_ADV_STATS_READS                 0   /**< Read calls that received events */
+#define BLE_ADV_STATS_EVENTS                1   /**< HCI events received */
+#define BLE_ADV_STATS_REPORTS               2   /**< Advertisements decoded and returned */
+#define BLE_ADV_STATS_SKIPPED               3   /**< HCI events without advertisements */
+#define BLE_ADV_STATS_DROP_PROTO            4   /**< Advertisements (or HCI events with an
+                                                     invalid header) dropped due to invalid
+                                                     encoding (`EPROTO`) */
+#define BLE_ADV_STATS_DROP_OVERFLOW         5   /**< Advertisements dropped due to an EIR
+                                                     field exceeding its buffer
+                                                     (`EOVERFLOW`) */
+#define BLE_ADV_STATS_DROP_SPACE            6   /**< Advertisements dropped due to lack of
+                                                     space in the buffer passed */
+#define BLE_ADV_STATS_DROP_RING             7   /**< Advertisements a reader thread could not
+                                                     push into its full ring buffer */
+#define BLE_ADV_STATS_FILTERED              8   /**< Advertisements rejected by
+                                                     @ref ble_adv_filter_match or by a filter
+                                                     of the application */
+#define BLE_ADV_STATS_DEDUPLICATED          9   /**< Advertisements suppressed as duplicates
+                                                     by @ref ble_adv_devtab_update */
+#define BLE_ADV_STATS_TRUNCATED             10  /**< Advertisements returned with
+                                                     @ref BLE_ADV_HAS_TRUNCATED set */
+#define BLE_ADV_STATS_DROP_POOL             11  /**< Advertisements dropped as
+                                                     @ref ble_adv_pool_read ran out of
+                                                     blocks */
+#define BLE_ADV_STATS_NUM                   12  /**< Number of counters */
+/** @} */
+
+/**
+ * @brief   Number of sub-bucket bits of the histograms
+ */
+#define BLE_ADV_STATS_HIST_SUB_BITS         3
+
+/**
+ * @brief   Number of buckets of the histograms, values of 2^32 or larger go to the last one
+ */
+#define BLE_ADV_STATS_HIST_BUCKETS          ((32 - BLE_ADV_STATS_HIST_SUB_BITS + 1) \
+                                             << BLE_ADV_STATS_HIST_SUB_BITS)
+
+/**
+ * @brief   Snapshot of a histogram
+ */
+struct ble_adv_stats_hist {
+    uint64_t buckets[BLE_ADV_STATS_HIST_BUCKETS];   /**< Number of values per bucket */
+    uint64_t count;                                 /**< Number of values recorded */
+    uint64_t sum;                                   /**< Sum of all values recorded */
+};
+
+/**
+ * @brief   Snapshot of the statistics of an adapter
+ */
+struct ble_adv_stats {
+    uint64_t counters[BLE_ADV_STATS_NUM];   /**< Counters, e.g. @ref BLE_ADV_STATS_EVENTS */
+    /**
+     * @brief   Time in µs from the kernel receiving an HCI event to the read call returning it
+     *
+     * Only events carrying a kernel timestamp (see @ref ble_adv::timestamp_us) are recorded.
+     */
+    struct ble_adv_stats_hist latency_us;
+    struct ble_adv_stats_hist batch;        /**< HCI events received per read call */
+};
+
+/**
+ * @brief   Add to a counter of an adapter
+ *
+ * This is used by the library itself, but also allows the application to account for e.g.
+ * its own filtering in @ref BLE_ADV_STATS_FILTERED.
+ *
+ * @param[in]       adapter     Adapter to account to, ignored if out of range
+ * @param[in]       counter     Counter to add to, e.g. @ref BLE_ADV_STATS_FILTERED
+ * @param[in]       n           Amount to add
+ */
+void ble_adv_stats_add(uint8_t adapter, unsigned counter, uint64_t n);
+
+/**
+ * @brief   Take a snapshot of the statistics of an adapter
+ *
+ * @param[out]      dest        Write the snapshot here
+ * @param[in]       adapter     Adapter to get the statistics of
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause, `EINVAL` if
+ *                              @p adapter is out of range
+ *
+ * @note    This is wait-free and does not stop concurrent updates. Hence, the values in a
+ *          snapshot may be off by the few updates in flight while taking it.
+ */
+int ble_adv_stats_snapshot(struct ble_adv_stats *dest, uint8_t adapter);
+
+/**
+ * @brief   Estimate a quantile of a histogram
+ *
+ * @param[in]       hist        Histogram to inspect
+ * @param[in]       q           Quantile to estimate in the range [0, 1], e.g. 0.99
+ *
+ * @return  Upper bound of the bucket holding the quantile, or 0 if @p hist is empty
+ */
+uint64_t ble_adv_stats_hist_quantile(const struct ble_adv_stats_hist *hist, double q);
+
+/** @} */
+#endif /* BLE_ADV_STATS_H */
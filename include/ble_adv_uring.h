@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef BLE_ADV_URING_H
+#define BLE_ADV_URING_H
+
+#include "ble_adv.h"
+#include "ble_adv_reader.h"
+
+#include <liburing.h>
+#include <stdint.h>
+
+/**
+ * @defgroup    ble_adv_uring   io_uring based ingestion of HCI events
+ * @ingroup     ble_adv
+ *
+ * @{
+ * @brief   Receive HCI events via multishot receive into a ring of provided buffers
+ * @file
+ *
+ * A single multishot receive request stays posted on the HCI socket. The kernel picks a buffer
+ * from the provided buffer ring for every HCI event and posts a completion. The completions
+ * are reaped in bulk and the events are parsed in place, so that a busy gateway needs next to
+ * no syscalls per event.
+ *
+ * Like @ref ble_adv_read_many, the advertisements are tagged with adapter 0 and accounted to
+ * it in @ref ble_adv_stats. The multishot receive does not pass on the control messages of the
+ * HCI socket, so @ref ble_adv::timestamp_us is always 0 and no latency is recorded.
+ *
+ * @note    This is only available if the library is build with `make WITH_IO_URING=1`, which
+ *          requires liburing 2.4 or newer and Linux 6.0 or newer.
+ */
+
+/**
+ * @brief   Buffer group ID of the provided buffer ring
+ */
+#define BLE_ADV_URING_BGID                  0
+
+/**
+ * @brief   Maximum number of completions reaped in one go
+ */
+#define BLE_ADV_URING_CQES                  32
+
+/**
+ * @brief   State of the io_uring backend
+ *
+ * @note    The contents are private
+ */
+struct ble_adv_uring {
+    struct io_uring ring;                       /**< The io_uring instance */
+    struct io_uring_buf_ring *br;               /**< Provided buffer ring */
+    uint8_t (*bufs)[HCI_MAX_EVENT_SIZE];        /**< Buffers backing @ref ble_adv_uring::br */
+    struct ble_adv batch[BLE_ADV_REPORTS_MAX];  /**< Buffer to decode into */
+    ble_adv_reader_cb_t cb;                     /**< Callback to pass advertisements to */
+    void *ctx;                                  /**< Context to pass to the callback */
+    unsigned nbufs;                             /**< Number of entries in bufs */
+    int dev;                                    /**< Descriptor of the HCI interface */
+    int armed;                                  /**< Multishot receive is posted */
+    int err;                                    /**< Error to report on the next call, or 0 */
+    unsigned parse_flags;                       /**< Parse flags to decode with */
+};
+
+/**
+ * @brief   Set up the io_uring instance and the provided buffer ring
+ *
+ * @param[out]      uring       State to initialize
+ * @param[in]       dev         Descriptor of the HCI interface
+ * @param[in]       nbufs       Number of buffers to provide, must be a power of two
+ * @param[in]       parse_flags Parse flags, e.g. @ref BLE_ADV_PARSE_FLAG_LENIENT, or 0
+ * @param[in]       cb          Callback to pass the advertisements to
+ * @param[in]       ctx         Context to pass to @p cb
+ *
+ * @retval  0                   Success
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * @note    The buffers are allocated once here, no allocations happen afterwards
+ */
+int ble_adv_uring_init(struct ble_adv_uring *uring, int dev, unsigned nbufs,
+                       unsigned parse_flags, ble_adv_reader_cb_t cb, void *ctx);
+
+/**
+ * @brief   Tear down the io_uring instance and free the buffers
+ *
+ * @param[in,out]   uring       State to tear down
+ *
+ * @note    This does not close the HCI descriptor
+ */
+void ble_adv_uring_exit(struct ble_adv_uring *uring);
+
+/**
+ * @brief   Get the descriptor of the io_uring, which becomes readable on completions
+ *
+ * @param[in]       uring       State to get the descriptor of
+ *
+ * @return  The io_uring descriptor
+ */
+static inline int ble_adv_uring_fd(const struct ble_adv_uring *uring)
+{
+    return uring->ring.ring_fd;
+}
+
+/**
+ * @brief   Pass all received advertisements to the callback
+ *
+ * @param[in,out]   uring       State to dispatch
+ * @param[in]       wait        If non-zero, block until at least one event was received
+ *
+ * @return  Number of advertisements passed to the callback
+ * @retval -1                   Failure and errno set to indicate the cause
+ *
+ * If a failure happens after advertisements were already passed to the callback, their number
+ * is returned and the failure is reported by the next call.
+ */
+int ble_adv_uring_dispatch(struct ble_adv_uring *uring, int wait);
+
+/** @} */
+#endif /* BLE_ADV_URING_H */
@@ -23,6 +23,9 @@
  * This software only works with the cheap Xiaomi LYWSD03MMC BLE temperature & humidity sensors and
  * only if the custom firmware at https://github.com/atc1441/ATC_MiThermometer or at
  * https://github.com/pvvx/ATC_MiThermometer is used.
+ *
+ * @note    The decoder registry in @ref ble_adv_decode supports this format as well, along with
+ *          other sensor and beacon formats.
  */
 
 /**
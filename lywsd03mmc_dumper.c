@@ -9,42 +9,267 @@
  *
  * This program dumps the data received from cheap LYWSD03MMC BLE temperature and humidity sensors,
  * provided the [this](https://github.com/atc1441/ATC_MiThermometer) or
- * [this](https://github.com/pvvx/ATC_MiThermometer) custom firmware is used.
+ * [this](https://github.com/pvvx/ATC_MiThermometer) custom firmware is used. The atc1441, the
+ * pvvx custom and the BTHome v2 advertising formats are supported.
+ *
+ * With `-a` the readings are not printed one by one. Instead, the minimum, mean and maximum
+ * per sensor over 1 minute and 15 minute windows are printed when a window closes.
+ *
+ * With `--format=ndjson` or `--format=binary` the readings (or aggregates) are written to
+ * stdout as machine readable records (see @ref ble_adv_output) instead of human readable text.
+ *
+ * With `--publish=URL` (e.g. `--publish=mqtt://broker/ble/readings`) the readings (or
+ * aggregates) are additionally sent in batches via UDP or MQTT (see @ref ble_adv_publish), as
+ * NDJSON or, with `--format=binary`, as binary records.
+ *
+ * With `--adaptive` the scan window is tuned by a @ref ble_adv_scanctl between 5 % and
+ * 100 % of the scan interval, so that no measurement of a known sensor is lost while scanning
+ * as little as possible.
  */
 #include "ble_adv.h"
-#include "lywsd03mmc.h"
+#include "ble_adv_agg.h"
+#include "ble_adv_decode.h"
+#include "ble_adv_devtab.h"
+#include "ble_adv_output.h"
+#include "ble_adv_publish.h"
+#include "ble_adv_reader.h"
+#include "ble_adv_scanctl.h"
 
-#include <endian.h>
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* flush machine readable output at least once per second */
+#define FLUSH_MS                1000
 
 static int dev;
+static struct ble_adv_devtab devtab;
+static struct ble_adv_agg agg;
+static int aggregate;
+static int machine;
+static struct ble_adv_output output;
+static struct ble_adv_publish publisher;
+static const char *publish_url;
+static int adaptive;
+static struct ble_adv_scanctl scanctl;
+static volatile sig_atomic_t stop;
+static const uint32_t windows_ms[] = { 60 * 1000, 15 * 60 * 1000 };
 
-static void __attribute__((noreturn)) handle_exit(int signal)
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t realtime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void print_centi(int32_t value)
+{
+    unsigned abs = (value < 0) ? (unsigned)-value : (unsigned)value;
+    printf("%s%u.%02u", (value < 0) ? "-" : "", abs / 100, abs % 100);
+}
+
+static void print_window(const struct ble_adv_agg_record *record, void *ctx)
+{
+    (void)ctx;
+    if (publish_url) {
+        /* rejected records are accounted for in the statistics of the publisher */
+        ble_adv_publish_agg(&publisher, record);
+    }
+
+    if (machine) {
+        if (ble_adv_output_agg(&output, record)) {
+            perror("writing output");
+            stop = 1;
+        }
+        return;
+    }
+
+    time_t start = (time_t)(record->start_ms / 1000);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&start));
+    printf("[%02X:%02X:%02X:%02X:%02X:%02X] %s + %u min%s\n",
+           record->addr[0], record->addr[1], record->addr[2], record->addr[3], record->addr[4],
+           record->addr[5], buf, (unsigned)(record->len_ms / 60000),
+           record->partial ? " (partial)" : "");
+
+    static const char *const names[BLE_ADV_AGG_CHANNELS] = {
+        [BLE_ADV_AGG_TEMPERATURE] = "temperature [°C]",
+        [BLE_ADV_AGG_HUMIDITY] = "humidity [%]",
+        [BLE_ADV_AGG_BAT_MV] = "battery [mV]",
+    };
+    for (unsigned c = 0; c < BLE_ADV_AGG_CHANNELS; c++) {
+        const struct ble_adv_agg_stat *stat = &record->channels[c];
+        if (!stat->count) {
+            continue;
+        }
+        printf("    %-16s min ", names[c]);
+        if (c == BLE_ADV_AGG_BAT_MV) {
+            printf("%d, mean %d, max %d", (int)stat->min, (int)ble_adv_agg_mean(stat),
+                   (int)stat->max);
+        }
+        else {
+            print_centi(stat->min);
+            printf(", mean ");
+            print_centi(ble_adv_agg_mean(stat));
+            printf(", max ");
+            print_centi(stat->max);
+        }
+        printf(" (%u readings)\n", (unsigned)stat->count);
+    }
+}
+
+static void handle_exit(int signal)
 {
     (void)signal;
-    /* stop BLE scanning on exit */
-    ble_adv_scan(dev, 0);
-    exit(EXIT_SUCCESS);
+    /* let the main loop flush the output and stop BLE scanning */
+    stop = 1;
 }
 
 static struct sigaction exit_handler = {
     .sa_handler = handle_exit,
 };
 
+static void dump_adv(const struct ble_adv *adv, void *ctx)
+{
+    (void)ctx;
+    struct ble_adv_sensor data;
+    if (ble_adv_decode(&data, adv)) {
+        return;
+    }
+
+    switch (data.decoder) {
+    case BLE_ADV_DECODER_ATC1441:
+    case BLE_ADV_DECODER_PVVX:
+    case BLE_ADV_DECODER_BTHOME_V2:
+        break;
+    default:
+        return;
+    }
+
+    /* the frame counter in the service data changes with each measurement, so this only
+     * suppresses repetitions of the same measurement */
+    const struct ble_adv_devtab_entry *entry;
+    if (!(data.has & BLE_ADV_SENSOR_HAS_TEMPERATURE)
+        || !ble_adv_devtab_update(&devtab, adv, now_ms(), &entry))
+    {
+        return;
+    }
+
+    if (aggregate) {
+        struct ble_adv_agg_sample sample;
+        ble_adv_agg_sample_from_sensor(&sample, &data);
+        ble_adv_agg_add(&agg, entry, &sample,
+                        adv->timestamp_us ? adv->timestamp_us / 1000 : realtime_ms());
+        return;
+    }
+
+    if (publish_url) {
+        ble_adv_publish_sensor(&publisher, adv, &data);
+    }
+
+    if (machine) {
+        if (ble_adv_output_sensor(&output, adv, &data)) {
+            perror("writing output");
+            stop = 1;
+        }
+        return;
+    }
+
+    printf("%s [%02X:%02X:%02X:%02X:%02X:%02X] RSSI: %u (%s)\n",
+           adv->name, adv->addr[0], adv->addr[1], adv->addr[2], adv->addr[3], adv->addr[4],
+           adv->addr[5], (unsigned)adv->rssi, ble_adv_decoder_name(data.decoder));
+    unsigned temp_abs = (data.temperature < 0) ? (unsigned)-data.temperature
+                                               : (unsigned)data.temperature;
+    printf("temperature = %s%u.%02u °C", (data.temperature < 0) ? "-" : "", temp_abs / 100,
+           temp_abs % 100);
+    if (data.has & BLE_ADV_SENSOR_HAS_HUMIDITY) {
+        printf(", humidity = %u.%02u %%", data.humidity / 100U, data.humidity % 100U);
+    }
+    if (data.has & BLE_ADV_SENSOR_HAS_BAT) {
+        printf(", battery = %u %%", data.bat);
+    }
+    if (data.has & BLE_ADV_SENSOR_HAS_BAT_MV) {
+        printf(" (%u mV)", data.bat_mv);
+    }
+    puts("");
+}
+
 int main(int argc, const char **argv)
 {
-    (void)argc;
+    unsigned format = BLE_ADV_OUTPUT_NDJSON;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-a")) {
+            aggregate = 1;
+        }
+        else if (!strcmp(argv[i], "--format=text")) {
+            machine = 0;
+        }
+        else if (!strcmp(argv[i], "--format=ndjson")) {
+            machine = 1;
+            format = BLE_ADV_OUTPUT_NDJSON;
+        }
+        else if (!strcmp(argv[i], "--format=binary")) {
+            machine = 1;
+            format = BLE_ADV_OUTPUT_BINARY;
+        }
+        else if (!strncmp(argv[i], "--publish=", 10)) {
+            publish_url = argv[i] + 10;
+        }
+        else if (!strcmp(argv[i], "--adaptive")) {
+            adaptive = 1;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-a] [--format=text|ndjson|binary] [--publish=URL] "
+                    "[--adaptive]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (publish_url && ble_adv_publish_init(&publisher, publish_url, format, 0, FLUSH_MS)) {
+        perror("ble_adv_publish_init()");
+        exit(EXIT_FAILURE);
+    }
+
+    if (machine && ble_adv_output_init(&output, STDOUT_FILENO, format, BLE_ADV_OUTPUT_BUF_SIZE,
+                                       FLUSH_MS))
+    {
+        perror("ble_adv_output_init()");
+        exit(EXIT_FAILURE);
+    }
+
     dev = ble_adv_open();
     if (dev < 0) {
         perror("ble_adv_open()");
         exit(EXIT_FAILURE);
     }
 
+    if (ble_adv_devtab_init(&devtab, 1024, 10 * 60 * 1000)) {
+        perror("ble_adv_devtab_init()");
+        exit(EXIT_FAILURE);
+    }
+
+    if (aggregate && ble_adv_agg_init(&agg, &devtab, windows_ms,
+                                      sizeof(windows_ms) / sizeof(windows_ms[0]), print_window,
+                                      NULL))
+    {
+        perror("ble_adv_agg_init()");
+        exit(EXIT_FAILURE);
+    }
+
     if (sigaction(SIGINT, &exit_handler, NULL) || sigaction(SIGTERM, &exit_handler, NULL)) {
-        puts("WARNING: Couldn't register exit handler to disable scanning on exit");
+        fputs("WARNING: Couldn't register exit handler to disable scanning on exit\n", stderr);
     }
 
     if (ble_adv_scan(dev, BLE_ADV_SCAN_FLAG_ENABLED)) {
@@ -57,33 +282,106 @@ int main(int argc, const char **argv)
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        struct ble_adv adv;
-        if (ble_adv_read(dev, &adv)) {
-            perror("reading advertisement");
+    /* the scan controller issues its HCI commands on a descriptor of its own, so that no
+     * advertisement queued on the one the reader uses is lost */
+    int ctl_dev = -1;
+    if (adaptive) {
+        struct ble_adv_scan_params params;
+        ble_adv_scan_params_init(&params, BLE_ADV_SCAN_PROFILE_BALANCED, 0);
+        ctl_dev = ble_adv_open();
+        if ((ctl_dev < 0)
+            || ble_adv_scanctl_init(&scanctl, ctl_dev, &devtab, &params, params.interval / 20,
+                                    params.interval, 0))
+        {
+            perror("ble_adv_scanctl_init() failed");
             ble_adv_scan(dev, 0);
             exit(EXIT_FAILURE);
         }
+    }
 
-        if (lywsd03mmc_is_match(&adv)) {
-            printf("%s [%02X:%02X:%02X:%02X:%02X:%02X] RSSI: %u\n",
-                   adv.name, adv.addr[0], adv.addr[1], adv.addr[2], adv.addr[3], adv.addr[4],
-                   adv.addr[5], (unsigned)adv.rssi);
-            struct lywsd03mmc_data data;
-            lywsd03mmc_parse(&data, &adv);
-            int temp_int; unsigned temp_rem;
-            if (data.temperature >= 0) {
-                temp_int = (unsigned)data.temperature / 10;
-                temp_rem = (unsigned)data.temperature % 10;
-            }
-            else {
-                temp_int = (data.temperature + 9) / 10;
-                temp_rem = (unsigned)(-data.temperature) % 10;
+    static struct ble_adv_reader reader;
+    if (ble_adv_reader_init(&reader, dev, 0, dump_adv, NULL)) {
+        perror("ble_adv_reader_init() failed");
+        ble_adv_scan(dev, 0);
+        exit(EXIT_FAILURE);
+    }
+
+    int retval = EXIT_SUCCESS;
+    while (!stop) {
+        struct pollfd pfds[2] = { { .fd = ble_adv_reader_fd(&reader), .events = POLLIN } };
+        nfds_t nfds = 1;
+        if (publish_url) {
+            pfds[1].fd = ble_adv_publish_pollfd(&publisher, &pfds[1].events);
+            nfds = 2;
+        }
+
+        /* wake up once per second to close the windows of silent sensors and flush output */
+        int timeout = (aggregate || machine || publish_url || adaptive) ? FLUSH_MS : -1;
+        if ((poll(pfds, nfds, timeout) < 0) && (errno != EINTR)) {
+            perror("poll()");
+            retval = EXIT_FAILURE;
+            break;
+        }
+
+        if ((pfds[0].revents & POLLIN) && (ble_adv_reader_dispatch(&reader) < 0)) {
+            perror("reading advertisement");
+            retval = EXIT_FAILURE;
+            break;
+        }
+
+        if (aggregate) {
+            ble_adv_agg_tick(&agg, realtime_ms());
+        }
+
+        if (publish_url) {
+            ble_adv_publish_run(&publisher);
+        }
+
+        if (adaptive && (ble_adv_scanctl_tick(&scanctl, now_ms()) < 0)) {
+            /* keep scanning with the previous parameters, the next evaluation retries */
+            perror("ble_adv_scanctl_tick()");
+        }
+
+        if (machine) {
+            if (ble_adv_output_tick(&output)) {
+                perror("writing output");
+                retval = EXIT_FAILURE;
+                break;
             }
-            printf("temperature = %d.%u °C, humidity = %u %%, battery = %u %% (%u mV)\n",
-                   temp_int, temp_rem, data.humidity, data.bat, data.bat_mv);
         }
+        else if (aggregate) {
+            fflush(stdout);
+        }
+    }
+
+    /* stop BLE scanning on exit */
+    ble_adv_scan(dev, 0);
+    if (adaptive) {
+        struct ble_adv_scanctl_status status;
+        ble_adv_scanctl_status(&scanctl, &status);
+        close(ctl_dev);
+        fprintf(stderr, "scan window %u/%u, raised %llu times, lowered %llu times\n",
+                (unsigned)status.window, (unsigned)status.interval,
+                (unsigned long long)status.raised, (unsigned long long)status.lowered);
+    }
+    if (aggregate) {
+        ble_adv_agg_flush(&agg);
+    }
+    if (machine && ble_adv_output_destroy(&output)) {
+        perror("writing output");
+        retval = EXIT_FAILURE;
+    }
+    if (publish_url) {
+        struct ble_adv_publish_stats stats;
+        ble_adv_publish_flush(&publisher);
+        ble_adv_publish_run(&publisher);
+        ble_adv_publish_stats(&publisher, &stats);
+        ble_adv_publish_destroy(&publisher);
+        fprintf(stderr, "published %llu records in %llu batches, %llu rejected, %llu dropped\n",
+                (unsigned long long)stats.records, (unsigned long long)stats.batches,
+                (unsigned long long)stats.rejected, (unsigned long long)stats.dropped);
     }
+    exit(retval);
 }
 
 /** @} */
@@ -5,44 +5,161 @@
  * @{
  * @brief   This program demonstrates the usage of the ble_adv library
  * @file
+ *
+ * With `--format=ndjson` or `--format=binary` the advertisements are written to stdout as
+ * machine readable records (see @ref ble_adv_output) instead of human readable text.
+ *
+ * Scanning is managed by a @ref ble_adv_autoscan, so that the scanner keeps running when the
+ * adapter is reset, taken down or unplugged, and continues as soon as it is back.
  */
 #include "ble_adv.h"
+#include "ble_adv_autoscan.h"
+#include "ble_adv_output.h"
+#include "ble_adv_reader.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static int dev;
+/* flush machine readable output at least once per second */
+#define FLUSH_MS                1000
 
-static void __attribute__((noreturn)) handle_exit(int signal)
+static struct ble_adv_autoscan autoscan;
+static int machine;
+static struct ble_adv_output output;
+static volatile sig_atomic_t stop;
+
+static void handle_exit(int signal)
 {
     (void)signal;
-    /* stop BLE scanning on exit */
-    ble_adv_scan(dev, 0);
-    exit(EXIT_SUCCESS);
+    /* let the main loop flush the output and stop BLE scanning */
+    stop = 1;
 }
 
 static struct sigaction exit_handler = {
     .sa_handler = handle_exit,
 };
 
+static void print_adv(const struct ble_adv *adv, void *ctx)
+{
+    (void)ctx;
+    if (machine) {
+        if (ble_adv_output_adv(&output, adv)) {
+            perror("writing output");
+            stop = 1;
+        }
+        return;
+    }
+
+    printf("%s [%02X:%02X:%02X:%02X:%02X:%02X] RSSI: %u\n",
+           adv->name, adv->addr[0], adv->addr[1], adv->addr[2], adv->addr[3], adv->addr[4],
+           adv->addr[5], (unsigned)adv->rssi);
+
+    if (adv->tx_power != INT8_MAX) {
+        printf("   TX power: %d dBm\n", (int)adv->tx_power);
+    }
+    if (adv->uri_len) {
+        printf("    URI: \"%s\"\n", adv->uri);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID16) {
+        printf("    UUID16: 0x%04X\n", adv->uuid16);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID32) {
+        printf("    UUID32: 0x%08X\n", adv->uuid16);
+    }
+    if (adv->has & BLE_ADV_HAS_UUID128) {
+        printf("    UUID128: {0x%02X", adv->uuid128[0]);
+        for (unsigned i = 1; i < sizeof(adv->uuid128); i++) {
+            printf(", 0x%02X", adv->uuid128[i]);
+        }
+        puts("}");
+    }
+    if (adv->has & BLE_ADV_HAS_FLAGS) {
+        puts("    Flags:");
+        if (adv->flags & BLE_ADV_FLAGS_DISCO_LIMITED) {
+            puts("        - LE Limited Discoverable Mode");
+        }
+        if (adv->flags & BLE_ADV_FLAGS_DISCO_GENERAL) {
+            puts("        - LE General Discoverable Mode");
+        }
+        if (adv->flags & BLE_ADV_FLAGS_BLE_ONLY) {
+            puts("        - Classic Bluetooth not supported");
+        }
+        if (adv->flags & BLE_ADV_FLAGS_BLE_MIXED_CONTROLLER) {
+            puts("        - Simultaneous LE and BR/EDR to Same Device Capable (Controller)");
+        }
+        if (adv->flags & BLE_ADV_FLAGS_BLE_MIXED_HOST) {
+            puts("        - Simultaneous LE and BR/EDR to Same Device Capable (Host)");
+        }
+    }
+    if (adv->has & BLE_ADV_HAS_SERVICE_DATA) {
+        printf("    Service 0x%04X: ", (unsigned)adv->service_uuid16);
+        if (adv->service_data_len) {
+            printf("{0x%02X", adv->service_data[0]);
+            for (unsigned i = 1; i < adv->service_data_len; i++) {
+                printf(", 0x%02X", adv->service_data[i]);
+            }
+            puts("}");
+        }
+        else {
+            puts("No data");
+        }
+    }
+    if (adv->has & BLE_ADV_HAS_MS_DATA) {
+        printf("    Manufacturer Specific Data 0x%04X: ", (unsigned)adv->ms_uuid16);
+        if (adv->ms_data_len) {
+            printf("{0x%02X", adv->ms_data[0]);
+            for (unsigned i = 1; i < adv->ms_data_len; i++) {
+                printf(", 0x%02X", adv->ms_data[i]);
+            }
+            puts("}");
+        }
+        else {
+            puts("No data");
+        }
+    }
+}
+
 int main(int argc, const char **argv)
 {
-    (void)argc;
-    dev = ble_adv_open();
-    if (dev < 0) {
-        perror("ble_adv_open()");
+    unsigned format = BLE_ADV_OUTPUT_NDJSON;
+    if ((argc == 1) || ((argc == 2) && !strcmp(argv[1], "--format=text"))) {
+        machine = 0;
+    }
+    else if ((argc == 2) && !strcmp(argv[1], "--format=ndjson")) {
+        machine = 1;
+    }
+    else if ((argc == 2) && !strcmp(argv[1], "--format=binary")) {
+        machine = 1;
+        format = BLE_ADV_OUTPUT_BINARY;
+    }
+    else {
+        fprintf(stderr, "Usage: %s [--format=text|ndjson|binary]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (machine && ble_adv_output_init(&output, STDOUT_FILENO, format, BLE_ADV_OUTPUT_BUF_SIZE,
+                                       FLUSH_MS))
+    {
+        perror("ble_adv_output_init()");
         exit(EXIT_FAILURE);
     }
 
     if (sigaction(SIGINT, &exit_handler, NULL) || sigaction(SIGTERM, &exit_handler, NULL)) {
-        puts("WARNING: Couldn't register exit handler to disable scanning on exit");
+        fputs("WARNING: Couldn't register exit handler to disable scanning on exit\n", stderr);
     }
 
-    if (ble_adv_scan(dev, BLE_ADV_SCAN_FLAG_ENABLED)) {
+    /* without an adapter present, wait for hci0 to show up */
+    int dev_id = hci_get_route(NULL);
+    struct ble_adv_scan_params params;
+    ble_adv_scan_params_init(&params, BLE_ADV_SCAN_PROFILE_LOW_LATENCY, 0);
+    if (ble_adv_autoscan_init(&autoscan, (dev_id < 0) ? 0 : dev_id, &params)) {
         int err = errno;
-        perror("ble_adv_scan() failed");
+        perror("ble_adv_autoscan_init() failed");
         if (err == EPERM) {
             printf("Try running \"sudo setcap 'cap_net_raw,cap_net_admin+eip' %s\"\n", argv[0]);
             /* theoretically, puts() could have overwritten value of errno */
@@ -50,82 +167,67 @@ int main(int argc, const char **argv)
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        struct ble_adv adv;
-        if (ble_adv_read(dev, &adv)) {
-            perror("reading advertisement");
-            ble_adv_scan(dev, 0);
-            exit(EXIT_FAILURE);
-        }
+    static struct ble_adv_reader reader;
+    int have_reader = (ble_adv_autoscan_fd(&autoscan) >= 0)
+                      && !ble_adv_reader_init(&reader, ble_adv_autoscan_fd(&autoscan), 0,
+                                              print_adv, NULL);
 
-        printf("%s [%02X:%02X:%02X:%02X:%02X:%02X] RSSI: %u\n",
-               adv.name, adv.addr[0], adv.addr[1], adv.addr[2], adv.addr[3], adv.addr[4],
-               adv.addr[5], (unsigned)adv.rssi);
+    int retval = EXIT_SUCCESS;
+    while (!stop) {
+        struct pollfd pfds[1 + BLE_ADV_AUTOSCAN_POLLFDS] = {
+            { .fd = have_reader ? ble_adv_reader_fd(&reader) : -1, .events = POLLIN },
+        };
+        ble_adv_autoscan_pollfds(&autoscan, pfds + 1);
 
-        if (adv.tx_power != INT8_MAX) {
-            printf("   TX power: %d dBm\n", (int)adv.tx_power);
+        /* the scan state machine needs to run at least every BLE_ADV_AUTOSCAN_RETRY_MS */
+        if ((poll(pfds, 1 + BLE_ADV_AUTOSCAN_POLLFDS, BLE_ADV_AUTOSCAN_RETRY_MS) < 0)
+            && (errno != EINTR))
+        {
+            perror("poll()");
+            retval = EXIT_FAILURE;
+            break;
         }
-        if (adv.uri_len) {
-            printf("    URI: \"%s\"\n", adv.uri);
+
+        if (have_reader && pfds[0].revents && (ble_adv_reader_dispatch(&reader) < 0)) {
+            if ((errno != EPIPE) && (errno != ENODEV) && (errno != ENETDOWN)) {
+                perror("reading advertisement");
+                retval = EXIT_FAILURE;
+                break;
+            }
+            /* the adapter is gone, the state machine reopens it once it is back */
+            have_reader = 0;
         }
-        if (adv.has & BLE_ADV_HAS_UUID16) {
-            printf("    UUID16: 0x%04X\n", adv.uuid16);
+
+        unsigned events = ble_adv_autoscan_run(&autoscan);
+        if (events & BLE_ADV_AUTOSCAN_EV_STOPPED) {
+            fputs("Adapter went away, waiting for it to come back\n", stderr);
         }
-        if (adv.has & BLE_ADV_HAS_UUID32) {
-            printf("    UUID32: 0x%08X\n", adv.uuid16);
+        if (events & BLE_ADV_AUTOSCAN_EV_CLOSED) {
+            /* the descriptor of the reader is gone, its number may be reused any time */
+            have_reader = 0;
         }
-        if (adv.has & BLE_ADV_HAS_UUID128) {
-            printf("    UUID128: {0x%02X", adv.uuid128[0]);
-            for (unsigned i = 1; i < sizeof(adv.uuid128); i++) {
-                printf(", 0x%02X", adv.uuid128[i]);
-            }
-            puts("}");
+        if (events & BLE_ADV_AUTOSCAN_EV_REOPENED) {
+            have_reader = !ble_adv_reader_init(&reader, ble_adv_autoscan_fd(&autoscan), 0,
+                                               print_adv, NULL);
         }
-        if (adv.has & BLE_ADV_HAS_FLAGS) {
-            puts("    Flags:");
-            if (adv.flags & BLE_ADV_FLAGS_DISCO_LIMITED) {
-                puts("        - LE Limited Discoverable Mode");
-            }
-            if (adv.flags & BLE_ADV_FLAGS_DISCO_GENERAL) {
-                puts("        - LE General Discoverable Mode");
-            }
-            if (adv.flags & BLE_ADV_FLAGS_BLE_ONLY) {
-                puts("        - Classic Bluetooth not supported");
-            }
-            if (adv.flags & BLE_ADV_FLAGS_BLE_MIXED_CONTROLLER) {
-                puts("        - Simultaneous LE and BR/EDR to Same Device Capable (Controller)");
-            }
-            if (adv.flags & BLE_ADV_FLAGS_BLE_MIXED_HOST) {
-                puts("        - Simultaneous LE and BR/EDR to Same Device Capable (Host)");
-            }
-        }
-        if (adv.has & BLE_ADV_HAS_SERVICE_DATA) {
-            printf("    Service 0x%04X: ", (unsigned)adv.service_uuid16);
-            if (adv.service_data_len) {
-                printf("{0x%02X", adv.service_data[0]);
-                for (unsigned i = 1; i < adv.service_data_len; i++) {
-                    printf(", 0x%02X", adv.service_data[i]);
-                }
-                puts("}");
-            }
-            else {
-                puts("No data");
-            }
+        if (events & BLE_ADV_AUTOSCAN_EV_SCANNING) {
+            fputs("Scanning\n", stderr);
         }
-        if (adv.has & BLE_ADV_HAS_MS_DATA) {
-            printf("    Manufacturer Specific Data 0x%04X: ", (unsigned)adv.ms_uuid16);
-            if (adv.ms_data_len) {
-                printf("{0x%02X", adv.ms_data[0]);
-                for (unsigned i = 1; i < adv.ms_data_len; i++) {
-                    printf(", 0x%02X", adv.ms_data[i]);
-                }
-                puts("}");
-            }
-            else {
-                puts("No data");
-            }
+
+        if (machine && ble_adv_output_tick(&output)) {
+            perror("writing output");
+            retval = EXIT_FAILURE;
+            break;
         }
     }
+
+    /* stop BLE scanning on exit */
+    ble_adv_autoscan_destroy(&autoscan);
+    if (machine && ble_adv_output_destroy(&output)) {
+        perror("writing output");
+        retval = EXIT_FAILURE;
+    }
+    exit(retval);
 }
 
 /** @} */